@@ -0,0 +1,135 @@
+/* Multi-rank driver for the I/O aggregation (--io-aggregators), without devices.
+
+   Each rank fills host buffers with a different number of particles per
+   (emulated) device, after a rank-dependent offset, with positions and ids
+   that encode the rank and the particle index. The particles are then
+   gathered to the aggregator of each group as Writer::Write() does, and the
+   aggregators check that they hold the particles and device counts of all
+   the ranks of their group, in rank order, and that the neighbor list was
+   not gathered. This is repeated a few times, to check the reuse of the
+   buffers and of the asynchronous sends.
+
+   Build from the top-level directory, after a regular `make` (for options/):
+
+     mpicxx -O2 -Isrc -Isrc/cuda -Isrc/geometries -Isrc/writers -Ioptions \
+       -isystem $CUDA_INCLUDE_PATH \
+       scripts/io-aggregator.cc src/writers/IOAggregator.cc src/NetworkManager.cc \
+       src/buffer_traits.cc src/HostArena.cc -o scripts/io-aggregator
+
+   and run it with the number of groups, e.g.
+
+     mpirun -np 5 scripts/io-aggregator 2
+
+   The exit status is 0 if all the aggregators got the expected particles.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "GlobalData.h"
+#include "NetworkManager.h"
+#include "IOAggregator.h"
+#include "hostbuffer.h"
+
+using namespace std;
+
+#define DEVICES	2
+#define ROUNDS	3
+
+// particles of each device of a rank, and offset of the first one
+static uint
+parts_of(int rank, uint dev)
+{ return dev ? 50 + rank : 100*rank + 3; }
+
+static uint
+offset_of(int rank)
+{ return 7 + rank; }
+
+int main(int argc, char *argv[])
+{
+	if (argc != 2) {
+		fprintf(stderr, "Usage: mpirun -np N %s GROUPS\n", argv[0]);
+		return 2;
+	}
+	const int groups = atoi(argv[1]);
+
+	GlobalData *gdata = new GlobalData();
+	gdata->networkManager = new NetworkManager();
+	gdata->networkManager->initNetwork();
+	gdata->mpi_nodes = gdata->networkManager->getWorldSize();
+	gdata->mpi_rank = gdata->networkManager->getProcessRank();
+	const int rank = gdata->mpi_rank;
+
+	gdata->devices = DEVICES;
+	uint numParts = 0;
+	for (uint d = 0; d < DEVICES; ++d) {
+		gdata->s_hPartsPerDevice[d] = parts_of(rank, d);
+		numParts += parts_of(rank, d);
+	}
+	const uint offset = offset_of(rank);
+
+	BufferList buffers;
+	buffers.addBuffer<HostBuffer, BUFFER_POS>();
+	buffers.addBuffer<HostBuffer, BUFFER_INFO>();
+	buffers.addBuffer<HostBuffer, BUFFER_NEIBSLIST>();
+	buffers.addBuffer<HostBuffer, BUFFER_VORTICITY>(); // never allocated, must not be gathered
+	buffers[BUFFER_POS]->alloc(offset + numParts);
+	buffers[BUFFER_INFO]->alloc(offset + numParts);
+	buffers[BUFFER_NEIBSLIST]->alloc(offset + numParts);
+
+	IOAggregator *aggregator = new IOAggregator(gdata, groups);
+	int errors = 0;
+
+	for (int round = 0; round < ROUNDS; ++round) {
+		float4 *pos = buffers.getData<BUFFER_POS>();
+		particleinfo *info = buffers.getData<BUFFER_INFO>();
+		for (uint i = 0; i < offset + numParts; ++i) {
+			pos[i] = make_float4(rank, i, round, -1);
+			info[i] = make_particleinfo(PT_FLUID, 0, rank*1000 + i);
+		}
+
+		aggregator->gather(buffers, offset, numParts);
+
+		if (aggregator->is_aggregator()) {
+			BufferList const& gathered = aggregator->get_buffers();
+			const float4 *gpos = gathered.getData<BUFFER_POS>();
+			const particleinfo *ginfo = gathered.getData<BUFFER_INFO>();
+			if (gathered.getData<BUFFER_NEIBSLIST>() || gathered.getData<BUFFER_VORTICITY>())
+				++errors;
+
+			// the particles of the ranks of the group, in rank order
+			DeviceCounts const& devices = aggregator->get_devices();
+			uint k = 0;
+			for (size_t j = 0; j < devices.size(); j += DEVICES) {
+				const int r = rank + j/DEVICES;
+				const uint roffset = offset_of(r);
+				uint rparts = 0;
+				for (uint d = 0; d < DEVICES; ++d) {
+					if (devices[j + d].first != GlobalData::GLOBAL_DEVICE_ID(r, d) ||
+						devices[j + d].second != parts_of(r, d))
+						++errors;
+					rparts += parts_of(r, d);
+				}
+				for (uint i = 0; i < rparts && k < aggregator->get_num_parts(); ++i, ++k)
+					if (gpos[k].x != r || gpos[k].y != roffset + i || gpos[k].z != round ||
+						id(ginfo[k]) != r*1000 + roffset + i)
+						++errors;
+			}
+			if (k != aggregator->get_num_parts())
+				++errors;
+
+			printf("rank %d round %d: %u particles from %zu devices, %d errors\n",
+				rank, round, aggregator->get_num_parts(), devices.size(), errors);
+		}
+		gdata->networkManager->networkBarrier();
+	}
+
+	delete aggregator;
+
+	gdata->networkManager->networkIntReduction(&errors, 1, SUM_REDUCTION);
+	if (rank == 0)
+		printf("%d ranks, %d groups: %s\n", gdata->mpi_nodes, groups, errors ? "FAILED" : "OK");
+
+	gdata->networkManager->finalizeNetwork();
+	return errors ? 1 : 0;
+}
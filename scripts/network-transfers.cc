@@ -0,0 +1,256 @@
+/* Multi-rank driver for the NetworkManager transfers, without devices.
+
+   Each rank runs one thread per (emulated) device, and every device exchanges
+   a number of bursts with every device of the other ranks, as the workers do
+   in GPUWorker::transferBursts(): either with blocking sends and receives,
+   in the same order on both sides, or (--async) posting all the transfers
+   of the device and then waiting for its own requests only. The contents of
+   the received bursts are checked.
+
+   Optionally, each device does some work (--work, in microseconds per burst)
+   while its transfers are in flight (async), or after them (blocking), to see
+   how much of it is hidden.
+
+   Build from the top-level directory, after a regular `make` (for options/):
+
+     mpicxx -O2 -Isrc -Isrc/cuda -Isrc/geometries -Isrc/writers -Ioptions \
+       -isystem $CUDA_INCLUDE_PATH \
+       scripts/network-transfers.cc src/NetworkManager.cc -lpthread \
+       -o scripts/network-transfers
+
+   and compare e.g.
+
+     mpirun -np 4 scripts/network-transfers --devices 2 --bursts 8 --size 1048576
+     mpirun -np 4 scripts/network-transfers --devices 2 --bursts 8 --size 1048576 --async
+
+   The exit status is 0 if all the bursts were received correctly.
+*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "NetworkManager.h"
+#include "GlobalData.h"
+
+using namespace std;
+
+static NetworkManager *net;
+static int nranks, my_rank;
+static uint devices = 1, bursts = 4, iters = 10, work_us = 0;
+static size_t burst_size = 1 << 20;
+static bool async = false;
+
+// the devices of a rank start each iteration together, after the ranks
+// have synchronized (from a single thread, since it's a collective)
+static pthread_barrier_t devices_barrier;
+
+// a transfer between two global devices, identified by its position in the list
+struct Transfer {
+	devcount_t	src, dst;
+	uint		bid;	// ordinal among the transfers from src to dst
+};
+
+// the same list on all ranks: every device of every rank with every device of the others
+static vector<Transfer> transfers;
+
+static double
+now()
+{
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + 1e-6*tv.tv_usec;
+}
+
+static void
+spin(double seconds)
+{
+	const double until = now() + seconds;
+	while (now() < until)
+		;
+}
+
+static unsigned char
+pattern(Transfer const& t, size_t i, uint iter)
+{ return (unsigned char)(t.src*31 + t.dst*17 + t.bid*7 + iter + i); }
+
+struct DeviceResult {
+	double	time;
+	size_t	errors;
+};
+
+static void *
+device_thread(void *arg)
+{
+	const uint dev = (uint)(size_t)arg;
+	const devcount_t self = GlobalData::GLOBAL_DEVICE_ID(my_rank, dev);
+
+	// the transfers of this device, in list order
+	vector<size_t> mine;
+	for (size_t t = 0; t < transfers.size(); ++t)
+		if (transfers[t].src == self || transfers[t].dst == self)
+			mine.push_back(t);
+
+	vector< vector<unsigned char> > buf(mine.size(), vector<unsigned char>(burst_size));
+
+	// at most one pending request per transfer (see sendBufferAsync for the +1)
+	net->setNumRequests(dev, mine.size() + 1);
+
+	DeviceResult *res = new DeviceResult();
+	res->time = 0;
+	res->errors = 0;
+
+	for (uint iter = 0; iter < iters; ++iter) {
+		for (size_t m = 0; m < mine.size(); ++m) {
+			Transfer const& t = transfers[mine[m]];
+			if (t.src == self)
+				for (size_t i = 0; i < burst_size; ++i)
+					buf[m][i] = pattern(t, i, iter);
+			else
+				memset(&buf[m][0], 0, burst_size);
+		}
+
+		pthread_barrier_wait(&devices_barrier);
+		if (dev == 0)
+			net->networkBarrier();
+		pthread_barrier_wait(&devices_barrier);
+		const double start = now();
+
+		for (size_t m = 0; m < mine.size(); ++m) {
+			Transfer const& t = transfers[mine[m]];
+			if (async) {
+				if (t.src == self)
+					net->sendBufferAsync(t.src, t.dst, burst_size, &buf[m][0], t.bid);
+				else
+					net->receiveBufferAsync(t.src, t.dst, burst_size, &buf[m][0], t.bid);
+			} else {
+				if (t.src == self)
+					net->sendBuffer(t.src, t.dst, burst_size, &buf[m][0]);
+				else
+					net->receiveBuffer(t.src, t.dst, burst_size, &buf[m][0]);
+			}
+		}
+		spin(1e-6*work_us*mine.size());
+		if (async)
+			net->waitAsyncTransfers(dev);
+
+		res->time += now() - start;
+
+		for (size_t m = 0; m < mine.size(); ++m) {
+			Transfer const& t = transfers[mine[m]];
+			if (t.dst != self)
+				continue;
+			for (size_t i = 0; i < burst_size; ++i)
+				if (buf[m][i] != pattern(t, i, iter)) {
+					++res->errors;
+					break;
+				}
+		}
+	}
+
+	return res;
+}
+
+static void
+usage(const char *prog)
+{
+	fprintf(stderr, "Usage: mpirun -np N %s [--devices D] [--bursts B] [--size BYTES]\n"
+		"\t[--iters I] [--work USEC] [--async]\n", prog);
+}
+
+int main(int argc, char *argv[])
+{
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const bool has_value = (i + 1 < argc);
+		if (!strcmp(arg, "--async"))
+			async = true;
+		else if (!strcmp(arg, "--devices") && has_value)
+			devices = atoi(argv[++i]);
+		else if (!strcmp(arg, "--bursts") && has_value)
+			bursts = atoi(argv[++i]);
+		else if (!strcmp(arg, "--size") && has_value)
+			burst_size = strtoul(argv[++i], NULL, 0);
+		else if (!strcmp(arg, "--iters") && has_value)
+			iters = atoi(argv[++i]);
+		else if (!strcmp(arg, "--work") && has_value)
+			work_us = atoi(argv[++i]);
+		else {
+			usage(argv[0]);
+			return 2;
+		}
+	}
+
+	net = new NetworkManager();
+	net->initNetwork();
+	nranks = net->getWorldSize();
+	my_rank = net->getProcessRank();
+
+	if (devices < 1 || devices > MAX_DEVICES_PER_NODE || nranks < 2) {
+		if (my_rank == 0)
+			fprintf(stderr, "Need at least 2 ranks, and 1 to %u devices per rank\n", MAX_DEVICES_PER_NODE);
+		net->finalizeNetwork();
+		return 2;
+	}
+	if (devices > 1 && !net->isThreadMultiple()) {
+		if (my_rank == 0)
+			fprintf(stderr, "The MPI library does not provide MPI_THREAD_MULTIPLE\n");
+		net->finalizeNetwork();
+		return 2;
+	}
+
+	for (int sr = 0; sr < nranks; ++sr)
+	for (uint sd = 0; sd < devices; ++sd)
+	for (int dr = 0; dr < nranks; ++dr) {
+		if (dr == sr)
+			continue;
+		for (uint dd = 0; dd < devices; ++dd)
+			for (uint b = 0; b < bursts; ++b) {
+				Transfer t;
+				t.src = GlobalData::GLOBAL_DEVICE_ID(sr, sd);
+				t.dst = GlobalData::GLOBAL_DEVICE_ID(dr, dd);
+				t.bid = b;
+				transfers.push_back(t);
+			}
+	}
+
+	pthread_barrier_init(&devices_barrier, NULL, devices);
+	vector<pthread_t> threads(devices);
+	for (uint d = 0; d < devices; ++d)
+		pthread_create(&threads[d], NULL, device_thread, (void*)(size_t)d);
+
+	// slowest device, total errors
+	float slowest = 0;
+	int errors = 0;
+	for (uint d = 0; d < devices; ++d) {
+		void *ret;
+		pthread_join(threads[d], &ret);
+		DeviceResult *res = (DeviceResult*)ret;
+		if (res->time > slowest)
+			slowest = res->time;
+		errors += res->errors;
+		delete res;
+	}
+
+	pthread_barrier_destroy(&devices_barrier);
+
+	net->networkFloatReduction(&slowest, 1, MAX_REDUCTION);
+	net->networkIntReduction(&errors, 1, SUM_REDUCTION);
+
+	if (my_rank == 0) {
+		const double bytes = double(transfers.size())*burst_size*iters;
+		printf("%s: %d ranks x %u devices, %zu transfers of %zu bytes per iteration, %u iterations\n",
+			async ? "async" : "blocking", nranks, devices, transfers.size(), burst_size, iters);
+		printf("  time per iteration: %g ms (slowest device), %g MB/s aggregate\n",
+			1e3*slowest/iters, bytes/slowest/1e6);
+		printf("  %d corrupted bursts\n", errors);
+	}
+
+	net->finalizeNetwork();
+	delete net;
+	return errors ? 1 : 0;
+}
@@ -0,0 +1,582 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+
+#include "BurstCodec.h"
+#include "define_buffers.h"
+
+using namespace std;
+
+/* Codec */
+
+// an LZ match must be at least this long, and at most this far back
+#define LZ_MIN_MATCH	4
+#define LZ_MAX_OFFSET	65535
+// size (log2) of the hash table of the match finder
+#define LZ_HASH_LOG		12
+
+static inline uint32_t
+read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t
+lz_hash(uint32_t v)
+{ return (v*2654435761U) >> (32 - LZ_HASH_LOG); }
+
+// bytes needed to encode a length in excess of the 4 bits of the token
+static inline size_t
+lz_extra_bytes(size_t len)
+{ return len < 15 ? 0 : (len - 15)/255 + 1; }
+
+static inline uint8_t*
+lz_put_length(uint8_t *op, size_t len)
+{
+	if (len < 15)
+		return op;
+	len -= 15;
+	while (len >= 255) {
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (uint8_t)len;
+	return op;
+}
+
+// emit a sequence: literals, then a match (unless mlen is 0, for the last one)
+static inline uint8_t*
+lz_put_sequence(uint8_t *op, const uint8_t *lit, size_t llen, size_t offset, size_t mlen)
+{
+	const size_t mcode = mlen ? mlen - LZ_MIN_MATCH : 0;
+	*op++ = (uint8_t)((min(llen, size_t(15)) << 4) | min(mcode, size_t(15)));
+	op = lz_put_length(op, llen);
+	memcpy(op, lit, llen);
+	op += llen;
+	if (mlen) {
+		*op++ = (uint8_t)(offset & 0xff);
+		*op++ = (uint8_t)(offset >> 8);
+		op = lz_put_length(op, mcode);
+	}
+	return op;
+}
+
+size_t
+BurstCodec::lz_compress(const uint8_t *in, size_t size, uint8_t *out, size_t cap)
+{
+	// positions (+1, so that 0 means none) of the last occurrence of each hashed sequence
+	vector<uint32_t> table(1 << LZ_HASH_LOG, 0);
+
+	uint8_t *op = out;
+	const uint8_t *const op_end = out + cap;
+
+	size_t anchor = 0; // first literal not emitted yet
+	size_t ip = 0;
+
+	while (size >= LZ_MIN_MATCH && ip <= size - LZ_MIN_MATCH) {
+		const uint32_t seq = read32(in + ip);
+		uint32_t &slot = table[lz_hash(seq)];
+		const size_t ref = slot;
+		slot = ip + 1;
+
+		if (!ref || ip + 1 - ref > LZ_MAX_OFFSET || read32(in + ref - 1) != seq) {
+			// skip faster over data that doesn't compress
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+
+		size_t mlen = LZ_MIN_MATCH;
+		while (ip + mlen < size && in[ref - 1 + mlen] == in[ip + mlen])
+			++mlen;
+
+		const size_t llen = ip - anchor;
+		const size_t need = 1 + lz_extra_bytes(llen) + llen + 2 +
+			lz_extra_bytes(mlen - LZ_MIN_MATCH);
+		if (need > size_t(op_end - op))
+			return 0;
+		op = lz_put_sequence(op, in + anchor, llen, ip + 1 - ref, mlen);
+
+		ip += mlen;
+		anchor = ip;
+	}
+
+	// last literals
+	const size_t llen = size - anchor;
+	if (1 + lz_extra_bytes(llen) + llen > size_t(op_end - op))
+		return 0;
+	op = lz_put_sequence(op, in + anchor, llen, 0, 0);
+
+	return op - out;
+}
+
+// read the extension of a length from the token
+static inline size_t
+lz_get_length(const uint8_t *&ip, const uint8_t *ip_end, size_t len)
+{
+	if (len < 15)
+		return len;
+	uint8_t b;
+	do {
+		if (ip >= ip_end)
+			throw runtime_error("corrupt compressed burst (truncated length)");
+		b = *ip++;
+		len += b;
+	} while (b == 255);
+	return len;
+}
+
+size_t
+BurstCodec::lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t cap)
+{
+	const uint8_t *ip = in;
+	const uint8_t *const ip_end = in + size;
+	uint8_t *op = out;
+	uint8_t *const op_end = out + cap;
+
+	while (ip < ip_end) {
+		const uint8_t token = *ip++;
+
+		const size_t llen = lz_get_length(ip, ip_end, token >> 4);
+		if (llen > size_t(ip_end - ip) || llen > size_t(op_end - op))
+			throw runtime_error("corrupt compressed burst (literals overflow)");
+		memcpy(op, ip, llen);
+		ip += llen;
+		op += llen;
+
+		// the last sequence has no match
+		if (ip == ip_end)
+			break;
+
+		if (ip_end - ip < 2)
+			throw runtime_error("corrupt compressed burst (truncated offset)");
+		const size_t offset = ip[0] | (size_t(ip[1]) << 8);
+		ip += 2;
+		const size_t mlen = lz_get_length(ip, ip_end, token & 15) + LZ_MIN_MATCH;
+		if (!offset || offset > size_t(op - out) || mlen > size_t(op_end - op))
+			throw runtime_error("corrupt compressed burst (invalid match)");
+
+		// matches can overlap with their own output
+		const uint8_t *ref = op - offset;
+		if (offset >= mlen) {
+			memcpy(op, ref, mlen);
+			op += mlen;
+		} else {
+			for (size_t i = 0; i < mlen; ++i)
+				*op++ = *ref++;
+		}
+	}
+
+	return op - out;
+}
+
+/* Byte shuffle, with an optional XOR with the previous data: the i-th byte
+ * of all the words come first, then the (i+1)-th etc; the bytes of the last
+ * incomplete word (if any) are left at the end */
+static void
+shuffle_xor(const uint8_t *in, const uint8_t *prev, uint8_t *out, size_t size, uint word)
+{
+	const size_t nwords = size/word;
+	const size_t tail = nwords*word;
+	for (uint b = 0; b < word; ++b) {
+		uint8_t *dst = out + b*nwords;
+		const uint8_t *src = in + b;
+		if (prev) {
+			const uint8_t *psrc = prev + b;
+			for (size_t i = 0; i < nwords; ++i)
+				dst[i] = src[i*word] ^ psrc[i*word];
+		} else {
+			for (size_t i = 0; i < nwords; ++i)
+				dst[i] = src[i*word];
+		}
+	}
+	for (size_t i = tail; i < size; ++i)
+		out[i] = prev ? in[i] ^ prev[i] : in[i];
+}
+
+static void
+unshuffle_xor(const uint8_t *in, const uint8_t *prev, uint8_t *out, size_t size, uint word)
+{
+	const size_t nwords = size/word;
+	const size_t tail = nwords*word;
+	for (uint b = 0; b < word; ++b) {
+		const uint8_t *src = in + b*nwords;
+		uint8_t *dst = out + b;
+		if (prev) {
+			const uint8_t *psrc = prev + b;
+			for (size_t i = 0; i < nwords; ++i)
+				dst[i*word] = src[i] ^ psrc[i*word];
+		} else {
+			for (size_t i = 0; i < nwords; ++i)
+				dst[i*word] = src[i];
+		}
+	}
+	for (size_t i = tail; i < size; ++i)
+		out[i] = prev ? in[i] ^ prev[i] : in[i];
+}
+
+void
+BurstCodec::shuffle(const void *in, void *out, size_t size, uint word)
+{ shuffle_xor((const uint8_t*)in, NULL, (uint8_t*)out, size, word); }
+
+void
+BurstCodec::unshuffle(const void *in, void *out, size_t size, uint word)
+{ unshuffle_xor((const uint8_t*)in, NULL, (uint8_t*)out, size, word); }
+
+// header: mode, word size, two unused bytes, payload size, checksum of the previous burst
+static inline void
+put_header(char *wire, BurstMode mode, uint word, uint32_t payload, uint32_t prev_check)
+{
+	wire[0] = (char)mode;
+	wire[1] = (char)word;
+	wire[2] = wire[3] = 0;
+	memcpy(wire + 4, &payload, sizeof(payload));
+	memcpy(wire + 8, &prev_check, sizeof(prev_check));
+}
+
+/* Checksum (FNV-1a on 32-bit words) of the previous burst the XOR delta
+ * refers to, so that a receiver whose history got out of sync with the
+ * sender fails loudly instead of decoding garbage */
+static uint32_t
+checksum(const void *data, size_t size)
+{
+	const uint8_t *p = (const uint8_t*)data;
+	uint32_t h = 2166136261U;
+	size_t i = 0;
+	for (; i + 4 <= size; i += 4)
+		h = (h ^ read32(p + i))*16777619U;
+	for (; i < size; ++i)
+		h = (h ^ p[i])*16777619U;
+	return h;
+}
+
+BurstMode
+BurstCodec::encoded_mode(const char *wire)
+{ return (BurstMode)wire[0]; }
+
+BurstMode
+BurstCodec::encode(BurstMode mode, const void *raw, size_t size, uint word,
+	const void *prev, double max_ratio, vector<char> &out)
+{
+	if (word < 1)
+		word = 1;
+	if (mode == BURST_XOR && !prev && size)
+		throw invalid_argument("XOR encoding of a burst without the previous one");
+
+	out.resize(max_encoded_size(size));
+	char *payload = &out[0] + HEADER_SIZE;
+
+	size_t encoded = 0;
+	if (mode != BURST_RAW && size > 0) {
+		vector<uint8_t> shuffled(size);
+		shuffle_xor((const uint8_t*)raw, mode == BURST_XOR ? (const uint8_t*)prev : NULL,
+			&shuffled[0], size, word);
+		encoded = lz_compress(&shuffled[0], size, (uint8_t*)payload, size_t(size*max_ratio));
+	}
+
+	if (!encoded) {
+		mode = BURST_RAW;
+		encoded = size;
+		if (size)
+			memcpy(payload, raw, size);
+	}
+
+	put_header(&out[0], mode, word, encoded,
+		mode == BURST_XOR ? checksum(prev, size) : 0);
+	out.resize(HEADER_SIZE + encoded);
+	return mode;
+}
+
+void
+BurstCodec::decode(const char *wire, size_t wire_size, void *raw, size_t size,
+	const void *prev)
+{
+	if (wire_size < HEADER_SIZE)
+		throw runtime_error("corrupt compressed burst (truncated header)");
+
+	const BurstMode mode = encoded_mode(wire);
+	const uint word = (uchar)wire[1];
+	uint32_t payload, prev_check;
+	memcpy(&payload, wire + 4, sizeof(payload));
+	memcpy(&prev_check, wire + 8, sizeof(prev_check));
+	if (payload > wire_size - HEADER_SIZE)
+		throw runtime_error("corrupt compressed burst (truncated payload)");
+	wire += HEADER_SIZE;
+
+	switch (mode) {
+	case BURST_RAW:
+		if (payload != size)
+			throw runtime_error("corrupt compressed burst (wrong raw size)");
+		if (size)
+			memcpy(raw, wire, size);
+		return;
+	case BURST_LZ:
+	case BURST_XOR:
+		break;
+	default:
+		throw runtime_error("corrupt compressed burst (unknown mode)");
+	}
+
+	if (mode == BURST_XOR && !prev && size)
+		throw runtime_error("XOR-encoded burst received without the previous one");
+	if (mode == BURST_XOR && checksum(prev, size) != prev_check)
+		throw runtime_error("XOR-encoded burst received against a different previous one");
+	if (word < 1)
+		throw runtime_error("corrupt compressed burst (word size)");
+
+	vector<uint8_t> shuffled(size);
+	if (lz_decompress((const uint8_t*)wire, payload, &shuffled[0], size) != size)
+		throw runtime_error("corrupt compressed burst (wrong decompressed size)");
+	unshuffle_xor(&shuffled[0], mode == BURST_XOR ? (const uint8_t*)prev : NULL,
+		(uint8_t*)raw, size, word);
+}
+
+/* Compressor */
+
+const double BurstCompressor::MAX_RATIO = 0.9;
+
+// the buffers that can be compressed, with the size of their words
+struct CompressibleBuffer {
+	const char	*name;
+	flag_t		key;
+	uint		word;
+};
+
+static const CompressibleBuffer compressible_buffers[] = {
+	{ "pos", BUFFER_POS, sizeof(float) },
+	{ "vel", BUFFER_VEL, sizeof(float) },
+	{ "info", BUFFER_INFO, sizeof(ushort) },
+	{ "hash", BUFFER_HASH, sizeof(hashKey) },
+	{ "forces", BUFFER_FORCES, sizeof(float) },
+	{ "contupd", BUFFER_CONTUPD, sizeof(float) },
+	{ "xsph", BUFFER_XSPH, sizeof(float) },
+	{ "tau", BUFFER_TAU, sizeof(float) },
+	{ "energy", BUFFER_INTERNAL_ENERGY, sizeof(float) },
+	{ "energyupd", BUFFER_INTERNAL_ENERGY_UPD, sizeof(float) },
+	{ "vertices", BUFFER_VERTICES, sizeof(uint) },
+	{ "vertpos", BUFFER_VERTPOS, sizeof(float) },
+	{ "boundelements", BUFFER_BOUNDELEMENTS, sizeof(float) },
+	{ "gradgamma", BUFFER_GRADGAMMA, sizeof(float) },
+	{ "eulervel", BUFFER_EULERVEL, sizeof(float) },
+	{ "tke", BUFFER_TKE, sizeof(float) },
+	{ "eps", BUFFER_EPSILON, sizeof(float) },
+	{ "dkde", BUFFER_DKDE, sizeof(float) },
+	{ "volume", BUFFER_VOLUME, sizeof(float) },
+	{ "sigma", BUFFER_SIGMA, sizeof(float) },
+};
+
+static const size_t num_compressible_buffers =
+	sizeof(compressible_buffers)/sizeof(*compressible_buffers);
+
+static const CompressibleBuffer *
+find_compressible(flag_t bufkey)
+{
+	for (size_t b = 0; b < num_compressible_buffers; ++b)
+		if (compressible_buffers[b].key == bufkey)
+			return compressible_buffers + b;
+	return NULL;
+}
+
+string
+BurstCompressor::buffer_names()
+{
+	string names;
+	for (size_t b = 0; b < num_compressible_buffers; ++b) {
+		if (b)
+			names += ", ";
+		names += compressible_buffers[b].name;
+	}
+	return names;
+}
+
+uint
+BurstCompressor::word_size(flag_t bufkey)
+{
+	const CompressibleBuffer *buf = find_compressible(bufkey);
+	return buf ? buf->word : sizeof(float);
+}
+
+map<flag_t, BurstMode>
+BurstCompressor::parse_spec(string const& spec)
+{
+	map<flag_t, BurstMode> modes;
+
+	istringstream items(spec);
+	string item;
+	while (getline(items, item, ',')) {
+		if (item.empty())
+			continue;
+
+		string name = item;
+		BurstMode mode = BURST_LZ;
+		const size_t colon = item.find(':');
+		if (colon != string::npos) {
+			name = item.substr(0, colon);
+			const string mode_name = item.substr(colon + 1);
+			if (mode_name == "lz")
+				mode = BURST_LZ;
+			else if (mode_name == "xor")
+				mode = BURST_XOR;
+			else if (mode_name == "none")
+				mode = BURST_RAW;
+			else
+				throw invalid_argument("unknown burst compression mode '" + mode_name +
+					"' (must be lz, xor or none)");
+		}
+
+		bool found = false;
+		for (size_t b = 0; b < num_compressible_buffers; ++b) {
+			if (name != "all" && name != compressible_buffers[b].name)
+				continue;
+			found = true;
+			if (mode == BURST_RAW)
+				modes.erase(compressible_buffers[b].key);
+			else
+				modes[compressible_buffers[b].key] = mode;
+		}
+		if (!found)
+			throw invalid_argument("unknown buffer '" + name + "' in burst compression (must be all, " +
+				buffer_names() + ")");
+	}
+
+	return modes;
+}
+
+BurstCompressor::BurstCompressor(string const& spec) :
+	m_modes(parse_spec(spec)),
+	m_messages(),
+	m_stats(),
+	m_record()
+{}
+
+void
+BurstCompressor::record(string const& fname)
+{
+	m_record.open(fname.c_str(), ios::binary);
+	if (!m_record)
+		throw runtime_error("Cannot record the bursts to " + fname);
+}
+
+void
+BurstCompressor::record_burst(flag_t bufkey, Key key, const void *raw, size_t size)
+{
+	BurstRecord rec;
+	rec.bufkey = bufkey;
+	rec.key = key;
+	rec.word = word_size(bufkey);
+	rec.size = size;
+	m_record.write((const char*)&rec, sizeof(rec));
+	m_record.write((const char*)raw, size);
+}
+
+vector<char> const&
+BurstCompressor::encode(flag_t bufkey, Key key, const void *raw, size_t size)
+{
+	Message &msg = m_messages[MessageId(bufkey, key)];
+	Stats &stats = m_stats[bufkey];
+
+	const BurstMode buffer_mode = m_modes.find(bufkey)->second;
+	// the delta needs the previous burst, of the same size
+	const bool delta = (buffer_mode == BURST_XOR && msg.prev.size() == size);
+
+	BurstMode mode = (buffer_mode == BURST_XOR && !delta) ? BURST_LZ : buffer_mode;
+	if (size < MIN_SIZE)
+		mode = BURST_RAW;
+	else if (stats.bypass) {
+		--stats.bypass;
+		mode = BURST_RAW;
+	}
+
+	const BurstMode used = BurstCodec::encode(mode, raw, size, word_size(bufkey),
+		delta ? &msg.prev[0] : NULL, MAX_RATIO, msg.wire);
+
+	// bypass the compression of the buffer if it doesn't pay off
+	if (mode != BURST_RAW) {
+		if (used != BURST_RAW)
+			stats.poor = 0;
+		else if (++stats.poor >= BYPASS_AFTER) {
+			stats.poor = 0;
+			stats.bypass = BYPASS_FOR;
+		}
+	}
+
+	stats.raw_bytes += size;
+	stats.wire_bytes += msg.wire.size();
+	stats.messages += 1;
+	stats.compressed += (used != BURST_RAW);
+
+	// the receiver keeps all the bursts too, even those not sent as deltas
+	if (buffer_mode == BURST_XOR)
+		msg.prev.assign((const char*)raw, (const char*)raw + size);
+
+	return msg.wire;
+}
+
+char *
+BurstCompressor::receive_buffer(flag_t bufkey, Key key, size_t size)
+{
+	Message &msg = m_messages[MessageId(bufkey, key)];
+	msg.wire.resize(BurstCodec::max_encoded_size(size));
+	return &msg.wire[0];
+}
+
+void
+BurstCompressor::decode(flag_t bufkey, Key key, void *raw, size_t size)
+{
+	Message &msg = m_messages[MessageId(bufkey, key)];
+
+	const bool delta = (BurstCodec::encoded_mode(&msg.wire[0]) == BURST_XOR);
+	if (delta && msg.prev.size() != size)
+		throw runtime_error("XOR-encoded burst received without the previous one");
+
+	BurstCodec::decode(&msg.wire[0], msg.wire.size(), raw, size,
+		delta ? &msg.prev[0] : NULL);
+
+	if (m_modes.find(bufkey)->second == BURST_XOR)
+		msg.prev.assign((const char*)raw, (const char*)raw + size);
+}
+
+void
+BurstCompressor::print_stats(ostream &out, const char *prefix) const
+{
+	for (map<flag_t, Stats>::const_iterator it = m_stats.begin(); it != m_stats.end(); ++it) {
+		Stats const& stats = it->second;
+		if (!stats.messages)
+			continue;
+		const CompressibleBuffer *buf = find_compressible(it->first);
+		char line[256];
+		snprintf(line, sizeof(line), "%s%s: %llu bursts (%.1f%% compressed), %.1f MiB sent as %.1f MiB (%.2fx)",
+			prefix, buf ? buf->name : "?",
+			(unsigned long long)stats.messages, 100.0*stats.compressed/stats.messages,
+			stats.raw_bytes/1048576.0, stats.wire_bytes/1048576.0,
+			stats.wire_bytes ? double(stats.raw_bytes)/stats.wire_bytes : 0.0);
+		out << line << endl;
+	}
+}
@@ -0,0 +1,202 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _BURSTCODEC_H
+#define _BURSTCODEC_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <ostream>
+
+#include <stdint.h>
+
+#include "common_types.h"
+
+/*! Lossless compression of the bursts exchanged over the network
+ * (see GPUWorker::transferBursts).
+ *
+ * A compressed burst is a small header followed by the payload, encoded
+ * in one of the following modes:
+ * - BURST_RAW: the data as is (used when compression does not pay off);
+ * - BURST_LZ: the bytes of each word (float, ushort ...) are regrouped by
+ *   significance (byte shuffle), so that the sign/exponent bytes of similar
+ *   values form long runs, and the result is compressed with a fast LZ77
+ *   codec (a simplified LZ4 block format);
+ * - BURST_XOR: as BURST_LZ, after XOR-ing the data with the previous burst
+ *   with the same key, so that the bits that did not change since the
+ *   previous transfer become zeros.
+ */
+enum BurstMode {
+	BURST_RAW = 0,
+	BURST_LZ = 1,
+	BURST_XOR = 2
+};
+
+class BurstCodec
+{
+public:
+	/* bytes preceding the payload of an encoded burst: mode, word size,
+	 * payload size, checksum of the previous burst (for BURST_XOR) */
+	static const size_t HEADER_SIZE = 12;
+
+	// largest message an encoded burst of the given size can take
+	static size_t max_encoded_size(size_t size)
+	{ return size + HEADER_SIZE; }
+
+	/* Encode size bytes of raw data (made of words of `word` bytes) in the
+	 * given mode, XOR-ing with prev (of the same size) for BURST_XOR.
+	 * If the encoded payload would be larger than max_ratio times the raw
+	 * data, the burst is encoded as BURST_RAW instead. Returns the mode
+	 * actually used; out holds the encoded burst, header included. */
+	static BurstMode encode(BurstMode mode, const void *raw, size_t size, uint word,
+		const void *prev, double max_ratio, std::vector<char> &out);
+
+	/* Decode an encoded burst of wire_size bytes into size bytes of raw data,
+	 * using prev (of the same size) if it was XOR-encoded; throws if the
+	 * burst is corrupt or doesn't decode to exactly size bytes. */
+	static void decode(const char *wire, size_t wire_size, void *raw, size_t size,
+		const void *prev);
+
+	// mode of an encoded burst
+	static BurstMode encoded_mode(const char *wire);
+
+	// the building blocks, exposed for the benchmarks
+
+	// regroup the bytes of each word by significance, and back
+	static void shuffle(const void *in, void *out, size_t size, uint word);
+	static void unshuffle(const void *in, void *out, size_t size, uint word);
+
+	/* LZ77 compression of size bytes into at most cap bytes; returns the
+	 * compressed size, or 0 if it doesn't fit */
+	static size_t lz_compress(const uint8_t *in, size_t size, uint8_t *out, size_t cap);
+	// decompression; returns the decompressed size, or throws if corrupt
+	static size_t lz_decompress(const uint8_t *in, size_t size, uint8_t *out, size_t cap);
+};
+
+/*! Compression of the network bursts of a worker: which buffers are
+ * compressed and how, the history for the XOR deltas, and the statistics
+ * used to bypass the compression of buffers that don't compress well.
+ *
+ * Each message is identified by the buffer and by a key that is the same
+ * on the sending and receiving side (peer, direction and ordinal of the
+ * burst, array of the buffer), so that the history of the XOR deltas is
+ * kept identical on both sides without any extra communication.
+ */
+class BurstCompressor
+{
+public:
+	// a message: peer, direction and ordinal of the burst, array in the buffer
+	typedef uint64_t Key;
+
+	static Key make_key(uint peer_gidx, bool send, uint ordinal, uint array)
+	{ return (Key(peer_gidx) << 40) | (Key(send) << 32) | (Key(ordinal) << 8) | array; }
+
+	/* Parse the compression specification: a comma-separated list of
+	 * buffer[:mode] items, where buffer is one of the names listed by
+	 * buffer_names() (or all), and mode is lz (default) or xor;
+	 * throws on invalid specifications */
+	static std::map<flag_t, BurstMode> parse_spec(std::string const& spec);
+	static std::string buffer_names();
+
+	// size of the words of the buffer, for the byte shuffle
+	static uint word_size(flag_t bufkey);
+
+	// bursts smaller than this are sent as they are
+	static const size_t MIN_SIZE = 256;
+	// a burst must shrink at least to this fraction of its size to be sent compressed
+	static const double MAX_RATIO;
+	// after this many consecutive bursts of a buffer that were not worth compressing ...
+	static const uint BYPASS_AFTER = 8;
+	// ... skip the compression of the next ones of the buffer, then try again
+	static const uint BYPASS_FOR = 256;
+
+private:
+	std::map<flag_t, BurstMode>	m_modes;
+
+	// per-message data
+	struct Message {
+		std::vector<char>	prev; // raw data of the previous message (for BURST_XOR)
+		std::vector<char>	wire; // encoded data of the current message
+	};
+	typedef std::pair<flag_t, Key> MessageId;
+	std::map<MessageId, Message>	m_messages;
+
+	// per-buffer statistics
+	struct Stats {
+		uint64_t	raw_bytes;
+		uint64_t	wire_bytes;
+		uint64_t	messages;
+		uint64_t	compressed;
+		uint		poor; // consecutive bursts not worth compressing
+		uint		bypass; // bursts left to send without trying
+		Stats() : raw_bytes(0), wire_bytes(0), messages(0), compressed(0), poor(0), bypass(0) {}
+	};
+	std::map<flag_t, Stats>	m_stats;
+
+	// recording of the sent bursts, for the benchmarks
+	std::ofstream	m_record;
+
+public:
+	BurstCompressor(std::string const& spec);
+
+	// record the raw data of all the bursts sent to the given file
+	void record(std::string const& fname);
+	bool recording() const
+	{ return m_record.is_open(); }
+	void record_burst(flag_t bufkey, Key key, const void *raw, size_t size);
+
+	// is the buffer compressed?
+	bool enabled(flag_t bufkey) const
+	{ return m_modes.find(bufkey) != m_modes.end(); }
+
+	/* encode a burst to be sent; the returned message stays valid until
+	 * the next burst with the same buffer and key is encoded */
+	std::vector<char> const& encode(flag_t bufkey, Key key, const void *raw, size_t size);
+
+	/* buffer to receive the message of a burst into, of the largest size
+	 * the message can have; valid until the next burst with the same buffer
+	 * and key is received */
+	char *receive_buffer(flag_t bufkey, Key key, size_t size);
+
+	/* decode the received message (of unknown size, but at most the size
+	 * of the receive buffer) into size bytes of raw data */
+	void decode(flag_t bufkey, Key key, void *raw, size_t size);
+
+	// print the compression ratio of each buffer
+	void print_stats(std::ostream &out, const char *prefix) const;
+};
+
+/* Recorded bursts (--record-bursts): a sequence of records, each made of
+ * this header followed by the raw data */
+struct BurstRecord {
+	uint64_t	bufkey;
+	uint64_t	key;
+	uint32_t	word;
+	uint32_t	size;
+};
+
+#endif
@@ -0,0 +1,172 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <cmath>
+#include <cfloat>
+
+#include "CompactPos.h"
+
+using namespace std;
+
+// fixed point over [-side, side]
+#define COMPACT_POS_SCALE	32767.5f
+
+/* Fixed point coordinate q of the cell-relative coordinate rel, truncated
+ * towards the center of the cell the particle is in (its own, or a neighbor
+ * if it moved since the last hash computation): the cell boundaries fall
+ * between two steps, and rounding could move the particle across them */
+static inline ushort
+quantize(float rel, float cellSize, float q)
+{
+	const float center = (floorf(rel/cellSize + 0.5f) + 1)*COMPACT_POS_SCALE;
+	return ushort(q < center ? ceilf(q) : floorf(q));
+}
+
+CompactPosCodec::CompactPosCodec(float3 const& cellSize) :
+	m_cellSize(cellSize),
+	m_masses(),
+	m_index()
+{}
+
+void
+CompactPosCodec::build_mass_table(const float4 *pos, const particleinfo *info, uint numParts)
+{
+	for (uint i = 0; i < numParts; ++i) {
+		// the mass of open boundary particles (but corners) changes
+		// during the simulation, and disabled particles have no mass
+		const bool variable = (IO_BOUNDARY(info[i]) && !CORNER(info[i])) || INACTIVE(pos[i]);
+		const uint key = mass_key(info[i]);
+
+		map<uint, ushort>::iterator found = m_index.find(key);
+		if (found == m_index.end()) {
+			// new type/fluid/object: start a table entry (if there is room)
+			if (variable || m_masses.size() >= COMPACT_POS_FALLBACK)
+				m_index[key] = COMPACT_POS_FALLBACK;
+			else {
+				m_index[key] = m_masses.size();
+				m_masses.push_back(pos[i].w);
+			}
+		} else if (found->second != COMPACT_POS_FALLBACK &&
+			(variable || m_masses[found->second] != pos[i].w)) {
+			// different masses within the same type/fluid/object:
+			// store them per particle
+			found->second = COMPACT_POS_FALLBACK;
+		}
+	}
+}
+
+float
+CompactPosCodec::max_error() const
+{
+	const float side = fmaxf(m_cellSize.x, fmaxf(m_cellSize.y, m_cellSize.z));
+	// the quantization step (the coordinates are truncated), plus the
+	// rounding of the float operations
+	return side/COMPACT_POS_SCALE + 4*side*FLT_EPSILON;
+}
+
+ushort
+CompactPosCodec::mass_index(float4 const& pos, particleinfo const& info) const
+{
+	map<uint, ushort>::const_iterator found = m_index.find(mass_key(info));
+	if (found == m_index.end() || found->second == COMPACT_POS_FALLBACK)
+		return COMPACT_POS_FALLBACK;
+	// a particle of a fixed-mass type whose mass changed anyway
+	if (m_masses[found->second] != pos.w)
+		return COMPACT_POS_FALLBACK;
+	return found->second;
+}
+
+uint
+CompactPosCodec::encode(const float4 *pos, const particleinfo *info, uint numParts,
+	compact_pos *compact, vector<float4> &fallback) const
+{
+	const float3 scale = make_float3(
+		COMPACT_POS_SCALE/m_cellSize.x,
+		COMPACT_POS_SCALE/m_cellSize.y,
+		COMPACT_POS_SCALE/m_cellSize.z);
+	uint numFallback = 0;
+
+	// mass index of the last particle type/fluid/object, to spare the
+	// table lookups for runs of particles of the same kind
+	uint last_key = UINT_MAX;
+	ushort last_index = COMPACT_POS_FALLBACK;
+
+	for (uint i = 0; i < numParts; ++i) {
+		const float4 p = pos[i];
+		const uint key = mass_key(info[i]);
+		ushort index;
+		if (key == last_key && last_index != COMPACT_POS_FALLBACK && m_masses[last_index] == p.w)
+			index = last_index;
+		else {
+			index = mass_index(p, info[i]);
+			last_key = key;
+			last_index = index;
+		}
+
+		// fixed point in [0, 65535] for coordinates in [-cellSize, cellSize]
+		const float qx = (p.x*scale.x + COMPACT_POS_SCALE);
+		const float qy = (p.y*scale.y + COMPACT_POS_SCALE);
+		const float qz = (p.z*scale.z + COMPACT_POS_SCALE);
+		const bool in_range =
+			qx >= 0 && qx <= 2*COMPACT_POS_SCALE &&
+			qy >= 0 && qy <= 2*COMPACT_POS_SCALE &&
+			qz >= 0 && qz <= 2*COMPACT_POS_SCALE;
+
+		compact_pos &c = compact[i];
+		if (index == COMPACT_POS_FALLBACK || !in_range) {
+			c.x = c.y = c.z = 0;
+			c.mass = COMPACT_POS_FALLBACK;
+			fallback.push_back(p);
+			++numFallback;
+			continue;
+		}
+		c.x = quantize(p.x, m_cellSize.x, qx);
+		c.y = quantize(p.y, m_cellSize.y, qy);
+		c.z = quantize(p.z, m_cellSize.z, qz);
+		c.mass = index;
+	}
+
+	return numFallback;
+}
+
+void
+CompactPosCodec::decode(const compact_pos *compact, const float4 *fallback, uint numParts,
+	float4 *pos) const
+{
+	const float3 step = m_cellSize/COMPACT_POS_SCALE;
+
+	for (uint i = 0; i < numParts; ++i) {
+		const compact_pos c = compact[i];
+		if (c.mass == COMPACT_POS_FALLBACK) {
+			pos[i] = *fallback++;
+			continue;
+		}
+		pos[i] = make_float4(
+			c.x*step.x - m_cellSize.x,
+			c.y*step.y - m_cellSize.y,
+			c.z*step.z - m_cellSize.z,
+			m_masses[c.mass]);
+	}
+}
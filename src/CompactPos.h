@@ -0,0 +1,110 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Compact position format: cell-relative fixed point coordinates and
+ * per-type mass tables */
+
+#ifndef _COMPACTPOS_H
+#define _COMPACTPOS_H
+
+#include <vector>
+#include <map>
+#include <climits>
+
+#include "particledefine.h"
+#include "vector_math.h"
+
+/*! Compact position and mass of a particle: 8 bytes instead of the 16 of
+ *  the float4 in BUFFER_POS.
+ *
+ *  The position is relative to the center of the particle cell (as in
+ *  BUFFER_POS), in 16-bit fixed point over [-cellSize, cellSize] along each
+ *  axis, so that particles that moved out of their cell since the last hash
+ *  computation are still representable. The quantization step is
+ *  cellSize/32767.5, and the coordinates are truncated towards the center
+ *  of the cell the particle is in, so that the decoded particle is never
+ *  moved across a cell boundary (the hash computed from it is the same).
+ *  The largest position error is one step: with the usual cells (as large
+ *  as the influence radius, 2*1.3*deltap for smoothing factor 1.3) this is
+ *  about 8e-5*deltap, and half that with the finer cells of the 5x5x5
+ *  stencil. This is more than the ~6e-8*cellSize of the float coordinates,
+ *  and decoded positions would drift if they were integrated and encoded
+ *  again, so the format is meant for output and analysis, not for the
+ *  simulation state.
+ *
+ *  The mass is the index of the mass in a table shared by all the particles
+ *  with the same type, fluid and object number. Particles whose mass is not
+ *  in the table (variable-mass open boundaries, disabled particles) or whose
+ *  position is out of range have their full float4 stored separately, in
+ *  order, and are marked by COMPACT_POS_FALLBACK.
+ */
+struct compact_pos
+{
+	ushort	x, y, z;
+	ushort	mass;
+};
+
+#define COMPACT_POS_FALLBACK	USHRT_MAX
+
+class CompactPosCodec
+{
+	float3				m_cellSize;
+
+	// masses, and table index by particle type, fluid and object number
+	// (COMPACT_POS_FALLBACK for the ones with variable mass)
+	std::vector<float>	m_masses;
+	std::map<uint, ushort>	m_index;
+
+	static uint mass_key(particleinfo const& info)
+	{ return (uint(PART_TYPE(info)) << 16) | info.y; }
+
+	ushort mass_index(float4 const& pos, particleinfo const& info) const;
+
+public:
+	CompactPosCodec(float3 const& cellSize);
+
+	/* Collect the masses of the given particles in the table: one entry
+	 * for each particle type, fluid and object number whose particles all
+	 * have the same mass */
+	void build_mass_table(const float4 *pos, const particleinfo *info, uint numParts);
+
+	size_t num_masses() const
+	{ return m_masses.size(); }
+
+	// largest position error, along any axis
+	float max_error() const;
+
+	/* Encode the positions of numParts particles; the full positions of the
+	 * particles that cannot be encoded are appended to fallback. Returns the
+	 * number of such particles */
+	uint encode(const float4 *pos, const particleinfo *info, uint numParts,
+		compact_pos *compact, std::vector<float4> &fallback) const;
+
+	// decode the positions encoded by encode()
+	void decode(const compact_pos *compact, const float4 *fallback, uint numParts,
+		float4 *pos) const;
+};
+
+#endif
@@ -48,6 +48,14 @@
 
 // HotFile
 #include "HotFile.h"
+// in-memory checkpoints recovery
+#include "MemHotWriter.h"
+// one-way nesting
+#include "NestingDriver.h"
+// SPH kernels on the host, for the probes
+#include "HostKernel.h"
+#include "HostPerfCounters.h"
+#include "MemoryRegistry.h"
 
 /* Include all other opt file for show_version */
 #include "gpusph_version.opt"
@@ -67,11 +75,14 @@ GPUSPH::GPUSPH() {
 	clOptions = NULL;
 	gdata = NULL;
 	problem = NULL;
+	m_hostArena = NULL;
 
 	initialized = false;
 	m_peakParticleSpeed = 0.0;
 	m_peakParticleSpeedTime = 0.0;
 
+	m_IOwaterdepthReductionPending = false;
+
 	openInfoStream();
 }
 
@@ -121,6 +132,9 @@ bool GPUSPH::initialize(GlobalData *_gdata) {
 	clOptions = gdata->clOptions;
 	problem = gdata->problem;
 
+	if (clOptions->perf_counters)
+		gdata->perfCounters = new HostPerfCounters();
+
 	// For the new problem interface (compute worldorigin, init ODE, etc.)
 	// In all cases, also runs the checks for dt, maxneibsnum, etc
 	// and creates the problem dir
@@ -161,6 +175,26 @@ bool GPUSPH::initialize(GlobalData *_gdata) {
 	}
 	gdata->nGridCells = (uint)longNGridCells;
 
+	// the multi-device domain split and the external cells exchange assume
+	// that all the neighbors of a particle are in the adjacent cells
+	if (MULTI_DEVICE && _sp->nlcellsperradius > 1) {
+		printf("FATAL: cells finer than the neighbor search radius are not supported in multi-device simulations\n");
+		return false;
+	}
+
+	// neighbor cells across a periodic boundary are found by shifting their
+	// grid position by the grid size once, which only works if the stencil
+	// fits in the grid along each periodic direction (otherwise a cell would be
+	// visited twice, or the shifted position would still be out of the grid)
+	const uint stencilSide = 2*_sp->get_cell_stencil_radius() + 1;
+	if (((_sp->periodicbound & PERIODIC_X) && gdata->gridSize.x < stencilSide) ||
+		((_sp->periodicbound & PERIODIC_Y) && gdata->gridSize.y < stencilSide) ||
+		((_sp->periodicbound & PERIODIC_Z) && gdata->gridSize.z < stencilSide)) {
+		printf("FATAL: periodic domains need at least %u cells along each periodic direction, the grid has %u x %u x %u\n",
+			stencilSide, gdata->gridSize.x, gdata->gridSize.y, gdata->gridSize.z);
+		return false;
+	}
+
 	// get the cell size
 	gdata->cellSize = make_float3(problem->get_cellsize());
 
@@ -187,57 +221,77 @@ bool GPUSPH::initialize(GlobalData *_gdata) {
 	HotFile **hf;
 	uint hot_nrank = 1;
 
-	if (clOptions->resume_fname.empty()) {
+	if (!clOptions->resuming()) {
 		// get number of particles from problem file
+		PerfRegion region(gdata->perfCounters, "fill");
 		gdata->totParticles = problem->fill_parts();
 	} else {
 		gdata->totParticles = problem->fill_parts(false);
 		// get number of particles from hot file
 		struct stat statbuf;
 		ostringstream err_msg;
-		// check if the hotfile is part of a multi-node simulation
-		size_t found = clOptions->resume_fname.find_last_of("/");
-		if (found == string::npos)
-			found = 0;
-		else
-			found++;
-		string resume_file = clOptions->resume_fname.substr(found);
-		string pre_fname, post_fname;
-		// this is the case if the filename is of the form "hot_nX.Y_Z.bin" where X,Y,Z are integers
-		if(resume_file.compare(0,5,"hot_n") == 0) {
-			// get number of ranks from previous simulation
-			pre_fname = clOptions->resume_fname.substr(0, found+5);
-			found = resume_file.find_first_of(".")+1;
-			size_t found2 = resume_file.find_first_of("_", 5);
-			if (found == string::npos || found2 == string::npos || found > found2) {
-				err_msg << "Malformed Hot start filename: " << resume_file << "\nNeeds to be of the form \"hot_nX.Y_ZZZZZ.bin\"";
-				throw runtime_error(err_msg.str());
+		// names of the hot files to load, one per process of the previous simulation
+		vector<string> hot_fnames;
+		if (clOptions->resume_memory) {
+			hot_fnames = MemHotWriter::recover(gdata);
+			hot_nrank = hot_fnames.size();
+			cout << "Hot start from the in-memory checkpoints of " << hot_nrank << " processes" << endl;
+		} else {
+			// check if the hotfile is part of a multi-node simulation
+			size_t found = clOptions->resume_fname.find_last_of("/");
+			if (found == string::npos)
+				found = 0;
+			else
+				found++;
+			string resume_file = clOptions->resume_fname.substr(found);
+			string pre_fname, post_fname;
+			// this is the case if the filename is of the form "hot_nX.Y_Z.bin" where X,Y,Z are integers
+			if(resume_file.compare(0,5,"hot_n") == 0) {
+				// get number of ranks from previous simulation
+				pre_fname = clOptions->resume_fname.substr(0, found+5);
+				found = resume_file.find_first_of(".")+1;
+				size_t found2 = resume_file.find_first_of("_", 5);
+				if (found == string::npos || found2 == string::npos || found > found2) {
+					err_msg << "Malformed Hot start filename: " << resume_file << "\nNeeds to be of the form \"hot_nX.Y_ZZZZZ.bin\"";
+					throw runtime_error(err_msg.str());
+				}
+				istringstream (resume_file.substr(found,found2-found)) >> hot_nrank;
+				post_fname = resume_file.substr(found-1);
+				cout << "Hot start has been written from a multi-node simulation with " << hot_nrank << " processes" << endl;
+			}
+			for (uint i = 0; i < hot_nrank; i++) {
+				ostringstream fname;
+				if (hot_nrank == 1)
+					fname << clOptions->resume_fname;
+				else
+					fname << pre_fname << i << post_fname;
+				hot_fnames.push_back(fname.str());
 			}
-			istringstream (resume_file.substr(found,found2-found)) >> hot_nrank;
-			post_fname = resume_file.substr(found-1);
-			cout << "Hot start has been written from a multi-node simulation with " << hot_nrank << " processes" << endl;
 		}
 		// allocate hot file arrays and file pointers
 		hot_in = new ifstream[hot_nrank];
 		hf = new HotFile*[hot_nrank];
 		gdata->totParticles = 0;
 		for (uint i = 0; i < hot_nrank; i++) {
-			ostringstream fname;
-			if (hot_nrank == 1)
-				fname << clOptions->resume_fname;
-			else
-				fname << pre_fname << i << post_fname;
-			cout << "Hot starting from " << fname.str() << "..." << endl;
-			if (stat(fname.str().c_str(), &statbuf)) {
+			string const& fname = hot_fnames[i];
+			cout << "Hot starting from " << fname << "..." << endl;
+			if (stat(fname.c_str(), &statbuf)) {
 				// stat failed
-				err_msg << "Hot start file " << fname.str() << " not found";
+				err_msg << "Hot start file " << fname << " not found";
 				throw runtime_error(err_msg.str());
 			}
 			/* enable automatic exception handling on failure */
 			hot_in[i].exceptions(ifstream::failbit | ifstream::badbit);
-			hot_in[i].open(fname.str().c_str());
+			hot_in[i].open(fname.c_str());
 			hf[i] = new HotFile(hot_in[i], gdata);
 			hf[i]->readHeader(gdata->totParticles, gdata->problem->simparams()->numOpenBoundaries);
+			// all the files must come from the same checkpoint (this may not be
+			// the case e.g. with in-memory checkpoints interrupted halfway)
+			if (hf[i]->get_iterations() != hf[0]->get_iterations()) {
+				err_msg << "Hot start file " << fname << " is from iteration " <<
+					hf[i]->get_iterations() << ", expected " << hf[0]->get_iterations();
+				throw runtime_error(err_msg.str());
+			}
 		}
 	}
 
@@ -317,11 +371,13 @@ bool GPUSPH::initialize(GlobalData *_gdata) {
 	 */
 	bool resumed = false;
 
-	if (clOptions->resume_fname.empty()) {
+	if (!clOptions->resuming()) {
 		printf("Copying the particles to shared arrays...\n");
 		printf("---\n");
 		problem->copy_to_array(gdata->s_hBuffers);
 		printf("---\n");
+		// densities at rest under gravity, if the problem asked for them
+		problem->init_hydrostatic(gdata->s_hBuffers, gdata->totParticles);
 	} else {
 		gdata->iterations = hf[0]->get_iterations();
 		gdata->dt = hf[0]->get_dt();
@@ -346,6 +402,17 @@ bool GPUSPH::initialize(GlobalData *_gdata) {
 		resumed = true;
 	}
 
+	// damped settling phase: run from t = -settle, without output, up to t = 0
+	if (clOptions->settle > 0) {
+		if (resumed)
+			fprintf(stderr, "WARNING: resuming, the settling phase is skipped\n");
+		else {
+			gdata->settling = true;
+			gdata->t = -clOptions->settle;
+			printf("Settling phase of %g s before the simulation\n", clOptions->settle);
+		}
+	}
+
 	cout << "RB First/Last Index:\n";
 	for (int i = 0 ; i < problem->simparams()->numforcesbodies; ++i) {
 			cout << "\t" << gdata->s_hRbFirstIndex[i] << "\t" << gdata->s_hRbLastIndex[i] << endl;
@@ -466,6 +533,9 @@ bool GPUSPH::finalize() {
 	if (m_multiNodePerformanceCounter)
 		delete m_multiNodePerformanceCounter;
 
+	delete gdata->perfCounters;
+	gdata->perfCounters = NULL;
+
 	initialized = false;
 
 	return true;
@@ -474,9 +544,11 @@ bool GPUSPH::finalize() {
 bool GPUSPH::runSimulation() {
 	if (!initialized) return false;
 
-	// doing first write
-	printf("Performing first write...\n");
-	doWrite(INITIALIZATION_STEP);
+	// doing first write (after the settling phase, if any)
+	if (!gdata->settling) {
+		printf("Performing first write...\n");
+		doWrite(INITIALIZATION_STEP);
+	}
 
 	printf("Letting threads upload the subdomains...\n");
 	gdata->threadSynchronizer->barrier(); // begins UPLOAD ***
@@ -504,6 +576,10 @@ bool GPUSPH::runSimulation() {
 
 	}
 
+	// velocity damping for the settling phase
+	if (gdata->settling)
+		doCommand(UPLOAD_SETTLE_DAMPING);
+
 	printf("Entering the main simulation cycle\n");
 
 	//  IPPS counter does not take the initial uploads into consideration
@@ -535,11 +611,24 @@ bool GPUSPH::runSimulation() {
 		// call Integrator -> setNextStep
 
 		// build neighbors list
-		if (gdata->iterations % problem->simparams()->buildneibsfreq == 0 ||
-			gdata->particlesCreated) {
-			buildNeibList();
+		const bool rebuild_neibs = (gdata->iterations % problem->simparams()->buildneibsfreq == 0 ||
+			gdata->particlesCreated);
+
+		// when the Shepard filter is the first filter due in this iteration and
+		// the neighbor list is being rebuilt, compute the filter during the
+		// neighbor search, sparing a separate pass over the neighbor list
+		gdata->fused_shepard = false;
+		if (rebuild_neibs && gdata->iterations > 0 && !clOptions->no_fused_filters) {
+			FilterFreqList::const_iterator flt(enabledFilters.begin());
+			FilterFreqList::const_iterator flt_end(enabledFilters.end());
+			while (flt != flt_end && gdata->iterations % flt->second != 0)
+				++flt;
+			gdata->fused_shepard = (flt != flt_end && flt->first == SHEPARD_FILTER);
 		}
 
+		if (rebuild_neibs)
+			buildNeibList();
+
 		// run enabled filters
 		if (gdata->iterations > 0) {
 			FilterFreqList::const_iterator flt(enabledFilters.begin());
@@ -549,7 +638,10 @@ bool GPUSPH::runSimulation() {
 				uint freq = flt->second; // known to be > 0
 				if (gdata->iterations % freq == 0) {
 					gdata->only_internal = true;
-					doCommand(FILTER, NO_FLAGS, float(filter));
+					// the new velocities are already in the WRITE buffer
+					// if the filter was computed by BUILDNEIBS
+					if (!(filter == SHEPARD_FILTER && gdata->fused_shepard))
+						doCommand(FILTER, NO_FLAGS, float(filter));
 					// update before swapping, since UPDATE_EXTERNAL works on write buffers
 					if (MULTI_DEVICE)
 						doCommand(UPDATE_EXTERNAL, BUFFER_VEL | DBLBUFFER_WRITE);
@@ -607,6 +699,11 @@ bool GPUSPH::runSimulation() {
 		if (gdata->clOptions->striping && MULTI_DEVICE)
 			doCommand(FORCES_COMPLETE, INTEGRATOR_STEP_1);
 
+		// the partial water depths are final: start their reduction, so that
+		// the network part of it can progress while we integrate
+		if (needIOwaterdepthReduction())
+			startIOwaterdepthReduction();
+
 		// boundelements is swapped because the normals are updated in the moving objects case
 		doCommand(SWAP_BUFFERS, BUFFER_BOUNDELEMENTS);
 
@@ -688,6 +785,11 @@ bool GPUSPH::runSimulation() {
 		if (gdata->clOptions->striping && MULTI_DEVICE)
 			doCommand(FORCES_COMPLETE, INTEGRATOR_STEP_2);
 
+		// the partial water depths are final: start their reduction, so that
+		// the network part of it can progress while we integrate
+		if (needIOwaterdepthReduction())
+			startIOwaterdepthReduction();
+
 		// swap read and writes again because the write contains the variables at time n
 		// boundelements is swapped because the normals are updated in the moving objects case
 		doCommand(SWAP_BUFFERS, BUFFER_POS | BUFFER_VEL | BUFFER_INTERNAL_ENERGY | BUFFER_VOLUME | BUFFER_TKE | BUFFER_EPSILON | BUFFER_BOUNDELEMENTS);
@@ -785,7 +887,7 @@ bool GPUSPH::runSimulation() {
 		}
 
 		// check that dt is not too small (absolute)
-		if (!gdata->t) {
+		if (!gdata->t && !gdata->settling) {
 			throw DtZeroException(gdata->t, gdata->dt);
 		} else if (gdata->dt < FLT_EPSILON) {
 			fprintf(stderr, "FATAL: timestep %g under machine epsilon at iteration %lu - requesting quit...\n", gdata->dt, gdata->iterations);
@@ -800,6 +902,16 @@ bool GPUSPH::runSimulation() {
 
 		//printf("Finished iteration %lu, time %g, dt %g\n", gdata->iterations, gdata->t, gdata->dt);
 
+		// end of the settling phase: the simulation proper starts from here,
+		// at t = 0, with the first write below
+		if (gdata->settling && gdata->t >= 0) {
+			printf("Settling phase complete after %lu iterations\n", gdata->iterations);
+			gdata->settling = false;
+			gdata->t = 0;
+			gdata->iterations = 0;
+			doCommand(UPLOAD_SETTLE_DAMPING);
+		}
+
 		// are we done?
 		const bool we_are_done =
 			// ask the problem if we're done
@@ -811,7 +923,10 @@ bool GPUSPH::runSimulation() {
 			gdata->quit_request;
 
 		// list of writers that need to write at this timestep
-		ConstWriterMap writers = Writer::NeedWrite(gdata->t);
+		// (no output while settling)
+		ConstWriterMap writers;
+		if (!gdata->settling)
+			writers = Writer::NeedWrite(gdata->t);
 
 		// we need to write if any writer is configured to write at this timestep
 		// i.e. if the writers list is not empty
@@ -820,7 +935,7 @@ bool GPUSPH::runSimulation() {
 		// do we want to write even if no writer is asking to?
 		const bool force_write =
 			// ask the problem if we want to write anyway
-			gdata->problem->need_write(gdata->t) ||
+			(!gdata->settling && gdata->problem->need_write(gdata->t)) ||
 			// always write if we're done with the simulation
 			we_are_done ||
 			// write if it was requested
@@ -883,11 +998,34 @@ bool GPUSPH::runSimulation() {
 
 	// elapsed time, excluding the initialization
 	printf("Elapsed time of simulation cycle: %.2gs\n", m_totalPerformanceCounter->getElapsedSeconds());
+	printf("Simulation cycle: %lu iterations, %.6g MIPPS\n", gdata->iterations,
+		m_totalPerformanceCounter->getMIPPS());
+
+	if (gdata->perfCounters) {
+		gdata->perfCounters->print_summary(stdout);
+		ostringstream fname;
+		fname << problem->get_dirname() << "/perfcounters";
+		if (MULTI_NODE)
+			fname << "_n" << gdata->mpi_rank;
+		fname << ".csv";
+		gdata->perfCounters->write_csv(fname.str());
+	}
+
+	// memory usage breakdown, including the peaks
+	MemoryRegistry::instance().print_summary(stdout);
+	{
+		ostringstream fname;
+		fname << problem->get_dirname() << "/memory";
+		if (MULTI_NODE)
+			fname << "_n" << gdata->mpi_rank;
+		fname << ".csv";
+		MemoryRegistry::instance().write_csv(fname.str());
+	}
 
 	// In multinode simulations we also print the global performance. To make only rank 0 print it, add
 	// the condition (gdata->mpi_rank == 0)
 	if (MULTI_NODE)
-		printf("Global performance of the multinode simulation: %.2g MIPPS\n", m_multiNodePerformanceCounter->getMIPPS());
+		printf("Global performance of the multinode simulation: %.6g MIPPS\n", m_multiNodePerformanceCounter->getMIPPS());
 
 	// suggest max speed for next runs
 	printf("Peak particle speed was ~%g m/s at %g s -> can set maximum vel %.2g for this problem\n",
@@ -958,9 +1096,12 @@ void GPUSPH::move_bodies(const uint step)
 		}
 
 		// Let the problem compute the new moving bodies data
-		problem->bodies_timestep(gdata->s_hRbAppliedForce, gdata->s_hRbAppliedTorque, step, gdata->dt, gdata->t,
-			gdata->s_hRbCgGridPos, gdata->s_hRbCgPos,
-			gdata->s_hRbTranslations, gdata->s_hRbRotationMatrices, gdata->s_hRbLinearVelocities, gdata->s_hRbAngularVelocities);
+		{
+			PerfRegion region(gdata->perfCounters, "body dynamics");
+			problem->bodies_timestep(gdata->s_hRbAppliedForce, gdata->s_hRbAppliedTorque, step, gdata->dt, gdata->t,
+				gdata->s_hRbCgGridPos, gdata->s_hRbCgPos,
+				gdata->s_hRbTranslations, gdata->s_hRbRotationMatrices, gdata->s_hRbLinearVelocities, gdata->s_hRbAngularVelocities);
+		}
 
 		if (step == 2)
 			problem->post_timestep_callback(gdata->t);
@@ -980,6 +1121,13 @@ void GPUSPH::move_bodies(const uint step)
 // This does *not* include what was previously allocated (e.g. particles in problem->fillparts())
 size_t GPUSPH::allocateGlobalHostBuffers()
 {
+	// the arena is sized when the buffers are allocated, but
+	// the buffers must know about it when they are added
+	if (!clOptions->host_arena.empty()) {
+		m_hostArena = new HostArena();
+		gdata->s_hBuffers.setHostArena(m_hostArena);
+	}
+
 	// define host buffers
 	gdata->s_hBuffers.addBuffer<HostBuffer, BUFFER_POS_GLOBAL>();
 	gdata->s_hBuffers.addBuffer<HostBuffer, BUFFER_POS>();
@@ -1040,15 +1188,43 @@ size_t GPUSPH::allocateGlobalHostBuffers()
 
 	size_t totCPUbytes = 0;
 
+	if (m_hostArena) {
+		size_t arenaBytes = 0;
+		BufferList::const_iterator iter = gdata->s_hBuffers.begin();
+		for ( ; iter != gdata->s_hBuffers.end(); ++iter) {
+			size_t elems = numparts;
+			if (iter->first == BUFFER_NEIBSLIST)
+				elems *= gdata->problem->simparams()->maxneibsnum;
+			arenaBytes += iter->second->get_array_count()*
+				HostArena::slice_size(elems*iter->second->get_element_size());
+		}
+		m_hostArena->reserve(arenaBytes, clOptions->host_arena == "hugetlb");
+	}
+
+	MemoryRegistry &registry = MemoryRegistry::instance();
+
 	BufferList::iterator iter = gdata->s_hBuffers.begin();
 	while (iter != gdata->s_hBuffers.end()) {
+		size_t bufbytes;
 		if (iter->first == BUFFER_NEIBSLIST)
-			totCPUbytes += iter->second->alloc(numparts*gdata->problem->simparams()->maxneibsnum);
+			bufbytes = iter->second->alloc(numparts*gdata->problem->simparams()->maxneibsnum);
 		else
-			totCPUbytes += iter->second->alloc(numparts);
+			bufbytes = iter->second->alloc(numparts);
+		totCPUbytes += bufbytes;
+		registry.allocated(MemoryRegistry::HOST_MEMORY, "shared host buffer",
+			iter->second->get_buffer_name(), bufbytes);
 		++iter;
 	}
 
+	// the arena is pinned by the first worker, once it has selected its device
+	if (m_hostArena) {
+		// the arrays have been cleared, so all the pages have been touched already
+		printf("  host arena: %s, %s in %s huge pages\n",
+			gdata->memString(m_hostArena->size()).c_str(),
+			gdata->memString(m_hostArena->huge_bytes()).c_str(),
+			m_hostArena->hugetlb() ? "hugetlbfs" : "transparent");
+	}
+
 	const size_t numbodies = gdata->problem->simparams()->numbodies;
 	cout << "Numbodies : " << numbodies << "\n";
 	if (numbodies > 0) {
@@ -1065,6 +1241,8 @@ size_t GPUSPH::allocateGlobalHostBuffers()
 		gdata->s_hRbRotationMatrices = new float [numbodies*9];
 		fill_n(gdata->s_hRbRotationMatrices, 9*numbodies, 0.0f);
 		totCPUbytes += numbodies*(sizeof(int3) + 4*sizeof(float3) + 9*sizeof(float));
+		registry.allocated(MemoryRegistry::HOST_MEMORY, "rigid bodies", "body data",
+			numbodies*(sizeof(int3) + 4*sizeof(float3) + 9*sizeof(float)));
 	}
 	const size_t numforcesbodies = gdata->problem->simparams()->numforcesbodies;
 	cout << "Numforcesbodies : " << numforcesbodies << "\n";
@@ -1119,6 +1297,7 @@ size_t GPUSPH::allocateGlobalHostBuffers()
 		gdata->s_hDeviceMap = new devcount_t[numcells];
 		memset(gdata->s_hDeviceMap, 0, devcountCellSize);
 		totCPUbytes += devcountCellSize;
+		registry.allocated(MemoryRegistry::HOST_MEMORY, "cell index", "device map", devcountCellSize);
 
 		// counters to help splitting evenly
 		gdata->s_hPartsPerSliceAlongX = new uint[ gdata->gridSize.x ];
@@ -1151,6 +1330,10 @@ size_t GPUSPH::allocateGlobalHostBuffers()
 // Deallocate the shared buffers, i.e. those accessed by all workers
 void GPUSPH::deallocateGlobalHostBuffers() {
 	gdata->s_hBuffers.clear();
+	MemoryRegistry::instance().freed_all(MemoryRegistry::HOST_MEMORY);
+	gdata->s_hBuffers.setHostArena(NULL);
+	delete m_hostArena;
+	m_hostArena = NULL;
 
 	// Deallocating rigid bodies related arrays
 	if (gdata->problem->simparams()->numbodies > 0) {
@@ -1195,6 +1378,8 @@ void GPUSPH::deallocateGlobalHostBuffers() {
 // and download the buffers. Finally, initialize s_dSegmentsStart
 // Assumptions: problem already filled, deviceMap filled, particles copied in shared arrays
 void GPUSPH::sortParticlesByHash() {
+	PerfRegion region(gdata->perfCounters, "sort by device");
+
 	// DEBUG: print the list of particles before sorting
 	// for (uint p=0; p < gdata->totParticles; p++)
 	//	printf(" p %d has id %u, dev %d\n", p, id(gdata->s_hInfo[p]), gdata->calcDevice(gdata->s_hPos[p]) );
@@ -1366,6 +1551,32 @@ void GPUSPH::particleSwap(uint idx1, uint idx2)
 	}
 }
 
+// integration step phase of a command for --perf-counters, or NULL if not timed
+static const char *
+command_phase(CommandType cmd)
+{
+	switch (cmd) {
+	case CALCHASH:
+	case SORT:
+	case REORDER:
+	case BUILDNEIBS:
+		return "step neibs";
+	case FORCES_SYNC:
+	case FORCES_ENQUEUE:
+	case FORCES_COMPLETE:
+		return "step forces";
+	case EULER:
+		return "step euler";
+	case FILTER:
+		return "step filter";
+	case APPEND_EXTERNAL:
+	case UPDATE_EXTERNAL:
+		return "step exchange";
+	default:
+		return NULL;
+	}
+}
+
 // set nextCommand, unlock the threads and wait for them to complete
 void GPUSPH::doCommand(CommandType cmd, flag_t flags, float arg)
 {
@@ -1378,6 +1589,11 @@ void GPUSPH::doCommand(CommandType cmd, flag_t flags, float arg)
 	 memset(gdata->s_hInfo, 0, infoSize);
 	 } */
 
+	// with --perf-counters, time the main phases of the integration step
+	// as seen by the host (i.e. until all workers are done)
+	const char *phase = gdata->perfCounters ? command_phase(cmd) : NULL;
+	PerfRegion region(phase ? gdata->perfCounters : NULL, phase);
+
 	gdata->nextCommand = cmd;
 	gdata->commandFlags = flags;
 	gdata->extraCommandArg = arg;
@@ -1448,6 +1664,120 @@ double GPUSPH::Wendland2D(const double r, const double h) {
 	return 7/(4*M_PI*h*h)*temp*(2*q + 1);
 }
 
+/*! Interpolate velocity and pressure (and k, epsilon) at the probes.
+ *
+ * Probes are fixed, so they are bucketed by cell once; then each particle
+ * of the node visits the probes in the cells of its neighbor search stencil.
+ * This is done on the host buffers at write time only, and each node only
+ * sees its own particles, so the partial sums are reduced across the network.
+ *
+ * NOTE: contributions across periodic boundaries are not taken into account.
+ */
+void GPUSPH::evaluateProbes(uint node_offset)
+{
+	const SimParams *simparams = problem->simparams();
+	const ProbeList& probes = simparams->probes;
+	const size_t numprobes = probes.size();
+
+	// bucket the probes by cell, the first time around
+	if (m_probeCellStart.empty()) {
+		vector<uint> probeCell(numprobes);
+		m_probeCellStart.assign(gdata->nGridCells + 1, 0);
+		for (size_t p = 0; p < numprobes; ++p) {
+			const Point pt(probes[p].x, probes[p].y, probes[p].z);
+			probeCell[p] = gdata->calcGridHashHost(problem->calc_grid_pos(pt));
+			++m_probeCellStart[probeCell[p] + 1];
+		}
+		for (uint c = 0; c < gdata->nGridCells; ++c)
+			m_probeCellStart[c + 1] += m_probeCellStart[c];
+		m_probeOrder.resize(numprobes);
+		vector<uint> fill(m_probeCellStart.begin(), m_probeCellStart.end() - 1);
+		for (size_t p = 0; p < numprobes; ++p)
+			m_probeOrder[fill[probeCell[p]]++] = p;
+	}
+
+	// normalized as on the device, so that the Shepard sum is about 1 for
+	// probes surrounded by fluid, as for the testpoints
+	const HostKernel kernel(simparams->kerneltype, simparams->slength, simparams->kernelradius);
+	const double influenceradius = simparams->influenceRadius;
+	const int stencil = simparams->get_cell_stencil_radius();
+	const bool keps = simparams->visctype == KEPSVISC;
+
+	const float4 *lpos = gdata->s_hBuffers.getData<BUFFER_POS>();
+	const double4 *gpos = gdata->s_hBuffers.getData<BUFFER_POS_GLOBAL>();
+	const float4 *vel = gdata->s_hBuffers.getData<BUFFER_VEL>();
+	const particleinfo *info = gdata->s_hBuffers.getData<BUFFER_INFO>();
+	const hashKey *particleHash = gdata->s_hBuffers.getData<BUFFER_HASH>();
+	const float *tke = gdata->s_hBuffers.getData<BUFFER_TKE>();
+	const float *eps = gdata->s_hBuffers.getData<BUFFER_EPSILON>();
+
+	// per probe: velocity (3), pressure, k, epsilon, Shepard normalization
+	static const uint stride = 7;
+	vector<float> sums(stride*numprobes, 0.0f);
+
+	for (uint i = node_offset; i < node_offset + gdata->processParticles[gdata->mpi_rank]; i++) {
+		if (INACTIVE(lpos[i]) || !(FLUID(info[i]) || VERTEX(info[i])))
+			continue;
+
+		const uint3 gridPos = gdata->calcGridPosFromCellHash(cellHashFromParticleHash(particleHash[i]));
+		const double w_base = lpos[i].w/vel[i].w; // mass/density
+		const double p = problem->pressure(vel[i].w, fluid_num(info[i]));
+
+		for (int dz = -stencil; dz <= stencil; dz++) {
+			const int cz = gridPos.z + dz;
+			if (cz < 0 || cz >= int(gdata->gridSize.z)) continue;
+			for (int dy = -stencil; dy <= stencil; dy++) {
+				const int cy = gridPos.y + dy;
+				if (cy < 0 || cy >= int(gdata->gridSize.y)) continue;
+				for (int dx = -stencil; dx <= stencil; dx++) {
+					const int cx = gridPos.x + dx;
+					if (cx < 0 || cx >= int(gdata->gridSize.x)) continue;
+
+					const uint cell = gdata->calcGridHashHost(cx, cy, cz);
+					for (uint n = m_probeCellStart[cell]; n < m_probeCellStart[cell + 1]; ++n) {
+						const uint pr = m_probeOrder[n];
+						const double r = length(make_double3(gpos[i]) - probes[pr]);
+						if (r >= influenceradius)
+							continue;
+						const double w = kernel.W(r)*w_base;
+						float *sum = &sums[stride*pr];
+						sum[0] += w*vel[i].x;
+						sum[1] += w*vel[i].y;
+						sum[2] += w*vel[i].z;
+						sum[3] += w*p;
+						if (keps) {
+							sum[4] += w*tke[i];
+							sum[5] += w*eps[i];
+						}
+						sum[6] += w;
+					}
+				}
+			}
+		}
+	}
+
+	// particles close to a probe can belong to other nodes
+	if (MULTI_NODE)
+		gdata->networkManager->networkFloatReduction(&sums[0], sums.size(), SUM_REDUCTION);
+
+	m_probeValues.resize(numprobes);
+	for (size_t pr = 0; pr < numprobes; ++pr) {
+		const float *sum = &sums[stride*pr];
+		ProbeValue& val = m_probeValues[pr];
+		// same threshold as the testpoints post-processing
+		const double alpha = sum[6] > 1e-5f ? sum[6] : 0;
+		val.alpha = alpha;
+		if (alpha) {
+			val.velp = make_double4(sum[0], sum[1], sum[2], sum[3])/alpha;
+			val.tke = sum[4]/alpha;
+			val.eps = sum[5]/alpha;
+		} else {
+			val.velp = make_double4(0.0);
+			val.tke = val.eps = 0;
+		}
+	}
+}
+
 void GPUSPH::doWrite(flag_t write_flags)
 {
 	uint node_offset = gdata->s_hStartPerDevice[0];
@@ -1490,6 +1820,9 @@ void GPUSPH::doWrite(flag_t write_flags)
 	// max particle speed only for this node only at time t
 	float local_max_part_speed = 0;
 
+	if (gdata->perfCounters)
+		gdata->perfCounters->begin("doWrite gages");
+
 	for (uint i = node_offset; i < node_offset + gdata->processParticles[gdata->mpi_rank]; i++) {
 		const float4 pos = lpos[i];
 		uint3 gridPos = gdata->calcGridPosFromCellHash( cellHashFromParticleHash(gdata->s_hBuffers.getData<BUFFER_HASH>()[i]) );
@@ -1546,6 +1879,9 @@ void GPUSPH::doWrite(flag_t write_flags)
 		local_max_part_speed = fmax(local_max_part_speed, length( as_float3(gdata->s_hBuffers.getData<BUFFER_VEL>()[i]) ));
 	}
 
+	if (gdata->perfCounters)
+		gdata->perfCounters->end();
+
 	// max speed: read simulation global for multi-node
 	if (MULTI_NODE)
 		// after this, local_max_part_speed actually becomes global_max_part_speed for time t only
@@ -1556,8 +1892,19 @@ void GPUSPH::doWrite(flag_t write_flags)
 		m_peakParticleSpeedTime = gdata->t;
 	}
 
+	// out-of-band test points need the global positions computed above
+	const size_t numprobes = problem->simparams()->probes.size();
+	if (numprobes)
+		evaluateProbes(node_offset);
+
+	// everything from here on is counted as writing
+	PerfRegion writing(gdata->perfCounters, "writers");
+
 	WriterMap writers = Writer::StartWriting(gdata->t, write_flags);
 
+	if (numprobes)
+		Writer::WriteProbes(writers, gdata->t, m_probeValues);
+
 	if (numgages) {
 		for (uint g = 0 ; g < numgages; ++g) {
 			/*cout << "Ng : " << g << " gage: " << gages[g].x << "," << gages[g].y << " r : " << gages[g].w << " z: " << gages[g].z
@@ -1747,6 +2094,14 @@ void GPUSPH::buildNeibList()
 			printf("\tpossible culprit: %d (neibs: %d)\n", gdata->timingInfo[d].hasTooManyNeibs, gdata->timingInfo[d].hasMaxNeibs);
 		}
 
+		// the neighbors in a cell too crowded for the neibdata encoding were skipped
+		if (gdata->timingInfo[d].hasCellOverflow > 0) {
+			printf("FATAL: %d particles in a cell at iteration %lu, the neighbor list can only address %u. Requesting immediate quit\n",
+				gdata->timingInfo[d].hasCellOverflow, gdata->iterations,
+				CELLNUM_ENCODED(gdata->problem->simparams()->get_cellnum_shift()));
+			gdata->quit_request = true;
+		}
+
 		if (currDevMaxNeibs > gdata->lastGlobalPeakNeibsNum)
 			gdata->lastGlobalPeakNeibsNum = currDevMaxNeibs;
 
@@ -1852,6 +2207,8 @@ void GPUSPH::printDeviceAccessibilityTable()
 // with compact particle filling (i.e. no holes in the ID space) and in simulations without open boundaries
 void GPUSPH::rollCallParticles()
 {
+	PerfRegion region(gdata->perfCounters, "roll call");
+
 	// everything's ok till now?
 	bool all_normal = true;
 	// warn the user about the first anomaly only
@@ -2021,6 +2378,46 @@ void GPUSPH::prepareProblem()
 	}
 }
 
+bool GPUSPH::needIOwaterdepthReduction() const
+{
+	const flag_t simflags = problem->simparams()->simflags;
+	return MULTI_DEVICE && problem->simparams()->boundarytype == SA_BOUNDARY &&
+		(simflags & ENABLE_INLET_OUTLET) && (simflags & ENABLE_WATER_DEPTH);
+}
+
+// Start the reduction of the water depth at pressure outlets: the devices of
+// each node combine their partial values with peer copies, and in multi-node
+// mode the node-wide maximum is then reduced across the network with a
+// non-blocking collective
+void GPUSPH::startIOwaterdepthReduction()
+{
+	doCommand(REDUCE_IOWATERDEPTH);
+
+	if (MULTI_NODE)
+		gdata->networkManager->networkIntReductionAsync((int*)gdata->h_IOwaterdepth[0],
+			problem->simparams()->numOpenBoundaries, MAX_REDUCTION);
+
+	m_IOwaterdepthReductionPending = true;
+}
+
+// Complete the reduction of the water depth at pressure outlets: after this,
+// all devices hold the global maximum
+void GPUSPH::completeIOwaterdepthReduction()
+{
+	// e.g. during initialization no forces computation started the reduction
+	if (!m_IOwaterdepthReductionPending)
+		startIOwaterdepthReduction();
+
+	// in single-node mode the devices already hold the global value, otherwise
+	// upload the result of the network reduction
+	if (MULTI_NODE) {
+		gdata->networkManager->waitAsyncReduction();
+		doCommand(UPLOAD_IOWATERDEPTH);
+	}
+
+	m_IOwaterdepthReductionPending = false;
+}
+
 void GPUSPH::saBoundaryConditions(flag_t cFlag)
 {
 	if (gdata->simframework->getBCEngine() == NULL)
@@ -2055,27 +2452,12 @@ void GPUSPH::saBoundaryConditions(flag_t cFlag)
 	if (problem->simparams()->simflags & ENABLE_INLET_OUTLET) {
 		// reduce the water depth at pressure outlets if required
 		// if we have multiple devices then we need to run a global max on the different gpus / nodes
-		if (MULTI_DEVICE && problem->simparams()->simflags & ENABLE_WATER_DEPTH) {
-			// each device gets his waterdepth array from the gpu
-			doCommand(DOWNLOAD_IOWATERDEPTH);
-			int* n_IOwaterdepth = new int[problem->simparams()->numOpenBoundaries];
-			// max over all devices per node
-			for (uint ob = 0; ob < problem->simparams()->numOpenBoundaries; ob ++) {
-				n_IOwaterdepth[ob] = 0;
-				for (uint d = 0; d < gdata->devices; d++)
-					n_IOwaterdepth[ob] = max(n_IOwaterdepth[ob], int(gdata->h_IOwaterdepth[d][ob]));
-			}
-			// if we are in multi-node mode we need to run an mpi reduction over all nodes
-			if (MULTI_NODE) {
-				gdata->networkManager->networkIntReduction((int*)n_IOwaterdepth, problem->simparams()->numOpenBoundaries, MAX_REDUCTION);
-			}
-			// copy global value back to one array so that we can upload it again
-			for (uint ob = 0; ob < problem->simparams()->numOpenBoundaries; ob ++)
-				gdata->h_IOwaterdepth[0][ob] = n_IOwaterdepth[ob];
-			// upload the global max value to the devices
-			doCommand(UPLOAD_IOWATERDEPTH);
-		}
+		if (needIOwaterdepthReduction())
+			completeIOwaterdepthReduction();
 		gdata->only_internal = false;
+		// nested simulation: load the coarse data for the current time
+		if (problem->get_nesting())
+			problem->get_nesting()->update(gdata->t);
 		doCommand(SWAP_BUFFERS, BUFFER_POS);
 		doCommand(IMPOSE_OPEN_BOUNDARY_CONDITION);
 		doCommand(SWAP_BUFFERS, BUFFER_POS);
@@ -2106,7 +2488,7 @@ void GPUSPH::saBoundaryConditions(flag_t cFlag)
 	if (cFlag & INITIALIZATION_STEP) {
 		// swap changed buffers back so that read contains the new data
 		doCommand(SWAP_BUFFERS, BUFFER_VEL | BUFFER_TKE | BUFFER_EPSILON | BUFFER_POS | BUFFER_EULERVEL | BUFFER_GRADGAMMA | BUFFER_VERTICES);
-		if (clOptions->resume_fname.empty()) {
+		if (!clOptions->resuming()) {
 			doCommand(SWAP_BUFFERS, BUFFER_BOUNDELEMENTS);
 			// initialise gamma using a Gauss quadrature formula
 			doCommand(INIT_GAMMA);
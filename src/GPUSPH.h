@@ -41,7 +41,12 @@
 // Note: this is not thread-safe, under both the singleton point of view and the destructor.
 // But we aren't that paranoid, are we?
 
+// single region for the global host buffers
+class HostArena;
+
 class GPUSPH {
+	// the microbenchmarks time some of the private host paths
+	friend class BenchContext;
 private:
 	// some pointers
 	Options* clOptions;
@@ -68,6 +73,19 @@ private:
 	float m_peakParticleSpeed;
 	double m_peakParticleSpeedTime; // ...and when
 
+	// is a reduction of the open boundary water depth in flight?
+	bool m_IOwaterdepthReductionPending;
+
+	// out-of-band test points (probes), bucketed by cell: the probes in cell c
+	// are m_probeOrder[m_probeCellStart[c]] ... m_probeOrder[m_probeCellStart[c+1]-1]
+	std::vector<uint> m_probeCellStart;
+	std::vector<uint> m_probeOrder;
+	// values interpolated at the probes at the last write
+	ProbeValueList m_probeValues;
+
+	// region the global host buffers are carved from (if enabled)
+	HostArena *m_hostArena;
+
 	// other vars
 	bool initialized;
 
@@ -126,6 +144,13 @@ private:
 	// setting of boundary conditions for the semi-analytical boundaries
 	void saBoundaryConditions(flag_t cFlag);
 
+	// global reduction of the open boundary water depth in multi-device runs:
+	// the reduction is started as soon as the forces kernel has computed the
+	// partial depths, and completed right before they are needed
+	bool needIOwaterdepthReduction() const;
+	void startIOwaterdepthReduction();
+	void completeIOwaterdepthReduction();
+
 	// print information about the status of the simulation
 	void printStatus(FILE *out = stdout);
 
@@ -143,6 +168,9 @@ private:
 
 	double Wendland2D(const double, const double);
 
+	// interpolate the fluid at the probes from the particles in the host buffers
+	void evaluateProbes(uint node_offset);
+
 public:
 	// destructor
 	~GPUSPH();
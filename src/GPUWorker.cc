@@ -27,11 +27,16 @@
 #include <sstream>
 // FLT_MAX
 #include <cfloat>
+// mkdir
+#include <sys/stat.h>
 
 #include "GPUWorker.h"
 #include "cudautil.h"
 
 #include "Problem.h"
+#include "NestingDriver.h"
+#include "MemoryRegistry.h"
+#include "HostArena.h"
 
 #include "cudabuffer.h"
 
@@ -61,7 +66,10 @@ GPUWorker::GPUWorker(GlobalData* _gdata, devcount_t _deviceIndex) :
 	m_dCompactDeviceMap(NULL),
 	m_dSegmentStart(NULL),
 	m_dIOwaterdepth(NULL),
+	m_dPeerIOwaterdepth(NULL),
 	m_dNewNumParticles(NULL),
+	m_dNestingPos(NULL),
+	m_dNestingVal(NULL),
 	m_asyncH2DCopiesStream(0),
 	m_asyncD2HCopiesStream(0),
 	m_asyncPeerCopiesStream(0),
@@ -98,6 +106,8 @@ GPUWorker::GPUWorker(GlobalData* _gdata, devcount_t _deviceIndex) :
 	// used if GPUDirect is disabled
 	m_hNetworkTransferBuffer = NULL;
 	m_hNetworkTransferBufferSize = 0;
+	m_hNetworkStagingOffset = 0;
+	m_burstCompressor = NULL;
 
 	m_dCompactDeviceMap = NULL;
 	m_hCompactDeviceMap = NULL;
@@ -343,43 +353,90 @@ void GPUWorker::asyncCellIndicesUpload(uint fromCell, uint toCell)
 }
 
 // wrapper for NetworkManage send/receive methods
-void GPUWorker::networkTransfer(uchar peer_gdix, TransferDirection direction, void* _ptr, size_t _size, uint bid)
-{
-	// reallocate host buffer if necessary
-	if (!gdata->clOptions->gpudirect && _size > m_hNetworkTransferBufferSize)
-		resizeNetworkTransferBuffer(_size);
+void GPUWorker::networkTransfer(uchar peer_gdix, TransferDirection direction, void* _ptr, size_t _size, uint bid,
+	flag_t bufkey, BurstCompressor::Key key)
+{
+	const bool async = gdata->clOptions->asyncNetworkTransfers;
+
+	// compressed bursts are sent and received from the buffers of the compressor,
+	// and (de)compressed from/to the host buffer (no GPUDirect, see main)
+	const bool compressed = m_burstCompressor && bufkey && m_burstCompressor->enabled(bufkey);
+
+	// without GPUDirect, the data goes through a host buffer: blocking transfers
+	// reuse it from the start, asynchronous ones take the next slice of it
+	// (the buffer was sized for all of them by transferBursts())
+	void *staging = NULL;
+	if (!gdata->clOptions->gpudirect) {
+		if (async) {
+			if (m_hNetworkStagingOffset + _size > m_hNetworkTransferBufferSize) {
+				stringstream err_msg;
+				err_msg << "Network staging buffer overflow on device " << (uint)m_deviceIndex
+					<< ": " << _size << " bytes requested at offset " << m_hNetworkStagingOffset
+					<< " of " << m_hNetworkTransferBufferSize;
+				throw runtime_error(err_msg.str());
+			}
+			staging = (char*)m_hNetworkTransferBuffer + m_hNetworkStagingOffset;
+			m_hNetworkStagingOffset += _size;
+		} else {
+			// reallocate host buffer if necessary
+			if (_size > m_hNetworkTransferBufferSize)
+				resizeNetworkTransferBuffer(_size);
+			staging = m_hNetworkTransferBuffer;
+		}
+	}
 
 	if (direction == SND) {
-		if (!gdata->clOptions->gpudirect) {
+		void *src = _ptr;
+		if (staging) {
 			// device -> host buffer, possibly async with forces kernel
-			CUDA_SAFE_CALL_NOSYNC( cudaMemcpyAsync(m_hNetworkTransferBuffer, _ptr, _size,
+			CUDA_SAFE_CALL_NOSYNC( cudaMemcpyAsync(staging, _ptr, _size,
 				cudaMemcpyDeviceToHost, m_asyncD2HCopiesStream) );
 			// wait for the data transfer to complete
 			cudaStreamSynchronize(m_asyncD2HCopiesStream);
-			// host buffer -> network
-			gdata->networkManager->sendBuffer(m_globalDeviceIdx, peer_gdix, _size, m_hNetworkTransferBuffer);
-		} else {
-			// GPUDirect: device -> network
-			if (gdata->clOptions->asyncNetworkTransfers)
-				gdata->networkManager->sendBufferAsync(m_globalDeviceIdx, peer_gdix, _size, _ptr, bid);
-			else
-				gdata->networkManager->sendBuffer(m_globalDeviceIdx, peer_gdix, _size, _ptr);
+			src = staging;
+		}
+		size_t count = _size;
+		if (m_burstCompressor && bufkey) {
+			if (m_burstCompressor->recording())
+				m_burstCompressor->record_burst(bufkey, key, src, _size);
+			if (compressed) {
+				vector<char> const& wire = m_burstCompressor->encode(bufkey, key, src, _size);
+				src = const_cast<char*>(&wire[0]);
+				count = wire.size();
+			}
 		}
+		// host buffer or device (GPUDirect) -> network
+		if (async)
+			gdata->networkManager->sendBufferAsync(m_globalDeviceIdx, peer_gdix, count, src, bid);
+		else
+			gdata->networkManager->sendBuffer(m_globalDeviceIdx, peer_gdix, count, src);
 	} else {
-		if (!gdata->clOptions->gpudirect) {
-			// network -> host buffer
-			gdata->networkManager->receiveBuffer(peer_gdix, m_globalDeviceIdx, _size, m_hNetworkTransferBuffer);
-			// host buffer -> device, possibly async with forces kernel
-			CUDA_SAFE_CALL_NOSYNC( cudaMemcpyAsync(_ptr, m_hNetworkTransferBuffer, _size,
-				cudaMemcpyHostToDevice, m_asyncH2DCopiesStream) );
-			// wait for the data transfer to complete (actually next iteration could requre no sync, but safer to do)
-			cudaStreamSynchronize(m_asyncH2DCopiesStream);
+		// network -> host buffer or device (GPUDirect)
+		void *dst = (staging ? staging : _ptr);
+		size_t count = _size;
+		if (compressed) {
+			dst = m_burstCompressor->receive_buffer(bufkey, key, _size);
+			count = BurstCodec::max_encoded_size(_size);
+		}
+		if (async) {
+			gdata->networkManager->receiveBufferAsync(peer_gdix, m_globalDeviceIdx, count, dst, bid);
+			// the upload to the device (and the decompression) must wait
+			// for the transfer to complete
+			if (staging)
+				m_pendingNetworkUploads.push_back(compressed ?
+					NetworkUpload(_ptr, staging, _size, bufkey, key) :
+					NetworkUpload(_ptr, staging, _size));
 		} else {
-			// GPUDirect: network -> device
-			if (gdata->clOptions->asyncNetworkTransfers)
-				gdata->networkManager->receiveBufferAsync(peer_gdix, m_globalDeviceIdx, _size, _ptr, bid);
-			else
-				gdata->networkManager->receiveBuffer(peer_gdix, m_globalDeviceIdx, _size, _ptr);
+			gdata->networkManager->receiveBuffer(peer_gdix, m_globalDeviceIdx, count, dst, !compressed);
+			if (compressed)
+				m_burstCompressor->decode(bufkey, key, staging, _size);
+			if (staging) {
+				// host buffer -> device, possibly async with forces kernel
+				CUDA_SAFE_CALL_NOSYNC( cudaMemcpyAsync(_ptr, staging, _size,
+					cudaMemcpyHostToDevice, m_asyncH2DCopiesStream) );
+				// wait for the data transfer to complete (actually next iteration could requre no sync, but safer to do)
+				cudaStreamSynchronize(m_asyncH2DCopiesStream);
+			}
 		}
 	}
 }
@@ -602,7 +659,7 @@ void GPUWorker::computeCellBursts()
 
 	// We need min (#network_bursts * 4) messages (since we send multiple buffers for
 	// each burst). Multiplying by 8 is just safer
-	gdata->networkManager->setNumRequests(network_bursts * 8);
+	gdata->networkManager->setNumRequests(m_deviceIndex, network_bursts * 8);
 
 	printf("D%u: data transfers compacted in %u bursts [%u node + %u network]\n",
 		m_deviceIndex, (uint)m_bursts.size(), node_bursts, network_bursts);
@@ -753,8 +810,27 @@ void GPUWorker::transferBursts()
 
 	// burst id counter, needed to correctly pair asynchronous network messages
 	uint bid[MAX_DEVICES_PER_CLUSTER];
+	// network bursts exchanged with each peer, to identify them for the compression
+	uint ordinal[MAX_DEVICES_PER_CLUSTER];
 	for (uint n = 0; n < MAX_DEVICES_PER_CLUSTER; n++)
-		bid[n] = 0;
+		bid[n] = ordinal[n] = 0;
+
+	// Asynchronous network transfers staged on the host need a slice of the
+	// staging buffer for each message, so size it for all of them in advance
+	if (MULTI_NODE && gdata->clOptions->asyncNetworkTransfers && !gdata->clOptions->gpudirect) {
+		size_t staging_size = 0;
+		for (uint i = 0; i < m_bursts.size(); i++) {
+			if (m_bursts[i].scope != NETWORK_SCOPE || m_bursts[i].numParticles == 0)
+				continue;
+			for (BufferList::iterator bufset = buflist->begin(); bufset != buflist->end(); ++bufset)
+				if (gdata->commandFlags & bufset->first)
+					staging_size += size_t(m_bursts[i].numParticles) *
+						bufset->second->get_element_size() * bufset->second->get_array_count();
+		}
+		resizeNetworkTransferBuffer(staging_size);
+		m_hNetworkStagingOffset = 0;
+		m_pendingNetworkUploads.clear();
+	}
 
 	// Iterate on scope type, so that intra-node transfers are performed first.
 	// Decrement instead of incrementing to transfer MPI first.
@@ -770,6 +846,9 @@ void GPUWorker::transferBursts()
 			// transfer the data if burst is not empty
 			if (m_bursts[i].numParticles == 0) continue;
 
+			const uint burst_ordinal = (current_scope == NETWORK_SCOPE ?
+				ordinal[m_bursts[i].peer_gidx]++ : 0);
+
 			/*
 			printf("IT %u D %u burst %u #parts %u dir %s (%u -> %u) scope %s\n",
 				gdata->iterations, m_deviceIndex, i, m_bursts[i].numParticles,
@@ -821,7 +900,9 @@ void GPUWorker::transferBursts()
 						peerAsyncTransfer(ptr, m_cudaDeviceNumber, peerptr, peerCudaDevNum, _size);
 					} else {
 						// network scope: SND or RCV
-						networkTransfer(m_bursts[i].peer_gidx, m_bursts[i].direction, ptr, _size, bid[m_bursts[i].peer_gidx]++);
+						networkTransfer(m_bursts[i].peer_gidx, m_bursts[i].direction, ptr, _size, bid[m_bursts[i].peer_gidx]++,
+							bufkey, BurstCompressor::make_key(m_bursts[i].peer_gidx, m_bursts[i].direction == SND,
+								burst_ordinal, ai));
 					}
 				}
 
@@ -831,9 +912,23 @@ void GPUWorker::transferBursts()
 
 	} // iterate on scopes
 
-	// waits for network async transfers to complete
-	if (MULTI_NODE)
-		gdata->networkManager->waitAsyncTransfers();
+	// waits for network async transfers to complete; the other workers of
+	// this process keep sending and receiving their own in the meantime
+	if (MULTI_NODE) {
+		gdata->networkManager->waitAsyncTransfers(m_deviceIndex);
+
+		// upload the bursts received in the host staging buffer
+		for (uint i = 0; i < m_pendingNetworkUploads.size(); i++) {
+			NetworkUpload const& up = m_pendingNetworkUploads[i];
+			if (up.bufkey)
+				m_burstCompressor->decode(up.bufkey, up.key, up.src, up.size);
+			CUDA_SAFE_CALL_NOSYNC( cudaMemcpyAsync(up.dst, up.src, up.size,
+				cudaMemcpyHostToDevice, m_asyncH2DCopiesStream) );
+		}
+		if (!m_pendingNetworkUploads.empty())
+			cudaStreamSynchronize(m_asyncH2DCopiesStream);
+		m_pendingNetworkUploads.clear();
+	}
 }
 
 
@@ -869,10 +964,13 @@ size_t GPUWorker::allocateHostBuffers() {
 
 	size_t allocated = 0;
 
+	MemoryRegistry &registry = MemoryRegistry::instance();
+
 	if (MULTI_DEVICE) {
 		m_hCompactDeviceMap = new uint[m_nGridCells];
 		memset(m_hCompactDeviceMap, 0, uintCellsSize);
 		allocated += uintCellsSize;
+		registry.allocated(MemoryRegistry::HOST_MEMORY, "cell index", "compact device map", uintCellsSize);
 
 		// allocate a 1Mb transferBuffer if peer copies are disabled
 		if (m_disableP2Ptranfers)
@@ -885,6 +983,8 @@ size_t GPUWorker::allocateHostBuffers() {
 		cudaMallocHost(&(gdata->s_dCellStarts[m_deviceIndex]), uintCellsSize);
 		cudaMallocHost(&(gdata->s_dCellEnds[m_deviceIndex]), uintCellsSize);
 		allocated += 2*uintCellsSize;
+		registry.allocated(MemoryRegistry::PINNED_MEMORY, "cell index", "cellStart", uintCellsSize);
+		registry.allocated(MemoryRegistry::PINNED_MEMORY, "cell index", "cellEnd", uintCellsSize);
 	}
 
 
@@ -901,6 +1001,8 @@ size_t GPUWorker::allocateDeviceBuffers() {
 
 	size_t allocated = 0;
 
+	MemoryRegistry &registry = MemoryRegistry::instance();
+
 	// used to set up the number of elements in CFL arrays,
 	// will only actually be used if adaptive timestepping is enabled
 
@@ -921,7 +1023,10 @@ size_t GPUWorker::allocateDeviceBuffers() {
 		else if (key == BUFFERS_CFL) // other CFL buffers
 			nels = fmaxElements;
 
-		allocated += m_dBuffers.alloc(key, nels);
+		const size_t bufbytes = m_dBuffers.alloc(key, nels);
+		allocated += bufbytes;
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "particle buffer",
+			(*m_dBuffers.getBufferList(0))[key]->get_buffer_name(), bufbytes);
 		++iter;
 	}
 
@@ -931,6 +1036,9 @@ size_t GPUWorker::allocateDeviceBuffers() {
 	CUDA_SAFE_CALL(cudaMalloc(&m_dCellEnd, uintCellsSize));
 	allocated += uintCellsSize;
 
+	registry.allocated(MemoryRegistry::DEVICE_MEMORY, "cell index", "cellStart", uintCellsSize);
+	registry.allocated(MemoryRegistry::DEVICE_MEMORY, "cell index", "cellEnd", uintCellsSize);
+
 	if (MULTI_DEVICE) {
 		// TODO: an array of uchar would suffice
 		CUDA_SAFE_CALL(cudaMalloc(&m_dCompactDeviceMap, uintCellsSize));
@@ -942,17 +1050,40 @@ size_t GPUWorker::allocateDeviceBuffers() {
 		CUDA_SAFE_CALL(cudaMalloc(&m_dSegmentStart, segmentsSize));
 		CUDA_SAFE_CALL(cudaMemset(m_dSegmentStart, 0, segmentsSize));
 		allocated += segmentsSize;
+
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "cell index", "compact device map", uintCellsSize);
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "cell index", "segment start", segmentsSize);
 	}
 
 	// water depth at open boundaries
 	if (m_simparams->simflags & (ENABLE_INLET_OUTLET | ENABLE_WATER_DEPTH)) {
 		CUDA_SAFE_CALL(cudaMalloc((void**)&m_dIOwaterdepth, m_simparams->numOpenBoundaries*sizeof(uint)));
 		allocated += m_simparams->numOpenBoundaries*sizeof(uint);
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "open boundaries", "water depth",
+			m_simparams->numOpenBoundaries*sizeof(uint));
+	}
+
+	// landing area for the partial water depths of the other devices
+	if (MULTI_GPU && (m_simparams->simflags & ENABLE_WATER_DEPTH)) {
+		const size_t peerDepthSize = gdata->devices*m_simparams->numOpenBoundaries*sizeof(uint);
+		CUDA_SAFE_CALL(cudaMalloc((void**)&m_dPeerIOwaterdepth, peerDepthSize));
+		allocated += peerDepthSize;
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "open boundaries", "peer water depth", peerDepthSize);
 	}
 
 	// newNumParticles for inlets
 	CUDA_SAFE_CALL(cudaMalloc((void**)&m_dNewNumParticles, sizeof(uint)));
 	allocated += sizeof(uint);
+	registry.allocated(MemoryRegistry::DEVICE_MEMORY, "open boundaries", "new particles count", sizeof(uint));
+
+	// coarse samples for nested simulations
+	if (gdata->problem->get_nesting()) {
+		const size_t nestingSize = gdata->problem->get_nesting()->get_num_samples()*sizeof(float4);
+		CUDA_SAFE_CALL(cudaMalloc((void**)&m_dNestingPos, nestingSize));
+		CUDA_SAFE_CALL(cudaMalloc((void**)&m_dNestingVal, nestingSize));
+		allocated += 2*nestingSize;
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "nesting", "coarse samples", 2*nestingSize);
+	}
 
 	if (m_simparams->numforcesbodies) {
 		m_numForcesBodiesParticles = gdata->problem->get_forces_bodies_numparts();
@@ -966,6 +1097,8 @@ size_t GPUWorker::allocateDeviceBuffers() {
 		CUDA_SAFE_CALL(cudaMalloc(&m_dRbNum, objParticlesUintSize));
 
 		allocated += 2 * objParticlesFloat4Size + objParticlesUintSize;
+		registry.allocated(MemoryRegistry::DEVICE_MEMORY, "rigid bodies", "forces and torques",
+			2 * objParticlesFloat4Size + objParticlesUintSize);
 
 		uint* rbnum = new uint[m_numForcesBodiesParticles];
 
@@ -1010,6 +1143,9 @@ void GPUWorker::deallocateHostBuffers() {
 	if (m_hNetworkTransferBuffer)
 		cudaFreeHost(m_hNetworkTransferBuffer);
 
+	MemoryRegistry::instance().freed_all(MemoryRegistry::HOST_MEMORY);
+	MemoryRegistry::instance().freed_all(MemoryRegistry::PINNED_MEMORY);
+
 	// here: dem host buffers?
 }
 
@@ -1027,9 +1163,17 @@ void GPUWorker::deallocateDeviceBuffers() {
 
 	CUDA_SAFE_CALL(cudaFree(m_dNewNumParticles));
 
+	if (m_dNestingPos) {
+		CUDA_SAFE_CALL(cudaFree(m_dNestingPos));
+		CUDA_SAFE_CALL(cudaFree(m_dNestingVal));
+	}
+
 	if (m_simparams->simflags & (ENABLE_INLET_OUTLET | ENABLE_WATER_DEPTH))
 		CUDA_SAFE_CALL(cudaFree(m_dIOwaterdepth));
 
+	if (m_dPeerIOwaterdepth)
+		CUDA_SAFE_CALL(cudaFree(m_dPeerIOwaterdepth));
+
 	if (m_simparams->numforcesbodies) {
 		CUDA_SAFE_CALL(cudaFree(m_dRbTorques));
 		CUDA_SAFE_CALL(cudaFree(m_dRbForces));
@@ -1040,6 +1184,8 @@ void GPUWorker::deallocateDeviceBuffers() {
 		// delete [] m_hRbTorques;
 	}
 
+	MemoryRegistry::instance().freed_all(MemoryRegistry::DEVICE_MEMORY);
+
 
 	// here: dem device buffers?
 }
@@ -1201,6 +1347,7 @@ void GPUWorker::resizePeerTransferBuffer(size_t required_size)
 	if (m_hPeerTransferBufferSize) {
 		CUDA_SAFE_CALL(cudaFreeHost(m_hPeerTransferBuffer));
 		m_hostMemory -= prev_size;
+		MemoryRegistry::instance().freed(MemoryRegistry::PINNED_MEMORY, "transfer staging", "peer", prev_size);
 	}
 
 	printf("Staging host buffer resized to %zu bytes\n", m_hPeerTransferBufferSize);
@@ -1208,6 +1355,8 @@ void GPUWorker::resizePeerTransferBuffer(size_t required_size)
 	// (re)allocate
 	CUDA_SAFE_CALL(cudaMallocHost(&m_hPeerTransferBuffer, m_hPeerTransferBufferSize));
 	m_hostMemory += m_hPeerTransferBufferSize;
+	MemoryRegistry::instance().allocated(MemoryRegistry::PINNED_MEMORY, "transfer staging", "peer",
+		m_hPeerTransferBufferSize);
 }
 
 // analog to resizeTransferBuffer
@@ -1227,6 +1376,7 @@ void GPUWorker::resizeNetworkTransferBuffer(size_t required_size)
 	if (m_hNetworkTransferBufferSize) {
 		CUDA_SAFE_CALL(cudaFreeHost(m_hNetworkTransferBuffer));
 		m_hostMemory -= prev_size;
+		MemoryRegistry::instance().freed(MemoryRegistry::PINNED_MEMORY, "transfer staging", "network", prev_size);
 	}
 
 	printf("Staging network host buffer resized to %zu bytes\n", m_hNetworkTransferBufferSize);
@@ -1234,6 +1384,8 @@ void GPUWorker::resizeNetworkTransferBuffer(size_t required_size)
 	// (re)allocate
 	CUDA_SAFE_CALL(cudaMallocHost(&m_hNetworkTransferBuffer, m_hNetworkTransferBufferSize));
 	m_hostMemory += m_hNetworkTransferBufferSize;
+	MemoryRegistry::instance().allocated(MemoryRegistry::PINNED_MEMORY, "transfer staging", "network",
+		m_hNetworkTransferBufferSize);
 }
 
 // download cellStart and cellEnd to the shared arrays
@@ -1362,6 +1514,27 @@ void GPUWorker::uploadGravity()
 		forcesEngine->setgravity(gdata->s_varGravity);
 }
 
+// upload the velocity damping rate of the settling phase; zero (no damping)
+// outside of it
+void GPUWorker::uploadSettleDamping()
+{
+	float rate = 0;
+	if (gdata->settling) {
+		const Options *opts = gdata->clOptions;
+		rate = 1/(isfinite(opts->settle_tau) ? opts->settle_tau : opts->settle/10);
+	}
+	integrationEngine->setsettledamping(rate);
+}
+
+// the damping of the settling phase keeps the fluid stable with longer steps
+float GPUWorker::dtAdaptFactor() const
+{
+	const float factor = m_simparams->dtadaptfactor;
+	if (!gdata->settling)
+		return factor;
+	return fmaxf(factor, fminf(1.5f*factor, 0.45f));
+}
+
 // upload planes (called once while planes are constant)
 void GPUWorker::uploadPlanes()
 {
@@ -1503,6 +1676,11 @@ const AbstractBuffer* GPUWorker::getBuffer(size_t list_idx, flag_t key) const
 	return (*m_dBuffers.getBufferList(list_idx))[key];
 }
 
+const uint* GPUWorker::getIOwaterdepth() const
+{
+	return m_dIOwaterdepth;
+}
+
 void GPUWorker::setDeviceProperties(cudaDeviceProp _m_deviceProperties) {
 	m_deviceProperties = _m_deviceProperties;
 }
@@ -1548,6 +1726,9 @@ void* GPUWorker::simulationThread(void *ptr) {
 	const unsigned int cudaDeviceNumber = instance->getCUDADeviceNumber();
 	const unsigned int deviceIndex = instance->getDeviceIndex();
 
+	// account the memory allocated by this thread to our device
+	MemoryRegistry::instance().set_thread_owner(deviceIndex);
+
 	try {
 
 		instance->setDeviceProperties( checkCUDA(gdata, deviceIndex) );
@@ -1629,9 +1810,9 @@ void* GPUWorker::simulationThread(void *ptr) {
 				if (dbg_step_printf) printf(" T %d issuing UPDATE_SEGMENTS\n", deviceIndex);
 				instance->updateSegments();
 				break;
-			case DOWNLOAD_IOWATERDEPTH:
-				if (dbg_step_printf) printf(" T %d issuing DOWNLOAD_IOWATERDEPTH\n", deviceIndex);
-				instance->kernel_download_iowaterdepth();
+			case REDUCE_IOWATERDEPTH:
+				if (dbg_step_printf) printf(" T %d issuing REDUCE_IOWATERDEPTH\n", deviceIndex);
+				instance->kernel_reduce_iowaterdepth();
 				break;
 			case UPLOAD_IOWATERDEPTH:
 				if (dbg_step_printf) printf(" T %d issuing UPLOAD_IOWATERDEPTH\n", deviceIndex);
@@ -1693,6 +1874,10 @@ void* GPUWorker::simulationThread(void *ptr) {
 				if (dbg_step_printf) printf(" T %d issuing UPLOAD_GRAVITY\n", deviceIndex);
 				instance->uploadGravity();
 				break;
+			case UPLOAD_SETTLE_DAMPING:
+				if (dbg_step_printf) printf(" T %d issuing UPLOAD_SETTLE_DAMPING\n", deviceIndex);
+				instance->uploadSettleDamping();
+				break;
 			case UPLOAD_PLANES:
 				if (dbg_step_printf) printf(" T %d issuing UPLOAD_PLANES\n", deviceIndex);
 				instance->uploadPlanes();
@@ -1793,6 +1978,12 @@ void GPUWorker::initialize()
 	allocateDeviceBuffers();
 	printAllocatedMemory();
 
+	// pin the shared host arena (registered as portable, so for all the devices)
+	// here rather than from the main thread, which would create a context on device 0
+	HostArena *arena = gdata->s_hBuffers.getHostArena();
+	if (m_deviceIndex == 0 && arena && gdata->clOptions->host_arena_pin && arena->pin())
+		printf("  host arena pinned\n");
+
 	// upload centers of gravity of the bodies
 	uploadEulerBodiesCentersOfGravity();
 	uploadForcesBodiesCentersOfGravity();
@@ -1807,6 +1998,19 @@ void GPUWorker::initialize()
 		createEventsAndStreams();
 	}
 
+	// compression (and recording) of the network bursts
+	Options const* options = gdata->clOptions;
+	if (MULTI_NODE && (!options->compress_bursts.empty() || !options->record_bursts.empty())) {
+		m_burstCompressor = new BurstCompressor(options->compress_bursts);
+		if (!options->record_bursts.empty()) {
+			mkdir(options->record_bursts.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+			ostringstream fname;
+			fname << options->record_bursts << "/bursts_n" << gdata->rankString() <<
+				"_d" << (uint)m_deviceIndex << ".bin";
+			m_burstCompressor->record(fname.str());
+		}
+	}
+
 	// TODO: here set_reduction_params() will be called (to be implemented in this class). These parameters can be device-specific.
 }
 
@@ -1820,6 +2024,20 @@ void GPUWorker::finalize()
 	deallocateDeviceBuffers();
 	// ...what else?
 
+	// the shared host arena was pinned by this worker, see initialize()
+	HostArena *arena = gdata->s_hBuffers.getHostArena();
+	if (m_deviceIndex == 0 && arena)
+		arena->unpin();
+
+	if (m_burstCompressor) {
+		ostringstream prefix, stats;
+		prefix << "Burst compression, device " << (uint)m_globalDeviceIdx << ", ";
+		m_burstCompressor->print_stats(stats, prefix.str().c_str());
+		cout << stats.str();
+		delete m_burstCompressor;
+		m_burstCompressor = NULL;
+	}
+
 	cudaDeviceReset();
 }
 
@@ -1900,6 +2118,8 @@ void GPUWorker::kernel_reorderDataAndFindCellStart()
 void GPUWorker::kernel_buildNeibsList()
 {
 	neibsEngine->resetinfo();
+	// not downloaded if the device is empty
+	gdata->timingInfo[m_deviceIndex].hasCellOverflow = 0;
 
 	uint numPartsToElaborate = (gdata->only_internal ? m_particleRangeEnd : m_numParticles);
 
@@ -1933,7 +2153,11 @@ void GPUWorker::kernel_buildNeibsList()
 					numPartsToElaborate,
 					m_nGridCells,
 					m_simparams->nlSqInfluenceRadius,
-					boundNlSqInflRad);
+					boundNlSqInflRad,
+					bufread.getData<BUFFER_VEL>(),
+					gdata->fused_shepard ? bufwrite.getData<BUFFER_VEL>() : NULL,
+					m_simparams->slength,
+					m_simparams->influenceRadius);
 
 	// download the peak number of neighbors and the estimated number of interactions
 	neibsEngine->getinfo( gdata->timingInfo[m_deviceIndex] );
@@ -1955,7 +2179,7 @@ uint GPUWorker::enqueueForcesOnRange(uint fromParticle, uint toParticle, uint cf
 		toParticle,
 		gdata->problem->m_deltap,
 		m_simparams->slength,
-		m_simparams->dtadaptfactor,
+		dtAdaptFactor(),
 		m_simparams->influenceRadius,
 		m_simparams->epsilon,
 		m_dIOwaterdepth,
@@ -1999,7 +2223,7 @@ float GPUWorker::forces_dt_reduce()
 
 	return forcesEngine->dtreduce(
 		m_simparams->slength,
-		m_simparams->dtadaptfactor,
+		dtAdaptFactor(),
 		max_kinematic,
 		bufwrite.getData<BUFFER_CFL>(),
 		bufwrite.getData<BUFFER_CFL_DS>(),
@@ -2235,18 +2459,43 @@ void GPUWorker::kernel_euler()
 		m_simparams->influenceRadius);
 }
 
-void GPUWorker::kernel_download_iowaterdepth()
+// Combine the partial water depths of all the devices of the node. Each device
+// fetches the partial depths of its peers and computes the maximum in place, so
+// no host round trip is needed in the single-node case. Since the maximum is
+// idempotent it doesn't matter if a peer has already overwritten its own partial
+// value with the node-wide maximum by the time we read it.
+// Note that empty devices still take part, since the peers read their array.
+void GPUWorker::kernel_reduce_iowaterdepth()
 {
-	uint numPartsToElaborate = (gdata->only_internal ? m_particleRangeEnd : m_numParticles);
+	const uint numOpenBoundaries = m_simparams->numOpenBoundaries;
 
-	// is the device empty? (unlikely but possible before LB kicks in)
-	if (numPartsToElaborate == 0) return;
+	if (MULTI_GPU) {
+		const size_t _size = numOpenBoundaries*sizeof(uint);
 
-	bcEngine->downloadIOwaterdepth(
-			gdata->h_IOwaterdepth[m_deviceIndex],
-			m_dIOwaterdepth,
-			m_simparams->numOpenBoundaries);
+		for (uint d = 0; d < gdata->devices; d++) {
+			if (d == m_deviceIndex) continue;
+			GPUWorker *peer = gdata->GPUWORKERS[d];
+			peerAsyncTransfer(m_dPeerIOwaterdepth + d*numOpenBoundaries, m_cudaDeviceNumber,
+				peer->getIOwaterdepth(), peer->getCUDADeviceNumber(), _size);
+		}
+		// the reduction kernel runs on the default stream, wait for the copies
+		CUDA_SAFE_CALL(cudaStreamSynchronize(m_asyncPeerCopiesStream));
+
+		bcEngine->reduceIOwaterdepth(
+				m_dIOwaterdepth,
+				m_dPeerIOwaterdepth,
+				m_deviceIndex,
+				gdata->devices,
+				numOpenBoundaries);
+	}
 
+	// in multi-node mode the node-wide result is reduced across the network by
+	// the host, which only needs one copy of it
+	if (MULTI_NODE && m_deviceIndex == 0)
+		bcEngine->downloadIOwaterdepth(
+				gdata->h_IOwaterdepth[0],
+				m_dIOwaterdepth,
+				numOpenBoundaries);
 }
 
 void GPUWorker::kernel_upload_iowaterdepth()
@@ -2273,6 +2522,29 @@ void GPUWorker::kernel_imposeBoundaryCondition()
 	BufferList const& bufread = *m_dBuffers.getReadBufferList();
 	BufferList &bufwrite = *m_dBuffers.getWriteBufferList();
 
+	// nested simulation: the boundary conditions come from the coarse data
+	const NestingDriver *nesting = gdata->problem->get_nesting();
+	if (nesting) {
+		const uint numSamples = nesting->get_num_samples();
+		CUDA_SAFE_CALL(cudaMemcpy(m_dNestingPos, nesting->get_sample_pos(),
+			numSamples*sizeof(float4), cudaMemcpyHostToDevice));
+		CUDA_SAFE_CALL(cudaMemcpy(m_dNestingVal, nesting->get_sample_val(),
+			numSamples*sizeof(float4), cudaMemcpyHostToDevice));
+
+		bcEngine->imposeNestedBoundaryConditions(
+			m_dBuffers.getWriteBufferList(),
+			m_dBuffers.getReadBufferList(),
+			m_dNestingPos,
+			m_dNestingVal,
+			numSamples,
+			numPartsToElaborate);
+
+		// the water depth is not used, but reset it as the problems do
+		if (m_simparams->simflags & ENABLE_WATER_DEPTH)
+			CUDA_SAFE_CALL(cudaMemset(m_dIOwaterdepth, 0, m_simparams->numOpenBoundaries*sizeof(uint)));
+		return;
+	}
+
 	gdata->problem->imposeBoundaryConditionHost(
 		m_dBuffers.getWriteBufferList(),
 		m_dBuffers.getReadBufferList(),
@@ -2554,7 +2826,7 @@ void GPUWorker::kernel_saVertexBoundaryConditions()
 				m_simparams->slength,
 				m_simparams->influenceRadius,
 				initStep,
-				!gdata->clOptions->resume_fname.empty(),
+				gdata->clOptions->resuming(),
 				m_globalDeviceIdx,
 				gdata->totDevices,
 				gdata->totParticles
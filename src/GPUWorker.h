@@ -49,10 +49,13 @@
 
 // Bursts handling
 #include "bursts.h"
+#include "BurstCodec.h"
 
 // In GPUWoker we implement as "private" all functions which are meant to be called only by the simulationThread().
 // Only the methods which need to be called by GPUSPH are declared public.
 class GPUWorker {
+	// the microbenchmarks time computeCellBursts()
+	friend class BenchContext;
 private:
 	GlobalData* gdata;
 
@@ -113,6 +116,26 @@ private:
 	size_t m_hNetworkTransferBufferSize;
 	void resizeNetworkTransferBuffer(size_t required_size);
 
+	// asynchronous network transfers without gpudirect: each message is staged in
+	// its own slice of the host buffer (starting at the given offset), and the
+	// received ones are uploaded to the device once all transfers are complete
+	// (compressed ones are decoded into their slice first)
+	struct NetworkUpload {
+		void *dst;
+		void *src;
+		size_t size;
+		flag_t bufkey; // 0 if not compressed
+		BurstCompressor::Key key;
+		NetworkUpload(void *_dst, void *_src, size_t _size,
+			flag_t _bufkey = 0, BurstCompressor::Key _key = 0) :
+			dst(_dst), src(_src), size(_size), bufkey(_bufkey), key(_key) {}
+	};
+	size_t m_hNetworkStagingOffset;
+	std::vector<NetworkUpload> m_pendingNetworkUploads;
+
+	// compression of the network bursts (--compress-bursts), NULL if disabled
+	BurstCompressor *m_burstCompressor;
+
 	// utility pointers - the actual structures are in Problem
 	PhysParams*	m_physparams;
 	SimParams*	m_simparams;
@@ -154,10 +177,18 @@ private:
 
 	// water depth at open boundaries
 	uint*		m_dIOwaterdepth;
+	// partial water depths gathered from the other devices in the node,
+	// numOpenBoundaries entries per device
+	uint*		m_dPeerIOwaterdepth;
 
 	// "new" number of particles for open boundaries
 	uint*		m_dNewNumParticles;
 
+	// coarse samples (positions and values) driving the open boundaries
+	// in nested simulations
+	float4*		m_dNestingPos;
+	float4*		m_dNestingVal;
+
 	// number of blocks used in forces kernel runs (for delayed cfl reduction)
 	uint		m_forcesKernelTotalNumBlocks;
 
@@ -185,8 +216,10 @@ private:
 	void peerAsyncTransfer(void* dst, int  dstDevice, const void* src, int  srcDevice, size_t count);
 	void asyncCellIndicesUpload(uint fromCell, uint toCell);
 
-	// wrapper for NetworkManage send/receive methods
-	void networkTransfer(uchar peer_gdix, TransferDirection direction, void* _ptr, size_t _size, uint bid = 0);
+	// wrapper for NetworkManage send/receive methods; bufkey and key identify
+	// the burst for the compression (bufkey 0: never compressed)
+	void networkTransfer(uchar peer_gdix, TransferDirection direction, void* _ptr, size_t _size, uint bid = 0,
+		flag_t bufkey = 0, BurstCompressor::Key key = 0);
 
 	size_t allocateHostBuffers();
 	size_t allocateDeviceBuffers();
@@ -220,6 +253,10 @@ private:
 	// moving boundaries, gravity, planes
 	void uploadGravity();
 	void uploadPlanes();
+	void uploadSettleDamping();
+
+	// safety factor of the adaptive time step (relaxed while settling)
+	float dtAdaptFactor() const;
 
 	void createCompactDeviceMap();
 	void uploadCompactDeviceMap();
@@ -254,7 +291,7 @@ private:
 	void kernel_initGamma();
 	void kernel_initIOmass_vertexCount();
 	void kernel_initIOmass();
-	void kernel_download_iowaterdepth();
+	void kernel_reduce_iowaterdepth();
 	void kernel_upload_iowaterdepth();
 	/*void uploadMbData();
 	void uploadGravity();*/
@@ -302,6 +339,8 @@ public:
 	size_t getDeviceMemory();
 	// for peer transfers: get the buffer `key` from the buffer list `list_idx`
 	const AbstractBuffer* getBuffer(size_t list_idx, flag_t key) const;
+	// for peer reductions: get the (partial) open boundary water depth
+	const uint* getIOwaterdepth() const;
 };
 
 #endif /* GPUWORKER_H_ */
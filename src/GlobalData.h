@@ -63,6 +63,9 @@
 // the problem of recursive inclusions
 class GPUWorker;
 
+// HostPerfCounters
+class HostPerfCounters;
+
 // Synchronizer
 #include "Synchronizer.h"
 // Writer
@@ -144,6 +147,8 @@ enum CommandType {
 	REDUCE_BODIES_FORCES,
 	/// Upload new value of gravity, after problem callback
 	UPLOAD_GRAVITY,
+	/// Upload the velocity damping of the settling phase (zero when not settling)
+	UPLOAD_SETTLE_DAMPING,
 	/// Upload planes to devices
 	UPLOAD_PLANES,
 	/// Upload centers of gravity of moving bodies for the integration engine
@@ -161,8 +166,10 @@ enum CommandType {
 	/// Impose problem-specific velocity/pressure on open boundaries
 	/// (should update the WRITE buffer in-place)
 	IMPOSE_OPEN_BOUNDARY_CONDITION,
-	/// Download (partial) computed water depth from device to host
-	DOWNLOAD_IOWATERDEPTH,
+	/// Combine the (partial) computed water depth of all the devices in the node
+	/// with peer copies; in multi-node mode, device 0 also downloads the
+	/// node-wide result to the host for the network reduction
+	REDUCE_IOWATERDEPTH,
 	/// Upload (total)computed water depth from host to device
 	UPLOAD_IOWATERDEPTH,
 	/// Initialize gamma using a Gaussian quadrature rule
@@ -223,6 +230,9 @@ struct GlobalData {
 
 	NetworkManager* networkManager;
 
+	// hardware performance counters for the host phases (NULL if disabled)
+	HostPerfCounters* perfCounters;
+
 	// NOTE: the following holds
 	// s_hPartsPerDevice[x] <= processParticles[d] <= totParticles <= allocatedParticles
 	// - s_hPartsPerDevice[x] is the number of particles currently being handled by the GPU
@@ -329,6 +339,12 @@ struct GlobalData {
 	// set to true if next kernel has to be run only on internal particles
 	// (need support of the worker and/or the kernel)
 	bool only_internal;
+	// set to true if the Shepard filter is due in this iteration and
+	// will be computed by BUILDNEIBS rather than by a separate FILTER
+	bool fused_shepard;
+	// set to true during the damped settling phase (--settle), which runs
+	// from t = -settle to t = 0
+	bool settling;
 
 	// ODE objects
 	int* s_hRbFirstIndex; // first indices: so forces kernel knows where to write rigid body force
@@ -371,6 +387,7 @@ struct GlobalData {
 		clOptions(NULL),
 		threadSynchronizer(NULL),
 		networkManager(NULL),
+		perfCounters(NULL),
 		totParticles(0),
 		allocatedParticles(0),
 		nGridCells(0),
@@ -396,6 +413,8 @@ struct GlobalData {
 		commandFlags(NO_FLAGS),
 		extraCommandArg(NAN),
 		only_internal(false),
+		fused_shepard(false),
+		settling(false),
 		s_hRbFirstIndex(NULL),
 		s_hRbLastIndex(NULL),
 		s_hRbDeviceTotalForce(NULL),
@@ -498,7 +517,7 @@ struct GlobalData {
 	}
 
 	// pretty-print memory amounts
-	std::string memString(size_t memory) const {
+	static std::string memString(size_t memory) {
 		static const char *memSuffix[] = {
 			"B", "KiB", "MiB", "GiB", "TiB"
 		};
@@ -0,0 +1,184 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <sys/mman.h>
+
+#include <cuda_runtime.h>
+
+#include "HostArena.h"
+
+using namespace std;
+
+HostArena::HostArena() :
+	m_base(NULL),
+	m_size(0),
+	m_used(0),
+	m_hugetlb(false),
+	m_pinned(false)
+{}
+
+HostArena::~HostArena()
+{
+	unpin();
+	if (m_base)
+		munmap(m_base, m_size);
+}
+
+void
+HostArena::reserve(size_t bytes, bool hugetlb)
+{
+	if (m_base)
+		throw runtime_error("host arena already reserved");
+
+	m_size = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+	if (hugetlb) {
+		void *ptr = mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (ptr != MAP_FAILED) {
+			m_base = (char*)ptr;
+			m_hugetlb = true;
+			return;
+		}
+		cerr << "WARNING: cannot map " << (m_size >> 20) << " MiB of hugetlbfs pages (" <<
+			strerror(errno) << "), falling back to transparent huge pages" << endl;
+	}
+#else
+	if (hugetlb)
+		cerr << "WARNING: hugetlbfs pages not supported, falling back to transparent huge pages" << endl;
+#endif
+
+	// over-allocate, so that the region can be aligned to the huge page size,
+	// and trim the excess on both sides
+	const size_t mapped = m_size + HUGE_PAGE_SIZE;
+	void *ptr = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+		MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		ostringstream err;
+		err << "cannot map " << (m_size >> 20) << " MiB host arena: " << strerror(errno);
+		m_size = 0;
+		throw runtime_error(err.str());
+	}
+
+	char *start = (char*)ptr;
+	char *aligned = (char*)(((size_t)start + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1));
+	if (aligned > start)
+		munmap(start, aligned - start);
+	char *end = aligned + m_size;
+	if (start + mapped > end)
+		munmap(end, start + mapped - end);
+	m_base = aligned;
+
+#ifdef MADV_HUGEPAGE
+	if (madvise(m_base, m_size, MADV_HUGEPAGE))
+		cerr << "WARNING: transparent huge pages not available for the host arena (" <<
+			strerror(errno) << ")" << endl;
+#endif
+}
+
+void *
+HostArena::carve(size_t bytes)
+{
+	const size_t slice = slice_size(bytes);
+	if (!m_base || m_used + slice > m_size) {
+		ostringstream err;
+		err << "host arena exhausted: " << slice << " bytes requested, " <<
+			(m_size - m_used) << " available";
+		throw runtime_error(err.str());
+	}
+	void *ptr = m_base + m_used;
+	m_used += slice;
+	return ptr;
+}
+
+bool
+HostArena::pin()
+{
+	if (m_pinned || !m_used)
+		return m_pinned;
+
+	cudaError_t err = cudaHostRegister(m_base, m_used, cudaHostRegisterPortable);
+	if (err != cudaSuccess) {
+		cerr << "WARNING: cannot pin the host arena: " << cudaGetErrorString(err) << endl;
+		// clear the error, it's not sticky
+		cudaGetLastError();
+		return false;
+	}
+	m_pinned = true;
+	return true;
+}
+
+void
+HostArena::unpin()
+{
+	if (!m_pinned)
+		return;
+	cudaHostUnregister(m_base);
+	m_pinned = false;
+}
+
+size_t
+HostArena::huge_bytes() const
+{
+	if (m_hugetlb)
+		return m_size;
+
+	// add up the AnonHugePages of the mappings within the region
+	ifstream smaps("/proc/self/smaps");
+	if (!smaps)
+		return 0;
+
+	const size_t region_start = (size_t)m_base;
+	const size_t region_end = region_start + m_size;
+
+	size_t huge = 0;
+	bool inside = false;
+	string line;
+	while (getline(smaps, line)) {
+		size_t start, end;
+		char dash;
+		istringstream fields(line);
+		// mapping header: start-end perms ...
+		if (fields >> hex >> start >> dash >> end && dash == '-') {
+			inside = (start >= region_start && end <= region_end);
+			continue;
+		}
+		if (inside && !line.compare(0, 14, "AnonHugePages:")) {
+			istringstream kb(line.substr(14));
+			size_t val = 0;
+			kb >> val;
+			huge += val << 10;
+		}
+	}
+	return huge;
+}
@@ -0,0 +1,97 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOSTARENA_H
+#define _HOSTARENA_H
+
+#include <cstddef>
+
+/*! A single contiguous host memory region, carved into the arrays of the
+ * host buffers (see HostBuffer and BufferList::setHostArena).
+ *
+ * Having all the (large) particle arrays in one region aligned to huge pages
+ * lets the kernel back it with 2MiB pages, reducing the TLB pressure of the
+ * host loops over the particles, and allows pinning all of them with a
+ * single registration.
+ *
+ * The region is mapped from hugetlbfs pages when requested (and available),
+ * falling back to transparent huge pages (madvise), and ultimately to
+ * regular pages if neither is available.
+ */
+class HostArena
+{
+	char	*m_base;
+	size_t	m_size;
+	size_t	m_used;
+	// region backed by (preallocated) hugetlbfs pages?
+	bool	m_hugetlb;
+	// region registered with the CUDA runtime?
+	bool	m_pinned;
+
+	// disallow copies
+	HostArena(HostArena const&);
+	HostArena& operator=(HostArena const&);
+
+public:
+	// size of the huge pages the region is aligned to
+	static const size_t HUGE_PAGE_SIZE = 2 << 20;
+	// alignment of each slice
+	static const size_t SLICE_ALIGN = 4096;
+
+	HostArena();
+	~HostArena();
+
+	// space taken by a slice of the given size
+	static size_t slice_size(size_t bytes)
+	{ return (bytes + SLICE_ALIGN - 1) & ~(SLICE_ALIGN - 1); }
+
+	// map a region of at least `bytes` bytes; throws on failure
+	void reserve(size_t bytes, bool hugetlb);
+
+	// return the next slice of the region; throws if the region is exhausted
+	void *carve(size_t bytes);
+
+	// register the used part of the region with the CUDA runtime,
+	// for faster transfers; returns false (with a warning) on failure.
+	// Both must be called from a thread that has already selected its device
+	bool pin();
+	void unpin();
+
+	// how much of the region is currently backed by huge pages
+	size_t huge_bytes() const;
+
+	void *base() const
+	{ return m_base; }
+	size_t size() const
+	{ return m_size; }
+	size_t used() const
+	{ return m_used; }
+	bool hugetlb() const
+	{ return m_hugetlb; }
+	bool pinned() const
+	{ return m_pinned; }
+};
+
+#endif
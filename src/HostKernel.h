@@ -0,0 +1,142 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* SPH kernels on the host */
+
+#ifndef _HOSTKERNEL_H
+#define _HOSTKERNEL_H
+
+#include <cmath>
+#include <stdexcept>
+
+#include "particledefine.h"
+
+/*! Smoothing kernel W and its derivative F = 1/r dW/dr on the host, with
+ *  the same normalization as the device kernels (see setconstants in
+ *  forces.cu), so that the sum of W times the particle volumes is about 1
+ *  inside the fluid
+ */
+class HostKernel
+{
+	KernelType	m_kerneltype;
+	double		m_slength;
+	double		m_wcoeff;	// kernel normalization
+	double		m_fcoeff;	// normalization of its derivative
+	double		m_wsub;		// shift to make the Gaussian kernel vanish at the influence radius
+
+public:
+	HostKernel(KernelType kerneltype, double slength, double kernelradius) :
+		m_kerneltype(kerneltype),
+		m_slength(slength),
+		m_wcoeff(NAN),
+		m_fcoeff(NAN),
+		m_wsub(0)
+	{
+		const double h = slength;
+		const double h3 = h*h*h;
+		switch (kerneltype) {
+		case CUBICSPLINE:
+			m_wcoeff = 1.0/(M_PI*h3);
+			m_fcoeff = 3.0/(4.0*M_PI*h3*h);
+			break;
+		case QUADRATIC:
+			m_wcoeff = 15.0/(16.0*M_PI*h3);
+			m_fcoeff = 15.0/(32.0*M_PI*h3*h);
+			break;
+		case WENDLAND:
+			m_wcoeff = 21.0/(16.0*M_PI*h3);
+			m_fcoeff = 105.0/(128.0*M_PI*h3*h*h);
+			break;
+		case GAUSSIAN: {
+			const double R = kernelradius;
+			const double R2 = R*R;
+			m_wsub = exp(-R2);
+			m_wcoeff = 1/(-2*m_wsub/3*h3*M_PI*R*(3 + 2*R2) + h3*pow(M_PI, 1.5)*erf(R));
+			m_fcoeff = m_wcoeff*2/(h*h);
+			break;
+		}
+		default:
+			throw std::runtime_error("unsupported kernel on the host");
+		}
+	}
+
+	double W(double r) const
+	{
+		const double R = r/m_slength;
+		double val = 0;
+		switch (m_kerneltype) {
+		case CUBICSPLINE:
+			if (R < 1)
+				val = 1 - 1.5*R*R + 0.75*R*R*R;
+			else
+				val = 0.25*(2 - R)*(2 - R)*(2 - R);
+			break;
+		case QUADRATIC:
+			val = 0.25*R*R - R + 1;
+			break;
+		case WENDLAND:
+			val = 1 - 0.5*R;
+			val *= val;
+			val *= val;
+			val *= 1 + 2*R;
+			break;
+		case GAUSSIAN:
+			val = exp(-R*R) - m_wsub;
+			break;
+		default:
+			break;
+		}
+		return val*m_wcoeff;
+	}
+
+	// 1/r dW/dr
+	double F(double r) const
+	{
+		const double R = r/m_slength;
+		double val = 0;
+		switch (m_kerneltype) {
+		case CUBICSPLINE:
+			if (R < 1)
+				val = (-4 + 3*R)/m_slength;
+			else
+				val = -(-2 + R)*(-2 + R)/r;
+			break;
+		case QUADRATIC:
+			val = (-2 + R)/r;
+			break;
+		case WENDLAND:
+			val = (R - 2)*(R - 2)*(R - 2);
+			break;
+		case GAUSSIAN:
+			val = -exp(-R*R);
+			break;
+		default:
+			break;
+		}
+		return val*m_fcoeff;
+	}
+};
+
+#endif
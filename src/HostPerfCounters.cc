@@ -0,0 +1,327 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+
+#include "HostPerfCounters.h"
+
+using namespace std;
+
+const char *HostPerfCounters::EventName[PERF_NUM_EVENTS] = {
+	"cycles",
+	"instructions",
+	"cache-misses",
+	"dTLB-load-misses",
+	"branch-misses"
+};
+
+static const uint32_t EventType[HostPerfCounters::PERF_NUM_EVENTS] = {
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HARDWARE,
+	PERF_TYPE_HW_CACHE,
+	PERF_TYPE_HARDWARE
+};
+
+static const uint64_t EventConfig[HostPerfCounters::PERF_NUM_EVENTS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_INSTRUCTIONS,
+	PERF_COUNT_HW_CACHE_MISSES,
+	PERF_COUNT_HW_CACHE_DTLB |
+		(PERF_COUNT_HW_CACHE_OP_READ << 8) |
+		(PERF_COUNT_HW_CACHE_RESULT_MISS << 16),
+	PERF_COUNT_HW_BRANCH_MISSES
+};
+
+// open a counter for the user-space events of the calling thread
+static int
+perf_open(uint32_t type, uint64_t config)
+{
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = type;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	// to scale the counts when the counters are multiplexed
+	attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int
+perf_event_paranoid()
+{
+	int level = -100;
+	ifstream in("/proc/sys/kernel/perf_event_paranoid");
+	in >> level;
+	return level;
+}
+
+static double
+seconds_since(timespec const& start)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)*1.0e-9;
+}
+
+HostPerfCounters::PhaseTotals::PhaseTotals() :
+	calls(0), seconds(0)
+{
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		count[e] = 0;
+}
+
+void
+HostPerfCounters::PhaseTotals::add(PhaseTotals const& other)
+{
+	calls += other.calls;
+	seconds += other.seconds;
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		count[e] += other.count[e];
+}
+
+HostPerfCounters::HostPerfCounters() :
+	m_hw(false),
+	m_threads()
+{
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		m_event_ok[e] = false;
+
+	pthread_key_create(&m_key, close_counters);
+	pthread_mutex_init(&m_mutex, NULL);
+
+	// check if we can count anything at all
+	int fd = perf_open(EventType[PERF_CYCLES], EventConfig[PERF_CYCLES]);
+	if (fd < 0) {
+		const int err = errno;
+		cerr << "WARNING: hardware performance counters not available (" << strerror(err);
+		const int paranoid = perf_event_paranoid();
+		if (paranoid > 2)
+			cerr << ", perf_event_paranoid is " << paranoid;
+		cerr << "), only timing host phases" << endl;
+		return;
+	}
+	close(fd);
+
+	m_hw = true;
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+		fd = perf_open(EventType[e], EventConfig[e]);
+		m_event_ok[e] = (fd >= 0);
+		if (fd >= 0)
+			close(fd);
+		else
+			cerr << "WARNING: performance counter " << EventName[e] << " not available" << endl;
+	}
+}
+
+HostPerfCounters::~HostPerfCounters()
+{
+	for (size_t t = 0; t < m_threads.size(); ++t) {
+		close_counters(m_threads[t]);
+		delete m_threads[t];
+	}
+	pthread_key_delete(m_key);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void
+HostPerfCounters::close_counters(void *arg)
+{
+	ThreadState *state = static_cast<ThreadState*>(arg);
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+		if (state->fd[e] >= 0)
+			close(state->fd[e]);
+		state->fd[e] = -1;
+	}
+}
+
+HostPerfCounters::ThreadState *
+HostPerfCounters::thread_state()
+{
+	ThreadState *state = static_cast<ThreadState*>(pthread_getspecific(m_key));
+	if (state)
+		return state;
+
+	state = new ThreadState();
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		state->fd[e] = (m_event_ok[e] ? perf_open(EventType[e], EventConfig[e]) : -1);
+
+	pthread_mutex_lock(&m_mutex);
+	state->index = m_threads.size();
+	m_threads.push_back(state);
+	pthread_mutex_unlock(&m_mutex);
+
+	pthread_setspecific(m_key, state);
+	return state;
+}
+
+void
+HostPerfCounters::read_counts(ThreadState const* state, uint64_t *count) const
+{
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+		count[e] = 0;
+		if (state->fd[e] < 0)
+			continue;
+		// value, time enabled, time running
+		uint64_t data[3];
+		if (read(state->fd[e], data, sizeof(data)) != sizeof(data))
+			continue;
+		if (data[2] && data[2] < data[1])
+			count[e] = (uint64_t)((double)data[0]*data[1]/data[2]);
+		else
+			count[e] = data[0];
+	}
+}
+
+void
+HostPerfCounters::begin(const char *phase)
+{
+	ThreadState *state = thread_state();
+	state->stack.push_back(Region());
+	Region &region = state->stack.back();
+	region.phase = phase;
+	read_counts(state, region.count);
+	clock_gettime(CLOCK_MONOTONIC, &region.start);
+}
+
+void
+HostPerfCounters::end()
+{
+	ThreadState *state = thread_state();
+	if (state->stack.empty())
+		throw runtime_error("performance counters region ended without beginning");
+
+	uint64_t count[PERF_NUM_EVENTS];
+	read_counts(state, count);
+
+	Region const& region = state->stack.back();
+	PhaseTotals &totals = state->totals[region.phase];
+	totals.seconds += seconds_since(region.start);
+	++totals.calls;
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		totals.count[e] += count[e] - region.count[e];
+
+	state->stack.pop_back();
+}
+
+map<string, HostPerfCounters::PhaseTotals>
+HostPerfCounters::phase_totals() const
+{
+	map<string, PhaseTotals> totals;
+	for (size_t t = 0; t < m_threads.size(); ++t) {
+		map<string, PhaseTotals>::const_iterator ph(m_threads[t]->totals.begin());
+		for (; ph != m_threads[t]->totals.end(); ++ph)
+			totals[ph->first].add(ph->second);
+	}
+	return totals;
+}
+
+void
+HostPerfCounters::print_summary(FILE *out) const
+{
+	map<string, PhaseTotals> const totals = phase_totals();
+	if (totals.empty())
+		return;
+
+	fprintf(out, "Host phases%s:\n", m_hw ? "" : " (hardware counters not available)");
+	fprintf(out, "  %-16s %8s %10s", "phase", "calls", "time (s)");
+	if (m_hw) {
+		fprintf(out, " %6s", "IPC");
+		for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+			fprintf(out, " %16s", EventName[e]);
+	}
+	fprintf(out, "\n");
+
+	map<string, PhaseTotals>::const_iterator ph(totals.begin());
+	for (; ph != totals.end(); ++ph) {
+		PhaseTotals const& pt = ph->second;
+		fprintf(out, "  %-16s %8lu %10.4g", ph->first.c_str(), pt.calls, pt.seconds);
+		if (m_hw) {
+			if (m_event_ok[PERF_CYCLES] && m_event_ok[PERF_INSTRUCTIONS] && pt.count[PERF_CYCLES])
+				fprintf(out, " %6.2f", (double)pt.count[PERF_INSTRUCTIONS]/pt.count[PERF_CYCLES]);
+			else
+				fprintf(out, " %6s", "n/a");
+			for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+				if (m_event_ok[e])
+					fprintf(out, " %16llu", (unsigned long long)pt.count[e]);
+				else
+					fprintf(out, " %16s", "n/a");
+			}
+		}
+		fprintf(out, "\n");
+	}
+
+	// per-thread breakdown, only if there are multiple threads
+	if (m_threads.size() < 2)
+		return;
+	for (size_t t = 0; t < m_threads.size(); ++t) {
+		map<string, PhaseTotals>::const_iterator tph(m_threads[t]->totals.begin());
+		for (; tph != m_threads[t]->totals.end(); ++tph)
+			fprintf(out, "    thread %zu %-16s %8lu %10.4g s %16llu cycles\n", t,
+				tph->first.c_str(), tph->second.calls, tph->second.seconds,
+				(unsigned long long)tph->second.count[PERF_CYCLES]);
+	}
+}
+
+void
+HostPerfCounters::write_csv(string const& fname) const
+{
+	ofstream out(fname.c_str());
+	if (!out) {
+		cerr << "WARNING: cannot save performance counters to " << fname << endl;
+		return;
+	}
+
+	out << "phase,thread,calls,seconds";
+	for (int e = 0; e < PERF_NUM_EVENTS; ++e)
+		out << "," << EventName[e];
+	out << "\n";
+
+	for (size_t t = 0; t < m_threads.size(); ++t) {
+		map<string, PhaseTotals>::const_iterator ph(m_threads[t]->totals.begin());
+		for (; ph != m_threads[t]->totals.end(); ++ph) {
+			PhaseTotals const& pt = ph->second;
+			out << ph->first << "," << t << "," << pt.calls << "," << pt.seconds;
+			// unavailable counters are left empty
+			for (int e = 0; e < PERF_NUM_EVENTS; ++e) {
+				out << ",";
+				if (m_hw && m_event_ok[e])
+					out << pt.count[e];
+			}
+			out << "\n";
+		}
+	}
+}
@@ -0,0 +1,146 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _HOSTPERFCOUNTERS_H
+#define _HOSTPERFCOUNTERS_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+
+#include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+
+/*! Hardware performance counters (via perf_event_open) for the host-side
+ * phases of the simulation (filling, sorting, writing, ...).
+ *
+ * Phases are delimited by begin()/end() pairs (or more conveniently by a
+ * PerfRegion object) and can be nested, in which case the counts of the
+ * inner phase are also included in those of the outer one.
+ * Counts are accumulated per phase and per thread; counters are opened the
+ * first time a thread enters a phase, and only count user-space events of
+ * that thread.
+ *
+ * When the counters are not available (e.g. perf_event_paranoid forbids
+ * them, or in virtual machines without a virtual PMU) only the number of
+ * calls and the wall-clock time of each phase are collected.
+ */
+class HostPerfCounters
+{
+public:
+	enum PerfEvent {
+		PERF_CYCLES,
+		PERF_INSTRUCTIONS,
+		PERF_CACHE_MISSES,
+		PERF_DTLB_MISSES,
+		PERF_BRANCH_MISSES,
+		PERF_NUM_EVENTS
+	};
+
+	static const char *EventName[PERF_NUM_EVENTS];
+
+	// totals of a phase on a thread
+	struct PhaseTotals {
+		unsigned long	calls;
+		double			seconds;
+		uint64_t		count[PERF_NUM_EVENTS];
+
+		PhaseTotals();
+		void add(PhaseTotals const& other);
+	};
+
+private:
+	// a phase in progress
+	struct Region {
+		const char	*phase;
+		timespec	start;
+		uint64_t	count[PERF_NUM_EVENTS];
+	};
+
+	struct ThreadState {
+		uint	index;
+		int		fd[PERF_NUM_EVENTS];
+		std::vector<Region>	stack;
+		std::map<std::string, PhaseTotals>	totals;
+	};
+
+	// are the hardware counters available at all?
+	bool	m_hw;
+	// which events could be opened (on the first thread)
+	bool	m_event_ok[PERF_NUM_EVENTS];
+
+	pthread_key_t	m_key;
+	pthread_mutex_t	m_mutex;
+	std::vector<ThreadState*>	m_threads;
+
+	ThreadState *thread_state();
+	void read_counts(ThreadState const* state, uint64_t *count) const;
+
+	static void close_counters(void *state);
+
+	// totals of each phase, over all threads
+	std::map<std::string, PhaseTotals> phase_totals() const;
+
+	// disallow copies
+	HostPerfCounters(HostPerfCounters const&);
+	HostPerfCounters& operator=(HostPerfCounters const&);
+
+public:
+	HostPerfCounters();
+	~HostPerfCounters();
+
+	bool hw_available() const
+	{ return m_hw; }
+
+	// enter/leave a phase on the calling thread
+	void begin(const char *phase);
+	void end();
+
+	// print the per-phase (and per-thread) totals
+	void print_summary(FILE *out) const;
+
+	// save the per-phase, per-thread totals as CSV
+	void write_csv(std::string const& fname) const;
+};
+
+/*! Count the events in a scope as the given phase.
+ * Does nothing if the counters are NULL (i.e. disabled).
+ */
+class PerfRegion
+{
+	HostPerfCounters *m_counters;
+
+public:
+	PerfRegion(HostPerfCounters *counters, const char *phase) :
+		m_counters(counters)
+	{ if (m_counters) m_counters->begin(phase); }
+
+	~PerfRegion()
+	{ if (m_counters) m_counters->end(); }
+};
+
+#endif
@@ -0,0 +1,214 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <iostream>
+#include <vector>
+#include <algorithm>
+
+#include <stdint.h>
+
+#include "MemoryRegistry.h"
+#include "GlobalData.h"
+
+using namespace std;
+
+const char *MemoryRegistry::LocationName[NUM_LOCATIONS] = {
+	"host",
+	"pinned",
+	"device"
+};
+
+static string
+owner_string(int owner)
+{
+	if (owner == MemoryRegistry::PROCESS_OWNER)
+		return "process";
+	char buf[32];
+	snprintf(buf, sizeof(buf), "device %d", owner);
+	return buf;
+}
+
+MemoryRegistry::MemoryRegistry()
+{
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_key_create(&m_owner_key, NULL);
+}
+
+MemoryRegistry::~MemoryRegistry()
+{
+	pthread_key_delete(m_owner_key);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+MemoryRegistry&
+MemoryRegistry::instance()
+{
+	// guaranteed to be destroyed; instantiated on first use
+	static MemoryRegistry registry;
+	return registry;
+}
+
+void
+MemoryRegistry::set_thread_owner(int owner)
+{
+	// store owner + 1, so that unset (NULL) means PROCESS_OWNER
+	pthread_setspecific(m_owner_key, (void*)(intptr_t)(owner + 1));
+}
+
+int
+MemoryRegistry::thread_owner() const
+{
+	return (int)(intptr_t)pthread_getspecific(m_owner_key) - 1;
+}
+
+void
+MemoryRegistry::allocated(Location where, const char *purpose, const char *name, size_t bytes)
+{
+	const Where w(thread_owner(), where);
+	const Tag tag(w, make_pair(string(purpose), string(name)));
+
+	pthread_mutex_lock(&m_mutex);
+	Usage &usage = m_tags[tag];
+	++usage.count;
+	usage.current += bytes;
+	usage.peak = max(usage.peak, usage.current);
+
+	Usage &total = m_totals[w];
+	++total.count;
+	total.current += bytes;
+	total.peak = max(total.peak, total.current);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void
+MemoryRegistry::freed(Location where, const char *purpose, const char *name, size_t bytes)
+{
+	const Where w(thread_owner(), where);
+	const Tag tag(w, make_pair(string(purpose), string(name)));
+
+	pthread_mutex_lock(&m_mutex);
+	Usage &usage = m_tags[tag];
+	bytes = min(bytes, usage.current);
+	usage.current -= bytes;
+	m_totals[w].current -= bytes;
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void
+MemoryRegistry::freed_all(Location where, const char *purpose)
+{
+	const Where w(thread_owner(), where);
+
+	pthread_mutex_lock(&m_mutex);
+	map<Tag, Usage>::iterator tag(m_tags.begin());
+	for (; tag != m_tags.end(); ++tag) {
+		if (tag->first.first != w || (purpose && tag->first.second.first != purpose))
+			continue;
+		m_totals[w].current -= tag->second.current;
+		tag->second.current = 0;
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+size_t
+MemoryRegistry::peak(int owner, Location where) const
+{
+	pthread_mutex_lock(&m_mutex);
+	map<Where, Usage>::const_iterator found = m_totals.find(Where(owner, where));
+	const size_t ret = (found == m_totals.end() ? 0 : found->second.peak);
+	pthread_mutex_unlock(&m_mutex);
+	return ret;
+}
+
+// sort tags within the same owner and location by decreasing peak
+struct by_peak {
+	bool operator()(pair<const pair<pair<int, int>, pair<string, string> >*, size_t> const& a,
+		pair<const pair<pair<int, int>, pair<string, string> >*, size_t> const& b) const
+	{
+		if (a.first->first != b.first->first)
+			return a.first->first < b.first->first;
+		return a.second > b.second;
+	}
+};
+
+void
+MemoryRegistry::print_summary(FILE *out) const
+{
+	pthread_mutex_lock(&m_mutex);
+
+	typedef pair<const Tag*, size_t> entry;
+	vector<entry> entries;
+	map<Tag, Usage>::const_iterator tag(m_tags.begin());
+	for (; tag != m_tags.end(); ++tag)
+		entries.push_back(entry(&tag->first, tag->second.peak));
+	sort(entries.begin(), entries.end(), by_peak());
+
+	fprintf(out, "Memory usage:\n");
+	fprintf(out, "  %-10s %-7s %-20s %-24s %8s %12s %12s\n",
+		"owner", "where", "purpose", "name", "allocs", "current", "peak");
+
+	Where last(PROCESS_OWNER - 1, 0);
+	for (size_t e = 0; e < entries.size(); ++e) {
+		Tag const& t = *entries[e].first;
+		Usage const& usage = m_tags.find(t)->second;
+		if (t.first != last) {
+			Usage const& total = m_totals.find(t.first)->second;
+			fprintf(out, "  %-10s %-7s %-20s %-24s %8lu %12s %12s\n",
+				owner_string(t.first.first).c_str(), LocationName[t.first.second],
+				"TOTAL", "", total.count,
+				GlobalData::memString(total.current).c_str(), GlobalData::memString(total.peak).c_str());
+			last = t.first;
+		}
+		fprintf(out, "  %-10s %-7s %-20s %-24s %8lu %12s %12s\n", "", "",
+			t.second.first.c_str(), t.second.second.c_str(), usage.count,
+			GlobalData::memString(usage.current).c_str(), GlobalData::memString(usage.peak).c_str());
+	}
+
+	pthread_mutex_unlock(&m_mutex);
+}
+
+void
+MemoryRegistry::write_csv(string const& fname) const
+{
+	ofstream out(fname.c_str());
+	if (!out) {
+		cerr << "WARNING: cannot save memory usage to " << fname << endl;
+		return;
+	}
+
+	pthread_mutex_lock(&m_mutex);
+	out << "owner,location,purpose,name,allocs,current,peak\n";
+	map<Where, Usage>::const_iterator total(m_totals.begin());
+	for (; total != m_totals.end(); ++total)
+		out << total->first.first << "," << LocationName[total->first.second] << ",TOTAL,," <<
+			total->second.count << "," << total->second.current << "," << total->second.peak << "\n";
+	map<Tag, Usage>::const_iterator tag(m_tags.begin());
+	for (; tag != m_tags.end(); ++tag)
+		out << tag->first.first.first << "," << LocationName[tag->first.first.second] << "," <<
+			tag->first.second.first << "," << tag->first.second.second << "," <<
+			tag->second.count << "," << tag->second.current << "," << tag->second.peak << "\n";
+	pthread_mutex_unlock(&m_mutex);
+}
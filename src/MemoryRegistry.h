@@ -0,0 +1,115 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _MEMORYREGISTRY_H
+#define _MEMORYREGISTRY_H
+
+#include <string>
+#include <map>
+#include <cstdio>
+
+#include <pthread.h>
+
+/*! Accounting of the host and device memory allocated by the simulation.
+ *
+ * Each allocation is tagged with its location (host, pinned host or device),
+ * an owner (the device index of the worker thread that made it, or the
+ * process itself for the main thread), a purpose (e.g. "particle buffer",
+ * "transfer staging") and a name (e.g. the BufferTraits name of a buffer).
+ * Current and peak usage are tracked for each tag, as well as the peak of the
+ * total per owner and location, so that we can see which buffers dominate,
+ * and how close to the limits the simulation got.
+ *
+ * The owner is set per thread with set_thread_owner(), so that allocations
+ * happening deep in the code (e.g. temporary storage of a sort) are
+ * attributed to the right device.
+ */
+class MemoryRegistry
+{
+public:
+	enum Location {
+		HOST_MEMORY,
+		PINNED_MEMORY,
+		DEVICE_MEMORY,
+		NUM_LOCATIONS
+	};
+
+	static const char *LocationName[NUM_LOCATIONS];
+
+	// owner of the allocations made by the main thread
+	static const int PROCESS_OWNER = -1;
+
+private:
+	struct Usage {
+		unsigned long	count; // number of allocations so far
+		size_t			current;
+		size_t			peak;
+		Usage() : count(0), current(0), peak(0) {}
+	};
+
+	// owner, location
+	typedef std::pair<int, int> Where;
+	// where, purpose, name
+	typedef std::pair<Where, std::pair<std::string, std::string> > Tag;
+
+	std::map<Tag, Usage>	m_tags;
+	std::map<Where, Usage>	m_totals;
+
+	mutable pthread_mutex_t	m_mutex;
+	pthread_key_t			m_owner_key;
+
+	MemoryRegistry();
+	~MemoryRegistry();
+
+	// disallow copies
+	MemoryRegistry(MemoryRegistry const&);
+	MemoryRegistry& operator=(MemoryRegistry const&);
+
+public:
+	static MemoryRegistry& instance();
+
+	// set the owner of the allocations of the calling thread
+	void set_thread_owner(int owner);
+	int thread_owner() const;
+
+	// record an allocation or deallocation of the given number of bytes
+	void allocated(Location where, const char *purpose, const char *name, size_t bytes);
+	void freed(Location where, const char *purpose, const char *name, size_t bytes);
+
+	// record the deallocation of everything with the given purpose
+	// (any purpose if NULL) allocated by the calling thread at the given location
+	void freed_all(Location where, const char *purpose=NULL);
+
+	// peak total usage of an owner at a location
+	size_t peak(int owner, Location where) const;
+
+	// breakdown table, sorted by owner, location and peak usage
+	void print_summary(FILE *out) const;
+
+	// save the breakdown as CSV
+	void write_csv(std::string const& fname) const;
+};
+
+#endif
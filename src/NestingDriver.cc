@@ -0,0 +1,171 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <stdexcept>
+#include <iostream>
+
+#include "NestingDriver.h"
+
+using namespace std;
+
+NestingDriver::NestingDriver(string const& probes_fname, double3 const& shift, double time_offset) :
+	m_fname(probes_fname),
+	m_in(probes_fname.c_str()),
+	m_shift(shift),
+	m_time_offset(time_offset),
+	m_columns(0),
+	m_alpha_col(0),
+	m_t0(NAN), m_t1(NAN),
+	m_eof(false)
+{
+	if (!m_in)
+		throw runtime_error("Cannot open nesting data file " + m_fname);
+
+	string line;
+
+	// first line: probe positions
+	getline(m_in, line);
+	if (line.empty() || line[0] != '#')
+		throw runtime_error("Nesting data file " + m_fname + " has no probe positions");
+	{
+		istringstream positions(line.substr(1));
+		double3 pos;
+		while (positions >> pos.x >> pos.y >> pos.z) {
+			pos += m_shift;
+			m_samplePos.push_back(make_float4(pos.x, pos.y, pos.z, 0.0f));
+		}
+	}
+	const size_t nprobes = m_samplePos.size();
+	if (!nprobes)
+		throw runtime_error("Nesting data file " + m_fname + " has no probes");
+
+	// second line: column names; P, Vx, Vy, Vz, Alpha (and Tke, Eps with k-epsilon) per probe
+	getline(m_in, line);
+	{
+		istringstream header(line);
+		string col;
+		size_t ncols = 0;
+		while (header >> col) {
+			if (col == "Alpha0")
+				m_alpha_col = ncols - 1;
+			++ncols;
+		}
+		if (ncols < 1 || (ncols - 1) % nprobes) {
+			ostringstream err;
+			err << "Nesting data file " << m_fname << " has " << ncols << " columns for " << nprobes << " probes";
+			throw runtime_error(err.str());
+		}
+		m_columns = (ncols - 1)/nprobes;
+		if (!m_alpha_col)
+			throw runtime_error("Nesting data file " + m_fname + " has no Shepard sums (Alpha columns)");
+	}
+
+	m_rec0.resize(nprobes);
+	m_rec1.resize(nprobes);
+	m_alpha0.resize(nprobes);
+	m_alpha1.resize(nprobes);
+	m_sampleVal.resize(nprobes, make_float4(0.0f));
+
+	if (!read_record(m_t0, m_rec0, m_alpha0) || !read_record(m_t1, m_rec1, m_alpha1))
+		throw runtime_error("Nesting data file " + m_fname + " has less than two records");
+
+	cout << "Nesting: " << nprobes << " coarse probes from " << m_fname <<
+		", coarse time " << m_t0 << " onwards" << endl;
+}
+
+bool
+NestingDriver::read_record(double &t, vector<double4> &rec, vector<double> &alpha)
+{
+	string line;
+	if (!getline(m_in, line))
+		return false;
+
+	istringstream values(line);
+	values >> t;
+	for (size_t p = 0; p < rec.size(); ++p) {
+		double4 &v = rec[p];
+		values >> v.w >> v.x >> v.y >> v.z;
+		// skip the columns we don't use
+		double col;
+		for (uint c = 4; c < m_columns; ++c) {
+			values >> col;
+			if (c == m_alpha_col)
+				alpha[p] = col;
+		}
+	}
+	if (!values) {
+		cerr << "WARNING: truncated record in nesting data file " << m_fname << endl;
+		return false;
+	}
+	return true;
+}
+
+void
+NestingDriver::update(double t)
+{
+	const double ct = t + m_time_offset;
+
+	// stream in records until [m_t0, m_t1] contains the current time
+	while (ct > m_t1 && !m_eof) {
+		double next_t;
+		vector<double4> next(m_rec1.size());
+		vector<double> next_alpha(m_alpha1.size());
+		if (!read_record(next_t, next, next_alpha)) {
+			m_eof = true;
+			cerr << "WARNING: nesting data ends at coarse time " << m_t1 <<
+				", holding the last values" << endl;
+			break;
+		}
+		m_t0 = m_t1;
+		m_rec0.swap(m_rec1);
+		m_t1 = next_t;
+		m_rec1.swap(next);
+		m_alpha0.swap(m_alpha1);
+		m_alpha1.swap(next_alpha);
+	}
+
+	double alpha = (ct - m_t0)/(m_t1 - m_t0);
+	if (alpha < 0) alpha = 0;
+	if (alpha > 1) alpha = 1;
+
+	for (size_t p = 0; p < m_samplePos.size(); ++p) {
+		const double4 &v0 = m_rec0[p];
+		const double4 &v1 = m_rec1[p];
+		const bool dry0 = m_alpha0[p] < NESTING_DRY_ALPHA;
+		const bool dry1 = m_alpha1[p] < NESTING_DRY_ALPHA;
+		double4 v;
+		if (dry0 && dry1)
+			v = make_double4(0.0);
+		else if (dry0)
+			v = v1;
+		else if (dry1)
+			v = v0;
+		else
+			v = v0 + (v1 - v0)*alpha;
+		m_samplePos[p].w = (dry0 && dry1) ? 0.0f : 1.0f;
+		m_sampleVal[p] = make_float4(v.x, v.y, v.z, v.w);
+	}
+}
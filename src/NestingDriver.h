@@ -0,0 +1,98 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _NESTINGDRIVER_H
+#define _NESTINGDRIVER_H
+
+#include <string>
+#include <vector>
+#include <fstream>
+
+#include "vector_math.h"
+
+/*! One-way nesting: the open boundaries of a (fine) simulation are driven
+ * by the velocity and pressure recorded by a (coarse) simulation at its
+ * probes (see Problem::add_probe).
+ *
+ * The probes file of the coarse run is streamed during the simulation,
+ * keeping only the two records that bracket the current time; values are
+ * interpolated linearly in time here, and in space (inverse distance weighting)
+ * on the device, for each open boundary vertex.
+ * Probes that were dry in the coarse run (Shepard sum of the kernel below
+ * NESTING_DRY_ALPHA) are skipped.
+ * Every open boundary vertex scans all the probes, so this is meant for a
+ * few hundred probes around the fine domain.
+ */
+/* The Shepard sum of a probe is about 1 inside the fluid, and about 1/2
+ * at the free surface: below that, the probe is mostly out of the fluid
+ * and its (normalized) values come from a handful of particles */
+#define NESTING_DRY_ALPHA 0.5
+
+class NestingDriver
+{
+	std::string			m_fname;
+	std::ifstream		m_in;
+
+	// shift from the coarse to the fine reference frame
+	double3				m_shift;
+	// coarse time corresponding to the start of the fine simulation
+	double				m_time_offset;
+
+	// number of columns per probe in the probes file
+	uint				m_columns;
+	// column (per probe) of the Shepard sum
+	uint				m_alpha_col;
+
+	// records bracketing the current time (velocity, pressure), and Shepard sums
+	double				m_t0, m_t1;
+	std::vector<double4>	m_rec0, m_rec1;
+	std::vector<double>	m_alpha0, m_alpha1;
+	bool				m_eof;
+
+	// positions (in the fine frame) and validity, values at the current time
+	std::vector<float4>	m_samplePos;
+	std::vector<float4>	m_sampleVal;
+
+	bool read_record(double &t, std::vector<double4> &rec, std::vector<double> &alpha);
+
+public:
+	NestingDriver(std::string const& probes_fname, double3 const& shift, double time_offset);
+
+	// load and interpolate the coarse data for the given (fine) simulation time
+	void update(double t);
+
+	uint get_num_samples() const
+	{ return m_samplePos.size(); }
+
+	// sample positions: .w is 0 for probes that are dry at the current time
+	const float4 *get_sample_pos() const
+	{ return &m_samplePos[0]; }
+
+	// sample values: velocity and pressure
+	const float4 *get_sample_val() const
+	{ return &m_sampleVal[0]; }
+};
+
+#endif
@@ -14,12 +14,16 @@
 #define NO_MPI_ERR throw runtime_error("MPI support not compiled in")
 #endif
 
+#include <algorithm>
+
 #include "NetworkManager.h"
 // for GlobalData::RANK()
 #include <GlobalData.h>
 
 #if USE_MPI
-static MPI_Request* m_requestsList;
+static MPI_Request* m_requestsList[MAX_DEVICES_PER_NODE];
+// request for the (single) pending asynchronous reduction
+static MPI_Request m_reductionRequest = MPI_REQUEST_NULL;
 #endif
 
 using namespace std;
@@ -38,12 +42,16 @@ NetworkManager::NetworkManager() {
 	process_rank = -1; // -1 until initialization is done
 	processor_name_len = 0;
 
+	thread_level = 0;
+
 	// MPIRequests for asynchronous calls
-	m_numRequests = 0;
-	m_requestsCounter = 0;
+	for (uint d = 0; d < MAX_DEVICES_PER_NODE; d++) {
+		m_numRequests[d] = 0;
+		m_requestsCounter[d] = 0;
 #if USE_MPI
-	m_requestsList = NULL;
+		m_requestsList[d] = NULL;
 #endif
+	}
 }
 
 NetworkManager::~NetworkManager() {
@@ -51,19 +59,21 @@ NetworkManager::~NetworkManager() {
 	// TODO Auto-generated destructor stub
 	// TODO: finalize if not done yet
 	// MPIRequests for asynchronous calls
-	if (m_requestsList)
-		free(m_requestsList);
+	for (uint d = 0; d < MAX_DEVICES_PER_NODE; d++)
+		if (m_requestsList[d])
+			free(m_requestsList[d]);
 #endif
 	delete[] processor_name;
 	processor_name = NULL;
 	processor_name_len = 0;
 }
 
-void NetworkManager::setNumRequests(uint _numRequests)
+void NetworkManager::setNumRequests(unsigned char localDevIdx, uint _numRequests)
 {
-	m_numRequests = _numRequests;
+	m_numRequests[localDevIdx] = _numRequests;
 #if USE_MPI
-	m_requestsList = (MPI_Request*)realloc(m_requestsList, m_numRequests * sizeof(MPI_Request));
+	m_requestsList[localDevIdx] = (MPI_Request*)realloc(m_requestsList[localDevIdx],
+		_numRequests * sizeof(MPI_Request));
 #endif
 }
 
@@ -73,6 +83,7 @@ void NetworkManager::initNetwork() {
 #if USE_MPI
 	int result;
 	MPI_Init_thread(NULL, NULL, MPI_THREAD_MULTIPLE, &result);
+	thread_level = result;
 	if (result < MPI_THREAD_MULTIPLE) {
 		printf("NetworkManager: no complete thread safety, current level: %d\n", result);
 		// MPI_Abort(MPI_COMM_WORLD, 1);
@@ -111,6 +122,14 @@ char* NetworkManager::getProcessorName() {
 	return processor_name;
 }
 
+bool NetworkManager::isThreadMultiple() {
+#if USE_MPI
+	return thread_level >= MPI_THREAD_MULTIPLE;
+#else
+	return true;
+#endif
+}
+
 // print world size,process name and rank
 void NetworkManager::printInfo()
 {
@@ -181,7 +200,8 @@ void NetworkManager::sendBuffer(unsigned char src_globalDevIdx, unsigned char ds
 #endif
 }
 
-void NetworkManager::receiveBuffer(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *dst_data)
+void NetworkManager::receiveBuffer(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *dst_data,
+	bool exact_count)
 {
 #if USE_MPI
 	unsigned int tag = ((unsigned int)src_globalDevIdx << 8) | dst_globalDevIdx;
@@ -202,7 +222,7 @@ void NetworkManager::receiveBuffer(unsigned char src_globalDevIdx, unsigned char
 	if (mpi_err != MPI_SUCCESS)
 		printf("WARNING: MPI_Get_count returned error %d\n", mpi_err);
 	else
-	if (actual_count != count)
+	if (exact_count && actual_count != count)
 		printf("WARNING: MPI_Get_count returned %d (bytes), expected %u\n", actual_count, count);
 #else
 	NO_MPI_ERR;
@@ -219,12 +239,14 @@ void NetworkManager::sendBufferAsync(unsigned char src_globalDevIdx, unsigned ch
 	printf("  ---- MPI BUFFER ASYNC src %u dst %u cnt %u tag %u\n", src_globalDevIdx, dst_globalDevIdx, count, tag);
 	#endif
 
-	if (m_requestsCounter == (m_numRequests-1))
+	const uchar dev = GlobalData::DEVICE(src_globalDevIdx);
+
+	if (m_requestsCounter[dev] == (m_numRequests[dev]-1))
 		printf("WARNING: NetworkManager: %u was set as max number of requests, ignoring SEND!\n",
-			m_numRequests);
+			m_numRequests[dev]);
 	else
 		mpi_err = MPI_Isend(src_data, count, MPI_BYTE, GlobalData::RANK(dst_globalDevIdx), tag, MPI_COMM_WORLD,
-			&m_requestsList[m_requestsCounter++]);
+			&m_requestsList[dev][m_requestsCounter[dev]++]);
 
 	if (mpi_err != MPI_SUCCESS)
 		printf("WARNING: MPI_ISend returned error %d\n", mpi_err);
@@ -243,12 +265,14 @@ void NetworkManager::receiveBufferAsync(unsigned char src_globalDevIdx, unsigned
 	printf("  ---- MPI BUFFER ASYNC src %u dst %u cnt %u tag %u\n", src_globalDevIdx, dst_globalDevIdx, count, tag);
 	#endif
 
-	if (m_requestsCounter == (m_numRequests-1))
+	const uchar dev = GlobalData::DEVICE(dst_globalDevIdx);
+
+	if (m_requestsCounter[dev] == (m_numRequests[dev]-1))
 		printf("WARNING: NetworkManager: %u was set as max number of requests, ignoring RECV!\n",
-			m_numRequests);
+			m_numRequests[dev]);
 	else
 		mpi_err = MPI_Irecv(dst_data, count, MPI_BYTE, GlobalData::RANK(src_globalDevIdx), tag, MPI_COMM_WORLD,
-		&m_requestsList[m_requestsCounter++]);
+		&m_requestsList[dev][m_requestsCounter[dev]++]);
 
 	if (mpi_err != MPI_SUCCESS)
 		printf("WARNING: MPI_IRecv returned error %d\n", mpi_err);
@@ -265,11 +289,12 @@ void NetworkManager::receiveBufferAsync(unsigned char src_globalDevIdx, unsigned
 #endif
 }
 
-void NetworkManager::waitAsyncTransfers()
+void NetworkManager::waitAsyncTransfers(unsigned char localDevIdx)
 {
 #if USE_MPI
-	if (m_requestsCounter > 0)
-		MPI_Waitall(m_requestsCounter, m_requestsList, MPI_STATUSES_IGNORE);
+	uint &counter = m_requestsCounter[localDevIdx];
+	if (counter > 0)
+		MPI_Waitall(counter, m_requestsList[localDevIdx], MPI_STATUSES_IGNORE);
 
 	// if one needs to check statuses one by one:
 	/*
@@ -287,7 +312,7 @@ void NetworkManager::waitAsyncTransfers()
 		// status can be reset on the sender's side if successful
 	}
 	*/
-	m_requestsCounter = 0;
+	counter = 0;
 #else
 	NO_MPI_ERR;
 #endif
@@ -442,6 +467,49 @@ void NetworkManager::networkIntReduction(int *buffer, const unsigned int bufferE
 #endif
 }
 
+void NetworkManager::networkIntReductionAsync(int *buffer, const unsigned int bufferElements, ReductionType rtype)
+{
+#if USE_MPI
+	MPI_Op _operator;
+	switch (rtype) {
+		case MIN_REDUCTION:
+			_operator = MPI_MIN;
+			break;
+		case MAX_REDUCTION:
+			_operator = MPI_MAX;
+			break;
+		case SUM_REDUCTION:
+			_operator = MPI_SUM;
+			break;
+		default:
+			_operator = MPI_SUM;
+			printf("WARNING: Wrong operator in networkIntReductionAsync specified. Defaulting to SUM_REDUCTION.\n");
+	}
+
+	// complete any previous reduction, we only track one at a time
+	waitAsyncReduction();
+
+	int mpi_err = MPI_Iallreduce(MPI_IN_PLACE, buffer, bufferElements, MPI_INTEGER, _operator, MPI_COMM_WORLD,
+		&m_reductionRequest);
+
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Iallreduce returned error %d\n", mpi_err);
+#else
+	NO_MPI_ERR;
+#endif
+}
+
+void NetworkManager::waitAsyncReduction()
+{
+#if USE_MPI
+	// no-op if no reduction is pending (MPI_REQUEST_NULL)
+	int mpi_err = MPI_Wait(&m_reductionRequest, MPI_STATUS_IGNORE);
+
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Wait returned error %d\n", mpi_err);
+#endif
+}
+
 void NetworkManager::networkBoolReduction(bool *buffer, const unsigned int bufferElements)
 {
 #if USE_MPI
@@ -482,6 +550,135 @@ void NetworkManager::networkBarrier()
 	MPI_Barrier(MPI_COMM_WORLD);
 #endif
 }
+
+#if USE_MPI
+// byte buffers are transferred in chunks, since MPI counts are ints
+static const unsigned long BYTES_CHUNK = 1UL << 30;
+// tag for rank-to-rank byte buffers; device-to-device tags are 16-bit
+static const int BYTES_TAG = 1 << 16;
+// tag for the asynchronous byte buffers, so that they never match the
+// ones of exchangeBytes between the same ranks
+static const int BYTES_ASYNC_TAG = BYTES_TAG + (1 << 8) - 1;
+// requests (and size) of the pending asynchronous byte buffer send: these
+// are process-wide (MPI types can't appear in the header), so there can be
+// only one pending sendBytesAsync per process, see NetworkManager.h
+static vector<MPI_Request> bytesRequests;
+static unsigned long bytesSize = 0;
+#endif
+
+void NetworkManager::exchangeBytes(std::vector<char> const& send_data, int dst_rank,
+	std::vector<char> &recv_data, int src_rank)
+{
+#if USE_MPI
+	unsigned long send_size = send_data.size();
+	unsigned long recv_size = 0;
+	MPI_Status status;
+
+	int mpi_err = MPI_Sendrecv(&send_size, 1, MPI_UNSIGNED_LONG, dst_rank, BYTES_TAG,
+		&recv_size, 1, MPI_UNSIGNED_LONG, src_rank, BYTES_TAG, MPI_COMM_WORLD, &status);
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Sendrecv returned error %d\n", mpi_err);
+
+	recv_data.resize(recv_size);
+
+	for (unsigned long ofs = 0; ofs < send_size || ofs < recv_size; ofs += BYTES_CHUNK) {
+		const int send_count = ofs < send_size ? min(BYTES_CHUNK, send_size - ofs) : 0;
+		const int recv_count = ofs < recv_size ? min(BYTES_CHUNK, recv_size - ofs) : 0;
+		mpi_err = MPI_Sendrecv(
+			send_count ? (void*)(&send_data[ofs]) : NULL, send_count, MPI_BYTE, dst_rank, BYTES_TAG,
+			recv_count ? &recv_data[ofs] : NULL, recv_count, MPI_BYTE, src_rank, BYTES_TAG,
+			MPI_COMM_WORLD, &status);
+		if (mpi_err != MPI_SUCCESS)
+			printf("WARNING: MPI_Sendrecv returned error %d\n", mpi_err);
+	}
+#else
+	NO_MPI_ERR;
+#endif
+}
+
+void NetworkManager::broadcastBytes(std::vector<char> &data, int root_rank)
+{
+#if USE_MPI
+	unsigned long size = data.size();
+	int mpi_err = MPI_Bcast(&size, 1, MPI_UNSIGNED_LONG, root_rank, MPI_COMM_WORLD);
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Bcast returned error %d\n", mpi_err);
+
+	data.resize(size);
+
+	for (unsigned long ofs = 0; ofs < size; ofs += BYTES_CHUNK) {
+		const int count = min(BYTES_CHUNK, size - ofs);
+		mpi_err = MPI_Bcast(&data[ofs], count, MPI_BYTE, root_rank, MPI_COMM_WORLD);
+		if (mpi_err != MPI_SUCCESS)
+			printf("WARNING: MPI_Bcast returned error %d\n", mpi_err);
+	}
+#else
+	NO_MPI_ERR;
+#endif
+}
+void NetworkManager::sendBytesAsync(std::vector<char> const& data, int dst_rank)
+{
+#if USE_MPI
+	// complete the previous send, we only track one at a time
+	waitAsyncBytes();
+
+	bytesSize = data.size();
+	bytesRequests.push_back(MPI_REQUEST_NULL);
+	int mpi_err = MPI_Isend(&bytesSize, 1, MPI_UNSIGNED_LONG, dst_rank, BYTES_ASYNC_TAG,
+		MPI_COMM_WORLD, &bytesRequests.back());
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Isend returned error %d\n", mpi_err);
+
+	for (unsigned long ofs = 0; ofs < bytesSize; ofs += BYTES_CHUNK) {
+		const int count = min(BYTES_CHUNK, bytesSize - ofs);
+		bytesRequests.push_back(MPI_REQUEST_NULL);
+		mpi_err = MPI_Isend((void*)(&data[ofs]), count, MPI_BYTE, dst_rank, BYTES_ASYNC_TAG,
+			MPI_COMM_WORLD, &bytesRequests.back());
+		if (mpi_err != MPI_SUCCESS)
+			printf("WARNING: MPI_Isend returned error %d\n", mpi_err);
+	}
+#else
+	NO_MPI_ERR;
+#endif
+}
+
+void NetworkManager::waitAsyncBytes()
+{
+#if USE_MPI
+	if (bytesRequests.empty())
+		return;
+
+	int mpi_err = MPI_Waitall(bytesRequests.size(), &bytesRequests[0], MPI_STATUSES_IGNORE);
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Waitall returned error %d\n", mpi_err);
+
+	bytesRequests.clear();
+#endif
+}
+
+void NetworkManager::receiveBytes(std::vector<char> &data, int src_rank)
+{
+#if USE_MPI
+	unsigned long size = 0;
+	int mpi_err = MPI_Recv(&size, 1, MPI_UNSIGNED_LONG, src_rank, BYTES_ASYNC_TAG,
+		MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+	if (mpi_err != MPI_SUCCESS)
+		printf("WARNING: MPI_Recv returned error %d\n", mpi_err);
+
+	data.resize(size);
+
+	for (unsigned long ofs = 0; ofs < size; ofs += BYTES_CHUNK) {
+		const int count = min(BYTES_CHUNK, size - ofs);
+		mpi_err = MPI_Recv(&data[ofs], count, MPI_BYTE, src_rank, BYTES_ASYNC_TAG,
+			MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+		if (mpi_err != MPI_SUCCESS)
+			printf("WARNING: MPI_Recv returned error %d\n", mpi_err);
+	}
+#else
+	NO_MPI_ERR;
+#endif
+}
+
 #ifdef DBG_PRINTF
 #undef DBG_PRINTF
 #endif
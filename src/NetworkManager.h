@@ -8,6 +8,10 @@
 #ifndef NETWORKMANAGER_H_
 #define NETWORKMANAGER_H_
 
+#include <vector>
+
+#include "multi_gpu_defines.h"
+
 typedef unsigned int uint;
 
 enum ReductionType
@@ -25,8 +29,13 @@ private:
 	char *processor_name;
 	int processor_name_len;
 
-	uint m_numRequests;
-	uint m_requestsCounter;
+	// thread support level provided by the MPI library
+	int thread_level;
+
+	// asynchronous transfers are tracked separately for each device of the
+	// process, so that the workers can issue and wait for them concurrently
+	uint m_numRequests[MAX_DEVICES_PER_NODE];
+	uint m_requestsCounter[MAX_DEVICES_PER_NODE];
 public:
 	NetworkManager();
 	~NetworkManager();
@@ -35,17 +44,24 @@ public:
 	int getWorldSize();
 	int getProcessRank();
 	char* getProcessorName();
+	// can the MPI library be called concurrently from multiple threads?
+	bool isThreadMultiple();
 	// print world size,process name and rank
 	void printInfo();
 	// methods to exchange data
 	void sendUint(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int *datum);
 	void receiveUint(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int *datum);
 	void sendBuffer(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *src_data);
-	void receiveBuffer(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *src_data);
-	void setNumRequests(uint _numRequests);
+	// with exact_count false, count is only the largest size the message can have
+	void receiveBuffer(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *src_data,
+		bool exact_count = true);
+	// asynchronous transfers: the requests are associated with the device (of this
+	// process) sending or receiving, and waitAsyncTransfers() only waits for the
+	// ones of the given device
+	void setNumRequests(unsigned char localDevIdx, uint _numRequests);
 	void sendBufferAsync(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *src_data, uint bid);
 	void receiveBufferAsync(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, void *src_data, uint bid);
-	void waitAsyncTransfers();
+	void waitAsyncTransfers(unsigned char localDevIdx);
 #if 0
 	void sendUints(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, unsigned int *src_data);
 	void receiveUints(unsigned char src_globalDevIdx, unsigned char dst_globalDevIdx, unsigned int count, unsigned int *dst_data);
@@ -58,12 +74,33 @@ public:
 	void networkBoolReduction(bool *buffer, const unsigned int bufferElements);
 	// network reduction on int buffer across the network
 	void networkIntReduction(int *buffer, const unsigned int bufferElements, ReductionType rtype);
+	// non-blocking network reduction on int buffer across the network; the buffer
+	// must not be accessed until waitAsyncReduction() returns. At most one
+	// asynchronous reduction can be pending at any time
+	void networkIntReductionAsync(int *buffer, const unsigned int bufferElements, ReductionType rtype);
+	void waitAsyncReduction();
 	// network reduction on float buffer across the network
 	void networkFloatReduction(float *buffer, const unsigned int bufferElements, ReductionType rtype);
 	// send one int, gather the int from all nodes (allgather)
 	void allGatherUints(unsigned int *datum, unsigned int *recv_buffer);
 	// synchronization barrier among all the nodes of the network
 	void networkBarrier();
+	// send a byte buffer of arbitrary size to rank dst_rank while receiving
+	// (and resizing to fit) the one sent by rank src_rank
+	void exchangeBytes(std::vector<char> const& send_data, int dst_rank,
+		std::vector<char> &recv_data, int src_rank);
+	// broadcast a byte buffer of arbitrary size from rank root_rank
+	// (the buffer is resized to fit on the other ranks)
+	void broadcastBytes(std::vector<char> &data, int root_rank);
+	// start sending a byte buffer of arbitrary size to rank dst_rank, without
+	// waiting for it to be received; the buffer must not be touched until
+	// waitAsyncBytes() returns. Only one such send can be pending in the whole
+	// process (not per device or per NetworkManager): a new one first waits for
+	// the previous one to complete
+	void sendBytesAsync(std::vector<char> const& data, int dst_rank);
+	void waitAsyncBytes();
+	// receive (and resize to fit) a byte buffer sent by rank src_rank with sendBytesAsync
+	void receiveBytes(std::vector<char> &data, int src_rank);
 };
 
 #endif /* NETWORKMANAGER_H_ */
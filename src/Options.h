@@ -45,43 +45,80 @@ public:
 	// legacy options
 	std::string	problem; // problem name
 	std::string	resume_fname; // file to resume simulation from
+	bool	resume_memory; // resume from the in-memory checkpoints
 	int		device;  // which device to use
 	std::string	dem; // DEM file to use
 	std::string	dir; // directory where data will be saved
+	std::string	stage_dir; // node-local directory where output is staged before being moved to dir
+	double	stage_bwlimit; // bandwidth limit (MB/s) when moving staged output (0: unlimited)
+	double	stage_minfree; // free space (MB) to keep in the staging directory
+	std::string	write_backend; // backend for the large data files: posix or uring (io_uring with O_DIRECT)
+	int		io_aggregators; // number of ranks writing the particle files for the whole job (0: all)
 	double	deltap; // deltap
 	float	tend; // simulation end
 	int		maxiter; // maximum number of iterations to run
 	float	checkpoint_freq; // frequency of hotstart checkpoints (in simulated seconds)
 	int		checkpoints; // number of hotstart checkpoints to keep
+	float	mem_checkpoint_freq; // frequency of in-memory checkpoints (in simulated seconds, 0 disables)
+	std::string	mem_checkpoint_dir; // RAM-backed directory for in-memory checkpoints
 	bool	nosave; // disable saving
 	bool	gpudirect; // enable GPUDirect
 	bool	striping; // enable striping (i.e. compute/transfer overlap)
 	bool	asyncNetworkTransfers; // enable asynchronous network transfers
+	std::string	compress_bursts; // buffers whose network bursts are compressed, as buffer[:mode],... (empty: none)
+	std::string	record_bursts; // directory where the raw network bursts are recorded (empty: disabled)
 	unsigned int num_hosts; // number of physical hosts to which the processes are being assigned
 	bool byslot_scheduling; // by slot scheduling across MPI nodes (not round robin)
 	bool no_leak_warning; // if true, do not warn if #parts decreased in simulations without outlets
+	std::string	host_arena; // allocate the global host buffers from a single region: thp or hugetlb (empty: disabled)
+	bool	host_arena_pin; // pin the host arena for faster transfers
+	bool	perf_counters; // collect hardware performance counters for the host phases
+	bool	no_fused_filters; // always run the Shepard filter as a separate pass
+	double	settle; // length of the damped settling phase before the simulation (0: none)
+	double	settle_tau; // velocity damping time during the settling phase (NAN: settle/10)
 
 	Options(void) :
 		m_options(),
 		problem(),
 		resume_fname(),
+		resume_memory(false),
 		device(-1),
 		dem(),
 		dir(),
+		stage_dir(),
+		stage_bwlimit(0),
+		stage_minfree(1024),
+		write_backend("posix"),
+		io_aggregators(0),
 		deltap(NAN),
 		tend(NAN),
 		maxiter(0),
 		checkpoint_freq(NAN),
 		checkpoints(-1),
+		mem_checkpoint_freq(0),
+		mem_checkpoint_dir("/dev/shm"),
 		nosave(false),
 		gpudirect(false),
 		striping(false),
 		asyncNetworkTransfers(false),
+		compress_bursts(),
+		record_bursts(),
 		num_hosts(0),
 		byslot_scheduling(false),
-		no_leak_warning(false)
+		no_leak_warning(false),
+		host_arena(),
+		host_arena_pin(false),
+		perf_counters(false),
+		no_fused_filters(false),
+		settle(0),
+		settle_tau(NAN)
 	{};
 
+	// are we resuming a previous simulation?
+	bool
+	resuming() const
+	{ return !resume_fname.empty() || resume_memory; }
+
 	// set an arbitrary option
 	// TODO templatize for serialization?
 	void
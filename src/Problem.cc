@@ -35,6 +35,8 @@
 
 // shared_ptr
 #include <memory>
+#include <algorithm>
+#include <map>
 
 #include "Problem.h"
 #include "vector_math.h"
@@ -44,6 +46,8 @@
 // here we need the complete definition of the GlobalData struct
 #include "GlobalData.h"
 
+#include "NestingDriver.h"
+
 // COORD1, COORD2, COORD3
 #include "linearization.h"
 
@@ -67,6 +71,8 @@ Problem::Problem(GlobalData *_gdata) :
 	m_dem(NULL),
 	m_physparams(new PhysParams()),
 	m_simframework(NULL),
+	m_nesting(NULL),
+	m_hydrostaticLevel(MAX_FLUID_TYPES, NAN),
 	m_size(make_double3(NAN, NAN, NAN)),
 	m_origin(make_double3(NAN, NAN, NAN)),
 	m_deltap(NAN),
@@ -108,6 +114,7 @@ Problem::initialize()
 Problem::~Problem(void)
 {
 	delete [] m_bodies_storage;
+	delete m_nesting;
 	delete m_simframework;
 	delete m_physparams;
 }
@@ -684,6 +691,27 @@ Problem::density_for_pressure(float P, int i) const
 }
 
 
+double
+Problem::hydrostatic_density(double depth, int i, double top_pressure) const
+{
+	const double rho0 = physparams()->rho0[i];
+	const double B = physparams()->bcoeff[i];
+	const double gamma = physparams()->gammacoeff[i];
+	const double g = length(physparams()->gravity);
+
+	// density at the surface
+	const double rtop = pow(top_pressure/B + 1, 1/gamma);
+	if (depth <= 0)
+		return rho0*rtop;
+
+	// with P = B((rho/rho0)^gamma - 1), dP/dh = rho g integrates to
+	// (rho/rho0)^(gamma-1) = (rtop)^(gamma-1) + (gamma-1)/gamma rho0 g h/B
+	const double k = rho0*g*depth/B;
+	if (gamma == 1)
+		return rho0*rtop*exp(k);
+	return rho0*pow(pow(rtop, gamma - 1) + (gamma - 1)/gamma*k, 1/(gamma - 1));
+}
+
 float
 Problem::soundspeed(float rho, int i) const
 {
@@ -703,6 +731,74 @@ Problem::add_gage(double3 const& pt)
 	simparams()->gage.push_back(make_double4(pt.x, pt.y, 0., pt.z));
 }
 
+void
+Problem::add_probe(double3 const& pt)
+{
+	simparams()->probes.push_back(pt);
+}
+
+void
+Problem::set_nesting(std::string const& probes_fname, double3 const& shift, double time_offset)
+{
+	if (!(simparams()->simflags & ENABLE_INLET_OUTLET))
+		throw invalid_argument("nesting requires open boundaries (ENABLE_INLET_OUTLET)");
+	delete m_nesting;
+	m_nesting = new NestingDriver(probes_fname, shift, time_offset);
+}
+
+void
+Problem::add_sponge(double3 const& origin, double3 const& normal,
+	double width, double sigma)
+{
+	add_wave_sponge(origin, normal, width, sigma, 0, 0, make_double3(1, 0, 0), 1, 0);
+}
+
+void
+Problem::add_wave_sponge(double3 const& origin, double3 const& normal,
+	double width, double sigma,
+	double wave_height, double period, double3 const& direction,
+	double depth, double swl)
+{
+	if (!(simparams()->simflags & ENABLE_SPONGE))
+		throw invalid_argument("sponge layers require ENABLE_SPONGE");
+	if (!(width > 0) || !(sigma > 0))
+		throw invalid_argument("sponge layers need a positive width and relaxation rate");
+	if (wave_height > 0 && !(period > 0 && depth > 0))
+		throw invalid_argument("wave sponge layers need a positive period and depth");
+
+	sponge_t sponge;
+	sponge.origin = make_float3(origin);
+	sponge.normal = make_float3(normal/length(normal));
+	sponge.width = width;
+	sponge.sigma = sigma;
+	sponge.direction = make_float3(direction/length(direction));
+	sponge.amplitude = wave_height/2;
+	sponge.omega = wave_height > 0 ? 2*M_PI/period : 0;
+	sponge.depth = depth;
+	sponge.swl = swl;
+
+	// wave number from the linear dispersion relation ω² = g k tanh(k d),
+	// by Newton iterations starting from the deep water value
+	double k = 0;
+	if (wave_height > 0) {
+		const double g = length(physparams()->gravity);
+		const double omega2 = sponge.omega*sponge.omega;
+		k = omega2/g;
+		for (int iter = 0; iter < 20; ++iter) {
+			const double th = tanh(k*depth);
+			const double f = g*k*th - omega2;
+			const double df = g*(th + k*depth*(1 - th*th));
+			const double dk = f/df;
+			k -= dk;
+			if (fabs(dk) < 1e-10*k)
+				break;
+		}
+	}
+	sponge.wavenumber = k;
+
+	physparams()->add_sponge(sponge);
+}
+
 plane_t
 Problem::implicit_plane(double4 const& p)
 {
@@ -1200,6 +1296,11 @@ Problem::set_grid_params(void)
 	if (simparams()->boundarytype == SA_BOUNDARY)
 		cellSide += m_deltap/2.0f;
 
+	// with finer cells, the neighbor search stencil spans more cells, so that
+	// it still covers the search radius
+	const uint cellsPerRadius = simparams()->nlcellsperradius;
+	cellSide /= cellsPerRadius;
+
 	m_gridsize.x = (uint)floor(m_size.x / cellSide);
 	m_gridsize.y = (uint)floor(m_size.y / cellSide);
 	m_gridsize.z = (uint)floor(m_size.z / cellSide);
@@ -1225,6 +1326,15 @@ Problem::set_grid_params(void)
 	printf("Domain size\t: (%f, %f, %f)\n", m_size.x, m_size.y, m_size.z);
 	*/
 	printf("Influence radius / neighbor search radius / expected cell side\t: %g / %g / %g\n", influenceRadius, nlInfluenceRadius, cellSide);
+
+	// ratio between the volume scanned by the stencil and the volume of the search sphere:
+	// this is (roughly) the number of distance checks per actual neighbor during the
+	// neighbor list construction, which is what finer cells trade against the
+	// larger number of (smaller) cells to visit
+	const double stencilSide = (2*cellsPerRadius + 1)*cellSide;
+	const double searchVolume = 4*M_PI*nlInfluenceRadius*nlInfluenceRadius*nlInfluenceRadius/3;
+	printf("Neighbor search stencil: %u cells, %g times the search volume\n",
+		simparams()->get_cell_stencil_size(), stencilSide*stencilSide*stencilSide/searchVolume);
 	/*
 	printf("Grid   size\t: (%d, %d, %d)\n", m_gridsize.x, m_gridsize.y, m_gridsize.z);
 	printf("Cell   size\t: (%f, %f, %f)\n", m_cellsize.x, m_cellsize.y, m_cellsize.z);
@@ -1292,6 +1402,157 @@ Problem::calc_localpos_and_hash(const Point& pos, const particleinfo& info, floa
 	localpos.w = float(pos(3));
 }
 
+void
+Problem::set_hydrostatic_level(double level, int fluid)
+{
+	if (fluid >= MAX_FLUID_TYPES)
+		throw out_of_range("hydrostatic level for a non-existent fluid");
+	if (fluid < 0)
+		fill(m_hydrostaticLevel.begin(), m_hydrostaticLevel.end(), level);
+	else
+		m_hydrostaticLevel[fluid] = level;
+}
+
+void
+Problem::init_hydrostatic(BufferList &buffers, uint numParticles)
+{
+	const PhysParams *pp = physparams();
+	const uint numFluids = pp->numFluids();
+
+	// fluids with a free surface, from the highest to the lowest
+	vector<pair<double, int> > levels;
+	for (uint f = 0; f < numFluids; ++f)
+		if (isfinite(m_hydrostaticLevel[f]))
+			levels.push_back(make_pair(m_hydrostaticLevel[f], f));
+	if (levels.empty())
+		return;
+	sort(levels.rbegin(), levels.rend());
+
+	const double g = length(pp->gravity);
+	if (g == 0) {
+		fprintf(stderr, "WARNING: no gravity, skipping the hydrostatic initialization\n");
+		return;
+	}
+	const double3 up = -make_double3(pp->gravity)/g;
+
+	// pressure at the free surface of each fluid: the weight of the fluids above
+	vector<double> top_pressure(numFluids, 0.0);
+	for (size_t k = 1; k < levels.size(); ++k) {
+		const int above = levels[k-1].second;
+		const double rho = hydrostatic_density(levels[k-1].first - levels[k].first,
+			above, top_pressure[above]);
+		top_pressure[levels[k].second] = pp->bcoeff[above]*(pow(rho/pp->rho0[above], pp->gammacoeff[above]) - 1);
+	}
+
+	const float4 *pos = buffers.getData<BUFFER_POS>();
+	const hashKey *hash = buffers.getData<BUFFER_HASH>();
+	const particleinfo *info = buffers.getData<BUFFER_INFO>();
+	float4 *vel = buffers.getData<BUFFER_VEL>();
+
+	const bool dynBoundary = (simparams()->boundarytype == DYN_BOUNDARY);
+	vector<double> maxdepth(numFluids, 0.0);
+
+	for (uint i = 0; i < numParticles; ++i) {
+		const bool fluid = FLUID(info[i]);
+		if (!fluid && !(dynBoundary && BOUNDARY(info[i])))
+			continue;
+		const uint3 gridPos = gdata->calcGridPosFromCellHash(cellHashFromParticleHash(hash[i]));
+		const double height = dot(gdata->calcGlobalPosOffset(gridPos, as_float3(pos[i])) + m_origin, up);
+		const int own = fluid_num(info[i]);
+
+		// the column the particle is in: its own fluid for fluid particles,
+		// the layer at its height for boundary particles
+		int f = -1;
+		if (fluid) {
+			if (isfinite(m_hydrostaticLevel[own]))
+				f = own;
+		} else {
+			for (size_t k = 0; k < levels.size() && levels[k].first >= height; ++k)
+				f = levels[k].second;
+		}
+		if (f < 0)
+			continue;
+
+		const double depth = m_hydrostaticLevel[f] - height;
+		const double rho = hydrostatic_density(depth, f, top_pressure[f]);
+		if (f == own)
+			vel[i].w = rho;
+		else {
+			// same pressure, with the equation of state of the particle
+			const double P = pp->bcoeff[f]*(pow(rho/pp->rho0[f], pp->gammacoeff[f]) - 1);
+			vel[i].w = pp->rho0[own]*pow(P/pp->bcoeff[own] + 1, 1/pp->gammacoeff[own]);
+		}
+		maxdepth[f] = fmax(maxdepth[f], depth);
+	}
+
+	for (size_t k = 0; k < levels.size(); ++k) {
+		const int f = levels[k].second;
+		printf("Hydrostatic initialization: fluid %d, free surface at %g, %g deep, surface pressure %g\n",
+			f, levels[k].first, maxdepth[f], top_pressure[f]);
+	}
+}
+
+double
+Problem::hydrostatic_imbalance(BufferList const& buffers, uint numParticles) const
+{
+	const PhysParams *pp = physparams();
+	const double g = length(pp->gravity);
+	if (g == 0)
+		return 0;
+	const double3 up = -make_double3(pp->gravity)/g;
+	// horizontal directions, to split the fluid in columns
+	const double3 across = normalize(cross(up,
+		fabs(up.x) < 0.9 ? make_double3(1, 0, 0) : make_double3(0, 1, 0)));
+	const double3 across2 = cross(up, across);
+
+	const float4 *pos = buffers.getData<BUFFER_POS>();
+	const hashKey *hash = buffers.getData<BUFFER_HASH>();
+	const particleinfo *info = buffers.getData<BUFFER_INFO>();
+	const float4 *vel = buffers.getData<BUFFER_VEL>();
+
+	// height and density of the particles of the initialized fluids,
+	// by fluid and column (of side deltap)
+	typedef pair<int, pair<long, long> > ColumnKey;
+	typedef vector<pair<double, double> > Column;
+	map<ColumnKey, Column> columns;
+	for (uint i = 0; i < numParticles; ++i) {
+		const int f = fluid_num(info[i]);
+		if (!FLUID(info[i]) || !isfinite(m_hydrostaticLevel[f]))
+			continue;
+		const uint3 gridPos = gdata->calcGridPosFromCellHash(cellHashFromParticleHash(hash[i]));
+		const double3 gpos = gdata->calcGlobalPosOffset(gridPos, as_float3(pos[i])) + m_origin;
+		const ColumnKey key(f, make_pair(lround(dot(gpos, across)/m_deltap), lround(dot(gpos, across2)/m_deltap)));
+		columns[key].push_back(make_pair(dot(gpos, up), double(vel[i].w)));
+	}
+
+	// the pressure difference between each particle and the first one at
+	// least deltap above it must match the weight of the fluid in between
+	double imbalance = 0;
+	for (map<ColumnKey, Column>::iterator c = columns.begin(); c != columns.end(); ++c) {
+		const int f = c->first.first;
+		const double rho0 = pp->rho0[f];
+		const double B = pp->bcoeff[f];
+		const double gamma = pp->gammacoeff[f];
+		Column &column = c->second;
+		sort(column.begin(), column.end());
+
+		size_t above = 0;
+		for (size_t j = 0; j < column.size(); ++j) {
+			while (above < column.size() && column[above].first - column[j].first < m_deltap)
+				++above;
+			if (above == column.size())
+				break;
+			const double dh = column[above].first - column[j].first;
+			const double rho_j = column[j].second;
+			const double rho_above = column[above].second;
+			const double dP = B*(pow(rho_j/rho0, gamma) - pow(rho_above/rho0, gamma));
+			const double weight = 0.5*(rho_j + rho_above)*g*dh;
+			imbalance = fmax(imbalance, fabs(dP - weight)/weight);
+		}
+	}
+	return imbalance;
+}
+
 /* Initialize the particle volumes from their masses and densities. */
 void
 Problem::init_volume(BufferList &buffers, uint numParticles)
@@ -70,6 +70,9 @@ class CallbackWriter;
 // not including GlobalData.h since it needs the complete definition of the Problem class
 struct GlobalData;
 
+// one-way nesting from a coarse simulation, see NestingDriver.h
+class NestingDriver;
+
 class Problem {
 	private:
 		std::string			m_problem_dir;
@@ -82,6 +85,10 @@ class Problem {
 
 		SimFramework		*m_simframework;			// simulation framework
 
+		NestingDriver		*m_nesting;					// coarse data driving the open boundaries (if any)
+
+		std::vector<double>	m_hydrostaticLevel;			// free-surface height of each fluid for the hydrostatic initialization (NAN: none)
+
 		// Set up the simulation framework. This must be done before the rest of the simulation parameters, and it sets
 		// * SPH kernel
 		// * SPH formulation
@@ -180,6 +187,11 @@ class Problem {
 		float density(float, int) const;
 		float density_for_pressure(float, int) const;
 
+		// density at the given depth below the free surface of fluid i, for a fluid
+		// at rest under gravity with the given pressure at its surface; this is the
+		// exact solution of dP/dh = rho g with the equation of state of the fluid
+		double hydrostatic_density(double depth, int i, double top_pressure = 0) const;
+
 		float pressure(float, int) const;
 
 		float soundspeed(float, int) const;
@@ -308,6 +320,51 @@ class Problem {
 		void add_gage(double x, double y, double z=0)
 		{ add_gage(make_double3(x, y, z)); }
 
+		// add an out-of-band test point (probe): velocity, pressure (and k, epsilon)
+		// are interpolated there only when writing. Contrary to testpoints
+		// (PT_TESTPOINT) these are not particles, so they don't cost anything
+		// during the simulation
+		void add_probe(double3 const& pt);
+
+		inline
+		void add_probe(double x, double y, double z)
+		{ add_probe(make_double3(x, y, z)); }
+
+		// Drive the open boundaries with the velocity and pressure recorded at the
+		// probes of a coarser simulation (its data/probes.txt file), instead of
+		// imposeBoundaryConditionHost. The coarse probes should be placed around
+		// the open boundaries of this problem; shift maps coarse coordinates to
+		// ours, and time_offset is the coarse time at which we start
+		void set_nesting(std::string const& probes_fname,
+			double3 const& shift = make_double3(0.0), double time_offset = 0);
+
+		NestingDriver *get_nesting() const
+		{ return m_nesting; }
+
+		// Initialize the density of the particles of the given fluid (all fluids
+		// if negative) to that of a fluid at rest with its free surface at the given
+		// height, measured against gravity. Fluids with a lower free surface lie
+		// under those with a higher one, and bear their weight; dynamic boundary
+		// particles get the density of the pressure at their height.
+		// Applied when the simulation starts (not on resume), see init_hydrostatic
+		void set_hydrostatic_level(double level, int fluid = -1);
+
+		// Add an absorbing (sponge) layer, requires ENABLE_SPONGE. The layer starts
+		// at the plane through origin with the given normal, pointing away from the
+		// fluid, and is width thick; velocities are relaxed to zero in it, at a rate
+		// growing up to sigma (1/s) at its far end. A width of about one wavelength
+		// and sigma of a few wave frequencies are usually enough.
+		void add_sponge(double3 const& origin, double3 const& normal,
+			double width, double sigma);
+
+		// As above, but relax the velocity to that of a linear wave of given height
+		// and period, propagating along direction in water of the given depth,
+		// with still water level swl (waves generated by the layer itself)
+		void add_wave_sponge(double3 const& origin, double3 const& normal,
+			double width, double sigma,
+			double wave_height, double period, double3 const& direction,
+			double depth, double swl);
+
 		/// Define a plane with equation ax + by + cz + d
 		plane_t implicit_plane(double4 const& p);
 
@@ -400,6 +457,16 @@ class Problem {
 							float3 * & trans, float * & steprot,
 							float3 * & linearvel, float3 * & angularvel);
 
+		/* Initialize the particle densities for the hydrostatic levels set by
+		 * set_hydrostatic_level(), if any */
+		virtual void init_hydrostatic(BufferList &, uint numParticles);
+
+		/* Largest relative difference between the pressure difference of pairs
+		 * of fluid particles along gravity, at least deltap apart, and the weight
+		 * of the fluid between them, over the fluids with a hydrostatic level:
+		 * this checks the densities set by init_hydrostatic() */
+		double hydrostatic_imbalance(BufferList const&, uint numParticles) const;
+
 		/* Initialize the particle volumes */
 		virtual void init_volume(BufferList &, uint numParticles);
 
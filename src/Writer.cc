@@ -36,13 +36,19 @@
 #include "UDPWriter.h"
 #include "VTKLegacyWriter.h"
 #include "VTKWriter.h"
+#include "LODWriter.h"
 #include "Writer.h"
 #include "HotWriter.h"
+#include "MemHotWriter.h"
+#include "OutputStager.h"
+#include "FileBackend.h"
 
 using namespace std;
 
 WriterMap Writer::m_writers = WriterMap();
 flag_t Writer::m_write_flags = NO_FLAGS;
+OutputStager *Writer::m_stager = NULL;
+IOAggregator *Writer::m_aggregator = NULL;
 
 static const char* WriterName[] = {
 	"CommonWriter",
@@ -52,7 +58,9 @@ static const char* WriterName[] = {
 	"CallbackWriter",
 	"CustomTextWriter",
 	"UDPWriter",
-	"HotWriter"
+	"HotWriter",
+	"MemHotWriter",
+	"LODWriter"
 };
 
 const char* Writer::Name(WriterType key)
@@ -75,6 +83,15 @@ Writer::Create(GlobalData *_gdata)
 	double avg_freq = 0;
 	int avg_count = 0;
 
+	// I/O aggregation: only some of the ranks write the particle files.
+	// This is set up first, since the writers check it when they are created
+	if (options->io_aggregators > 0 && options->io_aggregators < _gdata->mpi_nodes) {
+		m_aggregator = new IOAggregator(_gdata, options->io_aggregators);
+		if (_gdata->mpi_rank == 0)
+			cout << "Particle files written by " << options->io_aggregators <<
+				" I/O aggregator ranks" << endl;
+	}
+
 	for (; it != end; ++it) {
 		Writer *writer = NULL;
 		WriterType wt = it->first;
@@ -115,6 +132,9 @@ Writer::Create(GlobalData *_gdata)
 			case CALLBACKWRITER:
 				writer = new CallbackWriter(_gdata);
 				break;
+			case LODWRITER:
+				writer = new LODWriter(_gdata);
+				break;
 			default:
 				stringstream ss;
 				ss << "Unknown writer type " << wt;
@@ -199,10 +219,26 @@ Writer::Create(GlobalData *_gdata)
 		}
 	}
 
+	/* In-memory checkpoints are only enabled from the command line */
+	if (options->mem_checkpoint_freq > 0) {
+		MemHotWriter *mhw = new MemHotWriter(_gdata);
+		mhw->set_write_freq(options->mem_checkpoint_freq);
+		m_writers[MEMHOTWRITER] = mhw;
+		cout << "In-memory checkpoints every " << options->mem_checkpoint_freq <<
+			" (simulated) seconds in " << options->mem_checkpoint_dir << endl;
+	}
+
 	// If there is no CommonWriter, create it. It will have the default settings
 	// of writing whenever any other writer writes
 	if (m_writers.find(COMMONWRITER) == m_writers.end())
 		m_writers[COMMONWRITER] = new CommonWriter(_gdata);
+
+	// Two-tier output: numbered data files are written to the (node-local)
+	// staging directory and moved to the output directory in the background
+	if (!options->stage_dir.empty())
+		m_stager = new OutputStager(options->stage_dir,
+			problem->get_dirname() + "/data",
+			options->stage_bwlimit, options->stage_minfree);
 }
 
 ConstWriterMap
@@ -309,6 +345,21 @@ Writer::FakeMarkWritten(ConstWriterMap writers, double t)
  * function.
  */
 
+bool
+Writer::write_particles(Writer *writer, bool aggregate, uint numParts,
+	BufferList const& buffers, uint node_offset, double t, const bool testpoints)
+{
+	if (!(aggregate && writer->m_aggregatable)) {
+		writer->write(numParts, buffers, node_offset, t, testpoints);
+		return true;
+	}
+	if (!m_aggregator->is_aggregator())
+		return false;
+	writer->write(m_aggregator->get_num_parts(), m_aggregator->get_buffers(),
+		0, t, testpoints);
+	return true;
+}
+
 void
 Writer::Write(WriterMap writers, uint numParts, BufferList const& buffers,
 	uint node_offset, double t, const bool testpoints)
@@ -316,6 +367,17 @@ Writer::Write(WriterMap writers, uint numParts, BufferList const& buffers,
 	// is the common writer special?
 	bool common_special = m_writers[COMMONWRITER]->is_special();
 
+	// with I/O aggregation, the particles are gathered to the aggregator
+	// of the group if any of the writers needs them
+	bool aggregate = false;
+	if (m_aggregator) {
+		WriterMap::iterator it(writers.begin());
+		for ( ; it != writers.end() && !aggregate; ++it)
+			aggregate = it->second->m_aggregatable;
+	}
+	if (aggregate)
+		m_aggregator->gather(buffers, node_offset, numParts);
+
 	// save it because it writes last
 	CallbackWriter *cbwriter = NULL;
 
@@ -334,13 +396,12 @@ Writer::Write(WriterMap writers, uint numParts, BufferList const& buffers,
 			continue;
 		}
 
-		it->second->write(numParts, buffers, node_offset, t, testpoints);
-
-		have_written[it->first] = it->second;
+		if (write_particles(it->second, aggregate, numParts, buffers, node_offset, t, testpoints))
+			have_written[it->first] = it->second;
 	}
 
 	if (common_special && !writers.empty())
-		m_writers[COMMONWRITER]->write(numParts, buffers, node_offset, t, testpoints);
+		write_particles(m_writers[COMMONWRITER], aggregate, numParts, buffers, node_offset, t, testpoints);
 
 	if (cbwriter) {
 		cbwriter->set_writers_list(have_written);
@@ -368,6 +429,26 @@ Writer::WriteWaveGage(WriterMap writers, double t, GageList const& gage)
 		m_writers[COMMONWRITER]->write_WaveGage(t, gage);
 }
 
+void
+Writer::WriteProbes(WriterMap writers, double t, ProbeValueList const& values)
+{
+	// is the common writer special?
+	bool common_special = m_writers[COMMONWRITER]->is_special();
+
+	WriterMap::iterator it(writers.begin());
+	WriterMap::iterator end(writers.end());
+	for ( ; it != end; ++it) {
+		// skip COMMONWRITER if special
+		if (common_special && it->first == COMMONWRITER)
+			continue;
+
+		it->second->write_probes(t, values);
+	}
+
+	if (common_special && !writers.empty())
+		m_writers[COMMONWRITER]->write_probes(t, values);
+}
+
 void
 Writer::WriteObjects(WriterMap writers, double t)
 {
@@ -457,6 +538,17 @@ Writer::WriteFlux(WriterMap writers, double t, float* fluxes)
 void
 Writer::Destroy()
 {
+	// flush the staged files first, since the writers are notified
+	// when their files land
+	if (m_stager) {
+		m_stager->finish();
+		delete m_stager;
+		m_stager = NULL;
+	}
+
+	delete m_aggregator;
+	m_aggregator = NULL;
+
 	WriterMap::iterator it(m_writers.begin());
 	WriterMap::iterator end(m_writers.end());
 	for ( ; it != end; ++it) {
@@ -470,10 +562,15 @@ Writer::Destroy()
  *  Default Constructor; makes sure the file output format starts at PART_00000
  */
 Writer::Writer(const GlobalData *_gdata) :
+	m_stageable(true),
+	m_aggregatable(false),
 	m_last_write_time(-1),
 	m_writefreq(0),
 	m_FileCounter(0),
-	gdata(_gdata)
+	m_backend(NULL),
+	gdata(_gdata),
+	m_staged_files(),
+	m_timefile_entries()
 {
 	m_problem = _gdata->problem;
 
@@ -489,7 +586,7 @@ Writer::Writer(const GlobalData *_gdata) :
 
 Writer::~Writer()
 {
-	// hi
+	delete m_backend;
 }
 
 void
@@ -537,15 +634,30 @@ Writer::last_filenum() const {
 	return ss.str();
 }
 
+DeviceCounts
+Writer::device_counts() const
+{
+	if (m_aggregator && m_aggregatable)
+		return m_aggregator->get_devices();
+
+	DeviceCounts devices;
+	for (uint d = 0; d < gdata->devices; d++)
+		// compute the global device ID for each device
+		devices.push_back(make_pair(gdata->GLOBAL_DEVICE_ID(gdata->mpi_rank, d),
+			gdata->s_hPartsPerDevice[d]));
+	return devices;
+}
+
 uint Writer::getFilenum() const
 {
 	return m_FileCounter;
 }
 
 string
-Writer::open_data_file(ofstream &out, const char* base, string const& num, string const& sfx)
+Writer::data_file_path(const char* base, string const& num, string const& sfx,
+	string &filename)
 {
-	string filename(base), full_filename;
+	filename = base;
 
 	if (gdata && gdata->mpi_nodes > 1)
 		filename += "_n" + gdata->rankString();
@@ -555,7 +667,19 @@ Writer::open_data_file(ofstream &out, const char* base, string const& num, strin
 
 	filename += sfx;
 
-	full_filename = m_dirname + "/" + filename;
+	// numbered files go to the staging area, if enabled and there's room
+	if (m_stager && m_stageable && !num.empty() && m_stager->wait_for_space()) {
+		m_staged_files.push_back(filename);
+		return m_stager->get_stagedir() + "/" + filename;
+	}
+	return m_dirname + "/" + filename;
+}
+
+string
+Writer::open_data_file(ofstream &out, const char* base, string const& num, string const& sfx)
+{
+	string filename;
+	const string full_filename = data_file_path(base, num, sfx, filename);
 
 	out.open(full_filename.c_str());
 
@@ -570,3 +694,39 @@ Writer::open_data_file(ofstream &out, const char* base, string const& num, strin
 	return filename;
 }
 
+string
+Writer::open_backend_file(ostream &out, const char* base, string const& num)
+{
+	if (!m_backend)
+		m_backend = FileBackend::create(gdata->clOptions->write_backend);
+
+	string filename;
+	const string full_filename = data_file_path(base, num, m_fname_sfx, filename);
+
+	m_backend->open(full_filename);
+
+	out.rdbuf(m_backend);
+	out.exceptions(ostream::failbit | ostream::badbit);
+
+	return filename;
+}
+
+void
+Writer::close_backend_file()
+{
+	m_backend->close();
+}
+
+void
+Writer::commit_staged()
+{
+	if (m_stager && !(m_staged_files.empty() && m_timefile_entries.empty())) {
+		// even without files of our own, entries must not overtake
+		// the ones of previous batches
+		m_stager->enqueue(this, m_staged_files, m_timefile_entries);
+	} else if (!m_timefile_entries.empty()) {
+		write_timefile(m_timefile_entries);
+	}
+	m_staged_files.clear();
+	m_timefile_entries.clear();
+}
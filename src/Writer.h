@@ -29,6 +29,7 @@
 #include <fstream>
 #include <string>
 #include <map>
+#include <vector>
 #include <cstdlib>
 #include <cmath>
 // TODO on Windows it's direct.h
@@ -45,6 +46,9 @@
 // Object
 #include "Object.h"
 
+// DeviceCounts
+#include "IOAggregator.h"
+
 // deprecation macros
 // #include "deprecation.h"
 
@@ -54,6 +58,12 @@
 struct GlobalData;
 class Problem;
 
+// node-local staging of the output files
+class OutputStager;
+
+// backend for the large binary data files
+class FileBackend;
+
 // Writer types. Define new ones here and remember to include the corresponding
 // header in Writer.cc and the switch case in the implementation of Writer::Create
 
@@ -66,7 +76,9 @@ enum WriterType
 	CALLBACKWRITER,
 	CUSTOMTEXTWRITER,
 	UDPWRITER,
-	HOTWRITER
+	HOTWRITER,
+	MEMHOTWRITER,
+	LODWRITER
 };
 
 // list of writer type, write freq pairs
@@ -97,6 +109,22 @@ class Writer
 	// forced writes
 	static flag_t m_write_flags;
 
+	// staging of the output files, if enabled (NULL otherwise)
+	static OutputStager *m_stager;
+
+	// I/O aggregation of the particle files, if enabled (NULL otherwise)
+	static IOAggregator *m_aggregator;
+
+	// call write() on the given writer with the particles it should write:
+	// the ones of the whole I/O aggregation group if aggregate is true.
+	// Returns false if the writer has nothing to write on this rank
+	static bool
+	write_particles(Writer *writer, bool aggregate, uint numParts,
+		BufferList const& buffers, uint node_offset, double t, const bool testpoints);
+
+	// the stager notifies us when our files have been moved
+	friend class OutputStager;
+
 public:
 	// maximum number of files
 	static const uint MAX_FILES = 99999;
@@ -135,6 +163,10 @@ public:
 	static void
 	WriteWaveGage(WriterMap writers, double t, GageList const& gage);
 
+	// write out-of-band test points
+	static void
+	WriteProbes(WriterMap writers, double t, ProbeValueList const& values);
+
 	// write object data
 	static void
 	WriteObjects(WriterMap writers, double t);
@@ -188,6 +220,7 @@ protected:
 	{
 		m_last_write_time = t;
 		++m_FileCounter;
+		commit_staged();
 	}
 
 	virtual bool
@@ -202,6 +235,9 @@ protected:
 	virtual void
 	write_WaveGage(double t, GageList const& gage) {}
 
+	virtual void
+	write_probes(double t, ProbeValueList const& values) {}
+
 	virtual void
 	write_objects(double t) {}
 
@@ -218,6 +254,37 @@ protected:
 	// default suffix (extension) for data files)
 	std::string		m_fname_sfx;
 
+	// Can this writer's numbered data files go through the staging area?
+	// Writers that keep files open across writes, or whose files must hit
+	// the final directory immediately, should clear this
+	bool			m_stageable;
+
+	// Can this writer's particle files be written by the I/O aggregator of
+	// the group (see --io-aggregators)? Writers that set this must not depend
+	// on the particles being those of this rank (e.g. use device_counts()
+	// rather than the per-device counts in GlobalData)
+	bool			m_aggregatable;
+
+	// global device index and number of particles of each device, in the
+	// order of the particles being written
+	DeviceCounts	device_counts() const;
+
+	// false on the ranks whose particle files are written by the I/O
+	// aggregator of their group (only for aggregatable writers)
+	bool writes_particle_files() const
+	{ return !(m_aggregator && m_aggregatable) || m_aggregator->is_aggregator(); }
+
+	// add an entry to the timefile. Entries are held until mark_written,
+	// and with output staging until the files they reference have been moved
+	void add_timefile_entry(std::string const& entry)
+	{ m_timefile_entries += entry; }
+
+	// actually write (pending) entries to the timefile; writers that need to
+	// do something more (e.g. close the XML) should override this
+	virtual void
+	write_timefile(std::string const& entries)
+	{ if (m_timefile) m_timefile << entries << std::flush; }
+
 	/* open a data file on stream `out` assembling the file name from the provided
 	 * base, the current node (in case of multi-node simulaions), the provided sequence
 	 * number and the provided suffix
@@ -237,6 +304,17 @@ protected:
 	open_data_file(std::ofstream &out, const char* base)
 	{ return open_data_file(out, base, std::string(), m_fname_sfx); }
 
+	/* open a (large, binary) data file, named as above, attaching the stream `out`
+	 * to the file backend of the writer (selected with --write-backend).
+	 * The data is only guaranteed to be in the file after close_backend_file
+	 */
+	std::string
+	open_backend_file(std::ostream &out, const char* base,
+		std::string const& num);
+
+	void
+	close_backend_file();
+
 
 	// time of last write
 	double			m_last_write_time;
@@ -249,9 +327,32 @@ protected:
 	uint			m_FileCounter;
 	std::ofstream	m_timefile;
 
+	// backend for open_backend_file, created on first use
+	FileBackend		*m_backend;
+
 	const Problem	*m_problem;
 	std::string		current_filenum() const;
 	const GlobalData*		gdata;
+
+private:
+	// staged files written since the last mark_written
+	std::vector<std::string>	m_staged_files;
+	// timefile entries added since the last mark_written
+	std::string		m_timefile_entries;
+
+	// full path of the data file with the given name parts (in the staging
+	// area, if appropriate); the file name is returned in filename
+	std::string
+	data_file_path(const char* base, std::string const& num,
+		std::string const& sfx, std::string &filename);
+
+	// hand the staged files over to the stager, or write out the timefile
+	// entries directly if there's nothing to wait for
+	void commit_staged();
+
+	// called (from the mover thread) when the staged files have been moved
+	void staged_files_landed(std::string const& entries)
+	{ if (!entries.empty()) write_timefile(entries); }
 };
 
 #endif	/* _WRITER_H */
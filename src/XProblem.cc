@@ -39,6 +39,7 @@
 #include "Torus.h"
 #include "Plane.h"
 #include "STLMesh.h"
+#include "InstanceSet.h"
 #include "XProblem.h"
 #include "GlobalData.h"
 
@@ -848,6 +849,43 @@ GeometryID XProblem::addXYZFile(const GeometryType otype, const Point &origin,
 	);
 }
 
+GeometryID XProblem::addInstances(const GeometryID prototype, const vector<double3> &offsets,
+	const vector<EulerParameters> &orientations)
+{
+	if (!validGeometry(prototype)) return INVALID_GEOMETRY;
+
+	const GeometryInfo *proto = m_geometries[prototype];
+
+	// instances are not rigid bodies, and must be filled
+	if (proto->type == GT_FLOATING_BODY || proto->type == GT_MOVING_BODY ||
+		proto->type == GT_PLANE || proto->type == GT_OPENBOUNDARY) {
+		printf("WARNING: instances only available for fluid, fixed boundaries and testpoints! Ignoring\n");
+		return INVALID_GEOMETRY;
+	}
+	if (proto->has_hdf5_file || proto->has_xyz_file) {
+		printf("WARNING: instances not available for geometries loaded from file! Ignoring\n");
+		return INVALID_GEOMETRY;
+	}
+
+	const GeometryID gid = addGeometry(proto->type, proto->fill_type,
+		new InstanceSet(proto->ptr, offsets, orientations));
+
+	// the instances inherit the settings of the prototype
+	GeometryInfo *inst = m_geometries[gid];
+	inst->intersection_type = proto->intersection_type;
+	inst->erase_operation = proto->erase_operation;
+	inst->unfill_radius = proto->unfill_radius;
+	inst->particle_mass_was_set = proto->particle_mass_was_set;
+
+	// no Chrono body for the instances
+	disableCollisions(gid);
+
+	// from now on, the prototype is only used through the instances
+	deleteGeometry(prototype);
+
+	return gid;
+}
+
 // Add a single testpoint; returns the position of the testpoint in the vector of
 // testpoints, which will correspond to its particle id.
 // NOTE: testpoints should be assigned with consecutive particle ids starting from 0
@@ -1536,7 +1574,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 		// Compute density for hydrostatic filling. FIXME for multifluid
 		float rho = physparams()->rho0[0];
 		if (m_hydrostaticFilling && simparams()->boundarytype == DYN_BOUNDARY)
-			rho = density(m_waterLevel - globalPos[i].z, 0);
+			rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 		vel[i] = make_float4(0, 0, 0, rho);
 		if (eulerVel)
 			eulerVel[i] = make_float4(0);
@@ -1554,7 +1592,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 		// Compute density for hydrostatic filling. FIXME for multifluid
 		float rho = physparams()->rho0[0];
 		if (m_hydrostaticFilling)
-			rho = density(m_waterLevel - globalPos[i].z, 0);
+			rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 		vel[i] = make_float4(0, 0, 0, rho);
 		if (eulerVel)
 			eulerVel[i] = make_float4(0);
@@ -1572,7 +1610,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 		// Compute density for hydrostatic filling. FIXME for multifluid
 		float rho = physparams()->rho0[0];
 		if (m_hydrostaticFilling && simparams()->boundarytype == DYN_BOUNDARY)
-			rho = density(m_waterLevel - globalPos[i].z, 0);
+			rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 		vel[i] = make_float4(0, 0, 0, rho);
 		if (eulerVel)
 			eulerVel[i] = make_float4(0);
@@ -1722,7 +1760,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 				// Compute density for hydrostatic filling. FIXME for multifluid
 				float rho = physparams()->rho0[0];
 				if (m_hydrostaticFilling && (ptype == PT_FLUID || simparams()->boundarytype == DYN_BOUNDARY))
-					rho = density(m_waterLevel - globalPos[i].z, 0);
+					rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 				vel[i] = make_float4(0, 0, 0, rho);
 
 				// Update boundary particles counters for rb indices
@@ -1858,7 +1896,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 				// Compute density for hydrostatic filling. FIXME for multifluid
 				float rho = physparams()->rho0[0];
 				if (m_hydrostaticFilling && (ptype == PT_FLUID || simparams()->boundarytype == DYN_BOUNDARY))
-					rho = density(m_waterLevel - globalPos[i].z, 0);
+					rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 				vel[i] = make_float4(0, 0, 0, rho);
 
 				// Update boundary particles counters for rb indices
@@ -1907,7 +1945,7 @@ void XProblem::copy_to_array(BufferList &buffers)
 				// Compute density for hydrostatic filling. FIXME for multifluid
 				float rho = physparams()->rho0[0];
 				if (m_hydrostaticFilling && simparams()->boundarytype == DYN_BOUNDARY)
-					rho = density(m_waterLevel - globalPos[i].z, 0);
+					rho = hydrostatic_density(m_waterLevel - globalPos[i].z, 0);
 				vel[i] = make_float4(0, 0, 0, rho);
 				if (eulerVel)
 					// there should be no eulerVel with LJ bounds, but it is safe to init the array anyway
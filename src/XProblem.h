@@ -231,6 +231,13 @@ class XProblem: public Problem {
 		GeometryID addXYZFile(const GeometryType otype, const Point &origin,
 			const char *fname_xyz, const char *fname_stl = NULL);
 
+		// Method to add copies of an existing geometry (see InstanceSet): each instance
+		// is the prototype rotated around its center by its orientation (identity
+		// if none is given), then shifted by its offset. The prototype is filled only
+		// once and is deleted, the instances take over its type and erase settings.
+		GeometryID addInstances(const GeometryID prototype, const std::vector<double3> &offsets,
+			const std::vector<EulerParameters> &orientations = std::vector<EulerParameters>());
+
 		// Method to add a single testpoint.
 		// NOTE: does not create a geometry since Point does not derive from Object
 		size_t addTestPoint(const Point &coordinates);
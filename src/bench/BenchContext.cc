@@ -0,0 +1,226 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cstdio>
+#include <cerrno>
+
+#include <dirent.h>
+#include <unistd.h>
+
+#include "BenchContext.h"
+#include "GPUSPH.h"
+#include "GPUWorker.h"
+#include "NetworkManager.h"
+#include "hostbuffer.h"
+
+// the problem selected at compile time (PROBLEM)
+#include "problem_select.opt"
+
+using namespace std;
+
+BenchContext::BenchContext(Options *options, uint devices) :
+	m_gdata(),
+	m_gpusph(NULL),
+	m_seed(1)
+{
+	if (devices < 1 || devices > MAX_DEVICES_PER_NODE)
+		throw invalid_argument("invalid number of devices for the benchmarks");
+
+	m_gdata.clOptions = options;
+	m_gdata.devices = devices;
+	for (uint d = 0; d < devices; ++d)
+		m_gdata.device[d] = d;
+	m_gdata.mpi_nodes = 1;
+	m_gdata.mpi_rank = 0;
+	m_gdata.totDevices = devices;
+
+	// never initialized: only needed by computeCellBursts() to size the request list
+	m_gdata.networkManager = new NetworkManager();
+
+	m_gdata.problem = new PROBLEM(&m_gdata);
+	if (!m_gdata.problem->simframework())
+		throw invalid_argument("no simulation framework defined in the problem!");
+	m_gdata.simframework = m_gdata.problem->simframework();
+	m_gdata.allocPolicy = m_gdata.simframework->getAllocPolicy();
+
+	m_gpusph = GPUSPH::getInstance();
+	m_gpusph->gdata = &m_gdata;
+	m_gpusph->clOptions = options;
+	m_gpusph->problem = m_gdata.problem;
+
+	Problem *problem = m_gdata.problem;
+	if (!problem->initialize())
+		throw runtime_error("problem initialization failed");
+
+	// as in GPUSPH::initialize()
+	m_gdata.worldOrigin = make_float3(problem->get_worldorigin());
+	m_gdata.worldSize = make_float3(problem->get_worldsize());
+	m_gdata.gridSize = problem->get_gridsize();
+	m_gdata.cellSize = make_float3(problem->get_cellsize());
+	const ulong longNGridCells = (ulong) m_gdata.gridSize.x * m_gdata.gridSize.y * m_gdata.gridSize.z;
+	if (longNGridCells > MAX_CELLS)
+		throw runtime_error("too many cells in the problem grid");
+	m_gdata.nGridCells = (uint)longNGridCells;
+	m_gdata.dt = problem->simparams()->dt;
+
+	m_gdata.s_hDeviceMap = new devcount_t[m_gdata.nGridCells];
+	memset(m_gdata.s_hDeviceMap, 0, sizeof(devcount_t)*m_gdata.nGridCells);
+	if (devices > 1) {
+		try {
+			problem->fillDeviceMapByAxis(Problem::LONGEST_AXIS);
+		} catch (runtime_error &e) {
+			cerr << "WARNING: " << e.what() << "splitting the domain by cell hash instead" << endl;
+			problem->fillDeviceMapByCellHash();
+		}
+	}
+}
+
+BenchContext::~BenchContext()
+{
+	m_gpusph->gdata = NULL;
+	m_gpusph->clOptions = NULL;
+	m_gpusph->problem = NULL;
+
+	m_gdata.s_hBuffers.clear();
+	delete[] m_gdata.s_hDeviceMap;
+	delete m_gdata.problem;
+	delete m_gdata.networkManager;
+}
+
+string const&
+BenchContext::dir() const
+{
+	return m_gdata.problem->get_dirname();
+}
+
+void
+BenchContext::make_particles(uint numParts)
+{
+	BufferList &buffers = m_gdata.s_hBuffers;
+
+	// same as the minimal set in GPUSPH::allocateGlobalHostBuffers()
+	buffers.clear();
+	buffers.addBuffer<HostBuffer, BUFFER_POS_GLOBAL>();
+	buffers.addBuffer<HostBuffer, BUFFER_POS>();
+	buffers.addBuffer<HostBuffer, BUFFER_HASH>();
+	buffers.addBuffer<HostBuffer, BUFFER_VEL>();
+	buffers.addBuffer<HostBuffer, BUFFER_INFO>();
+
+	BufferList::iterator iter = buffers.begin();
+	for ( ; iter != buffers.end(); ++iter)
+		iter->second->alloc(numParts);
+
+	m_gdata.totParticles = m_gdata.allocatedParticles = numParts;
+
+	double4 *posGlobal = buffers.getData<BUFFER_POS_GLOBAL>();
+	float4 *pos = buffers.getData<BUFFER_POS>();
+	hashKey *hash = buffers.getData<BUFFER_HASH>();
+	float4 *vel = buffers.getData<BUFFER_VEL>();
+	particleinfo *info = buffers.getData<BUFFER_INFO>();
+
+	Problem *problem = m_gdata.problem;
+	const double3 origin = problem->get_worldorigin();
+	const double3 size = problem->get_worldsize();
+	const double dp = problem->m_deltap;
+	const vector<float> &rho0 = problem->physparams()->rho0;
+	const float rho = rho0.empty() ? 1000.0f : rho0[0];
+
+	srand48(m_seed++);
+	for (uint i = 0; i < numParts; ++i) {
+		const Point p(
+			origin.x + drand48()*size.x,
+			origin.y + drand48()*size.y,
+			origin.z + drand48()*size.z,
+			rho*dp*dp*dp);
+		info[i] = make_particleinfo(PT_FLUID, 0, i);
+		problem->calc_localpos_and_hash(p, info[i], pos[i], hash[i]);
+		posGlobal[i] = make_double4(p(0), p(1), p(2), p(3));
+		vel[i] = make_float4(0, 0, 0, rho);
+	}
+
+	if (m_gdata.devices > 1) {
+		sortParticlesByHash();
+	} else {
+		m_gdata.s_hStartPerDevice[0] = 0;
+		m_gdata.s_hPartsPerDevice[0] = m_gdata.processParticles[0] = numParts;
+	}
+}
+
+void
+BenchContext::shuffle_particles()
+{
+	srand48(m_seed++);
+	for (uint i = m_gdata.totParticles; i > 1; --i)
+		particleSwap(i - 1, (uint)(drand48()*i) % i);
+}
+
+void
+BenchContext::clean_data_dir() const
+{
+	const string datadir = dir() + "/data";
+	DIR *dp = opendir(datadir.c_str());
+	if (!dp)
+		return;
+	struct dirent *entry;
+	while ((entry = readdir(dp)) != NULL) {
+		if (entry->d_name[0] == '.')
+			continue;
+		const string fname = datadir + "/" + entry->d_name;
+		// subdirectories (e.g. testpoints) are left alone
+		if (unlink(fname.c_str()) && errno != EISDIR && errno != EPERM)
+			perror(fname.c_str());
+	}
+	closedir(dp);
+}
+
+void
+BenchContext::sortParticlesByHash()
+{
+	m_gpusph->sortParticlesByHash();
+}
+
+void
+BenchContext::particleSwap(uint idx1, uint idx2)
+{
+	m_gpusph->particleSwap(idx1, idx2);
+}
+
+GPUWorker *
+BenchContext::create_worker(devcount_t deviceIndex)
+{
+	// the workers only allocate device memory when their thread is started
+	return new GPUWorker(&m_gdata, deviceIndex);
+}
+
+uint
+BenchContext::computeCellBursts(GPUWorker *worker)
+{
+	worker->computeCellBursts();
+	return worker->m_bursts.size();
+}
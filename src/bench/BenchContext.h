@@ -0,0 +1,78 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Simulation context for the host microbenchmarks */
+
+#ifndef _BENCHCONTEXT_H
+#define _BENCHCONTEXT_H
+
+#include <string>
+
+#include "GlobalData.h"
+
+class GPUSPH;
+class GPUWorker;
+
+/*! Set up the compiled-in problem the same way GPUSPH::initialize() does,
+ *  up to (but excluding) the creation of the workers and any CUDA call, so
+ *  that the host paths can be benchmarked on synthetic particle systems
+ *  of any size, without a device.
+ */
+class BenchContext
+{
+	GlobalData	m_gdata;
+	GPUSPH		*m_gpusph;
+
+	// seed of the synthetic particle systems, for reproducibility
+	unsigned long	m_seed;
+
+public:
+	BenchContext(Options *options, uint devices);
+	~BenchContext();
+
+	GlobalData *gdata()
+	{ return &m_gdata; }
+	Problem *problem()
+	{ return m_gdata.problem; }
+	std::string const& dir() const;
+
+	/* (Re)allocate the shared host buffers for numParts fluid particles,
+	 * randomly distributed over the problem domain and sorted by device */
+	void make_particles(uint numParts);
+
+	// random permutation of the particles in the shared host buffers
+	void shuffle_particles();
+
+	// remove the files saved by the writers
+	void clean_data_dir() const;
+
+	// access to the private host paths under test
+	void sortParticlesByHash();
+	void particleSwap(uint idx1, uint idx2);
+	GPUWorker *create_worker(devcount_t deviceIndex);
+	uint computeCellBursts(GPUWorker *worker);
+};
+
+#endif
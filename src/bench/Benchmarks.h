@@ -0,0 +1,51 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* The host microbenchmarks */
+
+#ifndef _BENCHMARKS_H
+#define _BENCHMARKS_H
+
+#include <string>
+#include <vector>
+
+#include "MicroBench.h"
+
+class BenchContext;
+
+/* Benchmarks on the shared host buffers of the compiled-in problem:
+ * sorting by device, burst computation, writers; run on synthetic
+ * particle systems of each of the given sizes */
+void add_particle_benchmarks(MicroBench &bench, BenchContext &ctx,
+	std::vector<uint> const& sizes);
+
+/* Benchmarks independent from the problem: geometry filling, readers,
+ * base64, burst compression, host neighbor search, thread synchronization;
+ * input files are created in dir. The burst compression is also benchmarked
+ * on the bursts recorded (--record-bursts) in the given files, if any */
+void add_data_benchmarks(MicroBench &bench, std::string const& dir,
+	std::vector<uint> const& sizes, std::vector<std::string> const& bursts);
+
+#endif
@@ -0,0 +1,1013 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Microbenchmarks independent from the problem */
+
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+#include <algorithm>
+#include <map>
+#include <stdint.h>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Benchmarks.h"
+#include "multi_gpu_defines.h"
+#include "vector_math.h"
+#include "Cube.h"
+#include "Sphere.h"
+#include "Cylinder.h"
+#include "InstanceSet.h"
+#include "XYZReader.h"
+#include "VTUReader.h"
+#include "base64.h"
+#include "Synchronizer.h"
+#include "HostPostProcess.h"
+#include "FileBackend.h"
+#include "BurstCodec.h"
+#include "define_buffers.h"
+
+using namespace std;
+
+static BenchParams
+one_param(const char *name, double value)
+{
+	BenchParams params;
+	params.push_back(make_pair(string(name), value));
+	return params;
+}
+
+// number of lattice points per side of the unit cube for about numParts points
+static uint
+lattice_side(uint numParts)
+{
+	return max(2U, (uint)round(cbrt((double)numParts)));
+}
+
+/* Geometry */
+
+// fill a primitive (of unit size) with particles
+class FillBench : public Benchmark
+{
+	string		m_name;
+	Object		*m_object;
+	double		m_dx;
+	size_t		m_points;
+	PointVect	m_filled;
+
+public:
+	FillBench(string const& name, Object *object, uint side) :
+		m_name(name),
+		m_object(object),
+		m_dx(1.0/side),
+		m_points(0),
+		m_filled()
+	{
+		m_object->Fill(m_filled, m_dx, true);
+		m_points = m_filled.size();
+		m_filled.clear();
+	}
+
+	~FillBench()
+	{
+		delete m_object;
+	}
+
+	string name() const
+	{ return m_name; }
+	BenchParams params() const
+	{ return one_param("points", m_points); }
+	double items() const
+	{ return m_points; }
+	const char *items_unit() const
+	{ return "points"; }
+
+	void run()
+	{ m_object->Fill(m_filled, m_dx, true); }
+	void teardown()
+	{ m_filled.clear(); }
+};
+
+// carve a sphere out of (or intersect it with) a lattice in the unit cube
+class CarveBench : public Benchmark
+{
+	bool		m_intersect;
+	Sphere		m_sphere;
+	double		m_dx;
+	PointVect	m_lattice;
+	PointVect	m_points;
+
+public:
+	CarveBench(bool intersect, uint side) :
+		m_intersect(intersect),
+		m_sphere(Point(0.5, 0.5, 0.5), 0.3),
+		m_dx(1.0/side),
+		m_lattice(),
+		m_points()
+	{
+		Cube(Point(0, 0, 0), 1, 1, 1).Fill(m_lattice, m_dx, true);
+	}
+
+	string name() const
+	{ return m_intersect ? "Object::Intersect" : "Object::Unfill"; }
+	BenchParams params() const
+	{ return one_param("points", m_lattice.size()); }
+	double items() const
+	{ return m_lattice.size(); }
+	const char *items_unit() const
+	{ return "points"; }
+
+	void setup()
+	{ m_points = m_lattice; }
+	void run()
+	{
+		if (m_intersect)
+			m_sphere.Intersect(m_points, m_dx);
+		else
+			m_sphere.Unfill(m_points, m_dx);
+	}
+};
+
+// carve a grid of rotated instances of a box out of a lattice in the unit cube,
+// checking the points left against a linear scan over the instances
+class InstanceUnfillBench : public Benchmark
+{
+	// instances per side of the grid
+	static const uint grid = 6;
+
+	Cube					m_proto;
+	vector<double3>			m_offsets;
+	vector<EulerParameters>	m_rot, m_invrot;
+	double3					m_pivot;
+	InstanceSet				*m_instances;
+	double					m_dx;
+	PointVect				m_lattice;
+	PointVect				m_points;
+	size_t					m_expected;
+
+	vector<double3> offsets() const
+	{
+		vector<double3> offsets;
+		// the prototype is (about) centered on the origin
+		for (uint i = 0; i < grid*grid*grid; ++i)
+			offsets.push_back((make_double3(i % grid, (i/grid) % grid, i/(grid*grid)) + 0.5)/grid);
+		return offsets;
+	}
+
+	vector<EulerParameters> orientations() const
+	{
+		vector<EulerParameters> rot;
+		for (uint i = 0; i < grid*grid*grid; ++i)
+			rot.push_back(EulerParameters(Vector(1, i % 3, i % 5), 0.1*i));
+		return rot;
+	}
+
+	// is the point inside any of the instances? (same transform as InstanceSet)
+	bool inside_any(Point const& p) const
+	{
+		const double3 pos = make_double3(p);
+		for (size_t i = 0; i < m_offsets.size(); ++i) {
+			const double3 local = m_pivot + m_invrot[i].Rot(pos - m_pivot - m_offsets[i]);
+			if (m_proto.IsInside(Point(local), m_dx))
+				return true;
+		}
+		return false;
+	}
+
+public:
+	InstanceUnfillBench(uint side) :
+		m_proto(Point(-0.3/grid, -0.3/grid, -0.3/grid), 0.6/grid, 0.6/grid, 0.6/grid),
+		m_offsets(offsets()),
+		m_rot(orientations()),
+		m_invrot(),
+		m_pivot(),
+		m_instances(NULL),
+		m_dx(1.0/side),
+		m_lattice(),
+		m_points(),
+		m_expected(0)
+	{
+		for (size_t i = 0; i < m_rot.size(); ++i) {
+			m_rot[i].Normalize();
+			m_invrot.push_back(m_rot[i].Inverse());
+		}
+		// instances rotate around the center of the prototype bounding box
+		Point pmin, pmax;
+		m_proto.getBoundingBox(pmin, pmax);
+		m_pivot = (make_double3(pmin) + make_double3(pmax))/2;
+
+		m_instances = new InstanceSet(&m_proto, m_offsets, m_rot);
+
+		Cube(Point(0, 0, 0), 1, 1, 1).Fill(m_lattice, m_dx, true);
+		for (size_t i = 0; i < m_lattice.size(); ++i)
+			if (!inside_any(m_lattice[i]))
+				++m_expected;
+	}
+
+	~InstanceUnfillBench()
+	{
+		delete m_instances;
+	}
+
+	string name() const
+	{ return "InstanceSet::Unfill"; }
+	BenchParams params() const
+	{
+		BenchParams params = one_param("points", m_lattice.size());
+		params.push_back(make_pair(string("instances"), (double)m_offsets.size()));
+		return params;
+	}
+	double items() const
+	{ return m_lattice.size(); }
+	const char *items_unit() const
+	{ return "points"; }
+
+	void setup()
+	{ m_points = m_lattice; }
+	void run()
+	{ m_instances->Unfill(m_points, m_dx); }
+	void teardown()
+	{
+		if (m_points.size() != m_expected) {
+			ostringstream err;
+			err << "InstanceSet::Unfill left " << m_points.size() << " points, " <<
+				m_expected << " expected";
+			throw runtime_error(err.str());
+		}
+	}
+};
+
+/* Readers and encoding */
+
+class XYZReaderBench : public Benchmark
+{
+	string		m_fname;
+	uint		m_points;
+	XYZReader	m_reader;
+
+public:
+	XYZReaderBench(string const& dir, uint numParts) :
+		m_fname(dir + "/bench.xyz"),
+		m_points(numParts),
+		m_reader()
+	{
+		ofstream out(m_fname.c_str());
+		out.exceptions(ofstream::failbit | ofstream::badbit);
+		for (uint i = 0; i < numParts; ++i)
+			out << drand48() << " " << drand48() << " " << drand48() << "\n";
+		out.close();
+		m_reader.setFilename(m_fname);
+	}
+
+	~XYZReaderBench()
+	{
+		unlink(m_fname.c_str());
+	}
+
+	string name() const
+	{ return "XYZReader::read"; }
+	BenchParams params() const
+	{ return one_param("points", m_points); }
+	double items() const
+	{ return m_points; }
+	const char *items_unit() const
+	{ return "points"; }
+
+	void run()
+	{ m_reader.read(); }
+	void teardown()
+	{ m_reader.points.clear(); }
+};
+
+/* A VTU file in the format produced by Crixus, which is what VTUReader
+ * reads: double coordinates and normals, volumes and surfaces,
+ * int fields; all as raw appended data */
+static void
+write_crixus_vtu(string const& fname, uint numParts)
+{
+	static const char *scalarNames[] = { "Volume", "Surface" };
+	static const char *intNames[] = { "ParticleType", "FluidType", "KENT", "MovingBoundary", "AbsoluteIndex" };
+
+	ofstream out(fname.c_str(), ios::binary);
+	out.exceptions(ofstream::failbit | ofstream::badbit);
+
+	const uint32_t vecBytes = 3*sizeof(double)*numParts;
+	const uint32_t scalarBytes = sizeof(double)*numParts;
+	const uint32_t intBytes = sizeof(int32_t)*numParts;
+	const uint32_t ivecBytes = 3*sizeof(int32_t)*numParts;
+
+	uint offset = 0;
+	out << "<?xml version=\"1.0\"?>\n";
+	out << "<VTKFile type=\"UnstructuredGrid\" version=\"0.1\" byte_order=\"LittleEndian\">\n";
+	out << " <UnstructuredGrid>\n";
+	out << "  <Piece NumberOfPoints=\"" << numParts << "\" NumberOfCells=\"0\">\n";
+	out << "   <PointData>\n";
+	out << "    <DataArray type=\"Float64\" Name=\"Normal\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+	offset += sizeof(uint32_t) + vecBytes;
+	for (uint i = 0; i < 2; ++i) {
+		out << "    <DataArray type=\"Float64\" Name=\"" << scalarNames[i] << "\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+		offset += sizeof(uint32_t) + scalarBytes;
+	}
+	for (uint i = 0; i < 5; ++i) {
+		out << "    <DataArray type=\"Int32\" Name=\"" << intNames[i] << "\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+		offset += sizeof(uint32_t) + intBytes;
+	}
+	out << "    <DataArray type=\"Int32\" Name=\"VertexParticle\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+	offset += sizeof(uint32_t) + ivecBytes;
+	out << "   </PointData>\n";
+	out << "   <Points>\n";
+	out << "    <DataArray type=\"Float64\" NumberOfComponents=\"3\" format=\"appended\" offset=\"" << offset << "\"/>\n";
+	out << "   </Points>\n";
+	out << "  </Piece>\n";
+	out << " </UnstructuredGrid>\n";
+	out << " <AppendedData encoding=\"raw\">\n_";
+
+	vector<double> dvals(3*numParts);
+	vector<int32_t> ivals(3*numParts);
+
+	// normals
+	for (uint i = 0; i < 3*numParts; ++i)
+		dvals[i] = (i % 3 == 2);
+	out.write((const char*)&vecBytes, sizeof(vecBytes));
+	out.write((const char*)&dvals[0], vecBytes);
+	// volume, surface
+	for (uint f = 0; f < 2; ++f) {
+		for (uint i = 0; i < numParts; ++i)
+			dvals[i] = 1.0e-6;
+		out.write((const char*)&scalarBytes, sizeof(scalarBytes));
+		out.write((const char*)&dvals[0], scalarBytes);
+	}
+	// integer fields: fluid particles, with their index
+	for (uint f = 0; f < 5; ++f) {
+		for (uint i = 0; i < numParts; ++i)
+			ivals[i] = (f == 0 ? CRIXUS_FLUID : f == 4 ? int32_t(i) : 0);
+		out.write((const char*)&intBytes, sizeof(intBytes));
+		out.write((const char*)&ivals[0], intBytes);
+	}
+	// vertices
+	fill(ivals.begin(), ivals.end(), 0);
+	out.write((const char*)&ivecBytes, sizeof(ivecBytes));
+	out.write((const char*)&ivals[0], ivecBytes);
+	// coordinates
+	for (uint i = 0; i < 3*numParts; ++i)
+		dvals[i] = drand48();
+	out.write((const char*)&vecBytes, sizeof(vecBytes));
+	out.write((const char*)&dvals[0], vecBytes);
+
+	out << "\n </AppendedData>\n</VTKFile>\n";
+	out.close();
+}
+
+class VTUReaderBench : public Benchmark
+{
+	string		m_fname;
+	uint		m_points;
+	VTUReader	m_reader;
+
+public:
+	VTUReaderBench(string const& dir, uint numParts) :
+		m_fname(dir + "/bench.vtu"),
+		m_points(numParts),
+		m_reader()
+	{
+		write_crixus_vtu(m_fname, numParts);
+		m_reader.setFilename(m_fname);
+	}
+
+	~VTUReaderBench()
+	{
+		unlink(m_fname.c_str());
+	}
+
+	string name() const
+	{ return "VTUReader::read"; }
+	BenchParams params() const
+	{ return one_param("points", m_points); }
+	double items() const
+	{ return m_points; }
+	const char *items_unit() const
+	{ return "points"; }
+
+	void run()
+	{ m_reader.read(); }
+	void teardown()
+	{ m_reader.empty(); }
+};
+
+class Base64Bench : public Benchmark
+{
+	bool			m_decode;
+	vector<BYTE>	m_data;
+	string			m_encoded;
+	vector<BYTE>	m_decoded;
+
+public:
+	Base64Bench(bool decode, size_t bytes) :
+		m_decode(decode),
+		m_data(bytes),
+		m_encoded(),
+		m_decoded()
+	{
+		for (size_t i = 0; i < bytes; ++i)
+			m_data[i] = (BYTE)(lrand48() & 0xff);
+		m_encoded = base64_encode(&m_data[0], m_data.size());
+		if (base64_decode(m_encoded) != m_data)
+			throw runtime_error("base64 round trip failed");
+	}
+
+	string name() const
+	{ return m_decode ? "base64_decode" : "base64_encode"; }
+	BenchParams params() const
+	{ return one_param("bytes", m_data.size()); }
+	double items() const
+	{ return m_data.size(); }
+	const char *items_unit() const
+	{ return "bytes"; }
+
+	void run()
+	{
+		if (m_decode)
+			m_decoded = base64_decode(m_encoded);
+		else
+			m_encoded = base64_encode(&m_data[0], m_data.size());
+	}
+};
+
+/* Output file backends: the data is written in small pieces, as the
+ * writers do, and the file is compared byte by byte with the data after
+ * each repetition. The ofstream version is the reference */
+
+class FileBackendBench : public Benchmark
+{
+	string			m_type;
+	string			m_fname;
+	FileBackend		*m_backend;
+	vector<char>	m_data;
+
+	// size of each write (a float4)
+	static const size_t PIECE = 16;
+
+public:
+	FileBackendBench(string const& dir, string const& type, size_t bytes) :
+		m_type(type),
+		m_fname(dir + "/bench.bin"),
+		m_backend(type == "ofstream" ? NULL : FileBackend::create(type)),
+		m_data(bytes)
+	{
+		for (size_t i = 0; i < bytes; ++i)
+			m_data[i] = (char)(lrand48() & 0xff);
+	}
+
+	~FileBackendBench()
+	{
+		delete m_backend;
+		unlink(m_fname.c_str());
+	}
+
+	// name of the backend actually used (uring might have fallen back to posix)
+	string type() const
+	{ return m_backend ? m_backend->name() : m_type; }
+
+	string name() const
+	{ return "FileBackend::write(" + type() + ")"; }
+	BenchParams params() const
+	{ return one_param("bytes", m_data.size()); }
+	double items() const
+	{ return m_data.size(); }
+	const char *items_unit() const
+	{ return "bytes"; }
+
+	void run()
+	{
+		ofstream ref;
+		ostream out(NULL);
+		if (m_backend) {
+			m_backend->open(m_fname);
+			out.rdbuf(m_backend);
+		} else {
+			ref.open(m_fname.c_str(), ios::binary);
+			out.rdbuf(ref.rdbuf());
+		}
+		out.exceptions(ostream::failbit | ostream::badbit);
+		for (size_t i = 0; i < m_data.size(); i += PIECE)
+			out.write(&m_data[i], min(PIECE, m_data.size() - i));
+		if (m_backend)
+			m_backend->close();
+		else
+			ref.close();
+	}
+
+	void teardown()
+	{
+		ifstream in(m_fname.c_str(), ios::binary);
+		vector<char> written((istreambuf_iterator<char>(in)), istreambuf_iterator<char>());
+		if (written != m_data)
+			throw runtime_error("FileBackend " + type() + " wrote " + m_fname + " incorrectly");
+	}
+};
+
+/* Compression of the network bursts: a sequence of bursts (synthetic, or
+ * recorded with --record-bursts) is encoded or decoded as GPUWorker does,
+ * with the XOR deltas against the previous burst with the same key; the
+ * round trip is checked after each repetition */
+
+struct BurstPayload
+{
+	flag_t			bufkey;
+	uint64_t		key;
+	uint			word;
+	vector<char>	data;
+	int				prev; // index of the previous burst with the same key and size, or -1
+
+	BurstPayload() :
+		bufkey(0),
+		key(0),
+		word(0),
+		data(),
+		prev(-1)
+	{}
+};
+
+typedef vector<BurstPayload> BurstPayloads;
+
+// link each burst to the previous one with the same key
+static void
+link_bursts(BurstPayloads &bursts)
+{
+	map< pair<flag_t, uint64_t>, int > last;
+	for (size_t i = 0; i < bursts.size(); ++i) {
+		BurstPayload &b = bursts[i];
+		map< pair<flag_t, uint64_t>, int >::iterator found = last.find(make_pair(b.bufkey, b.key));
+		b.prev = (found != last.end() && bursts[found->second].data.size() == b.data.size()) ?
+			found->second : -1;
+		last[make_pair(b.bufkey, b.key)] = i;
+	}
+}
+
+// positions, velocities and info of a fluid lattice, at two consecutive time steps
+static BurstPayloads
+synthetic_bursts(uint numParts)
+{
+	const uint side = lattice_side(numParts);
+	const uint n = side*side;
+	const float dp = 1.0f/side;
+	const float dt = 1e-4f;
+
+	vector<float4> pos(n), vel(n);
+	vector<particleinfo> info(n);
+	for (uint i = 0; i < n; ++i) {
+		const float x = (i % side)*dp;
+		const float z = (i / side)*dp;
+		pos[i] = make_float4(x, 0.5f, z, 1e-3f);
+		vel[i] = make_float4(sinf(x*6), 0.01f*(drand48() - 0.5), cosf(z*6), 1000.0f + z);
+		info[i] = make_particleinfo(PT_FLUID, 0, i);
+	}
+
+	BurstPayloads bursts;
+	for (uint step = 0; step < 2; ++step) {
+		const flag_t keys[] = { BUFFER_POS, BUFFER_VEL, BUFFER_INFO };
+		const void *data[] = { &pos[0], &vel[0], &info[0] };
+		const size_t sizes[] = { n*sizeof(float4), n*sizeof(float4), n*sizeof(particleinfo) };
+		for (uint b = 0; b < 3; ++b) {
+			BurstPayload burst;
+			burst.bufkey = keys[b];
+			burst.key = 0;
+			burst.word = BurstCompressor::word_size(keys[b]);
+			burst.data.assign((const char*)data[b], (const char*)data[b] + sizes[b]);
+			bursts.push_back(burst);
+		}
+		for (uint i = 0; i < n; ++i) {
+			pos[i] += make_float4(vel[i].x, vel[i].y, vel[i].z, 0)*dt;
+			vel[i].w += 1e-3f*(drand48() - 0.5);
+		}
+	}
+	link_bursts(bursts);
+	return bursts;
+}
+
+// bursts recorded by GPUSPH --record-bursts
+static BurstPayloads
+recorded_bursts(vector<string> const& fnames)
+{
+	BurstPayloads bursts;
+	for (size_t f = 0; f < fnames.size(); ++f) {
+		ifstream in(fnames[f].c_str(), ios::binary);
+		if (!in)
+			throw runtime_error("Cannot read recorded bursts " + fnames[f]);
+		BurstRecord rec;
+		while (in.read((char*)&rec, sizeof(rec))) {
+			BurstPayload burst;
+			burst.bufkey = rec.bufkey;
+			// keep the bursts of different devices apart
+			burst.key = rec.key ^ (uint64_t(f) << 56);
+			burst.word = rec.word;
+			burst.data.resize(rec.size);
+			if (rec.size && !in.read(&burst.data[0], rec.size))
+				throw runtime_error("Truncated recorded bursts " + fnames[f]);
+			bursts.push_back(burst);
+		}
+	}
+	if (bursts.empty())
+		throw runtime_error("No recorded bursts found");
+	link_bursts(bursts);
+	return bursts;
+}
+
+static string
+burst_bench_name(bool decode, BurstMode mode, string const& source)
+{
+	return string("BurstCodec::") + (decode ? "decode(" : "encode(") +
+		(mode == BURST_XOR ? "xor" : "lz") + "," + source + ")";
+}
+
+class BurstCodecBench : public Benchmark
+{
+	bool					m_decode;
+	BurstMode				m_mode;
+	string					m_source;
+	BurstPayloads const&	m_bursts;
+	size_t					m_bytes;
+	size_t					m_encoded_bytes;
+	vector< vector<char> >	m_encoded;
+	vector< vector<char> >	m_decoded;
+
+	BurstMode mode(BurstPayload const& b) const
+	{ return (m_mode == BURST_XOR && b.prev < 0) ? BURST_LZ : m_mode; }
+	const void *prev(BurstPayload const& b) const
+	{ return (m_mode == BURST_XOR && b.prev >= 0) ? &m_bursts[b.prev].data[0] : NULL; }
+
+	void encode()
+	{
+		for (size_t i = 0; i < m_bursts.size(); ++i) {
+			BurstPayload const& b = m_bursts[i];
+			BurstCodec::encode(mode(b), &b.data[0], b.data.size(), b.word, prev(b),
+				BurstCompressor::MAX_RATIO, m_encoded[i]);
+		}
+	}
+
+public:
+	BurstCodecBench(bool decode, BurstMode mode, string const& source, BurstPayloads const& bursts) :
+		m_decode(decode),
+		m_mode(mode),
+		m_source(source),
+		m_bursts(bursts),
+		m_bytes(0),
+		m_encoded_bytes(0),
+		m_encoded(bursts.size()),
+		m_decoded(bursts.size())
+	{
+		encode();
+		for (size_t i = 0; i < m_bursts.size(); ++i) {
+			m_bytes += m_bursts[i].data.size();
+			m_encoded_bytes += m_encoded[i].size();
+			m_decoded[i].resize(m_bursts[i].data.size());
+		}
+	}
+
+	string name() const
+	{ return burst_bench_name(m_decode, m_mode, m_source); }
+	BenchParams params() const
+	{
+		BenchParams params;
+		params.push_back(make_pair(string("bursts"), (double)m_bursts.size()));
+		params.push_back(make_pair(string("bytes"), (double)m_bytes));
+		params.push_back(make_pair(string("ratio"), (double)m_bytes/m_encoded_bytes));
+		return params;
+	}
+	double items() const
+	{ return m_bytes; }
+	const char *items_unit() const
+	{ return "bytes"; }
+
+	void run()
+	{
+		if (!m_decode) {
+			encode();
+			return;
+		}
+		for (size_t i = 0; i < m_bursts.size(); ++i) {
+			BurstPayload const& b = m_bursts[i];
+			BurstCodec::decode(&m_encoded[i][0], m_encoded[i].size(),
+				&m_decoded[i][0], b.data.size(), prev(b));
+		}
+	}
+
+	void teardown()
+	{
+		for (size_t i = 0; i < m_bursts.size(); ++i) {
+			BurstPayload const& b = m_bursts[i];
+			if (!m_decode)
+				BurstCodec::decode(&m_encoded[i][0], m_encoded[i].size(),
+					&m_decoded[i][0], b.data.size(), prev(b));
+			if (m_decoded[i] != b.data)
+				throw runtime_error(name() + " round trip failed");
+		}
+	}
+};
+
+static const BurstMode burst_bench_modes[] = { BURST_LZ, BURST_XOR };
+
+// is any of the burst compression benchmarks on the given source selected?
+static bool
+burst_benchmarks_selected(MicroBench const& bench, string const& source)
+{
+	for (uint m = 0; m < 2; ++m)
+		for (uint decode = 0; decode < 2; ++decode)
+			if (bench.selected(burst_bench_name(decode, burst_bench_modes[m], source)))
+				return true;
+	return false;
+}
+
+static void
+add_burst_benchmarks(MicroBench &bench, string const& source, BurstPayloads const& bursts)
+{
+	const BurstMode *modes = burst_bench_modes;
+	for (uint m = 0; m < 2; ++m) {
+		for (uint decode = 0; decode < 2; ++decode)
+			if (bench.selected(burst_bench_name(decode, modes[m], source)))
+				bench.run(new BurstCodecBench(decode, modes[m], source, bursts));
+	}
+}
+
+/* Host neighbor search (as used by the offline post-processor) */
+
+class HostNeibsBench : public Benchmark
+{
+	bool				m_query;
+	vector<double3>		m_pos;
+	double				m_radius;
+	HostCellGrid		*m_grid;
+	vector<uint>		m_neibs;
+
+public:
+	// particles on a jittered lattice, with the usual smoothing factor
+	HostNeibsBench(bool query, uint numParts) :
+		m_query(query),
+		m_pos(),
+		m_radius(0),
+		m_grid(NULL),
+		m_neibs()
+	{
+		const uint side = lattice_side(numParts);
+		const double dp = 1.0/side;
+		m_radius = 2*1.3*dp;
+		m_pos.reserve(side*side*side);
+		for (uint k = 0; k < side; ++k)
+			for (uint j = 0; j < side; ++j)
+				for (uint i = 0; i < side; ++i)
+					m_pos.push_back(make_double3(
+						(i + 0.5 + 0.1*(drand48() - 0.5))*dp,
+						(j + 0.5 + 0.1*(drand48() - 0.5))*dp,
+						(k + 0.5 + 0.1*(drand48() - 0.5))*dp));
+		if (m_query)
+			m_grid = new HostCellGrid(m_pos, m_radius);
+	}
+
+	~HostNeibsBench()
+	{
+		delete m_grid;
+	}
+
+	string name() const
+	{ return m_query ? "HostCellGrid::neighbors" : "HostCellGrid::HostCellGrid"; }
+	BenchParams params() const
+	{ return one_param("particles", m_pos.size()); }
+	double items() const
+	{ return m_pos.size(); }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void run()
+	{
+		if (!m_query) {
+			delete m_grid;
+			m_grid = new HostCellGrid(m_pos, m_radius);
+			return;
+		}
+		for (size_t i = 0; i < m_pos.size(); ++i)
+			m_grid->neighbors(m_pos, m_pos[i], m_radius, m_neibs);
+	}
+};
+
+// Shepard density filter on a fluid lattice, either as a separate pass
+// over the neighbor lists or fused with their construction
+class HostShepardBench : public Benchmark
+{
+	bool				m_fused;
+	PostFrame			m_frame;
+	vector<float>		m_rho;
+	HostPostProcess		*m_pp;
+	HostCellGrid		*m_grid;
+	vector<uint>		m_neibsStart;
+	vector<uint>		m_neibs;
+
+public:
+	HostShepardBench(bool fused, uint numParts) :
+		m_fused(fused),
+		m_frame(),
+		m_rho(),
+		m_pp(NULL),
+		m_grid(NULL),
+		m_neibsStart(),
+		m_neibs()
+	{
+		const uint side = lattice_side(numParts);
+		const double dp = 1.0/side;
+		for (uint k = 0; k < side; ++k)
+			for (uint j = 0; j < side; ++j)
+				for (uint i = 0; i < side; ++i) {
+					m_frame.pos.push_back(make_double3(
+						(i + 0.5 + 0.1*(drand48() - 0.5))*dp,
+						(j + 0.5 + 0.1*(drand48() - 0.5))*dp,
+						(k + 0.5 + 0.1*(drand48() - 0.5))*dp));
+					m_rho.push_back(1000*(1 + 0.01*(drand48() - 0.5)));
+				}
+		m_frame.mass.assign(m_rho.size(), 1000*dp*dp*dp);
+		m_frame.type.assign(m_rho.size(), PT_FLUID);
+
+		PostParams params;
+		params.slength = 1.3*dp;
+		params.influenceRadius = params.kernelradius*params.slength;
+		params.deltap = dp;
+		m_pp = new HostPostProcess(params);
+		m_grid = new HostCellGrid(m_frame.pos, params.influenceRadius);
+	}
+
+	~HostShepardBench()
+	{
+		delete m_grid;
+		delete m_pp;
+	}
+
+	string name() const
+	{ return m_fused ? "HostPostProcess::shepard(fused)" : "HostPostProcess::shepard"; }
+	BenchParams params() const
+	{ return one_param("particles", m_frame.numParts()); }
+	double items() const
+	{ return m_frame.numParts(); }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void run()
+	{
+		m_frame.rho = m_rho;
+		m_pp->shepard(m_frame, *m_grid, m_pp->params().influenceRadius, m_fused,
+			m_neibsStart, m_neibs);
+	}
+};
+
+/* Synchronization */
+
+// rounds of barriers between the main thread and the given number of workers
+class BarrierBench : public Benchmark
+{
+	uint				m_workers;
+	uint				m_rounds;
+	Synchronizer		m_sync;
+	vector<pthread_t>	m_threads;
+	volatile bool		m_stop;
+
+	static void *worker_thread(void *arg)
+	{
+		BarrierBench *self = static_cast<BarrierBench*>(arg);
+		while (true) {
+			self->m_sync.barrier();
+			if (self->m_stop)
+				break;
+		}
+		return NULL;
+	}
+
+public:
+	BarrierBench(uint workers, uint rounds) :
+		m_workers(workers),
+		m_rounds(rounds),
+		m_sync(workers + 1),
+		m_threads(workers),
+		m_stop(false)
+	{
+		for (uint w = 0; w < m_workers; ++w)
+			if (pthread_create(&m_threads[w], NULL, worker_thread, (void*)this))
+				throw runtime_error("cannot start the barrier benchmark threads");
+	}
+
+	~BarrierBench()
+	{
+		// the workers might see m_stop right after the last timed barrier,
+		// so they are released with forceUnlock() rather than a final barrier
+		m_stop = true;
+		m_sync.forceUnlock();
+		for (uint w = 0; w < m_workers; ++w)
+			pthread_join(m_threads[w], NULL);
+	}
+
+	string name() const
+	{ return "Synchronizer::barrier"; }
+	BenchParams params() const
+	{ return one_param("threads", m_workers + 1); }
+	double items() const
+	{ return m_rounds; }
+	const char *items_unit() const
+	{ return "barriers"; }
+
+	void run()
+	{
+		for (uint r = 0; r < m_rounds; ++r)
+			m_sync.barrier();
+	}
+};
+
+void
+add_data_benchmarks(MicroBench &bench, string const& dir, vector<uint> const& sizes,
+	vector<string> const& bursts)
+{
+	for (vector<uint>::const_iterator n(sizes.begin()); n != sizes.end(); ++n) {
+		const uint side = lattice_side(*n);
+
+		if (bench.selected("Cube::Fill"))
+			bench.run(new FillBench("Cube::Fill", new Cube(Point(0, 0, 0), 1, 1, 1), side));
+		if (bench.selected("Sphere::Fill"))
+			bench.run(new FillBench("Sphere::Fill", new Sphere(Point(0.5, 0.5, 0.5), 0.5), side));
+		if (bench.selected("Cylinder::Fill"))
+			bench.run(new FillBench("Cylinder::Fill", new Cylinder(Point(0.5, 0.5, 0), 0.5, 1.0), side));
+		if (bench.selected("Object::Unfill"))
+			bench.run(new CarveBench(false, side));
+		if (bench.selected("Object::Intersect"))
+			bench.run(new CarveBench(true, side));
+		if (bench.selected("InstanceSet::Unfill"))
+			bench.run(new InstanceUnfillBench(side));
+
+		if (bench.selected("XYZReader::read"))
+			bench.run(new XYZReaderBench(dir, *n));
+		if (bench.selected("VTUReader::read"))
+			bench.run(new VTUReaderBench(dir, *n));
+
+		// as much data as the positions of the particles
+		if (bench.selected("base64_encode"))
+			bench.run(new Base64Bench(false, *n*sizeof(float4)));
+		if (bench.selected("base64_decode"))
+			bench.run(new Base64Bench(true, *n*sizeof(float4)));
+
+		// about as much data as a VTKWriter file, plus an unaligned tail
+		static const char *backends[] = { "ofstream", "posix", "uring" };
+		for (uint b = 0; b < 3; ++b) {
+			const string bname = string("FileBackend::write(") + backends[b] + ")";
+			if (!bench.selected(bname))
+				continue;
+			FileBackendBench *fbb = new FileBackendBench(dir, backends[b], *n*64 + 13);
+			// don't run posix twice when uring is not available
+			if (fbb->type() != backends[b])
+				delete fbb;
+			else
+				bench.run(fbb);
+		}
+
+		// the bursts of a slab of the lattice, as exchanged with a neighboring device
+		if (burst_benchmarks_selected(bench, "synthetic"))
+			add_burst_benchmarks(bench, "synthetic", synthetic_bursts(*n));
+
+		if (bench.selected("HostCellGrid::HostCellGrid"))
+			bench.run(new HostNeibsBench(false, *n));
+		if (bench.selected("HostCellGrid::neighbors"))
+			bench.run(new HostNeibsBench(true, *n));
+
+		if (bench.selected("HostPostProcess::shepard"))
+			bench.run(new HostShepardBench(false, *n));
+		if (bench.selected("HostPostProcess::shepard(fused)"))
+			bench.run(new HostShepardBench(true, *n));
+	}
+
+	if (!bursts.empty() && burst_benchmarks_selected(bench, "recorded"))
+		add_burst_benchmarks(bench, "recorded", recorded_bursts(bursts));
+
+	// one worker per device, up to a full node
+	for (uint workers = 1; workers <= MAX_DEVICES_PER_NODE; workers *= 2)
+		if (bench.selected("Synchronizer::barrier"))
+			bench.run(new BarrierBench(workers, 10000));
+}
@@ -0,0 +1,226 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <cmath>
+#include <ctime>
+
+#include <unistd.h>
+
+#include "MicroBench.h"
+
+using namespace std;
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec*1.0e-9;
+}
+
+double
+BenchResult::mean() const
+{
+	double sum = 0;
+	for (size_t i = 0; i < times.size(); ++i)
+		sum += times[i];
+	return times.empty() ? NAN : sum/times.size();
+}
+
+// sample standard deviation
+double
+BenchResult::stddev() const
+{
+	if (times.size() < 2)
+		return 0;
+	const double avg = mean();
+	double sum = 0;
+	for (size_t i = 0; i < times.size(); ++i)
+		sum += (times[i] - avg)*(times[i] - avg);
+	return sqrt(sum/(times.size() - 1));
+}
+
+double
+BenchResult::min() const
+{
+	return times.empty() ? NAN : *min_element(times.begin(), times.end());
+}
+
+double
+BenchResult::max() const
+{
+	return times.empty() ? NAN : *max_element(times.begin(), times.end());
+}
+
+double
+BenchResult::median() const
+{
+	if (times.empty())
+		return NAN;
+	vector<double> sorted(times);
+	sort(sorted.begin(), sorted.end());
+	const size_t half = sorted.size()/2;
+	return (sorted.size() & 1) ? sorted[half] : (sorted[half - 1] + sorted[half])/2;
+}
+
+MicroBench::MicroBench(uint reps, uint warmup, string const& filter) :
+	m_reps(reps),
+	m_warmup(warmup),
+	m_filter(filter),
+	m_results()
+{}
+
+bool
+MicroBench::selected(string const& name) const
+{
+	return m_filter.empty() || name.find(m_filter) != string::npos;
+}
+
+void
+MicroBench::run(Benchmark *bench)
+{
+	if (!selected(bench->name())) {
+		delete bench;
+		return;
+	}
+
+	BenchResult result;
+	result.name = bench->name();
+	result.params = bench->params();
+	result.items = bench->items();
+	result.items_unit = bench->items_unit();
+
+	cerr << "Running " << result.name;
+	for (BenchParams::const_iterator p(result.params.begin()); p != result.params.end(); ++p)
+		cerr << " " << p->first << "=" << p->second;
+	cerr << " ..." << endl;
+
+	for (uint r = 0; r < m_warmup + m_reps; ++r) {
+		bench->setup();
+		const double start = now();
+		bench->run();
+		const double elapsed = now() - start;
+		bench->teardown();
+		if (r >= m_warmup)
+			result.times.push_back(elapsed);
+	}
+
+	delete bench;
+	m_results.push_back(result);
+}
+
+void
+MicroBench::print_summary(FILE *out) const
+{
+	fprintf(out, "%-32s %-28s %12s %12s %12s %16s\n",
+		"benchmark", "parameters", "mean (ms)", "stddev (ms)", "min (ms)", "throughput");
+	for (vector<BenchResult>::const_iterator r(m_results.begin()); r != m_results.end(); ++r) {
+		ostringstream params;
+		for (BenchParams::const_iterator p(r->params.begin()); p != r->params.end(); ++p)
+			params << (p == r->params.begin() ? "" : ",") << p->first << "=" << p->second;
+		fprintf(out, "%-32s %-28s %12.4f %12.4f %12.4f",
+			r->name.c_str(), params.str().c_str(),
+			r->mean()*1.0e3, r->stddev()*1.0e3, r->min()*1.0e3);
+		if (r->items > 0)
+			fprintf(out, " %9.4g %s/s", r->items/r->mean(), r->items_unit.c_str());
+		fprintf(out, "\n");
+	}
+}
+
+// JSON has no representation for non-finite numbers
+static string
+json_number(double val)
+{
+	if (!isfinite(val))
+		return "null";
+	ostringstream os;
+	os.precision(9);
+	os << val;
+	return os.str();
+}
+
+static string
+json_string(string const& str)
+{
+	string quoted("\"");
+	for (size_t i = 0; i < str.size(); ++i) {
+		if (str[i] == '"' || str[i] == '\\')
+			quoted += '\\';
+		quoted += str[i];
+	}
+	return quoted + "\"";
+}
+
+void
+MicroBench::write_json(ostream &out, string const& problem) const
+{
+	char hostname[256];
+	if (gethostname(hostname, sizeof(hostname)))
+		hostname[0] = '\0';
+	hostname[sizeof(hostname) - 1] = '\0';
+
+	char date[32];
+	time_t rawtime;
+	time(&rawtime);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&rawtime));
+
+	out << "{\n";
+	out << "  \"host\": " << json_string(hostname) << ",\n";
+	out << "  \"date\": " << json_string(date) << ",\n";
+	out << "  \"problem\": " << json_string(problem) << ",\n";
+	out << "  \"repetitions\": " << m_reps << ",\n";
+	out << "  \"warmup\": " << m_warmup << ",\n";
+	out << "  \"benchmarks\": [";
+	for (vector<BenchResult>::const_iterator r(m_results.begin()); r != m_results.end(); ++r) {
+		out << (r == m_results.begin() ? "\n" : ",\n");
+		out << "    {\n";
+		out << "      \"name\": " << json_string(r->name) << ",\n";
+		out << "      \"params\": {";
+		for (BenchParams::const_iterator p(r->params.begin()); p != r->params.end(); ++p)
+			out << (p == r->params.begin() ? " " : ", ") << json_string(p->first) << ": " << json_number(p->second);
+		out << " },\n";
+		out << "      \"repetitions\": " << r->times.size() << ",\n";
+		out << "      \"mean_s\": " << json_number(r->mean()) << ",\n";
+		out << "      \"stddev_s\": " << json_number(r->stddev()) << ",\n";
+		out << "      \"variance_s2\": " << json_number(r->stddev()*r->stddev()) << ",\n";
+		out << "      \"median_s\": " << json_number(r->median()) << ",\n";
+		out << "      \"min_s\": " << json_number(r->min()) << ",\n";
+		out << "      \"max_s\": " << json_number(r->max()) << ",\n";
+		if (r->items > 0) {
+			out << "      \"items\": " << json_number(r->items) << ",\n";
+			out << "      \"items_unit\": " << json_string(r->items_unit) << ",\n";
+			out << "      \"items_per_s\": " << json_number(r->items/r->mean()) << ",\n";
+		}
+		out << "      \"times_s\": [";
+		for (size_t i = 0; i < r->times.size(); ++i)
+			out << (i ? ", " : "") << json_number(r->times[i]);
+		out << "]\n";
+		out << "    }";
+	}
+	out << "\n  ]\n}\n";
+}
@@ -0,0 +1,106 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Minimal harness for the host microbenchmarks */
+
+#ifndef _MICROBENCH_H
+#define _MICROBENCH_H
+
+#include <string>
+#include <vector>
+#include <utility>
+#include <ostream>
+#include <cstdio>
+
+#include "common_types.h"
+
+// benchmark parameters, reported alongside the timings
+typedef std::vector< std::pair<std::string, double> > BenchParams;
+
+/*! A single benchmark: run() is timed, setup() and teardown() are
+ *  called around each repetition but are not timed (e.g. to restore
+ *  the state that run() modifies).
+ */
+class Benchmark
+{
+public:
+	virtual ~Benchmark() {}
+
+	// name, as reported in the output
+	virtual std::string name() const = 0;
+	// parameters of this instance (size of the data etc)
+	virtual BenchParams params() const
+	{ return BenchParams(); }
+	// work done by each run, for the throughput (0 if not meaningful)
+	virtual double items() const
+	{ return 0; }
+	// what items() counts
+	virtual const char *items_unit() const
+	{ return "items"; }
+
+	virtual void setup() {}
+	virtual void run() = 0;
+	virtual void teardown() {}
+};
+
+struct BenchResult
+{
+	std::string			name;
+	BenchParams			params;
+	double				items;
+	std::string			items_unit;
+	std::vector<double>	times; // seconds, one per repetition
+
+	double mean() const;
+	double stddev() const;
+	double min() const;
+	double max() const;
+	double median() const;
+};
+
+class MicroBench
+{
+	uint		m_reps;
+	uint		m_warmup;
+	std::string	m_filter;
+
+	std::vector<BenchResult> m_results;
+
+public:
+	MicroBench(uint reps, uint warmup, std::string const& filter);
+
+	/* Run the benchmark (unless filtered out) and record its timings;
+	 * takes ownership of the benchmark, which is deleted afterwards, so
+	 * that the data of each benchmark is only alive while it runs */
+	void run(Benchmark *bench);
+
+	// skip the benchmarks whose name doesn't contain this
+	bool selected(std::string const& name) const;
+
+	void print_summary(FILE *out) const;
+	void write_json(std::ostream &out, std::string const& problem) const;
+};
+
+#endif
@@ -0,0 +1,471 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Microbenchmarks on the shared host buffers */
+
+#include <fstream>
+#include <algorithm>
+#include <sstream>
+#include <cstdlib>
+#include <iostream>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+#include <unistd.h>
+
+#include "Benchmarks.h"
+#include "BenchContext.h"
+#include "GPUWorker.h"
+#include "VTKWriter.h"
+#include "TextWriter.h"
+#include "HotFile.h"
+#include "CompactPos.h"
+
+using namespace std;
+
+static BenchParams
+size_params(uint numParts, uint devices)
+{
+	BenchParams params;
+	params.push_back(make_pair(string("particles"), double(numParts)));
+	params.push_back(make_pair(string("devices"), double(devices)));
+	return params;
+}
+
+// swap random pairs of particles in all the shared host buffers
+class ParticleSwapBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+	vector<uint>	m_pairs;
+
+public:
+	ParticleSwapBench(BenchContext &ctx) :
+		m_ctx(ctx),
+		m_pairs()
+	{
+		const uint numParts = ctx.gdata()->totParticles;
+		m_pairs.resize(numParts & ~1U);
+		for (size_t i = 0; i < m_pairs.size(); ++i)
+			m_pairs[i] = (uint)(drand48()*numParts) % numParts;
+	}
+
+	string name() const
+	{ return "particleSwap"; }
+	BenchParams params() const
+	{ return size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices); }
+	double items() const
+	{ return m_pairs.size()/2; }
+	const char *items_unit() const
+	{ return "swaps"; }
+
+	void run()
+	{
+		for (size_t i = 0; i < m_pairs.size(); i += 2)
+			m_ctx.particleSwap(m_pairs[i], m_pairs[i + 1]);
+	}
+};
+
+// sort the shuffled particles by device
+class SortByHashBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+
+public:
+	SortByHashBench(BenchContext &ctx) :
+		m_ctx(ctx)
+	{}
+
+	string name() const
+	{ return "sortParticlesByHash"; }
+	BenchParams params() const
+	{ return size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices); }
+	double items() const
+	{ return m_ctx.gdata()->totParticles; }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void setup()
+	{ m_ctx.shuffle_particles(); }
+	void run()
+	{ m_ctx.sortParticlesByHash(); }
+};
+
+// compute the transfer bursts of a device with neighbors on both sides (if any)
+class CellBurstsBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+	GPUWorker		*m_worker;
+	uint			m_bursts;
+
+public:
+	CellBurstsBench(BenchContext &ctx) :
+		m_ctx(ctx),
+		m_worker(ctx.create_worker(ctx.gdata()->devices/2)),
+		m_bursts(0)
+	{}
+
+	~CellBurstsBench()
+	{
+		delete m_worker;
+	}
+
+	string name() const
+	{ return "computeCellBursts"; }
+	BenchParams params() const
+	{
+		BenchParams params;
+		params.push_back(make_pair(string("cells"), double(m_ctx.gdata()->nGridCells)));
+		params.push_back(make_pair(string("devices"), double(m_ctx.gdata()->devices)));
+		return params;
+	}
+	double items() const
+	{ return m_ctx.gdata()->nGridCells; }
+	const char *items_unit() const
+	{ return "cells"; }
+
+	void run()
+	{ m_bursts = m_ctx.computeCellBursts(m_worker); }
+};
+
+// writers that need to set up each write (the VTKWriter, for the multi-block
+// file) do it outside of the timed part
+static void
+start_writing(VTKWriter *writer, double t)
+{ writer->start_writing(t, NO_FLAGS); }
+static void
+start_writing(Writer *, double)
+{}
+
+// save all the particles with the given writer
+template<typename WriterType>
+class WriterBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+	string			m_name;
+	WriterType		*m_writer;
+	double			m_t;
+
+public:
+	WriterBench(BenchContext &ctx, string const& name) :
+		m_ctx(ctx),
+		m_name(name),
+		m_writer(new WriterType(ctx.gdata())),
+		m_t(0)
+	{}
+
+	~WriterBench()
+	{
+		delete m_writer;
+		m_ctx.clean_data_dir();
+	}
+
+	string name() const
+	{ return m_name; }
+	BenchParams params() const
+	{ return size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices); }
+	double items() const
+	{ return m_ctx.gdata()->totParticles; }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void setup()
+	{ start_writing(m_writer, m_t); }
+
+	void run()
+	{
+		GlobalData const* gdata = m_ctx.gdata();
+		m_writer->write(gdata->totParticles, gdata->s_hBuffers, 0, m_t, false);
+	}
+
+	// don't let the output pile up in memory
+	void teardown()
+	{
+		m_t += 1;
+		m_ctx.clean_data_dir();
+	}
+};
+
+// save a checkpoint of all the particles
+class HotFileBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+	string			m_fname;
+
+public:
+	HotFileBench(BenchContext &ctx) :
+		m_ctx(ctx),
+		m_fname(ctx.dir() + "/data/hot_bench.bin")
+	{}
+
+	string name() const
+	{ return "HotFile::save"; }
+	BenchParams params() const
+	{ return size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices); }
+	double items() const
+	{ return m_ctx.gdata()->totParticles; }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void run()
+	{
+		GlobalData const* gdata = m_ctx.gdata();
+		ofstream out(m_fname.c_str(), ios::binary);
+		out.exceptions(ofstream::failbit | ofstream::badbit);
+		HotFile hf(out, gdata, gdata->totParticles, 0, 0.0, false);
+		hf.save();
+		out.close();
+	}
+
+	void teardown()
+	{ unlink(m_fname.c_str()); }
+};
+
+// encode/decode the (cell-relative) positions in the compact format, against
+// a plain copy of the float4 positions as a baseline for the bandwidth
+class CompactPosBench : public Benchmark
+{
+public:
+	enum Op { COPY, ENCODE, DECODE };
+
+private:
+	BenchContext		&m_ctx;
+	const Op			m_op;
+	CompactPosCodec		m_codec;
+	vector<compact_pos>	m_compact;
+	vector<float4>		m_fallback;
+	vector<float4>		m_pos;
+
+	const float4 *pos() const
+	{ return m_ctx.gdata()->s_hBuffers.getData<BUFFER_POS>(); }
+	const particleinfo *info() const
+	{ return m_ctx.gdata()->s_hBuffers.getData<BUFFER_INFO>(); }
+
+	// cell of a cell-relative position, relative to the one of the particle
+	// (as calcHash would compute it)
+	int3 cell_shift(float4 const& p) const
+	{
+		const float3 cellSize = m_ctx.gdata()->cellSize;
+		return make_int3(
+			(int)floorf(p.x/cellSize.x + 0.5f),
+			(int)floorf(p.y/cellSize.y + 0.5f),
+			(int)floorf(p.z/cellSize.z + 0.5f));
+	}
+
+	// the decoded positions must be within max_error() of the original ones,
+	// in the same cell, and with the same mass
+	void check_round_trip() const
+	{
+		const float4 *orig = pos();
+		const float err = m_codec.max_error();
+		for (uint i = 0; i < m_ctx.gdata()->totParticles; ++i) {
+			const float4 p = m_pos[i];
+			if (fabsf(p.x - orig[i].x) > err || fabsf(p.y - orig[i].y) > err ||
+				fabsf(p.z - orig[i].z) > err || memcmp(&p.w, &orig[i].w, sizeof(float)))
+				throw runtime_error(name() + " round trip failed");
+			const int3 shift = cell_shift(p), orig_shift = cell_shift(orig[i]);
+			if (shift.x != orig_shift.x || shift.y != orig_shift.y || shift.z != orig_shift.z)
+				throw runtime_error(name() + " round trip moved a particle to another cell");
+		}
+	}
+
+public:
+	CompactPosBench(BenchContext &ctx, Op op) :
+		m_ctx(ctx),
+		m_op(op),
+		m_codec(ctx.gdata()->cellSize),
+		m_compact(ctx.gdata()->totParticles),
+		m_fallback(),
+		m_pos(ctx.gdata()->totParticles)
+	{
+		const uint numParts = ctx.gdata()->totParticles;
+		m_codec.build_mass_table(pos(), info(), numParts);
+		if (m_op == DECODE)
+			m_codec.encode(pos(), info(), numParts, &m_compact[0], m_fallback);
+	}
+
+	string name() const
+	{
+		switch (m_op) {
+		case COPY: return "CompactPos::copy(float4)";
+		case ENCODE: return "CompactPos::encode";
+		default: return "CompactPos::decode";
+		}
+	}
+	BenchParams params() const
+	{
+		BenchParams params = size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices);
+		params.push_back(make_pair(string("bytes/particle"),
+			double(m_op == COPY ? sizeof(float4) : sizeof(compact_pos))));
+		return params;
+	}
+	double items() const
+	{ return m_ctx.gdata()->totParticles; }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	void setup()
+	{
+		if (m_op == ENCODE)
+			m_fallback.clear();
+	}
+
+	void run()
+	{
+		const uint numParts = m_ctx.gdata()->totParticles;
+		switch (m_op) {
+		case COPY:
+			copy(pos(), pos() + numParts, m_pos.begin());
+			break;
+		case ENCODE:
+			m_codec.encode(pos(), info(), numParts, &m_compact[0], m_fallback);
+			break;
+		case DECODE:
+			m_codec.decode(&m_compact[0], m_fallback.empty() ? NULL : &m_fallback[0],
+				numParts, &m_pos[0]);
+			break;
+		}
+	}
+
+	void teardown()
+	{
+		if (m_op == COPY)
+			return;
+		const uint numParts = m_ctx.gdata()->totParticles;
+		if (m_op == ENCODE)
+			m_codec.decode(&m_compact[0], m_fallback.empty() ? NULL : &m_fallback[0],
+				numParts, &m_pos[0]);
+		check_round_trip();
+	}
+};
+
+/* Hydrostatic initialization of the densities (as set_hydrostatic_level asks
+ * for) with the free surface at the top of the domain: the imbalance between
+ * the pressure and the weight of the fluid along gravity is timed, and must be
+ * within the float rounding of the densities. For reference, the linearized
+ * rho0 g h pressure gives about g*depth/c0^2 (1e-2 for 0.4 m of water with
+ * c0 = 20 m/s) */
+#define HYDROSTATIC_TOLERANCE	1e-3
+
+class HydrostaticBench : public Benchmark
+{
+	BenchContext	&m_ctx;
+	double			m_imbalance;
+	vector<float>	m_rho; // densities of the shared particles, restored in teardown
+
+public:
+	HydrostaticBench(BenchContext &ctx) :
+		m_ctx(ctx),
+		m_imbalance(0),
+		m_rho(ctx.gdata()->totParticles)
+	{
+		Problem *problem = ctx.problem();
+		const double3 up = -make_double3(problem->physparams()->gravity)/
+			length(problem->physparams()->gravity);
+		const double3 origin = problem->get_worldorigin();
+		const double3 size = problem->get_worldsize();
+		problem->set_hydrostatic_level(dot(origin, up) +
+			fmax(up.x, 0)*size.x + fmax(up.y, 0)*size.y + fmax(up.z, 0)*size.z, 0);
+	}
+
+	string name() const
+	{ return "Problem::hydrostatic_imbalance"; }
+	BenchParams params() const
+	{ return size_params(m_ctx.gdata()->totParticles, m_ctx.gdata()->devices); }
+	double items() const
+	{ return m_ctx.gdata()->totParticles; }
+	const char *items_unit() const
+	{ return "particles"; }
+
+	// the particles are shared with the following benchmarks, so the
+	// hydrostatic densities only last until the teardown
+	void setup()
+	{
+		const float4 *vel = m_ctx.gdata()->s_hBuffers.getData<BUFFER_VEL>();
+		for (size_t i = 0; i < m_rho.size(); ++i)
+			m_rho[i] = vel[i].w;
+		m_ctx.problem()->init_hydrostatic(m_ctx.gdata()->s_hBuffers, m_ctx.gdata()->totParticles);
+	}
+
+	void run()
+	{
+		m_imbalance = m_ctx.problem()->hydrostatic_imbalance(m_ctx.gdata()->s_hBuffers,
+			m_ctx.gdata()->totParticles);
+	}
+
+	void teardown()
+	{
+		float4 *vel = m_ctx.gdata()->s_hBuffers.getData<BUFFER_VEL>();
+		for (size_t i = 0; i < m_rho.size(); ++i)
+			vel[i].w = m_rho[i];
+
+		if (!(m_imbalance <= HYDROSTATIC_TOLERANCE)) {
+			ostringstream err;
+			err << name() << ": relative imbalance " << m_imbalance << " above " << HYDROSTATIC_TOLERANCE;
+			throw runtime_error(err.str());
+		}
+	}
+};
+
+void
+add_particle_benchmarks(MicroBench &bench, BenchContext &ctx, vector<uint> const& sizes)
+{
+	GlobalData *gdata = ctx.gdata();
+
+	// the bursts only depend on the grid and the device split
+	if (bench.selected("computeCellBursts")) {
+		ctx.make_particles(gdata->devices);
+		bench.run(new CellBurstsBench(ctx));
+	}
+
+	for (vector<uint>::const_iterator n(sizes.begin()); n != sizes.end(); ++n) {
+		ctx.make_particles(*n);
+
+		bench.run(new ParticleSwapBench(ctx));
+		bench.run(new SortByHashBench(ctx));
+		if (bench.selected("CompactPos::copy(float4)"))
+			bench.run(new CompactPosBench(ctx, CompactPosBench::COPY));
+		if (bench.selected("CompactPos::encode"))
+			bench.run(new CompactPosBench(ctx, CompactPosBench::ENCODE));
+		if (bench.selected("CompactPos::decode"))
+			bench.run(new CompactPosBench(ctx, CompactPosBench::DECODE));
+		if (bench.selected("Problem::hydrostatic_imbalance") &&
+			length(gdata->problem->physparams()->gravity) > 0)
+			bench.run(new HydrostaticBench(ctx));
+		// the writers expect the particles sorted by device
+		if (gdata->devices > 1)
+			ctx.sortParticlesByHash();
+
+		if (bench.selected("VTKWriter::write"))
+			bench.run(new WriterBench<VTKWriter>(ctx, "VTKWriter::write"));
+		if (bench.selected("TextWriter::write"))
+			bench.run(new WriterBench<TextWriter>(ctx, "TextWriter::write"));
+		// checkpoints also save the moving bodies, which are not set up here
+		if (!ctx.problem()->simparams()->numbodies)
+			bench.run(new HotFileBench(ctx));
+		else if (n == sizes.begin())
+			cerr << "WARNING: skipping the HotFile benchmark, the problem has moving bodies" << endl;
+	}
+}
@@ -0,0 +1,246 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* gpusph-microbench: microbenchmarks of the host data paths.
+ *
+ * The host side of GPUSPH (sorting the particles by device, computing the
+ * transfer bursts, writing and reading files, filling geometries, thread
+ * synchronization) is timed in isolation, on synthetic data of the given
+ * sizes, without any device. The compiled-in problem provides the domain,
+ * grid and buffers for the benchmarks that depend on them.
+ * Each benchmark is repeated, and the results (with their variance) are
+ * saved as JSON, so that performance work on these paths can be tracked.
+ */
+
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <unistd.h>
+#include <ftw.h>
+#include <sys/stat.h>
+
+#include "MicroBench.h"
+#include "Benchmarks.h"
+#include "BenchContext.h"
+#include "Options.h"
+
+// the problem selected at compile time (QUOTED_PROBLEM)
+#include "problem_select.opt"
+
+using namespace std;
+
+struct BenchOptions
+{
+	uint			reps;
+	uint			warmup;
+	uint			devices;
+	vector<uint>	sizes;
+	string			filter;
+	string			dir;
+	string			out;
+	vector<string>	bursts;
+	bool			keep;
+
+	BenchOptions() :
+		reps(10),
+		warmup(1),
+		devices(4),
+		sizes(),
+		filter(),
+		dir(),
+		out("microbench.json"),
+		bursts(),
+		keep(false)
+	{}
+};
+
+static void
+print_usage()
+{
+	cout << "Syntax: gpusph-microbench [options]\n";
+	cout << "Options:\n";
+	cout << " --reps N : timed repetitions of each benchmark (default 10)\n";
+	cout << " --warmup N : untimed repetitions before the timed ones (default 1)\n";
+	cout << " --sizes N1,N2,... : number of particles (or points) to benchmark with\n";
+	cout << "                     (default 32768,262144,2097152)\n";
+	cout << " --devices N : number of devices to split the domain across (default 4)\n";
+	cout << " --filter STRING : only run the benchmarks whose name contains STRING\n";
+	cout << " --dir DIR : scratch directory, should be on tmpfs (default /dev/shm/gpusph-microbench-PID)\n";
+	cout << " --keep : don't remove the scratch directory at the end\n";
+	cout << " --out FILE : JSON results (default microbench.json, - for stdout)\n";
+	cout << " --bursts FILE1,FILE2,... : also benchmark the burst compression on the network bursts\n";
+	cout << "                            recorded by GPUSPH --record-bursts\n";
+	cout << " --help : this help\n";
+}
+
+// parse an unsigned integer option, or bail out
+static uint
+parse_uint(const char *opt, const char *arg)
+{
+	char *end;
+	if (!arg)
+		throw invalid_argument(string("missing value for ") + opt);
+	errno = 0;
+	const unsigned long val = strtoul(arg, &end, 10);
+	if (errno || *end || end == arg)
+		throw invalid_argument(string("invalid value for ") + opt + ": " + arg);
+	return val;
+}
+
+static void
+parse_options(int argc, char **argv, BenchOptions &opts)
+{
+	for (int i = 1; i < argc; ++i) {
+		const char *arg = argv[i];
+		const char *val = (i + 1 < argc ? argv[i + 1] : NULL);
+		if (!strcmp(arg, "--help")) {
+			print_usage();
+			exit(0);
+		} else if (!strcmp(arg, "--reps")) {
+			opts.reps = parse_uint(arg, val); ++i;
+		} else if (!strcmp(arg, "--warmup")) {
+			opts.warmup = parse_uint(arg, val); ++i;
+		} else if (!strcmp(arg, "--devices")) {
+			opts.devices = parse_uint(arg, val); ++i;
+		} else if (!strcmp(arg, "--sizes")) {
+			if (!val)
+				throw invalid_argument("missing value for --sizes");
+			istringstream list(val);
+			string item;
+			while (getline(list, item, ','))
+				opts.sizes.push_back(parse_uint(arg, item.c_str()));
+			++i;
+		} else if (!strcmp(arg, "--filter")) {
+			if (!val)
+				throw invalid_argument("missing value for --filter");
+			opts.filter = val; ++i;
+		} else if (!strcmp(arg, "--dir")) {
+			if (!val)
+				throw invalid_argument("missing value for --dir");
+			opts.dir = val; ++i;
+		} else if (!strcmp(arg, "--out")) {
+			if (!val)
+				throw invalid_argument("missing value for --out");
+			opts.out = val; ++i;
+		} else if (!strcmp(arg, "--bursts")) {
+			if (!val)
+				throw invalid_argument("missing value for --bursts");
+			istringstream list(val);
+			string item;
+			while (getline(list, item, ','))
+				opts.bursts.push_back(item);
+			++i;
+		} else if (!strcmp(arg, "--keep")) {
+			opts.keep = true;
+		} else {
+			throw invalid_argument(string("unknown option ") + arg);
+		}
+	}
+
+	if (opts.reps < 1)
+		throw invalid_argument("at least one repetition is needed");
+
+	if (opts.sizes.empty()) {
+		opts.sizes.push_back(32768);
+		opts.sizes.push_back(262144);
+		opts.sizes.push_back(2097152);
+	}
+
+	if (opts.dir.empty()) {
+		ostringstream dir;
+		dir << "/dev/shm/gpusph-microbench-" << getpid();
+		opts.dir = dir.str();
+	}
+}
+
+static int
+remove_entry(const char *path, const struct stat *, int, struct FTW *)
+{
+	if (remove(path))
+		perror(path);
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	BenchOptions opts;
+	try {
+		parse_options(argc, argv, opts);
+	} catch (exception &e) {
+		cerr << e.what() << endl;
+		print_usage();
+		return 1;
+	}
+
+	if (mkdir(opts.dir.c_str(), S_IRWXU) && errno != EEXIST) {
+		perror(opts.dir.c_str());
+		return 1;
+	}
+
+	MicroBench bench(opts.reps, opts.warmup, opts.filter);
+
+	// the problem saves its files (and the writers their output) here
+	Options clOptions;
+	clOptions.dir = opts.dir + "/problem";
+
+	int ret = 0;
+	try {
+		{
+			BenchContext ctx(&clOptions, opts.devices);
+			add_particle_benchmarks(bench, ctx, opts.sizes);
+		}
+		add_data_benchmarks(bench, opts.dir, opts.sizes, opts.bursts);
+	} catch (exception &e) {
+		cerr << "FATAL: " << e.what() << endl;
+		ret = 1;
+	}
+
+	cout << endl;
+	bench.print_summary(stdout);
+
+	if (opts.out == "-") {
+		bench.write_json(cout, QUOTED_PROBLEM);
+	} else {
+		ofstream out(opts.out.c_str());
+		bench.write_json(out, QUOTED_PROBLEM);
+		if (!out) {
+			cerr << "Could not write " << opts.out << endl;
+			ret = 1;
+		} else {
+			cout << "Results saved to " << opts.out << endl;
+		}
+	}
+
+	if (!opts.keep)
+		nftw(opts.dir.c_str(), remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+	return ret;
+}
@@ -36,6 +36,9 @@
 #include "buffer_traits.h"
 #include "buffer_alloc_policy.h"
 
+// contiguous host memory region host buffers can be carved from
+class HostArena;
+
 /* Base class for the Buffer template class.
  * The base pointer is a pointer to pointer to allow easy management
  * of double-(or more)-buffered arrays.
@@ -69,6 +72,10 @@ public:
 	// allocate buffer and return total amount of memory allocated
 	virtual size_t alloc(size_t elems) = 0;
 
+	// set the arena the arrays should be allocated from;
+	// only meaningful for host buffers, ignored by default
+	virtual void set_host_arena(HostArena *) {}
+
 	// base method to return a specific buffer of the array
 	// WARNING: this doesn't check for validity of idx.
 	// We have both const and non-const version
@@ -242,6 +249,9 @@ class BufferList
 
 	map_type m_map;
 
+	// arena the buffers added to this list are allocated from (if any)
+	HostArena *m_arena;
+
 protected:
 	void addExistingBuffer(flag_t Key, AbstractBuffer* buf)
 	{ m_map[Key] = buf; }
@@ -265,7 +275,7 @@ protected:
 
 	friend class MultiBufferList;
 public:
-	BufferList() : m_map() {};
+	BufferList() : m_map(), m_arena(NULL) {};
 
 	~BufferList() {
 		clear();
@@ -375,11 +385,24 @@ public:
 		if (exists != m_map.end()) {
 			throw std::runtime_error("trying to add a buffer for an already-available key!");
 		} else {
-			m_map[Key] = new BufferClass<Key>(_init);
+			AbstractBuffer *buf = new BufferClass<Key>(_init);
+			if (m_arena)
+				buf->set_host_arena(m_arena);
+			m_map[Key] = buf;
 		}
 		return *this;
 	}
 
+	/* Allocate the arrays of the (host) buffers added from now on
+	 * from the given arena, rather than separately.
+	 * The arena must outlive the buffers.
+	 */
+	void setHostArena(HostArena *arena)
+	{ m_arena = arena; }
+
+	HostArena *getHostArena() const
+	{ return m_arena; }
+
 
 	/* map-like interface */
 	// Add more methods/types here as needed
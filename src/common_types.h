@@ -53,16 +53,26 @@ typedef unsigned char uchar;
 // neighbor data
 typedef unsigned short neibdata;
 
-/* The neighbor cell num ranges from 1 to 27 (included), so it fits in
- * 5 bits, which we put in the upper 5 bits of the neibdata, which is
- * 16-bit wide.
+/* The neighbor cell num ranges from 1 to 27 (included) with the standard
+ * cell grid, so it fits in 5 bits, which we put in the upper 5 bits of the
+ * neibdata, which is 16-bit wide. This leaves 11 bits for the index of the
+ * neighbor relative to the start of its cell, so at most 2048 particles per cell.
+ * When the cells are half the neighbor search radius (see
+ * SimParams::nlcellsperradius) the cell num goes up to 125, which needs 7 bits,
+ * leaving 9 bits (512 particles per cell) for the index; since the cells are
+ * then 8 times smaller, this is actually a looser limit.
+ * The shift in use is given by SimParams::get_cellnum_shift(); the kernels
+ * that decode the neighbor list take it as a template parameter, selected at
+ * launch (see CELLNUM_SHIFT_DISPATCH).
  * TODO actually compute this from sizeof(neibdata)
  */
-#define CELLNUM_SHIFT	11
-#define CELLNUM_ENCODED	(1U<<CELLNUM_SHIFT)
-#define NEIBINDEX_MASK	(CELLNUM_ENCODED-1)
-#define ENCODE_CELL(cell) ((cell + 1) << CELLNUM_SHIFT)
-#define DECODE_CELL(data) ((data >> CELLNUM_SHIFT) - 1)
+#define CELLNUM_SHIFT		11
+#define CELLNUM_SHIFT_FINE	9
+#define MAX_NEIB_CELLS	125
+#define CELLNUM_ENCODED(shift)	(1U<<(shift))
+#define NEIBINDEX_MASK(shift)	(CELLNUM_ENCODED(shift)-1)
+#define ENCODE_CELL(cell, shift) ((cell + 1) << (shift))
+#define DECODE_CELL(data, shift) ((data >> (shift)) - 1)
 
 #define NEIBS_END	USHRT_MAX
 #define CELL_EMPTY	UINT_MAX
@@ -27,3 +27,24 @@
 
 // TODO most of it still resides in forces*.cu, should be moved here
 #include "bounds_kernel.cu"
+
+/* Bits of the neibdata used for the neighbor index in its cell (see
+ * CELLNUM_SHIFT), as set up by the engines from SimParams. The kernels
+ * that decode the neighbor list take it as a template parameter, so that
+ * the decoding in their inner loop is done with constant shifts and masks */
+uint neibdata_cellnum_shift = CELLNUM_SHIFT;
+
+/* Launch the given kernel with the cellnum_shift matching
+ * neibdata_cellnum_shift: the launch should pass cellnum_shift as
+ * template argument of the kernel, e.g.
+ *	CELLNUM_SHIFT_DISPATCH(shepardDevice<kerneltype, boundarytype, cellnum_shift>
+ *		<<< numBlocks, numThreads >>>(...));
+ */
+#define CELLNUM_SHIFT_DISPATCH(...) do { \
+	if (neibdata_cellnum_shift == CELLNUM_SHIFT_FINE) { \
+		const uint cellnum_shift = CELLNUM_SHIFT_FINE; \
+		__VA_ARGS__; \
+	} else { \
+		const uint cellnum_shift = CELLNUM_SHIFT; \
+		__VA_ARGS__; \
+	} } while (0)
@@ -31,10 +31,12 @@
 #include <thrust/device_vector.h>
 #include <thrust/tuple.h>
 #include <thrust/iterator/zip_iterator.h>
+#include <thrust/system/cuda/execution_policy.h>
 
 #include "define_buffers.h"
 #include "engine_neibs.h"
 #include "utils.h"
+#include "MemoryRegistry.h"
 
 /* Important notes on block sizes:
 	- a parallel reduction for max neibs number is done inside neiblist, block
@@ -73,13 +75,15 @@
  *		- launch of neighbor list construction kernels
  *
  *	It is templatizd by:
+ *	\tparam kerneltype : SPH kernel (for the Shepard filter fused with the neighbor search)
  *	\tparam boundarytype : type of boundary
  *	\tparam periodicbound : type of periodic boundaries (0 ... 7)
  *	\tparam neibcount : true if we want to compute actual neighbors number
 
  *	\ingroup neibs
 */
-template<SPHFormulation sph_formulation, BoundaryType boundarytype, Periodicity periodicbound, bool neibcount>
+template<KernelType kerneltype, SPHFormulation sph_formulation, BoundaryType boundarytype,
+	Periodicity periodicbound, bool neibcount>
 class CUDANeibsEngine : public AbstractNeibsEngine
 {
 public:
@@ -106,6 +110,26 @@ setconstants(	const SimParams *simparams,		// pointer to simulation parameters s
 {
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_maxneibsnum, &simparams->maxneibsnum, sizeof(uint)));
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_neiblist_stride, &allocatedParticles, sizeof(idx_t)));
+	const int stencilRadius = simparams->get_cell_stencil_radius();
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_cellStencilRadius, &stencilRadius, sizeof(int)));
+	neibdata_cellnum_shift = simparams->get_cellnum_shift();
+
+	// kernel normalization, for the Shepard filter fused with the neighbor search
+	// (same coefficients as in the forces engine)
+	const float h = simparams->slength;
+	const float h3 = h*h*h;
+	float kernelcoeff = 1.0f/(M_PI*h3);
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_wcoeff_cubicspline, &kernelcoeff, sizeof(float)));
+	kernelcoeff = 15.0f/(16.0f*M_PI*h3);
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_wcoeff_quadratic, &kernelcoeff, sizeof(float)));
+	kernelcoeff = 21.0f/(16.0f*M_PI*h3);
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_wcoeff_wendland, &kernelcoeff, sizeof(float)));
+	const float R = simparams->kernelradius;
+	const float R2 = R*R;
+	const float exp_R2 = exp(-R2);
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_wsub_gaussian, &exp_R2, sizeof(float)));
+	kernelcoeff = 1/(-2*exp_R2/3 * h3 * M_PI * R*(3+2*R2) + h3 * pow(M_PI, 1.5) * erf(R));
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_wcoeff_gaussian, &kernelcoeff, sizeof(float)));
 }
 
 /// Download maximum number of neighbors
@@ -133,6 +157,7 @@ resetinfo(void)
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_numInteractions, &temp, sizeof(int)));
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_maxNeibs, &temp, sizeof(int)));
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_hasMaxNeibs, &temp, sizeof(int)));
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_hasCellOverflow, &temp, sizeof(int)));
 	temp = -1;
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuneibs::d_hasTooManyNeibs, &temp, sizeof(int)));
 }
@@ -152,6 +177,7 @@ getinfo(TimingInfo & timingInfo)	// timing info (in, out)
 	CUDA_SAFE_CALL(cudaMemcpyFromSymbol(&timingInfo.maxNeibs, cuneibs::d_maxNeibs, sizeof(int), 0));
 	CUDA_SAFE_CALL(cudaMemcpyFromSymbol(&timingInfo.hasTooManyNeibs, cuneibs::d_hasTooManyNeibs, sizeof(int), 0));
 	CUDA_SAFE_CALL(cudaMemcpyFromSymbol(&timingInfo.hasMaxNeibs, cuneibs::d_hasMaxNeibs, sizeof(int), 0));
+	CUDA_SAFE_CALL(cudaMemcpyFromSymbol(&timingInfo.hasCellOverflow, cuneibs::d_hasCellOverflow, sizeof(int), 0));
 }
 
 /** @} */
@@ -332,6 +358,29 @@ reorderDataAndFindCellStart(
 		CUDA_SAFE_CALL(cudaUnbindTexture(eulerVelTex));
 }
 
+/// Allocator for the temporary storage of the thrust sort,
+/// so that it gets accounted in the MemoryRegistry
+struct registered_temp_allocator
+{
+	typedef char value_type;
+
+	char *allocate(std::ptrdiff_t num_bytes)
+	{
+		char *ptr = NULL;
+		CUDA_SAFE_CALL(cudaMalloc(&ptr, num_bytes));
+		MemoryRegistry::instance().allocated(MemoryRegistry::DEVICE_MEMORY,
+			"thrust temporary", "sort", num_bytes);
+		return ptr;
+	}
+
+	void deallocate(char *ptr, size_t num_bytes)
+	{
+		CUDA_SAFE_CALL(cudaFree(ptr));
+		MemoryRegistry::instance().freed(MemoryRegistry::DEVICE_MEMORY,
+			"thrust temporary", "sort", num_bytes);
+	}
+};
+
 /// Functor to sort particles by hash (cell), and
 /// by fluid number within the cell
 struct ptype_hash_compare :
@@ -372,10 +421,11 @@ sort(	MultiBufferList::const_iterator bufread,
 		thrust::device_pointer_cast(bufwrite->getData<BUFFER_PARTINDEX>());
 
 	ptype_hash_compare comp;
+	registered_temp_allocator temp_alloc;
 
 	// Sort of the particle indices by cell, fluid number and id
 	// There is no need for a stable sort due to the id sort
-	thrust::sort_by_key(
+	thrust::sort_by_key(thrust::cuda::par(temp_alloc),
 		thrust::make_zip_iterator(thrust::make_tuple(particleHash, particleInfo)),
 		thrust::make_zip_iterator(thrust::make_tuple(
 			particleHash + numParticles,
@@ -407,7 +457,11 @@ const	uint		numParticles,
 const	uint		particleRangeEnd,
 const	uint		gridCells,
 const	float		sqinfluenceradius,
-const	float		boundNlSqInflRad)
+const	float		boundNlSqInflRad,
+const	float4		*oldVel,
+		float4		*newVel,
+const	float		slength,
+const	float		influenceradius)
 {
 	// vertices, boundeleme and vertPos must be either all NULL or all not-NULL.
 	// throw otherwise
@@ -440,14 +494,24 @@ const	float		boundNlSqInflRad)
 		CUDA_SAFE_CALL(cudaBindTexture(0, boundTex, boundelem, numParticles*sizeof(float4)));
 	}
 
+	// fused Shepard filter
+	if (newVel)
+		CUDA_SAFE_CALL(cudaBindTexture(0, velTex, oldVel, numParticles*sizeof(float4)));
+
 	buildneibs_params<boundarytype> params(neibsList, pos, particleHash, particleRangeEnd, sqinfluenceradius,
+			newVel, slength, influenceradius,
 			vertPos, boundNlSqInflRad);
 
-	cuneibs::buildNeibsListDevice<sph_formulation, boundarytype, periodicbound, neibcount><<<numBlocks, numThreads>>>(params);
+	CELLNUM_SHIFT_DISPATCH(
+		cuneibs::buildNeibsListDevice<kerneltype, sph_formulation, boundarytype, periodicbound, neibcount, cellnum_shift>
+			<<<numBlocks, numThreads>>>(params));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
 
+	if (newVel)
+		CUDA_SAFE_CALL(cudaUnbindTexture(velTex));
+
 	if (boundarytype == SA_BOUNDARY) {
 		CUDA_SAFE_CALL(cudaUnbindTexture(vertTex));
 		CUDA_SAFE_CALL(cudaUnbindTexture(boundTex));
@@ -65,6 +65,7 @@ namespace cuneibs {
  *  @{ */
 __constant__ uint d_maxneibsnum;		///< Maximum allowed number of neighbors per particle
 __constant__ idx_t d_neiblist_stride;	///< Stride dimension
+__constant__ int d_cellStencilRadius;	///< Radius (in cells) of the neighbor search stencil (1 or 2)
 /** @} */
 /** \name Device variables
  *  @{ */
@@ -72,8 +73,12 @@ __device__ int d_numInteractions;		///< Total number of interactions
 __device__ int d_maxNeibs;				///< Computed maximum number of neighbors per particle
 __device__ int d_hasTooManyNeibs;		///< Index of a particle with more than d_maxneibsnum neighbors
 __device__ int d_hasMaxNeibs;			///< Number of neighbors of that particle
+__device__ int d_hasCellOverflow;		///< Number of particles of the most crowded cell with too many particles for the neibdata encoding (0 if none)
 /** @} */
 
+// kernel functions, for the Shepard filter fused with the neighbor search
+#include "sph_core_utils.cuh"
+
 using namespace cubounds;
 
 /** \name Device functions
@@ -497,20 +502,20 @@ calcNeibCell(
 	gridPos += gridOffset;
 
 	// With periodic boundary when the neighboring cell grid position lies
-	// outside the domain size: we wrap it to the d_gridSize or 0 according
-	// with the chosen periodicity
-	// TODO: verify periodicity along multiple axis
+	// outside the domain size: we wrap it around by d_gridSize according
+	// with the chosen periodicity (the offset can be up to two cells
+	// with finer cells)
 	if (periodicbound) {
 		// Periodicity along x axis
 		if (gridPos.x < 0) {
 			if (periodicbound & PERIODIC_X)
-				gridPos.x = d_gridSize.x - 1;
+				gridPos.x += d_gridSize.x;
 			else
 				return false;
 		}
 		else if (gridPos.x >= d_gridSize.x) {
 			if (periodicbound & PERIODIC_X)
-				gridPos.x = 0;
+				gridPos.x -= d_gridSize.x;
 			else
 				return false;
 		}
@@ -518,13 +523,13 @@ calcNeibCell(
 		// Periodicity along y axis
 		if (gridPos.y < 0) {
 			if (periodicbound & PERIODIC_Y)
-				gridPos.y = d_gridSize.y - 1;
+				gridPos.y += d_gridSize.y;
 			else
 				return false;
 		}
 		else if (gridPos.y >= d_gridSize.y) {
 			if (periodicbound & PERIODIC_Y)
-				gridPos.y = 0;
+				gridPos.y -= d_gridSize.y;
 			else
 				return false;
 		}
@@ -532,13 +537,13 @@ calcNeibCell(
 		// Periodicity along z axis
 		if (gridPos.z < 0) {
 			if (periodicbound & PERIODIC_Z)
-				gridPos.z = d_gridSize.z - 1;
+				gridPos.z += d_gridSize.z;
 			else
 				return false;
 		}
 		else if (gridPos.z >= d_gridSize.z) {
 			if (periodicbound & PERIODIC_Z)
-				gridPos.z = 0;
+				gridPos.z -= d_gridSize.z;
 			else
 				return false;
 		}
@@ -696,6 +701,30 @@ bool isCloseEnough<SA_BOUNDARY>(float3 const& relPos, particleinfo const& neib_i
 		(rp2 < params.boundNlSqInflRad && BOUNDARY(neib_info)));
 }
 
+/// Squared radius of the neighbor search
+/*! Returns the largest squared distance at which isCloseEnough can accept
+ * 	a neighbor, used to skip cells that do not intersect the search sphere.
+ *
+ * 	\param[in] params : build neibs parameters
+ * 	\return : the squared neighbor search radius
+ * 	\tparam boundarytype : the boundary model used
+ */
+template<BoundaryType boundarytype>
+__device__ __forceinline__
+float sqSearchRadius(buildneibs_params<boundarytype> const& params)
+{
+	return params.sqinfluenceradius;
+}
+
+/// Specialization of sqSearchRadius for SA boundaries
+/// \see sqSearchRadius
+template<>
+__device__ __forceinline__
+float sqSearchRadius<SA_BOUNDARY>(buildneibs_params<SA_BOUNDARY> const& params)
+{
+	return fmaxf(params.sqinfluenceradius, params.boundNlSqInflRad);
+}
+
 
 /// Process SA segments in neibsInCell
 /*! Do special treatment for segments when using SA boundaries. Obviously
@@ -767,26 +796,34 @@ void process_niC_segment<SA_BOUNDARY>(const uint index, const uint neib_id, floa
  *	\param[in] pos : position of the current particle
  *	\param[in, out] neibs_num : current number of neighbors found for current particle
  *	\param[in] segment : true if the current particle belongs to a segment
+ *	\param[in] boundary : true if the current particle is a boundary particle
+ *	\param[in] shepard : true if the Shepard sums must be accumulated for the current particle
+ *	\param[in, out] shepard_sums : Shepard filter sums (density and volume) for the current particle
  *
+ *	\tparam kerneltype : the SPH kernel used by the Shepard filter
  *	\tparam boundarytype : the boundary model used
  *	\tparam periodicbound : type of periodic boundaries (0 ... 7)
+ *	\tparam cellnum_shift : bits of the neibdata used for the neighbor index in its cell
  *
  * First and last particle index for grid cells and particle's information
  * are read through texture fetches.
  */
-template <SPHFormulation sph_formulation, BoundaryType boundarytype, Periodicity periodicbound>
+template <KernelType kerneltype, SPHFormulation sph_formulation, BoundaryType boundarytype,
+	Periodicity periodicbound, uint cellnum_shift>
 __device__ __forceinline__ void
 neibsInCell(
 			buildneibs_params<boundarytype>
 				const& params,			// build neibs parameters
 			int3			gridPos,	// current particle grid position
 			const int3		gridOffset,	// cell offset from current particle grid position
-			const uchar		cell,		// cell number (0 ... 26)
+			const uchar		cell,		// cell number (0 ... 26, or 0 ... 124 with finer cells)
 			const uint		index,		// current particle index
 			float3			pos,		// current particle position
 			uint&			neibs_num,	// number of neighbors for the current particle
 			const bool		segment,	// true if the current particle belongs to a segment
-			const bool		boundary)	// true if the current particle is a boundary particle
+			const bool		boundary,	// true if the current particle is a boundary particle
+			const bool		shepard,	// true if the Shepard sums must be accumulated
+			float2&			shepard_sums)	// Shepard filter sums for the current particle
 {
 	// Compute the grid position of the current cell, and return if it's
 	// outside the domain
@@ -801,10 +838,28 @@ neibsInCell(
 	if (var.bucketStart == CELL_EMPTY)
 		return;
 
+	// The index of the neighbors relative to the start of the cell must fit
+	// in the low cellnum_shift bits of the neibdata: flag the cell otherwise,
+	// since the neighbors past the limit would be encoded as different cells
+	if (var.bucketEnd - var.bucketStart > CELLNUM_ENCODED(cellnum_shift)) {
+		atomicMax(&d_hasCellOverflow, (int)(var.bucketEnd - var.bucketStart));
+		return;
+	}
+
 	// Substract gridOffset*cellsize to pos so we don't need to do it each time
 	// we compute relPos respect to potential neighbor
 	pos -= gridOffset*d_cellSize;
 
+	// With cells finer than the search radius, many cells at the corners of the
+	// stencil are out of reach: skip the cell if the distance between the particle
+	// and the cell (pos is now relative to its center) exceeds the search radius.
+	// Segments look at all the cells since they also collect their vertices.
+	if (d_cellStencilRadius > 1 && !segment) {
+		const float3 outside = fmaxf(fabs(pos) - 0.5f*d_cellSize, make_float3(0.0f));
+		if (sqlength(outside) >= sqSearchRadius(params))
+			return;
+	}
+
 	// Iterate over all particles in the cell
 	bool encode_cell = true;
 
@@ -855,10 +910,21 @@ neibsInCell(
 		if (close_enough) {
 			if (neibs_num < d_maxneibsnum) {
 				params.neibsList[neibs_num*d_neiblist_stride + index] =
-						neib_index - var.bucketStart + ((encode_cell) ? ENCODE_CELL(cell) : 0);
+						neib_index - var.bucketStart + ((encode_cell) ? ENCODE_CELL(cell, cellnum_shift) : 0);
 				encode_cell = false;
 			}
 			neibs_num++;
+
+			// Shepard filter fused with the neighbor search: same contributions
+			// as shepardDevice, in the same order as the neighbor list
+			if (shepard && (boundarytype == DYN_BOUNDARY || FLUID(neib_info))) {
+				const float r = length(relPos);
+				if (r < params.influenceradius) {
+					const float w = W<kerneltype>(r, params.slength)*neib_pos.w;
+					shepard_sums.x += w;
+					shepard_sums.y += w/tex1Dfetch(velTex, neib_index).w;
+				}
+			}
 		}
 		if (segment) {
 			process_niC_segment(index, id(neib_info), relPos, params, var);
@@ -877,16 +943,22 @@ neibsInCell(
  * 	parameter params is built on specialized version of
  * 	build_neibs_params according to template values.
  *
+ *	When params.newVel is not NULL, the Shepard filter is computed in the same
+ *	pass (see shepardDevice), saving a separate walk over the neighbor list
+ *	when the filter runs right after a neighbor list construction.
+ *
  *	\param[in, out] params: build neibs parameters
+ *	\tparam kerneltype : SPH kernel (for the fused Shepard filter)
  *	\tparam boundarytype : boundary type (determines which particles have a neib list)
  *	\tparam periodicbound : type periodic boundaries (0 ... 7)
  *	\tparam neibcount : if true we compute maximum neighbor number
+ *	\tparam cellnum_shift : bits of the neibdata used for the neighbor index in its cell
  *
  *	First and last particle index for grid cells and particle's informations
  *	are read through texture fetches.
  */
-template<SPHFormulation sph_formulation, BoundaryType boundarytype, Periodicity periodicbound,
-	bool neibcount>
+template<KernelType kerneltype, SPHFormulation sph_formulation, BoundaryType boundarytype,
+	Periodicity periodicbound, bool neibcount, uint cellnum_shift>
 __global__ void
 /*! \cond */
 __launch_bounds__( BLOCK_SIZE_BUILDNEIBS, MIN_BLOCKS_BUILDNEIBS)
@@ -898,6 +970,12 @@ buildNeibsListDevice(buildneibs_params<boundarytype> params)
 	// Number of neighbors for the current particle
 	uint neibs_num = 0;
 
+	// Fused Shepard filter: velocity of the current particle, kernel sums
+	// for the fluid particles
+	float4 vel = make_float4(0.0f);
+	float2 shepard_sums = make_float2(0.0f);
+	bool shepard = false;
+
 	// Rather than nesting if's, use a do { } while (0) loop with breaks
 	// for early bail outs
 	do {
@@ -941,26 +1019,51 @@ buildNeibsListDevice(buildneibs_params<boundarytype> params)
 
 		const float3 pos3 = make_float3(pos);
 
+		// The Shepard filter only applies to fluid particles:
+		// start the sums from the self contribution
+		shepard = params.newVel && FLUID(info);
+		if (shepard) {
+			vel = tex1Dfetch(velTex, index);
+			shepard_sums.x = pos.w*W<kerneltype>(0, params.slength);
+			shepard_sums.y = shepard_sums.x/vel.w;
+		}
+
 		// Get particle grid position computed from particle hash
 		const int3 gridPos = calcGridPosFromParticleHash(params.particleHash[index]);
 
-		for(int z=-1; z<=1; z++) {
-			for(int y=-1; y<=1; y++) {
-				for(int x=-1; x<=1; x++) {
-					neibsInCell<sph_formulation, boundarytype, periodicbound>(params,
+		// Iterate over the stencil of neighboring cells: the numbering
+		// of the cells must match the one of d_cell_to_offset
+		const int radius = d_cellStencilRadius;
+		const int side = 2*radius + 1;
+		for(int z=-radius; z<=radius; z++) {
+			for(int y=-radius; y<=radius; y++) {
+				for(int x=-radius; x<=radius; x++) {
+					neibsInCell<kerneltype, sph_formulation, boundarytype, periodicbound, cellnum_shift>(params,
 						gridPos,
 						make_int3(x, y, z),
-						(x + 1) + (y + 1)*3 + (z + 1)*9,
+						(x + radius) + (y + radius)*side + (z + radius)*side*side,
 						index,
 						pos3,
 						neibs_num,
 						BOUNDARY(info),
-						BOUNDARY(info));
+						BOUNDARY(info),
+						shepard,
+						shepard_sums);
 				}
 			}
 		}
 	} while (0);
 
+	// Fused Shepard filter: normalize the density of the fluid particles,
+	// copy the velocity of all the others to the new velocity array
+	if (params.newVel && index < params.numParticles) {
+		if (shepard)
+			vel.w = shepard_sums.x/shepard_sums.y;
+		else
+			vel = tex1Dfetch(velTex, index);
+		params.newVel[index] = vel;
+	}
+
 	// Setting the end marker. Must be done here so that
 	// particles for which the neighbor list is not built actually
 	// have an empty neighbor list. Otherwise, particles which are
@@ -39,20 +39,29 @@ struct common_buildneibs_params
 	const	hashKey		*particleHash;			///< particle's hashes (in)
 	const	uint		numParticles;			///< total number of particles
 	const	float		sqinfluenceradius;		///< squared influence radius
+			float4		*newVel;				///< Shepard-filtered velocity and density, NULL if the filter is not fused (out)
+	const	float		slength;				///< smoothing length (Shepard filter)
+	const	float		influenceradius;		///< kernel influence radius (Shepard filter)
 
 	common_buildneibs_params(
 				neibdata	*_neibsList,
 		const	float4		*_pos,
 		const	hashKey		*_particleHash,
 		const	uint		_numParticles,
-		const	float		_sqinfluenceradius) :
+		const	float		_sqinfluenceradius,
+				float4		*_newVel,
+		const	float		_slength,
+		const	float		_influenceradius) :
 		neibsList(_neibsList),
 #if PREFER_L1
 		posArray(_pos),
 #endif
 		particleHash(_particleHash),
 		numParticles(_numParticles),
-		sqinfluenceradius(_sqinfluenceradius)
+		sqinfluenceradius(_sqinfluenceradius),
+		newVel(_newVel),
+		slength(_slength),
+		influenceradius(_influenceradius)
 	{}
 };
 
@@ -91,12 +100,15 @@ struct buildneibs_params :
 		const	hashKey		*_particleHash,
 		const	uint		_numParticles,
 		const	float		_sqinfluenceradius,
+				float4		*_newVel,
+		const	float		_slength,
+		const	float		_influenceradius,
 
 		// SA_BOUNDARY
 				float2	*_vertPos[],
 		const	float	_boundNlSqInflRad) :
 		common_buildneibs_params(_neibsList, _pos, _particleHash,
-			_numParticles, _sqinfluenceradius),
+			_numParticles, _sqinfluenceradius, _newVel, _slength, _influenceradius),
 		COND_STRUCT(boundarytype == SA_BOUNDARY, sa_boundary_buildneibs_params)(
 			_vertPos, _boundNlSqInflRad)
 	{}
@@ -43,7 +43,7 @@
 __constant__ float3	d_worldOrigin;			///< Origin of the simulation domain
 __constant__ float3	d_cellSize;				///< Size of cells used for the neighbor search
 __constant__ uint3	d_gridSize;				///< Size of the simulation domain expressed in terms of cell number
-__constant__ char3	d_cell_to_offset[27];	///< Map neibdata cell number to offset
+__constant__ char3	d_cell_to_offset[MAX_NEIB_CELLS];	///< Map neibdata cell number to offset
 
 /** @} */
 
@@ -53,7 +53,7 @@ __constant__ char3	d_cell_to_offset[27];	///< Map neibdata cell number to offset
 /// Compute offset to neighbor cell
 /*! Return the relative position offset to the center of the neighbor cell
  *
- * \param[in] neib_cellnum : number of neighbor cell (0..26)
+ * \param[in] neib_cellnum : number of neighbor cell (0..26, or 0..124 with finer cells)
  *
  * \return displacement offset
  */
@@ -150,23 +150,39 @@ globalDistance(int3 const& gridPos1, float3 const& pos1,
  *  we have periodic boundary and the grid position is updated according to the
  *  chosen periodicity.
  *
+ *  Each axis is wrapped independently, so cells across an edge or corner of a domain
+ *  periodic along multiple axes are handled correctly. Wrapping is only done along
+ *  the axes that are periodic in periodicbound, since a neighbor cell can only be
+ *  outside of the grid along those. The default (PERIODIC_XYZ) is correct for all
+ *  periodicities, and is used by callers which are not specialized on it.
+ *
  * \param[in] gridPos : grid position
  *
  * \return hash value
  *
+ *	\tparam periodicbound : type of periodic boundaries (0 ... 7)
+ *
  *	Note : no test is done by this function to ensure that grid position is within the
  *	range and no clamping is done
  */
-// TODO: verify periodicity along multiple axis and templatize
+template<Periodicity periodicbound = PERIODIC_XYZ>
 __device__ __forceinline__ uint
 calcGridHashPeriodic(int3 gridPos)
 {
-	if (gridPos.x < 0) gridPos.x = d_gridSize.x - 1;
-	if (gridPos.x >= d_gridSize.x) gridPos.x = 0;
-	if (gridPos.y < 0) gridPos.y = d_gridSize.y - 1;
-	if (gridPos.y >= d_gridSize.y) gridPos.y = 0;
-	if (gridPos.z < 0) gridPos.z = d_gridSize.z - 1;
-	if (gridPos.z >= d_gridSize.z) gridPos.z = 0;
+	// neighbor cells can be up to two cells away (with finer cells),
+	// so shift by the grid size rather than snapping to the opposite side
+	if (periodicbound & PERIODIC_X) {
+		if (gridPos.x < 0) gridPos.x += d_gridSize.x;
+		if (gridPos.x >= d_gridSize.x) gridPos.x -= d_gridSize.x;
+	}
+	if (periodicbound & PERIODIC_Y) {
+		if (gridPos.y < 0) gridPos.y += d_gridSize.y;
+		if (gridPos.y >= d_gridSize.y) gridPos.y -= d_gridSize.y;
+	}
+	if (periodicbound & PERIODIC_Z) {
+		if (gridPos.z < 0) gridPos.z += d_gridSize.z;
+		if (gridPos.z >= d_gridSize.z) gridPos.z -= d_gridSize.z;
+	}
 	return calcGridHash(gridPos);
 }
 
@@ -180,14 +196,18 @@ calcGridHashPeriodic(int3 gridPos)
  * \param[out] pos_corr : pos - current neighbor cell offset
  * \param[in] cellStart : cells first particle index
  * \param[in] neibdata : neighbor data
- * \param[in,out] neib_cellnum : current neighbor cell number (0...27)
+ * \param[in,out] neib_cellnum : current neighbor cell number (0...26, or 0...124 with finer cells)
  * \param[in,out] neib_cell_base_index : index of first particle of the current cell
  *
  * \return neighbor index
  *
+ *	\tparam cellnum_shift : bits of the neibdata used for the neighbor index in its cell (see CELLNUM_SHIFT)
+ *	\tparam periodicbound : type of periodic boundaries (0 ... 7), see calcGridHashPeriodic()
+ *
  * \note neib_cell_num and neib_cell_base_index must be persistent along
  * getNeibIndex calls.
  */
+template<uint cellnum_shift, Periodicity periodicbound = PERIODIC_XYZ>
 __device__ __forceinline__ uint
 getNeibIndex(float4 const&	pos,
 			float3&			pos_corr,
@@ -197,12 +217,12 @@ getNeibIndex(float4 const&	pos,
 			char&			neib_cellnum,
 			uint&			neib_cell_base_index)
 {
-	if (neib_data >= CELLNUM_ENCODED) {
+	if (neib_data >= CELLNUM_ENCODED(cellnum_shift)) {
 		// Update current neib cell number
-		neib_cellnum = DECODE_CELL(neib_data);
+		neib_cellnum = DECODE_CELL(neib_data, cellnum_shift);
 
 		// Compute neighbor index relative to belonging cell
-		neib_data &= NEIBINDEX_MASK;
+		neib_data &= NEIBINDEX_MASK(cellnum_shift);
 
 		// Substract current cell offset vector to pos
 		pos_corr = as_float3(pos) - d_cell_to_offset[neib_cellnum]*d_cellSize;
@@ -210,7 +230,7 @@ getNeibIndex(float4 const&	pos,
 		// Compute index of the first particle in the current cell
 		// use calcGridHashPeriodic because we can only have an out-of-grid cell with neighbors
 		// only in the periodic case.
-		neib_cell_base_index = cellStart[calcGridHashPeriodic(gridPos + d_cell_to_offset[neib_cellnum])];
+		neib_cell_base_index = cellStart[calcGridHashPeriodic<periodicbound>(gridPos + d_cell_to_offset[neib_cellnum])];
 	}
 
 	// Compute and return neighbor index
@@ -62,6 +62,11 @@ setconstants(const PhysParams *physparams,
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_wcoeff_quadratic, &kernelcoeff, sizeof(float)));
 	kernelcoeff = 21.0f/(16.0f*M_PI*h3);
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_wcoeff_wendland, &kernelcoeff, sizeof(float)));
+
+	const uint numsponges = physparams->sponges.size();
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_numsponges, &numsponges, sizeof(uint)));
+	if (numsponges)
+		CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_sponges, &physparams->sponges[0], numsponges*sizeof(sponge_t)));
 }
 
 void
@@ -101,6 +106,12 @@ setrbsteprot(const float* rot, int numbodies)
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_rbsteprot, rot, 9*numbodies*sizeof(float)));
 }
 
+void
+setsettledamping(float rate)
+{
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cueuler::d_settle_damping, &rate, sizeof(float)));
+}
+
 void
 basicstep(
 		MultiBufferList::const_iterator bufread,
@@ -162,9 +173,11 @@ basicstep(
 			newEnergy, oldEnergy, DEDt);
 
 	if (step == 1) {
-		cueuler::eulerDevice<kerneltype, sph_formulation, boundarytype, visctype, simflags><<< numBlocks, numThreads >>>(params);
+		CELLNUM_SHIFT_DISPATCH(cueuler::eulerDevice<kerneltype, sph_formulation, boundarytype, visctype, simflags, cellnum_shift>
+			<<< numBlocks, numThreads >>>(params));
 	} else if (step == 2) {
-		cueuler::eulerDevice<kerneltype, sph_formulation, boundarytype, visctype, simflags><<< numBlocks, numThreads >>>(params);
+		CELLNUM_SHIFT_DISPATCH(cueuler::eulerDevice<kerneltype, sph_formulation, boundarytype, visctype, simflags, cellnum_shift>
+			<<< numBlocks, numThreads >>>(params));
 	} else {
 		throw std::invalid_argument("unsupported predcorr timestep");
 	}
@@ -33,6 +33,7 @@
 #include "particledefine.h"
 #include "textures.cuh"
 #include "multi_gpu_defines.h"
+#include "sponge.h"
 
 namespace cueuler {
 
@@ -47,6 +48,11 @@ __constant__ float3	d_rblinearvel[MAX_BODIES];
 __constant__ float3	d_rbangularvel[MAX_BODIES];
 __constant__ float	d_rbsteprot[9*MAX_BODIES];
 
+__constant__ float	d_settle_damping; //< velocity damping rate during the settling phase (1/s)
+
+__constant__ uint		d_numsponges;
+__constant__ sponge_t	d_sponges[MAX_SPONGES]; //< absorbing layers
+
 __constant__ idx_t	d_neiblist_end; // maxneibsnum * number of allocated particles
 __constant__ idx_t	d_neiblist_stride; // stride between neighbors of the same particle
 
@@ -113,7 +119,7 @@ applyrot2(float* rot, float3 & pos, const float3 & cg)
 template<bool densitySum>
 struct sa_integrate_continuity_equation
 {
-	template<KernelType kerneltype>
+	template<KernelType kerneltype, uint cellnum_shift>
 	__device__ __forceinline__
 	static void
 	computeDensitySumTerms(
@@ -165,7 +171,7 @@ struct sa_integrate_continuity_equation
 
 			if (neib_data == NEIBS_END) break;
 
-			const uint neib_index = getNeibIndex(posN, pos_corr, cellStart, neib_data, gridPos,
+			const uint neib_index = getNeibIndex<cellnum_shift>(posN, pos_corr, cellStart, neib_data, gridPos,
 						neib_cellnum, neib_cell_base_index);
 			const particleinfo neib_info = pinfo[neib_index];
 
@@ -270,7 +276,7 @@ struct sa_integrate_continuity_equation
 		}
 	}
 
-	template<KernelType kerneltype>
+	template<KernelType kerneltype, uint cellnum_shift>
 	__device__ __forceinline__
 	static void
 	with(
@@ -306,7 +312,7 @@ struct sa_integrate_continuity_equation
 };
 
 template<>
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __device__ __forceinline__ void
 sa_integrate_continuity_equation<true>::with(
 	const	float	halfDensity,
@@ -361,7 +367,7 @@ sa_integrate_continuity_equation<true>::with(
 	float gGamDotR = 0.0f;
 	float3 gGam= make_float3(0.0f);
 	// compute new terms based on r^{n+1} and \delta r
-	computeDensitySumTerms<kerneltype>(
+	computeDensitySumTerms<kerneltype, cellnum_shift>(
 		oldPos[index],
 		newPPos,
 		newPVelc,
@@ -423,7 +429,7 @@ sa_integrate_continuity_equation<true>::with(
 }
 
 template<>
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __device__ __forceinline__ void
 sa_integrate_continuity_equation<false>::with(
 	const	float	halfDensity,
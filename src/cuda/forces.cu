@@ -199,6 +199,7 @@ template<
 	SPHFormulation sph_formulation,
 	ViscosityType visctype,
 	BoundaryType boundarytype,
+	Periodicity periodicbound,
 	flag_t simflags>
 class CUDAForcesEngine;
 
@@ -248,8 +249,8 @@ struct CUDADensityHelper<kerneltype, SPH_GRENIER, boundarytype> {
 		float4 *vel = bufwrite->getData<BUFFER_VEL>();
 		float *sigma = bufwrite->getData<BUFFER_SIGMA>();
 
-		cuforces::densityGrenierDevice<kerneltype, boundarytype>
-			<<<numBlocks, numThreads>>>(sigma, pos, vel, info, pHash, vol, cellStart, neibsList, numParticles, slength, influenceradius);
+		CELLNUM_SHIFT_DISPATCH(cuforces::densityGrenierDevice<kerneltype, boundarytype, cellnum_shift>
+			<<<numBlocks, numThreads>>>(sigma, pos, vel, info, pHash, vol, cellStart, neibsList, numParticles, slength, influenceradius));
 
 		// check if kernel invocation generated an error
 		KERNEL_CHECK_ERROR;
@@ -264,6 +265,7 @@ template<
 	SPHFormulation sph_formulation,
 	ViscosityType visctype,
 	BoundaryType boundarytype,
+	Periodicity periodicbound,
 	flag_t simflags>
 class CUDAForcesEngine : public AbstractForcesEngine
 {
@@ -368,17 +370,23 @@ setconstants(const SimParams *simparams, const PhysParams *physparams,
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuforces::d_neiblist_stride, &allocatedParticles, sizeof(idx_t)));
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cuforces::d_neiblist_end, &neiblist_end, sizeof(idx_t)));
 
-	// Neibs cell to offset table
-	char3 cell_to_offset[27];
-	for(char z=-1; z<=1; z++) {
-		for(char y=-1; y<=1; y++) {
-			for(char x=-1; x<=1; x++) {
-				int i = (x + 1) + (y + 1)*3 + (z + 1)*9;
+	// Neibs cell to offset table. The numbering must match the one used
+	// in buildNeibsListDevice
+	const char stencil_radius = simparams->get_cell_stencil_radius();
+	const int stencil_side = 2*stencil_radius + 1;
+	const uint stencil_size = simparams->get_cell_stencil_size();
+	char3 cell_to_offset[MAX_NEIB_CELLS];
+	for(char z=-stencil_radius; z<=stencil_radius; z++) {
+		for(char y=-stencil_radius; y<=stencil_radius; y++) {
+			for(char x=-stencil_radius; x<=stencil_radius; x++) {
+				int i = (x + stencil_radius) + (y + stencil_radius)*stencil_side +
+					(z + stencil_radius)*stencil_side*stencil_side;
 				cell_to_offset[i] =  make_char3(x, y, z);
 			}
 		}
 	}
-	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cubounds::d_cell_to_offset, cell_to_offset, 27*sizeof(char3)));
+	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cubounds::d_cell_to_offset, cell_to_offset, stencil_size*sizeof(char3)));
+	neibdata_cellnum_shift = simparams->get_cellnum_shift();
 
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cubounds::d_worldOrigin, &worldOrigin, sizeof(float3)));
 	CUDA_SAFE_CALL(cudaMemcpyToSymbol(cubounds::d_gridSize, &gridSize, sizeof(uint3)));
@@ -672,8 +680,9 @@ basicstep(
 			keps_dkde, turbvisc, DEDt);
 
 	// FIXME forcesDevice should use simflags, not the neverending pile of booleans
-	cuforces::forcesDevice<kerneltype, sph_formulation, boundarytype, visctype, simflags>
-			<<< numBlocks, numThreads, dummy_shared >>>(params);
+	CELLNUM_SHIFT_DISPATCH(
+		cuforces::forcesDevice<kerneltype, sph_formulation, boundarytype, visctype, periodicbound, simflags, cellnum_shift>
+			<<< numBlocks, numThreads, dummy_shared >>>(params));
 
 	return numBlocks;
 }
@@ -841,8 +850,9 @@ struct CUDAViscEngineHelper<SPSVISC, kerneltype, boundarytype>
 			pos, particleHash, cellStart, neibsList, numParticles, slength, influenceradius,
 			tau[0], tau[1], tau[2], turbvisc);
 
-	cuforces::SPSstressMatrixDevice<kerneltype, boundarytype, (SPSK_STORE_TAU | SPSK_STORE_TURBVISC)>
-		<<<numBlocks, numThreads, dummy_shared>>>(params);
+	CELLNUM_SHIFT_DISPATCH(
+		cuforces::SPSstressMatrixDevice<kerneltype, boundarytype, (SPSK_STORE_TAU | SPSK_STORE_TURBVISC), cellnum_shift>
+			<<<numBlocks, numThreads, dummy_shared>>>(params));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -944,8 +954,8 @@ struct CUDAFilterEngineHelper<SHEPARD_FILTER, kerneltype, boundarytype>
 	dummy_shared = 2560;
 	#endif
 
-	cuforces::shepardDevice<kerneltype, boundarytype><<< numBlocks, numThreads, dummy_shared >>>
-		(pos, newVel, particleHash, cellStart, neibsList, particleRangeEnd, slength, influenceradius);
+	CELLNUM_SHIFT_DISPATCH(cuforces::shepardDevice<kerneltype, boundarytype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(pos, newVel, particleHash, cellStart, neibsList, particleRangeEnd, slength, influenceradius));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -991,8 +1001,8 @@ struct CUDAFilterEngineHelper<MLS_FILTER, kerneltype, boundarytype>
 	dummy_shared = 2560;
 	#endif
 
-	cuforces::MlsDevice<kerneltype, boundarytype><<< numBlocks, numThreads, dummy_shared >>>
-		(pos, newVel, particleHash, cellStart, neibsList, particleRangeEnd, slength, influenceradius);
+	CELLNUM_SHIFT_DISPATCH(cuforces::MlsDevice<kerneltype, boundarytype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(pos, newVel, particleHash, cellStart, neibsList, particleRangeEnd, slength, influenceradius));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -1115,8 +1125,8 @@ saSegmentBoundaryConditions(
 	CUDA_SAFE_CALL(cudaBindTexture(0, infoTex, info, numParticles*sizeof(particleinfo)));
 
 	// execute the kernel
-	cuforces::saSegmentBoundaryConditions<kerneltype><<< numBlocks, numThreads, dummy_shared >>>
-		(oldPos, oldVel, oldTKE, oldEps, oldEulerVel, oldGGam, vertices, vertPos[0], vertPos[1], vertPos[2], particleHash, cellStart, neibsList, particleRangeEnd, deltap, slength, influenceradius, initStep, step, simflags & ENABLE_INLET_OUTLET);
+	CELLNUM_SHIFT_DISPATCH(cuforces::saSegmentBoundaryConditions<kerneltype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(oldPos, oldVel, oldTKE, oldEps, oldEulerVel, oldGGam, vertices, vertPos[0], vertPos[1], vertPos[2], particleHash, cellStart, neibsList, particleRangeEnd, deltap, slength, influenceradius, initStep, step, simflags & ENABLE_INLET_OUTLET));
 
 	CUDA_SAFE_CALL(cudaUnbindTexture(boundTex));
 	CUDA_SAFE_CALL(cudaUnbindTexture(infoTex));
@@ -1173,10 +1183,10 @@ saVertexBoundaryConditions(
 	#endif
 
 	// execute the kernel
-	cuforces::saVertexBoundaryConditions<kerneltype><<< numBlocks, numThreads, dummy_shared >>>
+	CELLNUM_SHIFT_DISPATCH(cuforces::saVertexBoundaryConditions<kerneltype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
 		(oldPos, oldVel, oldTKE, oldEps, oldGGam, oldEulerVel, forces, contupd, vertices, vertPos[0], vertPos[1], vertPos[2], info, particleHash, cellStart, neibsList,
 		 particleRangeEnd, numParticles, newNumParticles, dt, step, deltap, slength, influenceradius, initStep, resume, deviceId, numDevices, 
-		 totParticles);
+		 totParticles));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -1210,8 +1220,8 @@ initIOmass_vertexCount(
 	float4 *forces = bufwrite->getData<BUFFER_FORCES>();
 
 	// execute the kernel
-	cuforces::initIOmass_vertexCount<kerneltype><<< numBlocks, numThreads, dummy_shared >>>
-		(vertices, pHash, info, cellStart, neibsList, forces, particleRangeEnd);
+	CELLNUM_SHIFT_DISPATCH(cuforces::initIOmass_vertexCount<kerneltype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(vertices, pHash, info, cellStart, neibsList, forces, particleRangeEnd));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -1246,8 +1256,8 @@ initIOmass(
 	float4 *newPos = bufwrite->getData<BUFFER_POS>();
 
 	// execute the kernel
-	cuforces::initIOmass<kerneltype><<< numBlocks, numThreads, dummy_shared >>>
-		(oldPos, forces, vertices, pHash, info, cellStart, neibsList, newPos, particleRangeEnd, deltap);
+	CELLNUM_SHIFT_DISPATCH(cuforces::initIOmass<kerneltype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(oldPos, forces, vertices, pHash, info, cellStart, neibsList, newPos, particleRangeEnd, deltap));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -1286,8 +1296,8 @@ initGamma(
 	float4 *boundelement = bufwrite->getData<BUFFER_BOUNDELEMENTS>();
 
 	// execute the kernel
-	cuforces::initGamma<kerneltype><<< numBlocks, numThreads, dummy_shared >>>
-		(newGGam, boundelement, pos, oldGGam, vertices, vertPos[0], vertPos[1], vertPos[2], pHash, info, cellStart, neibsList, particleRangeEnd, slength, deltap, influenceradius, epsilon);
+	CELLNUM_SHIFT_DISPATCH(cuforces::initGamma<kerneltype, cellnum_shift><<< numBlocks, numThreads, dummy_shared >>>
+		(newGGam, boundelement, pos, oldGGam, vertices, vertPos[0], vertPos[1], vertPos[2], pHash, info, cellStart, neibsList, particleRangeEnd, slength, deltap, influenceradius, epsilon));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
@@ -1303,6 +1313,25 @@ downloadIOwaterdepth(
 	CUDA_SAFE_CALL(cudaMemcpy(h_IOwaterdepth, d_IOwaterdepth, numOpenBoundaries*sizeof(int), cudaMemcpyDeviceToHost));
 }
 
+// Combines the partial waterdepth of the other devices into the local one
+void
+reduceIOwaterdepth(
+			uint*	d_IOwaterdepth,
+	const	uint*	d_peerIOwaterdepth,
+	const	uint	deviceIndex,
+	const	uint	numDevices,
+	const	uint	numOpenBoundaries)
+{
+	uint numThreads = BLOCK_SIZE_FORCES;
+	uint numBlocks = div_up(numOpenBoundaries, numThreads);
+
+	cuforces::reduceIOwaterdepthDevice<<<numBlocks, numThreads>>>
+		(d_IOwaterdepth, d_peerIOwaterdepth, deviceIndex, numDevices, numOpenBoundaries);
+
+	// check if kernel invocation generated an error
+	KERNEL_CHECK_ERROR;
+}
+
 // Upload the global waterdepth to the GPU
 void
 uploadIOwaterdepth(
@@ -1313,6 +1342,36 @@ uploadIOwaterdepth(
 	CUDA_SAFE_CALL(cudaMemcpy(d_IOwaterdepth, h_IOwaterdepth, numOpenBoundaries*sizeof(int), cudaMemcpyHostToDevice));
 }
 
+// Imposes the boundary conditions interpolated from the coarse samples
+void
+imposeNestedBoundaryConditions(
+	MultiBufferList::iterator		bufwrite,
+	MultiBufferList::const_iterator	bufread,
+	const	float4*			samplePos,
+	const	float4*			sampleVal,
+	const	uint			numSamples,
+	const	uint			particleRangeEnd)
+{
+	float4	*newVel = bufwrite->getData<BUFFER_VEL>();
+	float4	*newEulerVel = bufwrite->getData<BUFFER_EULERVEL>();
+	float	*newTke = bufwrite->getData<BUFFER_TKE>();
+	float	*newEpsilon = bufwrite->getData<BUFFER_EPSILON>();
+
+	const particleinfo *info = bufread->getData<BUFFER_INFO>();
+	const float4 *oldPos = bufread->getData<BUFFER_POS>();
+	const hashKey *particleHash = bufread->getData<BUFFER_HASH>();
+
+	uint numThreads = BLOCK_SIZE_FORCES;
+	uint numBlocks = div_up(particleRangeEnd, numThreads);
+
+	cuforces::imposeNestedBoundaryConditionsDevice<<< numBlocks, numThreads >>>
+		(newVel, newEulerVel, newTke, newEpsilon, oldPos, info, particleHash,
+		 samplePos, sampleVal, numSamples, particleRangeEnd);
+
+	// check if kernel invocation generated an error
+	KERNEL_CHECK_ERROR;
+}
+
 // Identifies vertices at the corners of open boundaries
 void
 saIdentifyCornerVertices(
@@ -1340,7 +1399,7 @@ saIdentifyCornerVertices(
 	dummy_shared = 2560;
 	#endif
 	// execute the kernel
-	cuforces::saIdentifyCornerVertices<<< numBlocks, numThreads, dummy_shared >>> (
+	CELLNUM_SHIFT_DISPATCH(cuforces::saIdentifyCornerVertices<cellnum_shift><<< numBlocks, numThreads, dummy_shared >>> (
 		oldPos,
 		info,
 		particleHash,
@@ -1349,7 +1408,7 @@ saIdentifyCornerVertices(
 		neibsList,
 		numParticles,
 		deltap,
-		eps);
+		eps));
 
 	// check if kernel invocation generated an error
 	KERNEL_CHECK_ERROR;
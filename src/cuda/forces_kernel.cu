@@ -645,7 +645,8 @@ symtensor3 fetchTau(uint i)
 */
 template<KernelType kerneltype,
 	BoundaryType boundarytype,
-	uint simflags>
+	uint simflags,
+	uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SPS, MIN_BLOCKS_SPS)
 SPSstressMatrixDevice(sps_params<kerneltype, boundarytype, simflags> params)
@@ -693,7 +694,7 @@ SPSstressMatrixDevice(sps_params<kerneltype, boundarytype, simflags> params)
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, params.cellStart,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, params.cellStart,
 				neib_data, gridPos, neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -785,7 +786,7 @@ SPSstressMatrixDevice(sps_params<kerneltype, boundarytype, simflags> params)
  _all_ neighbors (not just the same-fluid ones) which is used in the continuity
  equation as well as the Navier-Stokes equation
 */
-template<KernelType kerneltype, BoundaryType boundarytype>
+template<KernelType kerneltype, BoundaryType boundarytype, uint cellnum_shift>
 __global__ void
 densityGrenierDevice(
 			float* __restrict__		sigmaArray,
@@ -845,7 +846,7 @@ densityGrenierDevice(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 			neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -917,7 +918,7 @@ densityGrenierDevice(
  crossed. The vertices of this segment are then used to identify how the mass of this fluid particle is
  split.
 */
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 saSegmentBoundaryConditions(			float4*		oldPos,
@@ -1007,7 +1008,7 @@ saSegmentBoundaryConditions(			float4*		oldPos,
 
 			if (neib_data == NEIBS_END) break;
 
-			const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+			const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 						neib_cellnum, neib_cell_base_index);
 
 			// Compute relative position vector and distance
@@ -1187,7 +1188,7 @@ saSegmentBoundaryConditions(			float4*		oldPos,
 
 			if (neib_data == NEIBS_END) break;
 
-			const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+			const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 						neib_cellnum, neib_cell_base_index);
 			const particleinfo neib_info = tex1Dfetch(infoTex, neib_index);
 
@@ -1299,7 +1300,7 @@ saSegmentBoundaryConditions(			float4*		oldPos,
  *	\param[in] deviceId : current device identifier
  *	\param[in] numDevices : total number of devices; used for id generation of new fluid particles
  */
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 saVertexBoundaryConditions(
@@ -1385,7 +1386,7 @@ saVertexBoundaryConditions(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -1693,7 +1694,7 @@ saVertexBoundaryConditions(
  *	\param[in] slength : the smoothing length
  *	\param[in] influenceradius : the kernel radius
  */
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 initGamma(
@@ -1746,7 +1747,7 @@ initGamma(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -1835,7 +1836,7 @@ initGamma(
  *	\param[in] slength : the smoothing length
  *	\param[in] influenceradius : the kernel radius
  */
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 initIOmass_vertexCount(
@@ -1876,7 +1877,7 @@ initIOmass_vertexCount(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -1916,7 +1917,7 @@ initIOmass_vertexCount(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -1933,7 +1934,7 @@ initIOmass_vertexCount(
 	forces[index].w = (float)(vertexCount);
 }
 
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 initIOmass(
@@ -1990,7 +1991,7 @@ initIOmass(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -2030,7 +2031,7 @@ initIOmass(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -2077,7 +2078,8 @@ initIOmass(
 
 //! This kernel computes the Sheppard correction
 template<KernelType kerneltype,
-	BoundaryType boundarytype>
+	BoundaryType boundarytype,
+	uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 shepardDevice(	const float4*	posArray,
@@ -2136,7 +2138,7 @@ shepardDevice(	const float4*	posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -2176,7 +2178,8 @@ shepardDevice(	const float4*	posArray,
 
 //! This kernel computes the MLS correction
 template<KernelType kerneltype,
-	BoundaryType boundarytype>
+	BoundaryType boundarytype,
+	uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_MLS, MIN_BLOCKS_MLS)
 MlsDevice(	const float4*	posArray,
@@ -2242,7 +2245,7 @@ MlsDevice(	const float4*	posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -2345,7 +2348,7 @@ MlsDevice(	const float4*	posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 			neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -2488,12 +2491,124 @@ disableOutgoingPartsDevice(			float4*		oldPos,
 	}
 }
 
+//! Combines the partial water depth computed by the devices of a node
+/*!
+ One thread per open boundary: the local value is replaced by the maximum
+ over the partial values of all the devices, which have been previously
+ copied into peerIOwaterdepth (numOpenBoundaries entries per device; the
+ slot of the current device is not used).
+*/
+__global__ void
+reduceIOwaterdepthDevice(			uint*	IOwaterdepth,
+							const	uint*	peerIOwaterdepth,
+							const	uint	deviceIndex,
+							const	uint	numDevices,
+							const	uint	numOpenBoundaries)
+{
+	const uint ob = INTMUL(blockIdx.x,blockDim.x) + threadIdx.x;
+
+	if (ob >= numOpenBoundaries)
+		return;
+
+	uint depth = IOwaterdepth[ob];
+	for (uint d = 0; d < numDevices; ++d) {
+		if (d == deviceIndex) continue;
+		depth = max(depth, peerIOwaterdepth[d*numOpenBoundaries + ob]);
+	}
+	IOwaterdepth[ob] = depth;
+}
+
+//! Imposes open boundary conditions from the samples of a coarse simulation
+/*!
+ Velocity (for velocity-driven boundaries) or pressure (for pressure-driven
+ ones) is interpolated at the vertex from the coarse samples by inverse
+ distance weighting. Samples with .w = 0 in samplePos (dry in the coarse
+ simulation) are skipped; if all of them are, the previous eulerVel of the
+ vertex is kept. Corners are treated as in the problem-specific
+ imposeBoundaryCondition kernels.
+ Each vertex scans all the samples, so the cost is O(vertices*samples):
+ this is meant for the few hundred probes of a coarse run around the fine
+ domain, not for dense sample sets.
+*/
+__global__ void
+imposeNestedBoundaryConditionsDevice(
+				float4*			newVel,
+				float4*			newEulerVel,
+				float*			newTke,
+				float*			newEpsilon,
+		const	float4*			oldPos,
+		const	particleinfo*	pinfo,
+		const	hashKey*		particleHash,
+		const	float4*			samplePos,
+		const	float4*			sampleVal,
+		const	uint			numSamples,
+		const	uint			numParticles)
+{
+	const uint index = INTMUL(blockIdx.x,blockDim.x) + threadIdx.x;
+
+	if (index >= numParticles)
+		return;
+
+	const particleinfo info = pinfo[index];
+	if (!((VERTEX(info) || BOUNDARY(info)) && IO_BOUNDARY(info) && (!CORNER(info) || !VEL_IO(info))))
+		return;
+
+	float4 eulerVel = make_float4(0.0f, 0.0f, 0.0f, d_rho0[fluid_num(info)]);
+	// for corners of pressure boundaries with k-epsilon, keep the viscous information
+	if (CORNER(info) && newTke && !VEL_IO(info))
+		eulerVel = newEulerVel[index];
+
+	const float3 absPos = d_worldOrigin + as_float3(oldPos[index])
+		+ calcGridPosFromParticleHash(particleHash[index])*d_cellSize
+		+ 0.5f*d_cellSize;
+
+	// inverse distance weighting
+	float4 val = make_float4(0.0f);
+	float wsum = 0.0f;
+	for (uint s = 0; s < numSamples; ++s) {
+		const float4 spos = samplePos[s];
+		if (spos.w == 0.0f)
+			continue;
+		const float r2 = sqlength(absPos - as_float3(spos));
+		// on a sample: take its value
+		if (r2 < 1.0e-12f) {
+			val = sampleVal[s];
+			wsum = 1.0f;
+			break;
+		}
+		const float w = 1.0f/r2;
+		val += w*sampleVal[s];
+		wsum += w;
+	}
+	if (wsum > 0.0f) {
+		val /= wsum;
+		if (VEL_IO(info)) {
+			eulerVel.x = val.x;
+			eulerVel.y = val.y;
+			eulerVel.z = val.z;
+		} else {
+			eulerVel.w = RHO(val.w, fluid_num(info));
+		}
+	} else {
+		// no (wet) sample: keep the previous value
+		eulerVel = newEulerVel[index];
+	}
+
+	newVel[index] = make_float4(0.0f);
+	newEulerVel[index] = eulerVel;
+	if (newTke)
+		newTke[index] = 0.0f;
+	if (newEpsilon)
+		newEpsilon[index] = 0.0f;
+}
+
 //! Identify corner vertices on open boundaries
 /*!
  Corner vertices are vertices that have segments that are not part of an open boundary. These
  vertices are treated slightly different when imposing the boundary conditions during the
  computation in saVertexBoundaryConditions.
 */
+template<uint cellnum_shift>
 __global__ void
 __launch_bounds__(BLOCK_SIZE_SHEPARD, MIN_BLOCKS_SHEPARD)
 saIdentifyCornerVertices(
@@ -2537,7 +2652,7 @@ saIdentifyCornerVertices(
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		const particleinfo neib_info = pinfo[neib_index];
@@ -130,7 +130,7 @@ struct CUDAPostProcessEngineHelper<VORTICITY, kerneltype, simflags>
 		CUDA_SAFE_CALL(cudaBindTexture(0, velTex, vel, numParticles*sizeof(float4)));
 		CUDA_SAFE_CALL(cudaBindTexture(0, infoTex, info, numParticles*sizeof(particleinfo)));
 
-		cupostprocess::calcVortDevice<kerneltype><<< numBlocks, numThreads >>>
+		CELLNUM_SHIFT_DISPATCH(cupostprocess::calcVortDevice<kerneltype, cellnum_shift><<< numBlocks, numThreads >>>
 			(	pos,
 				vort,
 				particleHash,
@@ -138,7 +138,7 @@ struct CUDAPostProcessEngineHelper<VORTICITY, kerneltype, simflags>
 				neibsList,
 				particleRangeEnd,
 				gdata->problem->simparams()->slength,
-				gdata->problem->simparams()->influenceRadius);
+				gdata->problem->simparams()->influenceRadius));
 
 		// check if kernel invocation generated an error
 		KERNEL_CHECK_ERROR;
@@ -194,7 +194,7 @@ struct CUDAPostProcessEngineHelper<TESTPOINTS, kerneltype, simflags>
 		CUDA_SAFE_CALL(cudaBindTexture(0, infoTex, info, numParticles*sizeof(particleinfo)));
 
 		// execute the kernel
-		cupostprocess::calcTestpointsVelocityDevice<kerneltype><<< numBlocks, numThreads >>>
+		CELLNUM_SHIFT_DISPATCH(cupostprocess::calcTestpointsVelocityDevice<kerneltype, cellnum_shift><<< numBlocks, numThreads >>>
 			(	pos,
 				newVel,
 				newTke,
@@ -204,7 +204,7 @@ struct CUDAPostProcessEngineHelper<TESTPOINTS, kerneltype, simflags>
 				neibsList,
 				particleRangeEnd,
 				gdata->problem->simparams()->slength,
-				gdata->problem->simparams()->influenceRadius);
+				gdata->problem->simparams()->influenceRadius));
 
 		// check if kernel invocation generated an error
 		KERNEL_CHECK_ERROR;
@@ -261,7 +261,7 @@ struct CUDAPostProcessEngineHelper<SURFACE_DETECTION, kerneltype, simflags>
 
 		// execute the kernel
 		if (options & BUFFER_NORMALS) {
-			cupostprocess::calcSurfaceparticleDevice<kerneltype, simflags, true><<< numBlocks, numThreads >>>
+			CELLNUM_SHIFT_DISPATCH(cupostprocess::calcSurfaceparticleDevice<kerneltype, simflags, true, cellnum_shift><<< numBlocks, numThreads >>>
 				(	pos,
 					normals,
 					newInfo,
@@ -270,9 +270,9 @@ struct CUDAPostProcessEngineHelper<SURFACE_DETECTION, kerneltype, simflags>
 					neibsList,
 					particleRangeEnd,
 					gdata->problem->simparams()->slength,
-					gdata->problem->simparams()->influenceRadius);
+					gdata->problem->simparams()->influenceRadius));
 		} else {
-			cupostprocess::calcSurfaceparticleDevice<kerneltype, simflags, false><<< numBlocks, numThreads >>>
+			CELLNUM_SHIFT_DISPATCH(cupostprocess::calcSurfaceparticleDevice<kerneltype, simflags, false, cellnum_shift><<< numBlocks, numThreads >>>
 				(	pos,
 					normals,
 					newInfo,
@@ -281,7 +281,7 @@ struct CUDAPostProcessEngineHelper<SURFACE_DETECTION, kerneltype, simflags>
 					neibsList,
 					particleRangeEnd,
 					gdata->problem->simparams()->slength,
-					gdata->problem->simparams()->influenceRadius);
+					gdata->problem->simparams()->influenceRadius));
 		}
 
 		// check if kernel invocation generated an error
@@ -421,7 +421,7 @@ struct CUDAPostProcessEngineHelper<CALC_PRIVATE, kerneltype, simflags>
 		CUDA_SAFE_CALL(cudaBindTexture(0, velTex, vel, numParticles*sizeof(float4)));
 
 		//execute kernel
-		cupostprocess::calcPrivateDevice<<<numBlocks, numThreads>>>
+		CELLNUM_SHIFT_DISPATCH(cupostprocess::calcPrivateDevice<cellnum_shift><<<numBlocks, numThreads>>>
 			(	pos,
 				priv,
 				particleHash,
@@ -429,7 +429,7 @@ struct CUDAPostProcessEngineHelper<CALC_PRIVATE, kerneltype, simflags>
 				neibsList,
 				gdata->problem->simparams()->slength,
 				gdata->problem->simparams()->influenceRadius,
-				numParticles);
+				numParticles));
 
 		#if !PREFER_L1
 		CUDA_SAFE_CALL(cudaUnbindTexture(posTex));
@@ -65,7 +65,7 @@ __constant__ float	d_cosconeanglenonfluid;
 /************************************************************************************************************/
 
 //! Computes the vorticity field
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 calcVortDevice(	const	float4*		posArray,
 						float3*		vorticity,
@@ -110,7 +110,7 @@ calcVortDevice(	const	float4*		posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -147,7 +147,7 @@ calcVortDevice(	const	float4*		posArray,
 
 
 //! Compute the values of velocity, density, k and epsilon at test points
-template<KernelType kerneltype>
+template<KernelType kerneltype, uint cellnum_shift>
 __global__ void
 calcTestpointsVelocityDevice(	const float4*	oldPos,
 								float4*			newVel,
@@ -198,7 +198,7 @@ calcTestpointsVelocityDevice(	const float4*	oldPos,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -265,7 +265,7 @@ calcTestpointsVelocityDevice(	const float4*	oldPos,
 
 
 //! Identifies particles which form the free-surface
-template<KernelType kerneltype, flag_t simflags, bool savenormals>
+template<KernelType kerneltype, flag_t simflags, bool savenormals, uint cellnum_shift>
 __global__ void
 calcSurfaceparticleDevice(	const	float4*			posArray,
 									float4*			normals,
@@ -317,7 +317,7 @@ calcSurfaceparticleDevice(	const	float4*			posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -373,7 +373,7 @@ calcSurfaceparticleDevice(	const	float4*			posArray,
 
 		if (neib_data == NEIBS_END) break;
 
-		const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+		const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 					neib_cellnum, neib_cell_base_index);
 
 		// Compute relative position vector and distance
@@ -425,6 +425,7 @@ calcSurfaceparticleDevice(	const	float4*			posArray,
 /*!
  This function computes an arbitrary passive array. It can be used for debugging purposes or passive scalars
 */
+template<uint cellnum_shift>
 __global__ void
 calcPrivateDevice(	const	float4*		pos_array,
 							float*		priv,
@@ -462,7 +463,7 @@ calcPrivateDevice(	const	float4*		pos_array,
 
 			if (neib_data == NEIBS_END) break;
 
-			const uint neib_index = getNeibIndex(pos, pos_corr, cellStart, neib_data, gridPos,
+			const uint neib_index = getNeibIndex<cellnum_shift>(pos, pos_corr, cellStart, neib_data, gridPos,
 						neib_cellnum, neib_cell_base_index);
 
 			// Compute relative position vector and distance
@@ -269,6 +269,16 @@ downloadIOwaterdepth(
 	const	uint*	d_IOwaterdepth,
 	const	uint	numObjects) = 0;
 
+// combines the partial waterdepth of the other devices (in peerIOwaterdepth,
+// numObjects entries per device) into the local one
+virtual void
+reduceIOwaterdepth(
+			uint*	d_IOwaterdepth,
+	const	uint*	d_peerIOwaterdepth,
+	const	uint	deviceIndex,
+	const	uint	numDevices,
+	const	uint	numObjects) = 0;
+
 // upload the global waterdepth to the GPU
 virtual void
 uploadIOwaterdepth(
@@ -276,6 +286,18 @@ uploadIOwaterdepth(
 			uint*	d_IOwaterdepth,
 	const	uint	numObjects) = 0;
 
+// imposes on open boundary vertices the velocity/pressure interpolated from the
+// samples of a coarse simulation (one-way nesting); sample positions have .w = 0
+// when the sample should be ignored
+virtual void
+imposeNestedBoundaryConditions(
+	MultiBufferList::iterator		bufwrite,
+	MultiBufferList::const_iterator	bufread,
+	const	float4*			samplePos,
+	const	float4*			sampleVal,
+	const	uint			numSamples,
+	const	uint			particleRangeEnd) = 0;
+
 // identifies vertices at the corners of open boundaries
 virtual void
 saIdentifyCornerVertices(
@@ -65,6 +65,11 @@ public:
 	virtual void
 	setrbangularvel(const float3* angularvel, int numbodies) = 0;
 
+	/// Velocity damping rate (1/s) of the fluid during the settling phase
+	// (zero to disable)
+	virtual void
+	setsettledamping(float rate) = 0;
+
 	/// Single integration 
 	// TODO will probably need to be made more generic for other
 	// integration schemes
@@ -107,6 +107,12 @@ public:
 					const uint			particleRangeEnd,
 					const uint			gridCells,
 					const float			sqinfluenceradius,
-					const float			boundNlSqInflRad) = 0;
+					const float			boundNlSqInflRad,
+					// Shepard filter fused with the neighbor search:
+					// newVel is NULL when the filter is not fused
+					const float4*		oldVel,
+					float4*				newVel,
+					const float			slength,
+					const float			influenceradius) = 0;
 };
 #endif
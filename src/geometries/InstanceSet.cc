@@ -0,0 +1,372 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cmath>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "InstanceSet.h"
+
+using namespace std;
+
+// maximum number of instances in a leaf of the BVH
+static const uint BVH_LEAF_SIZE = 4;
+
+// below this number of points, the copy is not worth the threads
+static const size_t MIN_PARALLEL_POINTS = 1 << 16;
+
+static inline double3
+min3(const double3 &a, const double3 &b)
+{ return make_double3(min(a.x, b.x), min(a.y, b.y), min(a.z, b.z)); }
+
+static inline double3
+max3(const double3 &a, const double3 &b)
+{ return make_double3(max(a.x, b.x), max(a.y, b.y), max(a.z, b.z)); }
+
+// a range of instances to copy the prototype points to
+struct replicate_job {
+	const InstanceSet	*set;
+	const PointVect		*local;
+	Point				*out;
+	uint				begin, end;
+};
+
+// order instances by the center of their bounding box, along an axis
+struct center_less {
+	const vector<double3>	&bmin, &bmax;
+	int						axis;
+
+	center_less(vector<double3> const& _bmin, vector<double3> const& _bmax, int _axis) :
+		bmin(_bmin), bmax(_bmax), axis(_axis)
+	{}
+
+	double center(uint i) const
+	{
+		const double3 c = bmin[i] + bmax[i];
+		return axis == 0 ? c.x : axis == 1 ? c.y : c.z;
+	}
+
+	bool operator()(uint a, uint b) const
+	{ return center(a) < center(b); }
+};
+
+InstanceSet::InstanceSet(Object *prototype, vector<double3> const& offsets,
+	vector<EulerParameters> const& orientations) :
+	m_proto(prototype),
+	m_offsets(offsets)
+{
+	if (!orientations.empty() && orientations.size() != offsets.size())
+		throw invalid_argument("InstanceSet: number of orientations does not match the number of offsets");
+
+	Point pmin, pmax;
+	m_proto->getBoundingBox(pmin, pmax);
+	m_pivot = (make_double3(pmin) + make_double3(pmax))/2;
+
+	const size_t n = m_offsets.size();
+	m_rot.resize(n);
+	m_invrot.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		if (!orientations.empty()) {
+			m_rot[i] = orientations[i];
+			m_rot[i].Normalize();
+		}
+		m_invrot[i] = m_rot[i].Inverse();
+	}
+
+	m_center = Point(m_pivot);
+	m_center(3) = m_proto->GetPartMass();
+	m_ep = EulerParameters();
+	m_ep.ComputeRot();
+
+	// bounding box of each instance, from the corners of the prototype one
+	m_bmin.resize(n);
+	m_bmax.resize(n);
+	for (size_t i = 0; i < n; ++i) {
+		m_bmin[i] = make_double3(INFINITY);
+		m_bmax[i] = make_double3(-INFINITY);
+		for (int c = 0; c < 8; ++c) {
+			const double3 corner = make_double3(
+				c & 1 ? pmax(0) : pmin(0),
+				c & 2 ? pmax(1) : pmin(1),
+				c & 4 ? pmax(2) : pmin(2));
+			const double3 w = toWorld(corner, i);
+			m_bmin[i] = min3(m_bmin[i], w);
+			m_bmax[i] = max3(m_bmax[i], w);
+		}
+	}
+
+	buildBVH();
+}
+
+double3
+InstanceSet::toWorld(const double3 &p, uint instance) const
+{
+	return m_pivot + m_offsets[instance] + m_rot[instance].Rot(p - m_pivot);
+}
+
+double3
+InstanceSet::toLocal(const double3 &p, uint instance) const
+{
+	return m_pivot + m_invrot[instance].Rot(p - m_pivot - m_offsets[instance]);
+}
+
+void
+InstanceSet::buildBVH(void)
+{
+	m_nodes.clear();
+	m_order.resize(m_offsets.size());
+	for (uint i = 0; i < m_order.size(); ++i)
+		m_order[i] = i;
+	if (!m_order.empty())
+		buildNode(0, m_order.size());
+}
+
+// build the node for the instances m_order[begin, end), returning its index
+uint
+InstanceSet::buildNode(uint begin, uint end)
+{
+	const uint idx = m_nodes.size();
+	m_nodes.push_back(BVHNode());
+
+	double3 bmin = make_double3(INFINITY), bmax = make_double3(-INFINITY);
+	double3 cmin = make_double3(INFINITY), cmax = make_double3(-INFINITY);
+	for (uint k = begin; k < end; ++k) {
+		const uint i = m_order[k];
+		bmin = min3(bmin, m_bmin[i]);
+		bmax = max3(bmax, m_bmax[i]);
+		const double3 c = (m_bmin[i] + m_bmax[i])/2;
+		cmin = min3(cmin, c);
+		cmax = max3(cmax, c);
+	}
+	m_nodes[idx].bmin = bmin;
+	m_nodes[idx].bmax = bmax;
+
+	if (end - begin <= BVH_LEAF_SIZE) {
+		m_nodes[idx].leaf = true;
+		m_nodes[idx].left = begin;
+		m_nodes[idx].right = end;
+		return idx;
+	}
+
+	// split at the median of the instance centers, along the longest axis
+	const double3 extent = cmax - cmin;
+	const int axis = (extent.x >= extent.y && extent.x >= extent.z) ? 0 :
+		(extent.y >= extent.z) ? 1 : 2;
+	const uint mid = begin + (end - begin)/2;
+	nth_element(m_order.begin() + begin, m_order.begin() + mid, m_order.begin() + end,
+		center_less(m_bmin, m_bmax, axis));
+
+	// m_nodes may be reallocated by the recursion, so no references here
+	const uint left = buildNode(begin, mid);
+	const uint right = buildNode(mid, end);
+	m_nodes[idx].leaf = false;
+	m_nodes[idx].left = left;
+	m_nodes[idx].right = right;
+	return idx;
+}
+
+void *
+InstanceSet::replicate_thread(void *arg)
+{
+	replicate_job const& job = *static_cast<replicate_job*>(arg);
+	PointVect const& local = *job.local;
+	const size_t nlocal = local.size();
+
+	for (uint i = job.begin; i < job.end; ++i) {
+		Point *out = job.out + i*nlocal;
+		for (size_t j = 0; j < nlocal; ++j) {
+			out[j] = Point(job.set->toWorld(make_double3(local[j]), i));
+			out[j](3) = local[j](3);
+		}
+	}
+	return NULL;
+}
+
+void
+InstanceSet::replicate(PointVect& points, PointVect const& local) const
+{
+	const uint n = m_offsets.size();
+	const size_t base = points.size();
+	points.resize(base + n*local.size());
+	if (!n || local.empty())
+		return;
+
+	long nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (nthreads < 1 || n*local.size() < MIN_PARALLEL_POINTS)
+		nthreads = 1;
+	if (nthreads > n)
+		nthreads = n;
+
+	vector<replicate_job> jobs(nthreads);
+	for (long t = 0; t < nthreads; ++t) {
+		jobs[t].set = this;
+		jobs[t].local = &local;
+		jobs[t].out = &points[base];
+		jobs[t].begin = (uint)(t*n/nthreads);
+		jobs[t].end = (uint)((t + 1)*n/nthreads);
+	}
+
+	if (nthreads == 1) {
+		replicate_thread(&jobs[0]);
+		return;
+	}
+
+	vector<pthread_t> threads(nthreads);
+	for (long t = 0; t < nthreads; ++t) {
+		int err = pthread_create(&threads[t], NULL, replicate_thread, &jobs[t]);
+		if (err)
+			throw runtime_error(string("Cannot start instance filling thread: ") + strerror(err));
+	}
+	for (long t = 0; t < nthreads; ++t)
+		pthread_join(threads[t], NULL);
+}
+
+double
+InstanceSet::SetPartMass(const double dx, const double rho)
+{
+	const double mass = m_proto->SetPartMass(dx, rho);
+	m_center(3) = mass;
+	return mass;
+}
+
+void
+InstanceSet::SetPartMass(const double mass)
+{
+	m_proto->SetPartMass(mass);
+	m_center(3) = mass;
+}
+
+double
+InstanceSet::Volume(const double dx) const
+{
+	return m_offsets.size()*m_proto->Volume(dx);
+}
+
+void
+InstanceSet::SetInertia(const double)
+{
+	throw std::runtime_error("Trying to set inertia on an instance set!");
+}
+
+void
+InstanceSet::setEulerParameters(const EulerParameters &)
+{
+	throw std::runtime_error("Trying to set EulerParameters on an instance set! Rotate the prototype or the instances instead");
+}
+
+void
+InstanceSet::getBoundingBox(Point &output_min, Point &output_max)
+{
+	if (m_nodes.empty()) {
+		output_min = output_max = Point(m_pivot);
+		return;
+	}
+	output_min = Point(m_nodes[0].bmin);
+	output_max = Point(m_nodes[0].bmax);
+}
+
+void
+InstanceSet::shift(const double3 &offset)
+{
+	for (size_t i = 0; i < m_offsets.size(); ++i) {
+		m_offsets[i] += offset;
+		m_bmin[i] += offset;
+		m_bmax[i] += offset;
+	}
+	for (size_t n = 0; n < m_nodes.size(); ++n) {
+		m_nodes[n].bmin += offset;
+		m_nodes[n].bmax += offset;
+	}
+	m_center += Point(offset);
+}
+
+void
+InstanceSet::FillBorder(PointVect& points, const double dx)
+{
+	PointVect local;
+	m_proto->FillBorder(local, dx);
+	replicate(points, local);
+}
+
+void
+InstanceSet::FillIn(PointVect& points, const double dx, const int layers)
+{
+	PointVect local;
+	m_proto->FillIn(local, dx, layers);
+	replicate(points, local);
+}
+
+int
+InstanceSet::Fill(PointVect& points, const double dx, const bool fill)
+{
+	PointVect local;
+	const int nparts = m_proto->Fill(local, dx, fill);
+	if (fill)
+		replicate(points, local);
+	return nparts*m_offsets.size();
+}
+
+bool
+InstanceSet::IsInside(const Point& p, const double dx) const
+{
+	if (m_nodes.empty())
+		return false;
+
+	const double3 pos = make_double3(p);
+	// the prototype grows by dx along its own axes, which reaches up to
+	// sqrt(3)*dx along the world axes for a rotated instance
+	const double tol = sqrt(3.0)*fabs(dx);
+
+	// depth-first visit of the nodes whose bounding box contains the point
+	uint stack[64];
+	int top = 0;
+	stack[top++] = 0;
+	while (top > 0) {
+		BVHNode const& node = m_nodes[stack[--top]];
+		if (pos.x < node.bmin.x - tol || pos.x > node.bmax.x + tol ||
+			pos.y < node.bmin.y - tol || pos.y > node.bmax.y + tol ||
+			pos.z < node.bmin.z - tol || pos.z > node.bmax.z + tol)
+			continue;
+		if (!node.leaf) {
+			stack[top++] = node.left;
+			stack[top++] = node.right;
+			continue;
+		}
+		for (uint k = node.left; k < node.right; ++k) {
+			const uint i = m_order[k];
+			if (pos.x < m_bmin[i].x - tol || pos.x > m_bmax[i].x + tol ||
+				pos.y < m_bmin[i].y - tol || pos.y > m_bmax[i].y + tol ||
+				pos.z < m_bmin[i].z - tol || pos.z > m_bmax[i].z + tol)
+				continue;
+			if (m_proto->IsInside(Point(toLocal(pos, i)), dx))
+				return true;
+		}
+	}
+	return false;
+}
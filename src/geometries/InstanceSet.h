@@ -0,0 +1,105 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _INSTANCESET_H
+#define	_INSTANCESET_H
+
+#include <vector>
+
+#include "Object.h"
+#include "Point.h"
+#include "EulerParameters.h"
+
+//! Set of instances of a geometry
+/*!
+ *	An InstanceSet places copies of a prototype Object in the domain, each
+ *	rotated around the center of the prototype bounding box and then shifted
+ *	by its own offset.
+ *
+ *	Filling is done only once, for the prototype, and the resulting points
+ *	are then transformed and copied to each instance (in parallel).
+ *	Inside tests use a bounding volume hierarchy over the instances, and the
+ *	inside test of the prototype on the back-transformed point, so that erase
+ *	operations do not grow with the number of instances.
+ *
+ *	Instances are meant for fluid, fixed boundaries and test points: they are
+ *	not rigid bodies, and have no Chrono counterpart.
+ */
+class InstanceSet: public Object {
+	private:
+		Object							*m_proto;	///< prototype, in its own (local) frame
+		double3							m_pivot;	///< rotation center (center of the prototype bounding box)
+		std::vector<double3>			m_offsets;	///< offset of each instance
+		std::vector<EulerParameters>	m_rot;		///< rotation of each instance
+		std::vector<EulerParameters>	m_invrot;	///< inverse rotation of each instance
+
+		//! node of the bounding volume hierarchy
+		struct BVHNode {
+			double3	bmin, bmax;	///< bounding box of the instances in the node
+			uint	left, right;	///< children (inner nodes), or range in m_order (leaves)
+			bool	leaf;
+		};
+		std::vector<BVHNode>	m_nodes;	///< BVH nodes, the root is the first one
+		std::vector<uint>		m_order;	///< instance indices, in leaf order
+		std::vector<double3>	m_bmin;		///< bounding box of each instance
+		std::vector<double3>	m_bmax;
+
+		void buildBVH(void);
+		uint buildNode(uint begin, uint end);
+
+		// copy the (local) prototype points to each instance
+		void replicate(PointVect& points, PointVect const& local) const;
+		static void *replicate_thread(void *);
+
+		// position of a point, in the frame of the given instance
+		double3 toLocal(const double3 &p, uint instance) const;
+		double3 toWorld(const double3 &p, uint instance) const;
+
+	public:
+		InstanceSet(Object *prototype, std::vector<double3> const& offsets,
+			std::vector<EulerParameters> const& orientations);
+		virtual ~InstanceSet(void) {};
+
+		size_t GetNumInstances(void) const
+		{ return m_offsets.size(); }
+
+		double SetPartMass(const double, const double);
+		void SetPartMass(const double);
+
+		double Volume(const double) const;
+		void SetInertia(const double);
+
+		void setEulerParameters(const EulerParameters &);
+		void getBoundingBox(Point &output_min, Point &output_max);
+		void shift(const double3 &offset);
+
+		void FillBorder(PointVect&, const double);
+		void FillIn(PointVect&, const double, const int);
+		int Fill(PointVect&, const double, const bool fill = true);
+
+		bool IsInside(const Point&, const double) const;
+};
+
+#endif	/* _INSTANCESET_H */
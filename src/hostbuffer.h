@@ -37,6 +37,7 @@
 #include <algorithm>
 
 #include "buffer.h"
+#include "HostArena.h"
 
 /* a specialization of buffers, for the host */
 
@@ -44,11 +45,15 @@ template<flag_t Key>
 class HostBuffer : public Buffer<Key>
 {
 	typedef Buffer<Key> baseclass;
+
+	// arena the arrays are carved from, NULL if they are malloc'ed
+	HostArena *m_arena;
+
 public:
 	typedef typename baseclass::element_type element_type;
 
 	// constructor: nothing to do
-	HostBuffer(int _init = 0) : Buffer<Key>(_init) {}
+	HostBuffer(int _init = 0) : Buffer<Key>(_init), m_arena(NULL) {}
 
 	// destructor: free allocated memory
 	virtual ~HostBuffer() {
@@ -59,7 +64,9 @@ public:
 			//printf("\tfreeing buffer %d\n", i);
 #endif
 			if (bufs[i]) {
-				free(bufs[i]);
+				// arena slices are released with the arena
+				if (!m_arena)
+					free(bufs[i]);
 				bufs[i] = NULL;
 			}
 		}
@@ -73,12 +80,18 @@ public:
 		for (int i = 0; i < N; ++i) {
 			// malloc instead of calloc since the init
 			// value might be nonzero
-			bufs[i] = (element_type*)malloc(bufmem);
+			if (m_arena)
+				bufs[i] = (element_type*)m_arena->carve(bufmem);
+			else
+				bufs[i] = (element_type*)malloc(bufmem);
 			memset(bufs[i], baseclass::get_init_value(), bufmem);
 		}
 		return bufmem*N;
 	}
 
+	virtual void set_host_arena(HostArena *arena)
+	{ m_arena = arena; }
+
 	virtual void swap_elements(uint idx1, uint idx2, uint _buf=0) {
 		element_type *buf = baseclass::get_raw_ptr()[_buf];
 		std::swap(buf[idx1], buf[idx2]);
@@ -33,6 +33,7 @@
 #include "Options.h"
 #include "GlobalData.h"
 #include "NetworkManager.h"
+#include "BurstCodec.h"
 
 // Include only the problem selected at compile time (PROBLEM, QUOTED_PROBLEM)
 #include "problem_select.opt"
@@ -44,6 +45,7 @@
 #include "fastmath_select.opt"
 #include "gpusph_version.opt"
 #include "hdf5_select.opt"
+#include "iouring_select.opt"
 #include "mpi_select.opt"
 
 using namespace std;
@@ -65,6 +67,7 @@ void show_version()
 	printf("Chrono : %s\n", USE_CHRONO ? "enabled" : "disabled");
 	printf("HDF5   : %s\n", USE_HDF5 ? "enabled" : "disabled");
 	printf("MPI    : %s\n", USE_MPI ? "enabled" : "disabled");
+	printf("io_uring: %s\n", USE_IOURING ? "enabled" : "disabled");
 	printf("Compiled for problem \"%s\"\n", QUOTED_PROBLEM);
 }
 
@@ -75,14 +78,25 @@ void print_usage() {
 	cout << "Syntax: " << endl;
 	cout << "\tGPUSPH [--device n[,n...]] [--dem dem_file] [--deltap VAL] [--tend VAL]\n";
 	cout << "\t       [--resume fname] [--checkpoint-every VAL] [--checkpoints VAL]\n";
-	cout << "\t       [--dir directory] [--nosave] [--striping] [--gpudirect [--asyncmpi]]\n";
+	cout << "\t       [--resume-memory] [--mem-checkpoint-every VAL] [--mem-checkpoint-dir directory]\n";
+	cout << "\t       [--dir directory] [--nosave] [--striping] [--gpudirect] [--asyncmpi]\n";
+	cout << "\t       [--compress-bursts buffer[:mode][,...]] [--record-bursts directory]\n";
+	cout << "\t       [--stage-dir directory [--stage-bwlimit VAL] [--stage-minfree VAL]]\n";
+	cout << "\t       [--write-backend posix|uring] [--io-aggregators VAL]\n";
 	cout << "\t       [--num-hosts VAL [--byslot-scheduling]]\n";
+	cout << "\t       [--host-arena thp|hugetlb [--host-arena-pin]] [--perf-counters]\n";
+	cout << "\t       [--no-fused-filters]\n";
+	cout << "\t       [--settle VAL [--settle-tau VAL]]\n";
 	cout << "\t       [--debug FLAGS]\n";
 	cout << "\tGPUSPH --help\n\n";
 	cout << " --resume : resume from the given file (HotStart file saved by HotWriter)\n";
 	cout << " --checkpoint-every : HotStart checkpoints will be created every VAL seconds\n";
 	cout << "                      of simulated time (float VAL, 0 disables)\n";
 	cout << " --checkpoints : number of HotStart checkpoints to keep (integer VAL)\n";
+	cout << " --resume-memory : resume from the in-memory checkpoints (same number of processes and --dir)\n";
+	cout << " --mem-checkpoint-every : in-memory checkpoints (with a copy on the next rank) will be\n";
+	cout << "                          created every VAL seconds of simulated time (float VAL, 0 disables)\n";
+	cout << " --mem-checkpoint-dir : RAM-backed directory for in-memory checkpoints (default /dev/shm)\n";
 	cout << " --device n[,n...] : Use device number n; runs multi-gpu if multiple n are given\n";
 	cout << " --dem : Use given DEM (if problem supports it)\n";
 	cout << " --deltap : Use given deltap (VAL is cast to float)\n";
@@ -90,12 +104,39 @@ void print_usage() {
 	cout << " --maxiter : Break after this many iterations (integer VAL)\n";
 	cout << " --dir : Use given directory for dumps instead of date-based one\n";
 	cout << " --nosave : Disable all file dumps but the last\n";
+	cout << " --stage-dir : Write output to the given (node-local) directory first, and move it\n";
+	cout << "               to the output directory in the background\n";
+	cout << " --stage-bwlimit : Limit the bandwidth used to move staged output to VAL MB/s (float VAL)\n";
+	cout << " --stage-minfree : Wait for staged output to be moved if less than VAL MB are free\n";
+	cout << "                   in the staging directory (float VAL, default 1024)\n";
+	cout << " --write-backend : how the particle and HotStart files are written: plain POSIX writes\n";
+	cout << "                   (posix, default) or O_DIRECT writes queued on an io_uring (uring),\n";
+	cout << "                   bypassing the page cache; uring falls back to posix if not available\n";
+	cout << " --io-aggregators : only VAL ranks write the particle files, each for a group of ranks\n";
+	cout << "                    which send it their particles (integer VAL, 0 = all ranks write)\n";
 	cout << " --gpudirect: Enable GPUDirect for RDMA (requires a CUDA-aware MPI library)\n";
 	cout << " --striping : Enable computation/transfer overlap  in multi-GPU (usually convenient for 3+ devices)\n";
-	cout << " --asyncmpi : Enable asynchronous network transfers (requires GPUDirect and 1 process per device)\n";
+	cout << " --asyncmpi : Enable asynchronous network transfers (with multiple devices per process,\n";
+	cout << "              requires an MPI library supporting MPI_THREAD_MULTIPLE)\n";
+	cout << " --compress-bursts : compress the bursts of the given buffers (e.g. pos:xor,vel:xor,info,\n";
+	cout << "                     or all) exchanged over the network; mode is lz (byte shuffle + LZ,\n";
+	cout << "                     default) or xor (delta against the previous burst first); not with --gpudirect\n";
+	cout << " --record-bursts : save the raw network bursts sent by each device in the given directory,\n";
+	cout << "                   for gpusph-microbench --bursts\n";
 	cout << " --num-hosts : Specify number of hosts. To be used if #processes > #hosts (VAL is cast to uint)\n";
 	cout << " --byslot-scheduling : MPI scheduler is filling hosts first, as opposite to round robin scheduling\n";
 	cout << " --no-leak-warning : do not warn if #particles decreases without outlets (e.g. overtopping, leaking)\n";
+	cout << " --host-arena : allocate the host particle buffers from a single region backed by\n";
+	cout << "                transparent (thp) or hugetlbfs (hugetlb) huge pages\n";
+	cout << " --host-arena-pin : pin the host arena memory, for faster transfers\n";
+	cout << " --perf-counters : collect hardware performance counters for the host phases\n";
+	cout << "                   (fill, sort, gages, writers, roll call, body dynamics)\n";
+	cout << " --no-fused-filters : run the Shepard filter as a separate pass, even when it could be\n";
+	cout << "                      computed while building the neighbor list\n";
+	cout << " --settle : run a damped settling phase of VAL seconds of simulated time (float VAL)\n";
+	cout << "            before the simulation, without output and with relaxed time steps\n";
+	cout << " --settle-tau : velocity damping time during the settling phase (float VAL, default 1/10\n";
+	cout << "                of the settling phase)\n";
 	//cout << " --nobalance : Disable dynamic load balancing\n";
 	//cout << " --lb-threshold : Set custom LB activation threshold (VAL is cast to float)\n";
 	cout << " --debug : enable debug flags FLAGS\n";
@@ -121,6 +162,16 @@ int parse_options(int argc, char **argv, GlobalData *gdata)
 			_clOptions->resume_fname = string(*argv);
 			argv++;
 			argc--;
+		} else if (!strcmp(arg, "--resume-memory")) {
+			_clOptions->resume_memory = true;
+		} else if (!strcmp(arg, "--mem-checkpoint-every")) {
+			sscanf(*argv, "%f", &(_clOptions->mem_checkpoint_freq));
+			argv++;
+			argc--;
+		} else if (!strcmp(arg, "--mem-checkpoint-dir")) {
+			_clOptions->mem_checkpoint_dir = string(*argv);
+			argv++;
+			argc--;
 		} else if (!strcmp(arg, "--checkpoint-every")) {
 			sscanf(*argv, "%f", &(_clOptions->checkpoint_freq));
 			argv++;
@@ -180,6 +231,33 @@ int parse_options(int argc, char **argv, GlobalData *gdata)
 			_clOptions->dir = string(*argv);
 			argv++;
 			argc--;
+		} else if (!strcmp(arg, "--stage-dir")) {
+			_clOptions->stage_dir = string(*argv);
+			argv++;
+			argc--;
+		} else if (!strcmp(arg, "--stage-bwlimit")) {
+			/* read the next arg as a double */
+			sscanf(*argv, "%lf", &(_clOptions->stage_bwlimit));
+			argv++;
+			argc--;
+		} else if (!strcmp(arg, "--stage-minfree")) {
+			/* read the next arg as a double */
+			sscanf(*argv, "%lf", &(_clOptions->stage_minfree));
+			argv++;
+			argc--;
+		} else if (!strcmp(arg, "--write-backend")) {
+			_clOptions->write_backend = string(*argv);
+			argv++;
+			argc--;
+			if (_clOptions->write_backend != "posix" && _clOptions->write_backend != "uring") {
+				cerr << "Fatal: --write-backend must be posix or uring" << endl;
+				return -1;
+			}
+		} else if (!strcmp(arg, "--io-aggregators")) {
+			/* read the next arg as a int */
+			sscanf(*argv, "%d", &(_clOptions->io_aggregators));
+			argv++;
+			argc--;
 		} else if (!strcmp(arg, "--nosave")) {
 			_clOptions->nosave = true;
 		} else if (!strcmp(arg, "--gpudirect")) {
@@ -188,6 +266,20 @@ int parse_options(int argc, char **argv, GlobalData *gdata)
 			_clOptions->striping = true;
 		} else if (!strcmp(arg, "--asyncmpi")) {
 			_clOptions->asyncNetworkTransfers = true;
+		} else if (!strcmp(arg, "--compress-bursts")) {
+			_clOptions->compress_bursts = string(*argv);
+			argv++;
+			argc--;
+			try {
+				BurstCompressor::parse_spec(_clOptions->compress_bursts);
+			} catch (exception &e) {
+				cerr << "Fatal: --compress-bursts: " << e.what() << endl;
+				return -1;
+			}
+		} else if (!strcmp(arg, "--record-bursts")) {
+			_clOptions->record_bursts = string(*argv);
+			argv++;
+			argc--;
 		} else if (!strcmp(arg, "--num-hosts") || !strcmp(arg, "--num_hosts")) {
 			/* read the next arg as a uint */
 			sscanf(*argv, "%u", &(_clOptions->num_hosts));
@@ -200,6 +292,28 @@ int parse_options(int argc, char **argv, GlobalData *gdata)
 			_clOptions->byslot_scheduling = true;
 		} else if (!strcmp(arg, "--no-leak-warning") || !strcmp(arg, "--no_leak_warning")) {
 			_clOptions->no_leak_warning = true;
+		} else if (!strcmp(arg, "--host-arena")) {
+			_clOptions->host_arena = string(*argv);
+			argv++;
+			argc--;
+			if (_clOptions->host_arena != "thp" && _clOptions->host_arena != "hugetlb") {
+				cerr << "Fatal: --host-arena must be thp or hugetlb" << endl;
+				return -1;
+			}
+		} else if (!strcmp(arg, "--host-arena-pin")) {
+			_clOptions->host_arena_pin = true;
+		} else if (!strcmp(arg, "--perf-counters")) {
+			_clOptions->perf_counters = true;
+		} else if (!strcmp(arg, "--no-fused-filters")) {
+			_clOptions->no_fused_filters = true;
+		} else if (!strcmp(arg, "--settle")) {
+			sscanf(*argv, "%lf", &(_clOptions->settle));
+			argv++;
+			argc--;
+		} else if (!strcmp(arg, "--settle-tau")) {
+			sscanf(*argv, "%lf", &(_clOptions->settle_tau));
+			argv++;
+			argc--;
 #if 0 // options will be enabled later
 		} else if (!strcmp(arg, "--nobalance")) {
 			_clOptions->nobalance = true;
@@ -235,6 +349,25 @@ int parse_options(int argc, char **argv, GlobalData *gdata)
 		}
 	}
 
+	// the bursts are (de)compressed and recorded on the host
+	if (_clOptions->gpudirect && (!_clOptions->compress_bursts.empty() || !_clOptions->record_bursts.empty())) {
+		cerr << "Fatal: --compress-bursts and --record-bursts cannot be used with --gpudirect" << endl;
+		return -1;
+	}
+
+	// the aggregators do not receive the neighbor lists, whose layout
+	// depends on the particles of each device
+	if (_clOptions->io_aggregators > 0 && gdata->debug.neibs) {
+		cerr << "Fatal: --io-aggregators cannot be used with the neibs debug flag" << endl;
+		return -1;
+	}
+
+	// the in-memory images are found through the output directory of the interrupted run
+	if (_clOptions->resume_memory && _clOptions->dir.empty()) {
+		cerr << "Fatal: --resume-memory needs the --dir of the interrupted run" << endl;
+		return -1;
+	}
+
 	if (gdata->devices==0) {
 		printf(" * No devices specified, falling back to default (dev 0)...\n");
 		// default: use first device. May use cutGetMaxGflopsDeviceId() instead.
@@ -350,22 +483,12 @@ int main(int argc, char** argv) {
 	if (gdata.clOptions->num_hosts > 0)
 		printf(" num-hosts was specified: %u; shifting device numbers with offset %u\n", gdata.clOptions->num_hosts, devIndexOffset);
 
-	if (gdata.clOptions->asyncNetworkTransfers) {
-
-		if (!gdata.clOptions->gpudirect) {
-			// since H2D and D2H transfers have to wait for network transfers
-			fprintf(stderr, "FATAL: asynchronous network transfers require --gpudirect\n");
-			gdata.networkManager->finalizeNetwork();
-			return 1;
-		}
-
-		if (gdata.devices > 1) {
-			// since we were too lazy to implement a more complex mechanism
-			fprintf(stderr, "FATAL: asynchronous network transfers only supported with 1 process per device\n");
-			gdata.networkManager->finalizeNetwork();
-			return 1;
-		}
-
+	// with multiple devices per process, the workers issue (and wait for) their
+	// asynchronous network transfers concurrently
+	if (gdata.clOptions->asyncNetworkTransfers && gdata.devices > 1 &&
+		!gdata.networkManager->isThreadMultiple()) {
+		printf("WARNING: the MPI library does not support MPI_THREAD_MULTIPLE, disabling asynchronous network transfers\n");
+		gdata.clOptions->asyncNetworkTransfers = false;
 	}
 
 	// the Problem could (should?) be initialized inside GPUSPH::initialize()
@@ -223,10 +223,11 @@ enum SPSKernelSimFlags {
 	SPSK_STORE_TURBVISC = (SPSK_STORE_TAU << 1)
 };
 
-/* Upper limits for number of planes, fluids, and rigit bodies */
+/* Upper limits for number of planes, fluids, rigit bodies and sponge layers */
 #define MAX_PLANES			8
 #define MAX_FLUID_TYPES		4
 #define	MAX_BODIES			16
+#define MAX_SPONGES			6
 
 /* CUDA linear textures have a limit of 2^27 to the number of elements they can hold.
  * This effectively imposes an upper limit on the number of particles that we can use
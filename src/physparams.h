@@ -33,6 +33,7 @@
 #include <iostream>
 
 #include "particledefine.h"
+#include "sponge.h"
 
 // #include "deprecation.h"
 
@@ -113,6 +114,8 @@ typedef struct PhysParams {
 	float	objectobjectdf;	// damping factor for object-object interaction
 	float	objectboundarydf;	// damping factor for object-boundary interaction
 
+	std::vector<sponge_t>	sponges;	// absorbing layers (with ENABLE_SPONGE)
+
 	PhysParams(void) :
 		artvisccoeff(0.3f),
 		partsurf(0),
@@ -165,6 +168,14 @@ protected:
 		return rho0.size() - 1;
 	}
 
+	//! Add an absorbing layer
+	size_t add_sponge(sponge_t const& sponge) {
+		if (sponges.size() == MAX_SPONGES)
+			throw std::runtime_error("too many sponge layers");
+		sponges.push_back(sponge);
+		return sponges.size() - 1;
+	}
+
 	//! Change the density of the given fluid
 	void set_density(size_t fluid_idx, float _rho0)
 	{
@@ -0,0 +1,390 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdlib>
+#include <cmath>
+
+#include "HostPostProcess.h"
+
+using namespace std;
+
+void
+PostParams::read_summary(string const& fname)
+{
+	ifstream in(fname.c_str());
+	if (!in)
+		throw runtime_error("Cannot open " + fname);
+
+	string line;
+	while (getline(in, line)) {
+		istringstream is(line);
+		string key, sep;
+		is >> key >> sep;
+		if (key == "slength" && sep == "=")
+			is >> slength;
+		else if (key == "kernelradius" && sep == "=")
+			is >> kernelradius;
+		else if (key == "influenceRadius" && sep == "=")
+			is >> influenceRadius;
+		else if (key == "deltap" && sep == "=")
+			is >> deltap;
+		else if (key == "kerneltype:") {
+			kerneltype = (KernelType)atoi(sep.c_str());
+		}
+	}
+
+	if (isnan(slength) || isnan(influenceRadius))
+		throw runtime_error("Smoothing length or influence radius missing from " + fname);
+}
+
+HostCellGrid::HostCellGrid(vector<double3> const& pos, double influenceRadius) :
+	m_origin(make_double3(0.0)),
+	m_cellSide(influenceRadius),
+	m_gridSize(make_int3(1))
+{
+	const size_t numParts = pos.size();
+	if (!numParts)
+		return;
+
+	double3 minp = pos[0], maxp = pos[0];
+	for (size_t i = 1; i < numParts; ++i) {
+		minp = make_double3(fmin(minp.x, pos[i].x), fmin(minp.y, pos[i].y), fmin(minp.z, pos[i].z));
+		maxp = make_double3(fmax(maxp.x, pos[i].x), fmax(maxp.y, pos[i].y), fmax(maxp.z, pos[i].z));
+	}
+	m_origin = minp;
+
+	const double3 extent = maxp - minp;
+	m_gridSize = make_int3(
+		int(extent.x/m_cellSide) + 1,
+		int(extent.y/m_cellSide) + 1,
+		int(extent.z/m_cellSide) + 1);
+
+	// counting sort by cell
+	const size_t numCells = size_t(m_gridSize.x)*m_gridSize.y*m_gridSize.z;
+	vector<uint> cellIndex(numParts);
+	m_cellStart.assign(numCells + 1, 0);
+	for (size_t i = 0; i < numParts; ++i) {
+		const int3 c = cell_of(pos[i]);
+		cellIndex[i] = (size_t(c.z)*m_gridSize.y + c.y)*m_gridSize.x + c.x;
+		++m_cellStart[cellIndex[i] + 1];
+	}
+	for (size_t c = 0; c < numCells; ++c)
+		m_cellStart[c + 1] += m_cellStart[c];
+
+	vector<uint> fill(m_cellStart.begin(), m_cellStart.end() - 1);
+	m_sorted.resize(numParts);
+	for (size_t i = 0; i < numParts; ++i)
+		m_sorted[fill[cellIndex[i]]++] = i;
+}
+
+int3
+HostCellGrid::cell_of(double3 const& p) const
+{
+	int3 c = make_int3(
+		int(floor((p.x - m_origin.x)/m_cellSide)),
+		int(floor((p.y - m_origin.y)/m_cellSide)),
+		int(floor((p.z - m_origin.z)/m_cellSide)));
+	return clamp(c, make_int3(0), m_gridSize - make_int3(1));
+}
+
+// collect the neighbor indices
+struct NeibsCollector
+{
+	vector<uint> &neibs;
+
+	NeibsCollector(vector<uint> &_neibs) : neibs(_neibs) {}
+
+	void operator()(uint j, double3 const&, double)
+	{ neibs.push_back(j); }
+};
+
+void
+HostCellGrid::neighbors(vector<double3> const& pos, double3 const& p, double radius,
+	vector<uint> &neibs) const
+{
+	neibs.clear();
+	NeibsCollector collect(neibs);
+	for_each_neighbor(pos, p, radius, collect);
+}
+
+HostPostProcess::HostPostProcess(PostParams const& params) :
+	m_params(params),
+	m_kernel(params.kerneltype, params.slength, params.kernelradius)
+{}
+
+void
+HostPostProcess::process(PostFrame &frame, HostCellGrid const& cells,
+	bool vorticity, bool surface) const
+{
+	const size_t numParts = frame.numParts();
+	const double influenceRadius = m_params.influenceRadius;
+
+	if (vorticity)
+		frame.vorticity.assign(numParts, make_float3(0.0f));
+	if (surface) {
+		frame.normals.assign(numParts, make_float3(0.0f));
+		frame.surface.assign(numParts, 0);
+	}
+
+	vector<uint> neibs;
+	for (size_t i = 0; i < numParts; ++i) {
+		if (frame.type[i] != PT_FLUID)
+			continue;
+
+		cells.neighbors(frame.pos, frame.pos[i], influenceRadius, neibs);
+
+		const double3 pos = frame.pos[i];
+		const double3 vel = make_double3(frame.vel[i]);
+
+		double3 vort = make_double3(0.0);
+		double3 normal = make_double3(0.0);
+
+		for (size_t n = 0; n < neibs.size(); ++n) {
+			const uint j = neibs[n];
+			if (j == i)
+				continue;
+			const double3 relPos = pos - frame.pos[j];
+			const double r = length(relPos);
+			const double f = F(r)*frame.mass[j]/frame.rho[j];	// 1/r ∂Wij/∂r Vj
+
+			if (vorticity && frame.type[j] == PT_FLUID)
+				vort += f*cross(vel - make_double3(frame.vel[j]), relPos);
+			normal -= f*relPos;
+		}
+
+		if (vorticity)
+			frame.vorticity[i] = make_float3(vort);
+
+		if (!surface)
+			continue;
+
+		// a particle is on the surface if there are no neighbors
+		// in the cone around its normal
+		const double normal_length = length(normal);
+		bool covered = false;
+		for (size_t n = 0; n < neibs.size() && !covered; ++n) {
+			const uint j = neibs[n];
+			if (j == i)
+				continue;
+			const double3 relPos = pos - frame.pos[j];
+			const double r = length(relPos);
+			const double cosconeangle = (frame.type[j] == PT_FLUID ?
+				m_params.cosconeanglefluid : m_params.cosconeanglenonfluid);
+			covered = (-dot(normal, relPos) > r*normal_length*cosconeangle);
+		}
+		frame.surface[i] = !covered;
+		if (normal_length > 0)
+			frame.normals[i] = make_float3(normal/normal_length);
+	}
+}
+
+void
+HostPostProcess::save_grid(PostFrame const& frame, HostCellGrid const& cells,
+	PostGrid const& grid, string const& fname) const
+{
+	const size_t numNodes = size_t(grid.size.x)*grid.size.y*grid.size.z;
+	vector<float3> vel(numNodes, make_float3(0.0f));
+	vector<float> pressure(numNodes, 0.0f);
+	vector<float> shepard(numNodes, 0.0f);
+
+	vector<uint> neibs;
+	size_t node = 0;
+	for (int z = 0; z < grid.size.z; ++z)
+	for (int y = 0; y < grid.size.y; ++y)
+	for (int x = 0; x < grid.size.x; ++x, ++node) {
+		const double3 p = grid.origin + make_double3(x, y, z)*grid.spacing;
+		cells.neighbors(frame.pos, p, m_params.influenceRadius, neibs);
+
+		double3 v = make_double3(0.0);
+		double pres = 0, wsum = 0;
+		for (size_t n = 0; n < neibs.size(); ++n) {
+			const uint j = neibs[n];
+			if (frame.type[j] != PT_FLUID)
+				continue;
+			const double w = W(length(p - frame.pos[j]))*frame.mass[j]/frame.rho[j];
+			v += w*make_double3(frame.vel[j]);
+			pres += w*frame.pressure[j];
+			wsum += w;
+		}
+		// the Shepard sum is also saved, to tell dry nodes apart
+		shepard[node] = wsum;
+		if (wsum > 0) {
+			vel[node] = make_float3(v/wsum);
+			pressure[node] = pres/wsum;
+		}
+	}
+
+	ofstream fid(fname.c_str(), ios::binary);
+	fid.exceptions(ofstream::failbit | ofstream::badbit);
+
+	const int endian_int = 1;
+	fid << "<?xml version='1.0'?>" << endl;
+	fid << "<VTKFile type='ImageData' version='0.1' byte_order='" <<
+		((*(char*)&endian_int & 1) ? "LittleEndian" : "BigEndian") << "'>" << endl;
+	ostringstream extent_str;
+	extent_str << "0 " << grid.size.x - 1 << " 0 " << grid.size.y - 1 << " 0 " << grid.size.z - 1;
+	const string extent = extent_str.str();
+	fid << " <ImageData WholeExtent='" << extent << "' Origin='" <<
+		grid.origin.x << " " << grid.origin.y << " " << grid.origin.z << "' Spacing='" <<
+		grid.spacing << " " << grid.spacing << " " << grid.spacing << "'>" << endl;
+	fid << "  <Piece Extent='" << extent << "'>" << endl;
+	fid << "   <PointData Scalars='Pressure' Vectors='Velocity'>" << endl;
+	size_t offset = 0;
+	fid << "	<DataArray type='Float32' Name='Pressure' format='appended' offset='" << offset << "'/>" << endl;
+	offset += sizeof(float)*numNodes + sizeof(int);
+	fid << "	<DataArray type='Float32' Name='Shepard' format='appended' offset='" << offset << "'/>" << endl;
+	offset += sizeof(float)*numNodes + sizeof(int);
+	fid << "	<DataArray type='Float32' Name='Velocity' NumberOfComponents='3' format='appended' offset='" << offset << "'/>" << endl;
+	fid << "   </PointData>" << endl;
+	fid << "  </Piece>" << endl;
+	fid << " </ImageData>" << endl;
+	fid << " <AppendedData encoding='raw'>\n_";
+
+	int numbytes = sizeof(float)*numNodes;
+	fid.write((const char*)&numbytes, sizeof(numbytes));
+	fid.write((const char*)&pressure[0], numbytes);
+	fid.write((const char*)&numbytes, sizeof(numbytes));
+	fid.write((const char*)&shepard[0], numbytes);
+	numbytes = sizeof(float)*3*numNodes;
+	fid.write((const char*)&numbytes, sizeof(numbytes));
+	fid.write((const char*)&vel[0], numbytes);
+
+	fid << " </AppendedData>" << endl;
+	fid << "</VTKFile>" << endl;
+}
+
+void
+HostPostProcess::gage_levels(PostFrame const& frame,
+	vector<double2> const& gages, vector<double> &levels) const
+{
+	// the free surface at a gage is the highest fluid particle
+	// within a smoothing length (horizontally) from it
+	const double h2 = m_params.slength*m_params.slength;
+	const size_t numParts = frame.numParts();
+
+	levels.assign(gages.size(), NAN);
+	for (size_t g = 0; g < gages.size(); ++g) {
+		double level = -INFINITY;
+		for (size_t i = 0; i < numParts; ++i) {
+			if (frame.type[i] != PT_FLUID)
+				continue;
+			const double dx = frame.pos[i].x - gages[g].x;
+			const double dy = frame.pos[i].y - gages[g].y;
+			if (dx*dx + dy*dy < h2)
+				level = fmax(level, frame.pos[i].z);
+		}
+		if (level > -INFINITY)
+			levels[g] = level;
+	}
+}
+
+// builds the neighbor list of a particle and, for the fused Shepard filter,
+// accumulates the filter sums of its fluid neighbors at the same time
+struct HostPostProcess::ShepardNeibs
+{
+	HostPostProcess const& pp;
+	const float *mass;
+	const float *rho;
+	const uchar *type;
+	vector<uint> &neibs;
+	const double influenceRadius2;
+	const bool fused;
+	uint self;
+	double sum_w, sum_wv;
+
+	ShepardNeibs(HostPostProcess const& _pp, PostFrame const& frame, vector<uint> &_neibs, bool _fused) :
+		pp(_pp), mass(&frame.mass[0]), rho(&frame.rho[0]), type(&frame.type[0]), neibs(_neibs),
+		influenceRadius2(_pp.m_params.influenceRadius*_pp.m_params.influenceRadius),
+		fused(_fused), self(0), sum_w(0), sum_wv(0)
+	{}
+
+	void operator()(uint j, double3 const&, double r2)
+	{
+		if (j == self)
+			return;
+		neibs.push_back(j);
+		if (fused && type[j] == PT_FLUID && r2 < influenceRadius2) {
+			const double w = pp.W(sqrt(r2))*mass[j];
+			sum_w += w;
+			sum_wv += w/rho[j];
+		}
+	}
+};
+
+void
+HostPostProcess::shepard(PostFrame &frame, HostCellGrid const& cells, double nlRadius, bool fused,
+	vector<uint> &neibsStart, vector<uint> &neibs) const
+{
+	const size_t numParts = frame.numParts();
+	const double W0 = W(0);
+	const double influenceRadius2 = m_params.influenceRadius*m_params.influenceRadius;
+
+	vector<float> newRho(frame.rho);
+	neibsStart.assign(numParts + 1, 0);
+	neibs.clear();
+
+	ShepardNeibs visit(*this, frame, neibs, fused);
+
+	// neighbor search, and fused filter
+	for (size_t i = 0; i < numParts; ++i) {
+		neibsStart[i] = neibs.size();
+		if (frame.type[i] != PT_FLUID)
+			continue;
+
+		visit.self = i;
+		visit.sum_w = frame.mass[i]*W0;
+		visit.sum_wv = visit.sum_w/frame.rho[i];
+		cells.for_each_neighbor(frame.pos, frame.pos[i], nlRadius, visit);
+		if (fused)
+			newRho[i] = visit.sum_w/visit.sum_wv;
+	}
+	neibsStart[numParts] = neibs.size();
+
+	// separate filter pass over the neighbor lists
+	if (!fused) {
+		for (size_t i = 0; i < numParts; ++i) {
+			if (frame.type[i] != PT_FLUID)
+				continue;
+
+			double sum_w = frame.mass[i]*W0;
+			double sum_wv = sum_w/frame.rho[i];
+			for (uint n = neibsStart[i]; n < neibsStart[i + 1]; ++n) {
+				const uint j = neibs[n];
+				const double r2 = sqlength(frame.pos[i] - frame.pos[j]);
+				if (frame.type[j] == PT_FLUID && r2 < influenceRadius2) {
+					const double w = W(sqrt(r2))*frame.mass[j];
+					sum_w += w;
+					sum_wv += w/frame.rho[j];
+				}
+			}
+			newRho[i] = sum_w/sum_wv;
+		}
+	}
+
+	frame.rho.swap(newRho);
+}
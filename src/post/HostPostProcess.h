@@ -0,0 +1,179 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Host implementation of the post-processing, for the offline post-processor */
+
+#ifndef _HOSTPOSTPROCESS_H
+#define _HOSTPOSTPROCESS_H
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cmath>
+
+#include "particledefine.h"
+#include "HostKernel.h"
+#include "PostFrame.h"
+
+/*! Simulation parameters needed by the post-processing, as read
+ *  from the summary.txt of the simulation
+ */
+struct PostParams
+{
+	KernelType	kerneltype;
+	double		slength;
+	double		kernelradius;
+	double		influenceRadius;
+	double		deltap;
+	// cone angles for the surface detection (see PhysParams)
+	double		cosconeanglefluid;
+	double		cosconeanglenonfluid;
+
+	PostParams() :
+		kerneltype(WENDLAND),
+		slength(NAN),
+		kernelradius(2),
+		influenceRadius(NAN),
+		deltap(NAN),
+		cosconeanglefluid(0.86),
+		cosconeanglenonfluid(0.5)
+	{}
+
+	void read_summary(std::string const& fname);
+};
+
+/*! Cell grid on the host: particles are sorted by cell, with the same
+ *  cellStart/cellEnd representation used on the device, and neighbors
+ *  are found in the 27 cells around the particle cell. Cells are at least
+ *  as large as the influence radius.
+ */
+class HostCellGrid
+{
+	double3		m_origin;
+	double		m_cellSide;
+	int3		m_gridSize;
+
+	std::vector<uint>	m_cellStart;	// first particle in each cell, plus end marker
+	std::vector<uint>	m_sorted;		// particle indices, sorted by cell
+
+public:
+	HostCellGrid(std::vector<double3> const& pos, double influenceRadius);
+
+	int3 cell_of(double3 const& p) const;
+
+	/* Indices of the particles within radius of p (including the ones
+	 * at p itself) */
+	void neighbors(std::vector<double3> const& pos, double3 const& p, double radius,
+		std::vector<uint> &neibs) const;
+
+	/* Call visit(j, relPos, r2) for each particle j within radius of p,
+	 * with its relative position and squared distance from p */
+	template<typename Visitor>
+	void for_each_neighbor(std::vector<double3> const& pos, double3 const& p, double radius,
+		Visitor &visit) const;
+
+	double3 const& origin() const
+	{ return m_origin; }
+};
+
+template<typename Visitor>
+void
+HostCellGrid::for_each_neighbor(std::vector<double3> const& pos, double3 const& p, double radius,
+	Visitor &visit) const
+{
+	if (m_sorted.empty())
+		return;
+
+	const double radius2 = radius*radius;
+	const int3 c = cell_of(p);
+	const int reach = int(ceil(radius/m_cellSide));
+
+	for (int z = std::max(c.z - reach, 0); z <= std::min(c.z + reach, m_gridSize.z - 1); ++z)
+	for (int y = std::max(c.y - reach, 0); y <= std::min(c.y + reach, m_gridSize.y - 1); ++y)
+	for (int x = std::max(c.x - reach, 0); x <= std::min(c.x + reach, m_gridSize.x - 1); ++x) {
+		const size_t cell = (size_t(z)*m_gridSize.y + y)*m_gridSize.x + x;
+		for (uint s = m_cellStart[cell]; s < m_cellStart[cell + 1]; ++s) {
+			const uint j = m_sorted[s];
+			const double3 relPos = p - pos[j];
+			const double r2 = sqlength(relPos);
+			if (r2 < radius2)
+				visit(j, relPos, r2);
+		}
+	}
+}
+
+/*! A regularly spaced grid on which particle data is interpolated */
+struct PostGrid
+{
+	double3		origin;
+	double		spacing;
+	int3		size;
+};
+
+class HostPostProcess
+{
+	PostParams	m_params;
+	HostKernel	m_kernel;
+
+	double W(double r) const
+	{ return m_kernel.W(r); }
+	double F(double r) const
+	{ return m_kernel.F(r); }
+
+	// neighbor search visitor for the fused Shepard filter
+	struct ShepardNeibs;
+
+public:
+	HostPostProcess(PostParams const& params);
+
+	PostParams const& params() const
+	{ return m_params; }
+
+	/* Compute vorticity (VORTICITY) and surface particles and normals
+	 * (SURFACE_DETECTION), for all the fluid particles of the frame */
+	void process(PostFrame &frame, HostCellGrid const& cells,
+		bool vorticity, bool surface) const;
+
+	/* Shepard interpolation of velocity and pressure on the given grid,
+	 * saved as VTK image data */
+	void save_grid(PostFrame const& frame, HostCellGrid const& cells,
+		PostGrid const& grid, std::string const& fname) const;
+
+	/* Free surface elevation at the given (x, y) positions,
+	 * NAN where there is no fluid */
+	void gage_levels(PostFrame const& frame,
+		std::vector<double2> const& gages, std::vector<double> &levels) const;
+
+	/* Shepard filter of the density of the fluid particles (as SHEPARD_FILTER
+	 * with LJ boundaries), building the neighbor lists (fluid particles only,
+	 * within nlRadius, in CSR form) at the same time. The filter is either run
+	 * as a second pass over the lists, as when FILTER follows BUILDNEIBS, or
+	 * fused with the neighbor search, as BUILDNEIBS does when the filter is due
+	 * at a neighbor list rebuild. */
+	void shepard(PostFrame &frame, HostCellGrid const& cells, double nlRadius, bool fused,
+		std::vector<uint> &neibsStart, std::vector<uint> &neibs) const;
+};
+
+#endif
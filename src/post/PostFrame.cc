@@ -0,0 +1,364 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "PostFrame.h"
+
+using namespace std;
+
+/* Endianness check, as in the VTKWriter */
+static int endian_int=1;
+static const char* endianness[2] = { "BigEndian", "LittleEndian" };
+
+// value of the attribute with the given name in an XML tag, empty if missing
+static string
+get_attr(string const& tag, const char *name)
+{
+	const string key = string(" ") + name + "=";
+	size_t start = tag.find(key);
+	if (start == string::npos)
+		return string();
+	start += key.size();
+	const char quote = tag[start];
+	const size_t end = tag.find(quote, start + 1);
+	if (end == string::npos)
+		return string();
+	return tag.substr(start + 1, end - start - 1);
+}
+
+namespace {
+
+// a DataArray in the appended section of a VTU file
+struct vtu_array {
+	string	type;
+	uint	components;
+	size_t	offset;
+};
+
+// the (relevant) content of a VTU file written by the VTKWriter
+class vtu_file {
+	string	m_fname;
+	ifstream	m_in;
+	size_t	m_numParts;
+	streamoff	m_data_start;
+	map<string, vtu_array>	m_arrays;
+
+public:
+	vtu_file(string const& fname) :
+		m_fname(fname),
+		m_in(fname.c_str(), ios::binary),
+		m_numParts(0),
+		m_data_start(0)
+	{
+		if (!m_in)
+			throw runtime_error("Cannot open " + m_fname);
+
+		// the XML part of the file is written one tag per line
+		string line;
+		bool in_points = false;
+		while (getline(m_in, line)) {
+			if (line.find("<VTKFile") != string::npos) {
+				const string order = get_attr(line, "byte_order");
+				if (order != endianness[*(char*)&endian_int & 1])
+					throw runtime_error(m_fname + " has the wrong endianness");
+			} else if (line.find("<Piece") != string::npos) {
+				m_numParts = atol(get_attr(line, "NumberOfPoints").c_str());
+			} else if (line.find("<Points>") != string::npos) {
+				in_points = true;
+			} else if (line.find("</Points>") != string::npos) {
+				in_points = false;
+			} else if (line.find("<DataArray") != string::npos) {
+				vtu_array arr;
+				arr.type = get_attr(line, "type");
+				const string ncomp = get_attr(line, "NumberOfComponents");
+				arr.components = ncomp.empty() ? 1 : atoi(ncomp.c_str());
+				arr.offset = atol(get_attr(line, "offset").c_str());
+				m_arrays[in_points ? string("Points") : get_attr(line, "Name")] = arr;
+			} else if (line.find("<AppendedData") != string::npos) {
+				// the raw data starts after the underscore
+				m_data_start = m_in.tellg() + streamoff(1);
+				break;
+			}
+		}
+		if (!m_data_start)
+			throw runtime_error(m_fname + " has no appended data");
+	}
+
+	size_t numParts() const
+	{ return m_numParts; }
+
+	bool has(const char *name) const
+	{ return m_arrays.find(name) != m_arrays.end(); }
+
+	// read an array, converting it to T; missing arrays are an error
+	template<typename T>
+	void read(const char *name, T *out, uint components)
+	{
+		map<string, vtu_array>::const_iterator found = m_arrays.find(name);
+		if (found == m_arrays.end())
+			throw runtime_error(m_fname + " has no " + name + " array");
+		vtu_array const& arr = found->second;
+		if (arr.components != components)
+			throw runtime_error(m_fname + ": unexpected size for the " + name + " array");
+
+		m_in.seekg(m_data_start + streamoff(arr.offset));
+		int32_t numbytes = 0;
+		m_in.read((char*)&numbytes, sizeof(numbytes));
+
+		const size_t count = m_numParts*components;
+		vector<char> raw(numbytes);
+		if (numbytes)
+			m_in.read(&raw[0], numbytes);
+		if (!m_in)
+			throw runtime_error(m_fname + ": truncated " + name + " array");
+
+#define CONVERT(vtktype, ctype) \
+		if (arr.type == vtktype) { \
+			if (size_t(numbytes) != count*sizeof(ctype)) \
+				throw runtime_error(m_fname + ": inconsistent " + name + " array"); \
+			const ctype *src = (const ctype *)(numbytes ? &raw[0] : NULL); \
+			for (size_t i = 0; i < count; ++i) \
+				out[i] = src[i]; \
+			return; \
+		}
+		CONVERT("Float64", double)
+		CONVERT("Float32", float)
+		CONVERT("Int32", int32_t)
+		CONVERT("UInt32", uint32_t)
+		CONVERT("UInt16", uint16_t)
+		CONVERT("UInt8", uint8_t)
+#undef CONVERT
+		throw runtime_error(m_fname + ": unsupported type " + arr.type + " for " + name);
+	}
+};
+
+// Binary dump a single variable of a given type
+template<typename T>
+inline void
+write_var(ofstream &out, T const& var)
+{
+	out.write(reinterpret_cast<const char *>(&var), sizeof(T));
+}
+
+// Binary dump an array of variables of given type and size
+template<typename T>
+inline void
+write_arr(ofstream &out, T const *var, size_t len)
+{
+	out.write(reinterpret_cast<const char *>(var), sizeof(T)*len);
+}
+
+// declare an appended array, and advance the offset
+inline void
+data_array(ofstream &out, const char *type, const char *name, uint dim,
+	size_t bytes, size_t &offset)
+{
+	out << "	<DataArray type='" << type << "'";
+	if (name)
+		out << " Name='" << name << "'";
+	if (dim > 1)
+		out << " NumberOfComponents='" << dim << "'";
+	out << " format='appended' offset='" << offset << "'/>" << endl;
+	offset += bytes + sizeof(int);
+}
+
+}
+
+void
+PostFrame::load(string const& datadir)
+{
+	clear();
+
+	vector<string>::const_iterator f(files.begin());
+	for (; f != files.end(); ++f) {
+		vtu_file vtu(datadir + "/" + *f);
+		const size_t n = vtu.numParts();
+		const size_t start = numParts();
+
+		pos.resize(start + n);
+		vel.resize(start + n);
+		rho.resize(start + n);
+		pressure.resize(start + n);
+		mass.resize(start + n);
+		type.resize(start + n, PT_FLUID);
+
+		vtu.read("Points", (double*)&pos[start], 3);
+		vtu.read("Velocity", (float*)&vel[start], 3);
+		vtu.read("Density", &rho[start], 1);
+		vtu.read("Pressure", &pressure[start], 1);
+		vtu.read("Mass", &mass[start], 1);
+		if (vtu.has("Part type"))
+			vtu.read("Part type", &type[start], 1);
+	}
+}
+
+void
+PostFrame::clear()
+{
+	vector<double3>().swap(pos);
+	vector<float3>().swap(vel);
+	vector<float>().swap(rho);
+	vector<float>().swap(pressure);
+	vector<float>().swap(mass);
+	vector<uchar>().swap(type);
+	vector<float3>().swap(vorticity);
+	vector<float3>().swap(normals);
+	vector<uchar>().swap(surface);
+}
+
+void
+PostFrame::save(string const& fname) const
+{
+	const size_t numParts = this->numParts();
+
+	ofstream fid(fname.c_str(), ios::binary);
+	fid.exceptions(ofstream::failbit | ofstream::badbit);
+
+	fid << "<?xml version='1.0'?>" << endl;
+	fid << "<VTKFile type='UnstructuredGrid'  version='0.1'  byte_order='" <<
+		endianness[*(char*)&endian_int & 1] << "'>" << endl;
+	fid << " <UnstructuredGrid>" << endl;
+	fid << "  <Piece NumberOfPoints='" << numParts << "' NumberOfCells='" << numParts << "'>" << endl;
+	fid << "   <PointData Scalars='Pressure' Vectors='Velocity'>" << endl;
+
+	size_t offset = 0;
+	data_array(fid, "Float32", "Pressure", 1, sizeof(float)*numParts, offset);
+	data_array(fid, "Float32", "Density", 1, sizeof(float)*numParts, offset);
+	data_array(fid, "Float32", "Mass", 1, sizeof(float)*numParts, offset);
+	data_array(fid, "UInt8", "Part type", 1, sizeof(uchar)*numParts, offset);
+	data_array(fid, "Float32", "Velocity", 3, sizeof(float)*3*numParts, offset);
+	if (!vorticity.empty())
+		data_array(fid, "Float32", "Vorticity", 3, sizeof(float)*3*numParts, offset);
+	if (!normals.empty())
+		data_array(fid, "Float32", "Normals", 3, sizeof(float)*3*numParts, offset);
+	if (!surface.empty())
+		data_array(fid, "UInt8", "Surface", 1, sizeof(uchar)*numParts, offset);
+	fid << "   </PointData>" << endl;
+
+	fid << "   <Points>" << endl;
+	data_array(fid, "Float64", NULL, 3, sizeof(double)*3*numParts, offset);
+	fid << "   </Points>" << endl;
+
+	fid << "   <Cells>" << endl;
+	data_array(fid, "Int32", "connectivity", 1, sizeof(uint)*numParts, offset);
+	data_array(fid, "Int32", "offsets", 1, sizeof(uint)*numParts, offset);
+	data_array(fid, "UInt8", "types", 1, sizeof(uchar)*numParts, offset);
+	fid << "   </Cells>" << endl;
+	fid << "  </Piece>" << endl;
+	fid << " </UnstructuredGrid>" << endl;
+	fid << " <AppendedData encoding='raw'>\n_";
+
+	int numbytes = sizeof(float)*numParts;
+	write_var(fid, numbytes);
+	write_arr(fid, &pressure[0], numParts);
+	write_var(fid, numbytes);
+	write_arr(fid, &rho[0], numParts);
+	write_var(fid, numbytes);
+	write_arr(fid, &mass[0], numParts);
+
+	numbytes = sizeof(uchar)*numParts;
+	write_var(fid, numbytes);
+	write_arr(fid, &type[0], numParts);
+
+	numbytes = sizeof(float)*3*numParts;
+	write_var(fid, numbytes);
+	write_arr(fid, &vel[0], numParts);
+	if (!vorticity.empty()) {
+		write_var(fid, numbytes);
+		write_arr(fid, &vorticity[0], numParts);
+	}
+	if (!normals.empty()) {
+		write_var(fid, numbytes);
+		write_arr(fid, &normals[0], numParts);
+	}
+	if (!surface.empty()) {
+		numbytes = sizeof(uchar)*numParts;
+		write_var(fid, numbytes);
+		write_arr(fid, &surface[0], numParts);
+	}
+
+	numbytes = sizeof(double)*3*numParts;
+	write_var(fid, numbytes);
+	write_arr(fid, &pos[0], numParts);
+
+	numbytes = sizeof(int)*numParts;
+	write_var(fid, numbytes);
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, i);
+	write_var(fid, numbytes);
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, i + 1);
+
+	numbytes = sizeof(uchar)*numParts;
+	write_var(fid, numbytes);
+	const uchar celltype = 1;
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, celltype);
+
+	fid << " </AppendedData>" << endl;
+	fid << "</VTKFile>" << endl;
+}
+
+// sort frames by time
+static bool
+earlier(PostFrame const& a, PostFrame const& b)
+{ return a.t < b.t; }
+
+PostFrameList
+read_frame_list(string const& pvd_fname)
+{
+	ifstream in(pvd_fname.c_str());
+	if (!in)
+		throw runtime_error("Cannot open " + pvd_fname);
+
+	// Particles blocks, grouped by their timestep attribute
+	map<string, PostFrame> by_time;
+
+	string line;
+	while (getline(in, line)) {
+		if (line.find("<DataSet") == string::npos)
+			continue;
+		if (get_attr(line, "name") != "Particles")
+			continue;
+		const string t = get_attr(line, "timestep");
+		PostFrame &frame = by_time[t];
+		frame.t = atof(t.c_str());
+		frame.files.push_back(get_attr(line, "file"));
+	}
+
+	PostFrameList frames;
+	map<string, PostFrame>::const_iterator f(by_time.begin());
+	for (; f != by_time.end(); ++f)
+		frames.push_back(f->second);
+	sort(frames.begin(), frames.end(), earlier);
+
+	return frames;
+}
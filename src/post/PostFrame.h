@@ -0,0 +1,83 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Particle frames for the offline post-processor */
+
+#ifndef _POSTFRAME_H
+#define _POSTFRAME_H
+
+#include <string>
+#include <vector>
+#include <map>
+
+#include "common_types.h"
+#include "vector_math.h"
+
+/*! A frame saved by the VTKWriter: all the Particles blocks written at the
+ *  same time (one per process in multi-node runs), merged together.
+ *
+ *  Only the data needed by the host post-processing is loaded: position,
+ *  velocity, density, pressure, mass and particle type. The results of the
+ *  post-processing are stored in the frame, and saved with it in a new
+ *  (smaller) VTU file.
+ */
+struct PostFrame
+{
+	double		t;
+	std::vector<std::string>	files;
+
+	std::vector<double3>	pos;
+	std::vector<float3>		vel;
+	std::vector<float>		rho;
+	std::vector<float>		pressure;
+	std::vector<float>		mass;
+	std::vector<uchar>		type;
+
+	// post-processing results, empty if not computed
+	std::vector<float3>		vorticity;
+	std::vector<float3>		normals;
+	std::vector<uchar>		surface;
+
+	size_t numParts() const
+	{ return pos.size(); }
+
+	// load (and append) the particles of all the files of the frame
+	void load(std::string const& datadir);
+
+	// free the particle data, keeping the time and file list
+	void clear();
+
+	// save particles and post-processing results to a VTU file
+	void save(std::string const& fname) const;
+};
+
+typedef std::vector<PostFrame> PostFrameList;
+
+/*! Read the list of frames from the VTUinp.pvd file of a simulation,
+ *  grouping the Particles blocks by time
+ */
+PostFrameList read_frame_list(std::string const& pvd_fname);
+
+#endif
@@ -0,0 +1,428 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* gpusph-post: offline post-processing of the frames saved by a simulation.
+ *
+ * Vorticity, surface detection, gridding and gage extraction can be computed
+ * from the saved VTU files instead of during the simulation, so that
+ * production runs only need to save the basic particle data.
+ * Frames are processed in parallel by multiple threads, and can be split
+ * across multiple processes (e.g. MPI ranks: the rank and number of processes
+ * are taken from the environment set up by mpirun or srun, so that the tool
+ * doesn't need to be linked against MPI).
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define GPUSPH_MAIN
+#include "particledefine.h"
+#undef GPUSPH_MAIN
+
+#include "PostFrame.h"
+#include "HostPostProcess.h"
+
+using namespace std;
+
+struct PostOptions
+{
+	string	simdir;
+	string	outdir;
+	bool	vorticity;
+	bool	surface;
+	double	grid_spacing;
+	vector<double2>	gages;
+	int		threads;
+	int		rank;
+	int		ranks;
+	double	t_from;
+	double	t_to;
+
+	PostOptions() :
+		vorticity(false),
+		surface(false),
+		grid_spacing(0),
+		threads(0),
+		rank(-1),
+		ranks(-1),
+		t_from(-INFINITY),
+		t_to(INFINITY)
+	{}
+};
+
+static void
+print_usage(const char *progname)
+{
+	cout << "Syntax: " << progname << " [options] <simulation directory>\n";
+	cout << "Options:\n";
+	cout << " --help : Show this help and exit\n";
+	cout << " --vorticity : Compute the vorticity of fluid particles\n";
+	cout << " --surface : Detect the free surface particles, and compute their normals\n";
+	cout << " --grid dx : Interpolate velocity and pressure on a grid with spacing dx\n";
+	cout << " --gage x,y : Extract the free surface elevation at (x, y) (can be repeated)\n";
+	cout << " --from t, --to t : Only process the frames in the given time range\n";
+	cout << " --threads N : Process N frames at a time (default: number of cores)\n";
+	cout << " --rank R --ranks N : Only process the frames of process R out of N\n";
+	cout << "                      (default: from the MPI or SLURM environment)\n";
+	cout << " --outdir dir : Output directory (default: <simulation directory>/post)\n";
+}
+
+// rank and number of processes set by the launcher, if any
+static void
+rank_from_environment(int &rank, int &ranks)
+{
+	static const char *env[][2] = {
+		{ "OMPI_COMM_WORLD_RANK", "OMPI_COMM_WORLD_SIZE" },
+		{ "PMI_RANK", "PMI_SIZE" },
+		{ "SLURM_PROCID", "SLURM_NTASKS" },
+	};
+	for (size_t i = 0; i < sizeof(env)/sizeof(*env); ++i) {
+		const char *r = getenv(env[i][0]);
+		const char *n = getenv(env[i][1]);
+		if (r && n) {
+			rank = atoi(r);
+			ranks = atoi(n);
+			return;
+		}
+	}
+	rank = 0;
+	ranks = 1;
+}
+
+static int
+parse_options(int argc, char **argv, PostOptions &opts)
+{
+	const char *progname = argv[0];
+	--argc;
+	++argv;
+
+	while (argc > 0) {
+		const char *arg = *argv;
+		const bool has_value = (argc > 1);
+		if (!strcmp(arg, "--help")) {
+			print_usage(progname);
+			exit(0);
+		} else if (!strcmp(arg, "--vorticity")) {
+			opts.vorticity = true;
+		} else if (!strcmp(arg, "--surface")) {
+			opts.surface = true;
+		} else if (!strcmp(arg, "--grid") && has_value) {
+			sscanf(*++argv, "%lf", &opts.grid_spacing);
+			--argc;
+		} else if (!strcmp(arg, "--gage") && has_value) {
+			double2 gage;
+			if (sscanf(*++argv, "%lf,%lf", &gage.x, &gage.y) != 2) {
+				cerr << "Invalid gage position " << *argv << endl;
+				return -1;
+			}
+			opts.gages.push_back(gage);
+			--argc;
+		} else if (!strcmp(arg, "--from") && has_value) {
+			sscanf(*++argv, "%lf", &opts.t_from);
+			--argc;
+		} else if (!strcmp(arg, "--to") && has_value) {
+			sscanf(*++argv, "%lf", &opts.t_to);
+			--argc;
+		} else if (!strcmp(arg, "--threads") && has_value) {
+			sscanf(*++argv, "%d", &opts.threads);
+			--argc;
+		} else if (!strcmp(arg, "--rank") && has_value) {
+			sscanf(*++argv, "%d", &opts.rank);
+			--argc;
+		} else if (!strcmp(arg, "--ranks") && has_value) {
+			sscanf(*++argv, "%d", &opts.ranks);
+			--argc;
+		} else if (!strcmp(arg, "--outdir") && has_value) {
+			opts.outdir = *++argv;
+			--argc;
+		} else if (arg[0] == '-') {
+			cerr << "Unknown or incomplete option " << arg << endl;
+			print_usage(progname);
+			return -1;
+		} else if (opts.simdir.empty()) {
+			opts.simdir = arg;
+		} else {
+			cerr << "Only one simulation directory can be given" << endl;
+			return -1;
+		}
+		--argc;
+		++argv;
+	}
+
+	if (opts.simdir.empty()) {
+		print_usage(progname);
+		return -1;
+	}
+	if (!opts.vorticity && !opts.surface && !(opts.grid_spacing > 0) && opts.gages.empty()) {
+		cerr << "Nothing to do: select at least one of --vorticity, --surface, --grid, --gage" << endl;
+		return -1;
+	}
+
+	if (opts.outdir.empty())
+		opts.outdir = opts.simdir + "/post";
+	if (opts.threads < 1)
+		opts.threads = max(1L, sysconf(_SC_NPROCESSORS_ONLN));
+	if (opts.rank < 0 || opts.ranks < 1) {
+		int rank, ranks;
+		rank_from_environment(rank, ranks);
+		if (opts.rank < 0) opts.rank = rank;
+		if (opts.ranks < 1) opts.ranks = ranks;
+	}
+	if (opts.rank >= opts.ranks) {
+		cerr << "Rank " << opts.rank << " out of range for " << opts.ranks << " processes" << endl;
+		return -1;
+	}
+
+	return 0;
+}
+
+/* The work shared by the post-processing threads */
+struct PostJob
+{
+	PostOptions const*	opts;
+	HostPostProcess const*	post;
+	string		datadir;
+
+	PostFrameList	frames;
+	// numbers of the frames to process, and next one to be taken
+	vector<size_t>	todo;
+	size_t		next;
+	pthread_mutex_t	mutex;
+
+	// per-frame gage levels
+	vector< vector<double> >	levels;
+	size_t		failed;
+};
+
+static string
+frame_fname(const char *prefix, size_t num, const char *ext)
+{
+	ostringstream fname;
+	fname << prefix << "_" << setw(5) << setfill('0') << num << ext;
+	return fname.str();
+}
+
+static void
+process_frame(PostJob &job, size_t num)
+{
+	PostOptions const& opts = *job.opts;
+	PostFrame &frame = job.frames[num];
+
+	frame.load(job.datadir);
+
+	const HostCellGrid cells(frame.pos, job.post->params().influenceRadius);
+
+	if (opts.vorticity || opts.surface) {
+		job.post->process(frame, cells, opts.vorticity, opts.surface);
+		frame.save(opts.outdir + "/" + frame_fname("POST", num, ".vtu"));
+	}
+
+	if (opts.grid_spacing > 0) {
+		// cover the fluid, with the grid nodes aligned to the origin
+		double3 minp = make_double3(INFINITY), maxp = make_double3(-INFINITY);
+		for (size_t i = 0; i < frame.numParts(); ++i) {
+			if (frame.type[i] != PT_FLUID)
+				continue;
+			const double3 &p = frame.pos[i];
+			minp = make_double3(fmin(minp.x, p.x), fmin(minp.y, p.y), fmin(minp.z, p.z));
+			maxp = make_double3(fmax(maxp.x, p.x), fmax(maxp.y, p.y), fmax(maxp.z, p.z));
+		}
+		if (minp.x <= maxp.x) {
+			const double dx = opts.grid_spacing;
+			PostGrid grid;
+			grid.spacing = dx;
+			grid.origin = make_double3(floor(minp.x/dx), floor(minp.y/dx), floor(minp.z/dx))*dx;
+			grid.size = make_int3(
+				int((maxp.x - grid.origin.x)/dx) + 2,
+				int((maxp.y - grid.origin.y)/dx) + 2,
+				int((maxp.z - grid.origin.z)/dx) + 2);
+			job.post->save_grid(frame, cells, grid, opts.outdir + "/" + frame_fname("GRID", num, ".vti"));
+		}
+	}
+
+	if (!opts.gages.empty())
+		job.post->gage_levels(frame, opts.gages, job.levels[num]);
+
+	frame.clear();
+}
+
+static void *
+post_thread(void *arg)
+{
+	PostJob &job = *static_cast<PostJob*>(arg);
+
+	while (true) {
+		pthread_mutex_lock(&job.mutex);
+		if (job.next == job.todo.size()) {
+			pthread_mutex_unlock(&job.mutex);
+			break;
+		}
+		const size_t num = job.todo[job.next++];
+		pthread_mutex_unlock(&job.mutex);
+
+		try {
+			process_frame(job, num);
+			pthread_mutex_lock(&job.mutex);
+			cout << "Frame " << num << " (t = " << job.frames[num].t << ") done" << endl;
+			pthread_mutex_unlock(&job.mutex);
+		} catch (exception const& e) {
+			job.frames[num].clear();
+			pthread_mutex_lock(&job.mutex);
+			cerr << "Frame " << num << " failed: " << e.what() << endl;
+			++job.failed;
+			pthread_mutex_unlock(&job.mutex);
+		}
+	}
+	return NULL;
+}
+
+// name of per-process output files, when running with multiple processes
+static string
+rank_fname(PostOptions const& opts, const char *base, const char *ext)
+{
+	ostringstream fname;
+	fname << opts.outdir << "/" << base;
+	if (opts.ranks > 1)
+		fname << "_r" << opts.rank;
+	fname << ext;
+	return fname.str();
+}
+
+static void
+write_results(PostJob const& job)
+{
+	PostOptions const& opts = *job.opts;
+
+	// the processed frames, for ParaView
+	if (opts.vorticity || opts.surface || opts.grid_spacing > 0) {
+		ofstream pvd(rank_fname(opts, "post", ".pvd").c_str());
+		pvd << "<?xml version='1.0'?>\n";
+		pvd << "<VTKFile type='Collection' version='0.1'>\n";
+		pvd << " <Collection>\n";
+		for (size_t n = 0; n < job.todo.size(); ++n) {
+			const size_t num = job.todo[n];
+			const double t = job.frames[num].t;
+			if (opts.vorticity || opts.surface)
+				pvd << "  <DataSet timestep='" << t << "' group='0' name='Particles' file='" <<
+					frame_fname("POST", num, ".vtu") << "'/>\n";
+			if (opts.grid_spacing > 0)
+				pvd << "  <DataSet timestep='" << t << "' group='1' name='Grid' file='" <<
+					frame_fname("GRID", num, ".vti") << "'/>\n";
+		}
+		pvd << " </Collection>\n";
+		pvd << "</VTKFile>" << endl;
+	}
+
+	// gage time series
+	if (!opts.gages.empty()) {
+		ofstream out(rank_fname(opts, "gages", ".txt").c_str());
+		out << "#\ttime";
+		for (size_t g = 0; g < opts.gages.size(); ++g)
+			out << "\tz(" << opts.gages[g].x << "," << opts.gages[g].y << ")";
+		out << "\n";
+		for (size_t n = 0; n < job.todo.size(); ++n) {
+			const size_t num = job.todo[n];
+			if (job.levels[num].empty())
+				continue;
+			out << job.frames[num].t;
+			for (size_t g = 0; g < opts.gages.size(); ++g)
+				out << "\t" << job.levels[num][g];
+			out << "\n";
+		}
+	}
+}
+
+int
+main(int argc, char **argv)
+{
+	PostOptions opts;
+	if (parse_options(argc, argv, opts))
+		return 1;
+
+	try {
+		PostParams params;
+		params.read_summary(opts.simdir + "/summary.txt");
+		const HostPostProcess post(params);
+
+		PostJob job;
+		job.opts = &opts;
+		job.post = &post;
+		job.datadir = opts.simdir + "/data";
+		job.frames = read_frame_list(job.datadir + "/VTUinp.pvd");
+		job.next = 0;
+		job.failed = 0;
+		job.levels.resize(job.frames.size());
+
+		// frames in range are assigned to the processes round-robin
+		size_t in_range = 0;
+		for (size_t num = 0; num < job.frames.size(); ++num) {
+			const double t = job.frames[num].t;
+			if (t < opts.t_from || t > opts.t_to)
+				continue;
+			if (in_range++ % opts.ranks == size_t(opts.rank))
+				job.todo.push_back(num);
+		}
+
+		mkdir(opts.outdir.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+
+		const int nthreads = min(size_t(opts.threads), max(job.todo.size(), size_t(1)));
+		cout << "Post-processing " << job.todo.size() << " of " << job.frames.size() <<
+			" frames with " << nthreads << " threads";
+		if (opts.ranks > 1)
+			cout << " (process " << opts.rank << " of " << opts.ranks << ")";
+		cout << ", " << KernelName[params.kerneltype] << " kernel, influence radius " <<
+			params.influenceRadius << endl;
+
+		pthread_mutex_init(&job.mutex, NULL);
+		vector<pthread_t> threads(nthreads);
+		for (int i = 0; i < nthreads; ++i)
+			pthread_create(&threads[i], NULL, post_thread, &job);
+		for (int i = 0; i < nthreads; ++i)
+			pthread_join(threads[i], NULL);
+		pthread_mutex_destroy(&job.mutex);
+
+		write_results(job);
+
+		if (job.failed) {
+			cerr << job.failed << " frames could not be processed" << endl;
+			return 1;
+		}
+	} catch (exception const& e) {
+		cerr << e.what() << endl;
+		return 1;
+	}
+
+	return 0;
+}
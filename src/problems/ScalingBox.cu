@@ -0,0 +1,110 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <cmath>
+
+#include "ScalingBox.h"
+#include "GlobalData.h"
+#include "cudasimframework.cu"
+
+ScalingBox::ScalingBox(GlobalData *_gdata) : XProblem(_gdata)
+{
+	// weak scaling: fixed number of particles per device
+	const double ppd = get_option("ppd", 1.0e6);
+	// strong scaling: fixed total number of particles
+	const double particles = get_option("particles", 0.0);
+	// resolution of the cross-section
+	const int ppside = get_option("ppside", 64);
+
+	SETUP_FRAMEWORK(
+		viscosity<KINEMATICVISC>,
+		boundary<LJ_BOUNDARY>,
+		periodicity<PERIODIC_XYZ>
+	);
+
+	W = H = 1;
+	U = 1;
+
+	set_deltap(H/ppside);
+
+	// the box is made longer (along X, the split axis) to accommodate
+	// the requested number of particles, with at least 3 layers per device
+	const double target = (particles > 0 ? particles : ppd*gdata->totDevices);
+	const uint layers = ppside*ppside;
+	const uint nx = max((uint)round(target/layers), 3U*gdata->totDevices);
+	L = nx*m_deltap;
+
+	m_origin = make_double3(0.0);
+	m_size = make_double3(L, W, H);
+
+	// SPH parameters
+	simparams()->dt = 0.0001f;
+	simparams()->dtadaptfactor = 0.3;
+	simparams()->buildneibsfreq = 10;
+	simparams()->tend = 10;
+
+	// Physical parameters: no gravity, the flow is only driven
+	// by the initial velocity field
+	physparams()->gravity = make_float3(0.0);
+	add_fluid(1000.0);
+	set_equation_of_state(0, 7.0f, 10*U);
+	set_kinematic_visc(0, 1.0e-2f);
+
+	physparams()->r0 = m_deltap;
+
+	add_writer(VTKWRITER, 1.0);
+
+	m_name = "ScalingBox";
+
+	// Building the geometry
+	setPositioning(PP_CORNER);
+	// gap due to periodicity, in all directions
+	const double gap = m_deltap/2;
+	addBox(GT_FLUID, FT_SOLID, Point(gap, gap, gap),
+		L - m_deltap, W - m_deltap, H - m_deltap);
+
+	printf("ScalingBox: %u x %d x %d = %lu particles, %g per device on %u devices\n",
+		nx, ppside, ppside, (ulong)nx*layers,
+		double(nx)*layers/gdata->totDevices, gdata->totDevices);
+}
+
+void
+ScalingBox::fillDeviceMap()
+{
+	fillDeviceMapByAxis(X_AXIS);
+}
+
+// Shear flow along X, varying with Z: particles move across the device
+// boundaries, so that the load balancing and exchange paths are exercised
+void
+ScalingBox::initializeParticles(BufferList &buffers, const uint numParticles)
+{
+	float4 *vel = buffers.getData<BUFFER_VEL>();
+	const double4 *pos = buffers.getData<BUFFER_POS_GLOBAL>();
+
+	for (uint i = 0; i < numParticles; i++)
+		vel[i].x = U*sin(2*M_PI*pos[i].z/H);
+}
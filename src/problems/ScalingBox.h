@@ -0,0 +1,55 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _SCALINGBOX_H
+#define _SCALINGBOX_H
+
+#include "XProblem.h"
+
+/* Synthetic problem for scaling tests: a fully periodic box of fluid
+ * with a decaying shear flow along X, whose length is chosen at runtime
+ * so that each device gets a given number of particles (weak scaling),
+ * or so that the total number of particles is fixed (strong scaling).
+ * The domain is split across devices along X.
+ *
+ * Options:
+ *   --ppd N        particles per device (default 1M)
+ *   --particles N  total number of particles (overrides --ppd)
+ *   --ppside N     particles across the (unit) cross-section (default 64)
+ *
+ * See scripts/scaling for a driver that runs whole scaling series.
+ */
+class ScalingBox: public XProblem
+{
+	double	U;			// amplitude of the shear flow
+	double	L, W, H;	// box dimensions
+
+public:
+	ScalingBox(GlobalData *);
+	void fillDeviceMap();
+	void initializeParticles(BufferList &buffers, const uint numParticles);
+};
+
+#endif
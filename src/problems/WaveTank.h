@@ -37,6 +37,10 @@
 class WaveTank: public XProblem {
 	private:
 		bool		use_cyl, use_bottom_plane;
+		bool		use_sponge;		// absorbing layer instead of the sloping beach
+		double		sponge_length;
+		double		flat_length;	// length of the flat section after the paddle, with the sponge
+		double		tank_length;	// h_length plus the slope or the flat section
 		double		paddle_length;
 		double		paddle_width;
 		double		h_length, height, slope_length, beta;
@@ -74,7 +74,10 @@
 // Compute internal energy
 #define ENABLE_INTERNAL_ENERGY (ENABLE_GAMMA_QUADRATURE << 1)
 
-#define LAST_SIMFLAG		ENABLE_INTERNAL_ENERGY
+// Absorbing (sponge) layers
+#define ENABLE_SPONGE			(ENABLE_INTERNAL_ENERGY << 1)
+
+#define LAST_SIMFLAG		ENABLE_SPONGE
 
 // since flags are a bitmap, LAST_SIMFLAG - 1 sets all bits before
 // the LAST_SIMFLAG bit, and OR-ing with LAST_SIMFLAG gives us
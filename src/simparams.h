@@ -36,6 +36,19 @@
 
 typedef std::vector<double4> GageList;
 
+// Out-of-band test points (probes): unlike PT_TESTPOINT particles, they are not
+// part of the particle system, and are only evaluated when writing
+typedef std::vector<double3> ProbeList;
+
+// Values interpolated at a probe
+struct ProbeValue {
+	double4	velp;	// velocity (x, y, z) and pressure (w)
+	double	tke;	// turbulent kinetic energy (KEPSVISC only)
+	double	eps;	// turbulent dissipation (KEPSVISC only)
+	double	alpha;	// Shepard sum of the kernel, about 1 inside the fluid (0 if dry)
+};
+typedef std::vector<ProbeValue> ProbeValueList;
+
 typedef struct SimParams {
 	// Options that are set via SimFramework.
 	const KernelType		kerneltype;				// kernel type
@@ -52,6 +65,7 @@ typedef struct SimParams {
 	double			nlexpansionfactor;		// expand influenceradius by nlexpansionfactor for neib list construction
 	double			nlInfluenceRadius;		// extended radius ( = influence radius * nlexpansionfactor)
 	double			nlSqInfluenceRadius;	// square influence radius for neib list construction
+	uint			nlcellsperradius;		// number of cells per neib search radius (1: 27-cell stencil, 2: 125-cell stencil)
 	float			dt;						// initial timestep
 	double			tend;					// simulation end time (0 means run forever)
 	float			dtadaptfactor;			// safety factor in the adaptive time step formula
@@ -65,6 +79,7 @@ typedef struct SimParams {
 	bool			gcallback;				// true if using a variable gravity in problem
 	bool			calc_energy;			// true if we want to compute system energy at save time
 	GageList		gage;					// water gages
+	ProbeList		probes;					// out-of-band test points
 	uint			numODEbodies;			// number of bodies which movmement is computed by ODE
 	uint			numforcesbodies;		// number of moving bodies on which we need to compute the forces (includes ODE bodies)
 	uint			numbodies;				// total number of bodies (ODE + forces + moving)
@@ -101,6 +116,7 @@ typedef struct SimParams {
 		nlexpansionfactor(1.0f),
 		nlInfluenceRadius(0),
 		nlSqInfluenceRadius(0),
+		nlcellsperradius(1),
 		dt(0),
 		tend(0),
 		dtadaptfactor(0.3f),
@@ -147,6 +163,39 @@ typedef struct SimParams {
 	}
 
 
+	/// use cells which are a fraction 1/cells of the neighbor search radius:
+	/// smaller cells need a larger stencil (5x5x5 instead of 3x3x3 for cells=2),
+	/// but the stencil better approximates the search sphere, so fewer
+	/// distance checks are wasted during the neighbor list construction.
+	/// Only supported in single-device runs
+	inline uint
+	set_neiblist_cells_per_radius(uint cells)
+	{
+		if (cells < 1 || cells > 2)
+			throw std::invalid_argument("neighbor search radius can only be split in 1 or 2 cells");
+		nlcellsperradius = cells;
+		return nlcellsperradius;
+	}
+
+	/// radius of the neighbor search stencil, in cells
+	inline int
+	get_cell_stencil_radius() const
+	{ return nlcellsperradius; }
+
+	/// number of bits of the neibdata used for the neighbor index within
+	/// its cell (see CELLNUM_SHIFT)
+	inline uint
+	get_cellnum_shift() const
+	{ return nlcellsperradius > 1 ? CELLNUM_SHIFT_FINE : CELLNUM_SHIFT; }
+
+	/// number of cells in the neighbor search stencil
+	inline uint
+	get_cell_stencil_size() const
+	{
+		const uint side = 2*nlcellsperradius + 1;
+		return side*side*side;
+	}
+
 	// internal: update the influence radius et al
 	inline double
 	set_influenceradius() {
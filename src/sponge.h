@@ -0,0 +1,65 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/* Data structures for absorbing (sponge) layers */
+
+#ifndef _SPONGE_H
+#define _SPONGE_H
+
+#include "common_types.h"
+#include "vector_math.h"
+
+/*! A sponge layer is a slab of the domain in which the fluid velocity is
+ *  relaxed towards a target velocity, so that waves reaching it are absorbed
+ *  instead of being reflected.
+ *
+ *  The slab starts at the plane through origin with the given (unit) normal,
+ *  and extends for width in the direction of the normal. The relaxation rate
+ *  grows quadratically from 0 on the inner face to sigma on the outer face,
+ *  so that the layer itself reflects as little as possible.
+ *
+ *  The target is the still fluid (amplitude == 0) or a linear (Airy) wave
+ *  of given amplitude, angular frequency and wave number, propagating along
+ *  direction in water of the given depth, with still water level swl. The
+ *  vertical is assumed to be z.
+ *
+ *  Contrary to planes, positions are in world coordinates: the relaxation
+ *  ramp is not sensitive to the loss of precision.
+ */
+struct sponge_t {
+	float3	origin;		/// a point on the inner face of the layer
+	float3	normal;		/// normal to the layer, pointing away from the fluid domain
+	float	width;		/// thickness of the layer
+	float	sigma;		/// relaxation rate (1/s) at the outer face
+
+	float3	direction;	/// propagation direction of the target wave
+	float	amplitude;	/// amplitude of the target wave (0: relax to rest)
+	float	omega;		/// angular frequency of the target wave
+	float	wavenumber;	/// wave number of the target wave
+	float	depth;		/// still water depth
+	float	swl;		/// still water level
+};
+
+#endif
@@ -58,6 +58,9 @@ typedef struct TimingInfo {
 	int	hasTooManyNeibs;
 	// number of neibs of that particle
 	int	hasMaxNeibs;
+	// number of particles of the most crowded cell, if too crowded
+	// for the neibdata encoding (0 otherwise)
+	int	hasCellOverflow;
 	// iterations done so far
 	//ulong	iterations;
 	// number of particle-particle interactions with current neiblist
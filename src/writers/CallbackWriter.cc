@@ -30,6 +30,8 @@ using namespace std;
 
 CallbackWriter::CallbackWriter(const GlobalData *_gdata) : Writer(_gdata)
 {
+	// the problem callback may keep its files open across writes
+	m_stageable = false;
 }
 
 CallbackWriter::~CallbackWriter()
@@ -75,6 +75,32 @@ CommonWriter::CommonWriter(const GlobalData *_gdata)
 		}
 	}
 
+	const ProbeList& probes = m_problem->simparams()->probes;
+	if (probes.size() > 0) {
+		const bool keps = m_problem->simparams()->visctype == KEPSVISC;
+		string probes_fn = open_data_file(m_probesfile, "probes");
+		if (m_probesfile) {
+			// probe positions, as a comment line (used e.g. for nesting)
+			m_probesfile << "#";
+			m_probesfile.precision(9);
+			for (size_t p = 0; p < probes.size(); ++p)
+				m_probesfile << "\t" << probes[p].x << " " << probes[p].y << " " << probes[p].z;
+			m_probesfile << endl;
+			m_probesfile << "time";
+			for (size_t p = 0; p < probes.size(); ++p) {
+				m_probesfile	<< "\tP" << p
+								<< "\tVx" << p
+								<< "\tVy" << p
+								<< "\tVz" << p
+								<< "\tAlpha" << p;
+				if (keps)
+					m_probesfile << "\tTke" << p << "\tEps" << p;
+			}
+			m_probesfile << endl;
+			m_probesfile.precision(9);
+		}
+	}
+
 	// TODO only do this if object data writing is enabled
 	size_t nbodies = m_problem->simparams()->numbodies;
 	if (nbodies > 0) {
@@ -162,6 +188,8 @@ CommonWriter::~CommonWriter()
 		m_energyfile.close();
 	if (m_WaveGagefile)
 		m_WaveGagefile.close();
+	if (m_probesfile)
+		m_probesfile.close();
 	if (m_objectfile)
 		m_objectfile.close();
 	if (m_objectforcesfile)
@@ -246,6 +274,26 @@ CommonWriter::write_WaveGage(double t, GageList const& gage)
 	}
 }
 
+void
+CommonWriter::write_probes(double t, ProbeValueList const& values)
+{
+	if (m_probesfile) {
+		const bool keps = m_problem->simparams()->visctype == KEPSVISC;
+		m_probesfile << t;
+		for (size_t p = 0; p < values.size(); ++p) {
+			const ProbeValue& val = values[p];
+			m_probesfile	<< "\t" << val.velp.w
+							<< "\t" << val.velp.x
+							<< "\t" << val.velp.y
+							<< "\t" << val.velp.z
+							<< "\t" << val.alpha;
+			if (keps)
+				m_probesfile << "\t" << val.tke << "\t" << val.eps;
+		}
+		m_probesfile << endl;
+	}
+}
+
 void
 CommonWriter::write_objects(double t)
 {
@@ -362,6 +410,10 @@ CommonWriter::write_simparams(ostream &out)
 	out << " open boundaries " << ED[!!(SP->simflags & ENABLE_INLET_OUTLET)] << endl;
 	out << " water depth computation " << ED[!!(SP->simflags & ENABLE_WATER_DEPTH)] << endl;
 	out << " time-dependent gravity " << ED[!!(SP->gcallback)] << endl;
+	out << " sponge layers " << ED[!!(SP->simflags & ENABLE_SPONGE)];
+	if (SP->simflags & ENABLE_SPONGE)
+		out << ", " << m_problem->physparams()->sponges.size() << " defined";
+	out << endl;
 
 	const bool has_dem = !!(SP->simflags & ENABLE_DEM);
 	const bool has_planes = !!(SP->simflags & ENABLE_PLANES);
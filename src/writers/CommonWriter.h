@@ -57,6 +57,7 @@ public:
 
 	void write_energy(double t, double4 *energy);
 	void write_WaveGage(double t, GageList const& gage);
+	void write_probes(double t, ProbeValueList const& values);
 	void write_objects(double t);
 	void write_objectforces(double t, uint numobjects,
 		const float3* computedforces, const float3* computedtorques,
@@ -74,6 +75,7 @@ private:
 
 	std::ofstream		m_energyfile;
 	std::ofstream		m_WaveGagefile;
+	std::ofstream		m_probesfile;
 	std::ofstream		m_objectfile;
 	std::ofstream		m_objectforcesfile;
 	std::ofstream		m_fluxfile;
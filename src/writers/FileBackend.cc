@@ -0,0 +1,470 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "FileBackend.h"
+
+#include "iouring_select.opt"
+
+#if USE_IOURING
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+
+using namespace std;
+
+// size of the backend buffers, and their alignment (for O_DIRECT)
+static const size_t BACKEND_BUFFER_SIZE = 4 << 20;
+static const size_t BACKEND_ALIGNMENT = 4096;
+
+static char *
+alloc_aligned_buffer()
+{
+	void *buf = NULL;
+	if (posix_memalign(&buf, BACKEND_ALIGNMENT, BACKEND_BUFFER_SIZE))
+		throw bad_alloc();
+	return (char*)buf;
+}
+
+static string
+errno_string(string const& what, string const& fname, int err)
+{
+	return what + " " + fname + ": " + strerror(err);
+}
+
+// write the whole buffer at the current file position
+static void
+write_fully(int fd, const char *buf, size_t len, string const& fname)
+{
+	while (len > 0) {
+		ssize_t written = write(fd, buf, len);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			throw runtime_error(errno_string("Cannot write data file", fname, errno));
+		}
+		buf += written;
+		len -= written;
+	}
+}
+
+FileBackend::int_type
+FileBackend::overflow(int_type c)
+{
+	flush_put_area();
+	if (!traits_type::eq_int_type(c, traits_type::eof())) {
+		*pptr() = traits_type::to_char_type(c);
+		pbump(1);
+	}
+	return traits_type::not_eof(c);
+}
+
+/* POSIX backend: write(2) from a single buffer */
+
+class PosixFileBackend : public FileBackend
+{
+	string	m_fname;
+	int		m_fd;
+	char	*m_buf;
+
+protected:
+	void flush_put_area()
+	{
+		write_fully(m_fd, pbase(), pptr() - pbase(), m_fname);
+		setp(m_buf, m_buf + BACKEND_BUFFER_SIZE);
+	}
+
+public:
+	PosixFileBackend() :
+		m_fname(),
+		m_fd(-1),
+		m_buf(alloc_aligned_buffer())
+	{ setp(m_buf, m_buf + BACKEND_BUFFER_SIZE); }
+
+	~PosixFileBackend()
+	{
+		if (m_fd >= 0)
+			::close(m_fd);
+		free(m_buf);
+	}
+
+	const char *name() const
+	{ return "posix"; }
+
+	void open(string const& fname)
+	{
+		if (m_fd >= 0)
+			::close(m_fd);
+		m_fname = fname;
+		m_fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (m_fd < 0)
+			throw runtime_error(errno_string("Cannot open data file", fname, errno));
+		setp(m_buf, m_buf + BACKEND_BUFFER_SIZE);
+	}
+
+	void close()
+	{
+		const int fd = m_fd;
+		m_fd = -1;
+		try {
+			write_fully(fd, pbase(), pptr() - pbase(), m_fname);
+		} catch (...) {
+			::close(fd);
+			throw;
+		}
+		setp(m_buf, m_buf + BACKEND_BUFFER_SIZE);
+		if (::close(fd))
+			throw runtime_error(errno_string("Cannot close data file", m_fname, errno));
+	}
+};
+
+#if USE_IOURING
+
+/* io_uring backend: O_DIRECT writes of the full buffers are queued on the
+ * ring, and the writer moves on to the next free buffer. The ring is driven
+ * with the raw system calls, so that no library is needed.
+ * When O_DIRECT is not supported by the filesystem (e.g. older tmpfs),
+ * the same writes go through the page cache. */
+
+class UringFileBackend : public FileBackend
+{
+	static const uint QUEUE_DEPTH = 4;
+
+	// the ring
+	int				m_ring;
+	void			*m_sq_ring;
+	size_t			m_sq_ring_size;
+	void			*m_cq_ring;
+	size_t			m_cq_ring_size;
+	io_uring_sqe	*m_sqes;
+	size_t			m_sqes_size;
+	unsigned		*m_sq_tail, *m_sq_mask, *m_sq_array;
+	unsigned		*m_cq_head, *m_cq_tail, *m_cq_mask;
+	io_uring_cqe	*m_cqes;
+
+	// buffers, and whether they are registered with the ring
+	char			*m_bufs[QUEUE_DEPTH];
+	iovec			m_iov[QUEUE_DEPTH];
+	bool			m_fixed;
+	vector<uint>	m_free;
+	uint			m_current;
+	uint			m_inflight;
+
+	// the file
+	string			m_fname;
+	int				m_fd;
+	bool			m_direct;
+	off_t			m_offset;
+	// first error reported by a completion (errno value)
+	int				m_error;
+
+	static int
+	enter(int ring, uint to_submit, uint min_complete, uint flags)
+	{
+		return syscall(__NR_io_uring_enter, ring, to_submit, min_complete, flags, NULL, 0);
+	}
+
+	// queue the write of len bytes of buffer idx at the given offset
+	void submit(uint idx, size_t len, off_t offset)
+	{
+		const unsigned tail = *m_sq_tail;
+		const unsigned slot = tail & *m_sq_mask;
+		io_uring_sqe *sqe = m_sqes + slot;
+		memset(sqe, 0, sizeof(*sqe));
+		sqe->fd = m_fd;
+		sqe->off = offset;
+		sqe->user_data = idx;
+		m_iov[idx].iov_len = len;
+		if (m_fixed) {
+			sqe->opcode = IORING_OP_WRITE_FIXED;
+			sqe->addr = (unsigned long)m_bufs[idx];
+			sqe->len = len;
+			sqe->buf_index = idx;
+		} else {
+			sqe->opcode = IORING_OP_WRITEV;
+			sqe->addr = (unsigned long)(m_iov + idx);
+			sqe->len = 1;
+		}
+		m_sq_array[slot] = slot;
+		__atomic_store_n(m_sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+		int ret;
+		while ((ret = enter(m_ring, 1, 0, 0)) < 0 && (errno == EINTR || errno == EAGAIN))
+			;
+		if (ret < 0)
+			throw runtime_error(errno_string("Cannot queue write to data file", m_fname, errno));
+		++m_inflight;
+	}
+
+	// collect the completed writes, waiting for at least one if wait is true
+	void reap(bool wait)
+	{
+		while (true) {
+			unsigned head = *m_cq_head;
+			const unsigned tail = __atomic_load_n(m_cq_tail, __ATOMIC_ACQUIRE);
+			const bool any = (head != tail);
+			for (; head != tail; ++head) {
+				const io_uring_cqe *cqe = m_cqes + (head & *m_cq_mask);
+				const uint idx = cqe->user_data;
+				if (cqe->res < 0 && !m_error)
+					m_error = -cqe->res;
+				else if (size_t(cqe->res) != m_iov[idx].iov_len && !m_error)
+					m_error = EIO; // short write
+				m_free.push_back(idx);
+				--m_inflight;
+			}
+			__atomic_store_n(m_cq_head, head, __ATOMIC_RELEASE);
+
+			if (any || !wait || !m_inflight)
+				return;
+			if (enter(m_ring, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+				throw runtime_error(errno_string("Cannot wait for writes to data file", m_fname, errno));
+		}
+	}
+
+	void drain()
+	{
+		while (m_inflight)
+			reap(true);
+	}
+
+	void check_error()
+	{
+		if (m_error) {
+			const int err = m_error;
+			m_error = 0;
+			throw runtime_error(errno_string("Cannot write data file", m_fname, err));
+		}
+	}
+
+	void take_buffer()
+	{
+		if (m_free.empty())
+			reap(true);
+		m_current = m_free.back();
+		m_free.pop_back();
+		setp(m_bufs[m_current], m_bufs[m_current] + BACKEND_BUFFER_SIZE);
+	}
+
+	// close a file left open by a previous error
+	void discard()
+	{
+		if (m_fd < 0)
+			return;
+		drain();
+		::close(m_fd);
+		m_fd = -1;
+		m_error = 0;
+	}
+
+	void *map_ring(size_t size, off_t what)
+	{
+		void *ptr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, m_ring, what);
+		if (ptr == MAP_FAILED)
+			throw runtime_error(string("io_uring mapping failed: ") + strerror(errno));
+		return ptr;
+	}
+
+	void release()
+	{
+		if (m_sqes) munmap(m_sqes, m_sqes_size);
+		if (m_cq_ring) munmap(m_cq_ring, m_cq_ring_size);
+		if (m_sq_ring) munmap(m_sq_ring, m_sq_ring_size);
+		if (m_ring >= 0) ::close(m_ring);
+		for (uint i = 0; i < QUEUE_DEPTH; ++i)
+			free(m_bufs[i]);
+	}
+
+protected:
+	// only called when the put area is full, so the writes stay aligned
+	void flush_put_area()
+	{
+		submit(m_current, pptr() - pbase(), m_offset);
+		m_offset += pptr() - pbase();
+		reap(false);
+		take_buffer();
+		check_error();
+	}
+
+public:
+	UringFileBackend() :
+		m_ring(-1),
+		m_sq_ring(NULL), m_sq_ring_size(0),
+		m_cq_ring(NULL), m_cq_ring_size(0),
+		m_sqes(NULL), m_sqes_size(0),
+		m_fixed(false),
+		m_free(),
+		m_current(0),
+		m_inflight(0),
+		m_fname(),
+		m_fd(-1),
+		m_direct(false),
+		m_offset(0),
+		m_error(0)
+	{
+		memset(m_bufs, 0, sizeof(m_bufs));
+
+		io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		m_ring = syscall(__NR_io_uring_setup, QUEUE_DEPTH, &params);
+		if (m_ring < 0)
+			throw runtime_error(string("io_uring not available: ") + strerror(errno));
+
+		try {
+			m_sq_ring_size = params.sq_off.array + params.sq_entries*sizeof(unsigned);
+			m_cq_ring_size = params.cq_off.cqes + params.cq_entries*sizeof(io_uring_cqe);
+			m_sqes_size = params.sq_entries*sizeof(io_uring_sqe);
+			m_sq_ring = map_ring(m_sq_ring_size, IORING_OFF_SQ_RING);
+			m_cq_ring = map_ring(m_cq_ring_size, IORING_OFF_CQ_RING);
+			m_sqes = (io_uring_sqe*)map_ring(m_sqes_size, IORING_OFF_SQES);
+		} catch (...) {
+			release();
+			throw;
+		}
+
+		char *sq = (char*)m_sq_ring;
+		m_sq_tail = (unsigned*)(sq + params.sq_off.tail);
+		m_sq_mask = (unsigned*)(sq + params.sq_off.ring_mask);
+		m_sq_array = (unsigned*)(sq + params.sq_off.array);
+		char *cq = (char*)m_cq_ring;
+		m_cq_head = (unsigned*)(cq + params.cq_off.head);
+		m_cq_tail = (unsigned*)(cq + params.cq_off.tail);
+		m_cq_mask = (unsigned*)(cq + params.cq_off.ring_mask);
+		m_cqes = (io_uring_cqe*)(cq + params.cq_off.cqes);
+
+		for (uint i = 0; i < QUEUE_DEPTH; ++i) {
+			m_bufs[i] = alloc_aligned_buffer();
+			m_iov[i].iov_base = m_bufs[i];
+			m_iov[i].iov_len = BACKEND_BUFFER_SIZE;
+			m_free.push_back(QUEUE_DEPTH - 1 - i);
+		}
+
+		// registering the buffers saves the page pinning on each write,
+		// but needs enough locked memory (RLIMIT_MEMLOCK)
+		m_fixed = !syscall(__NR_io_uring_register, m_ring,
+			IORING_REGISTER_BUFFERS, m_iov, QUEUE_DEPTH);
+
+		take_buffer();
+	}
+
+	~UringFileBackend()
+	{
+		try {
+			discard();
+		} catch (...) {
+			// nothing we can do
+		}
+		release();
+	}
+
+	const char *name() const
+	{ return "uring"; }
+
+	void open(string const& fname)
+	{
+		discard();
+		m_fname = fname;
+		m_direct = true;
+		m_fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0666);
+		if (m_fd < 0 && errno == EINVAL) {
+			m_direct = false;
+			m_fd = ::open(fname.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		}
+		if (m_fd < 0)
+			throw runtime_error(errno_string("Cannot open data file", fname, errno));
+		m_offset = 0;
+		setp(m_bufs[m_current], m_bufs[m_current] + BACKEND_BUFFER_SIZE);
+	}
+
+	void close()
+	{
+		const size_t len = pptr() - pbase();
+		// with O_DIRECT, the unaligned tail is written through the page cache
+		// once everything else is done
+		const size_t aligned = m_direct ? (len & ~(BACKEND_ALIGNMENT - 1)) : len;
+		const uint last = m_current;
+
+		if (aligned)
+			submit(last, aligned, m_offset);
+		else
+			m_free.push_back(last);
+		drain();
+
+		try {
+			check_error();
+			if (len > aligned) {
+				if (fcntl(m_fd, F_SETFL, fcntl(m_fd, F_GETFL) & ~O_DIRECT))
+					throw runtime_error(errno_string("Cannot write data file", m_fname, errno));
+				if (lseek(m_fd, m_offset + aligned, SEEK_SET) < 0)
+					throw runtime_error(errno_string("Cannot write data file", m_fname, errno));
+				write_fully(m_fd, m_bufs[last] + aligned, len - aligned, m_fname);
+			}
+		} catch (...) {
+			::close(m_fd);
+			m_fd = -1;
+			take_buffer();
+			throw;
+		}
+
+		const int fd = m_fd;
+		m_fd = -1;
+		take_buffer();
+		if (::close(fd))
+			throw runtime_error(errno_string("Cannot close data file", m_fname, errno));
+	}
+};
+
+#endif
+
+FileBackend *
+FileBackend::create(string const& type)
+{
+	if (type == "uring") {
+#if USE_IOURING
+		try {
+			return new UringFileBackend();
+		} catch (runtime_error const& e) {
+			cerr << "WARNING: " << e.what() << ", falling back to POSIX writes" << endl;
+		}
+#else
+		cerr << "WARNING: io_uring support not compiled in, falling back to POSIX writes" << endl;
+#endif
+	} else if (type != "posix") {
+		throw invalid_argument("unknown file backend " + type);
+	}
+	return new PosixFileBackend();
+}
@@ -0,0 +1,77 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _FILEBACKEND_H
+#define	_FILEBACKEND_H
+
+#include <streambuf>
+#include <string>
+
+/*! Backend for the large (binary) data files of the writers.
+ *
+ * A FileBackend is the streambuf of the stream the writer formats its data
+ * into: the writer fills the put area, and full buffers are handed over to
+ * the kernel by the backend. Two backends are available:
+ *  - posix: plain write(2) calls from a single large buffer;
+ *  - uring: O_DIRECT writes queued on an io_uring from a small pool of
+ *    aligned (and, if possible, registered) buffers, so that the writer
+ *    keeps filling the next buffer while the previous ones are written out,
+ *    bypassing the page cache.
+ *
+ * Backends are reused across files, so that the buffers (and the ring) are
+ * only set up once per writer. Flushing the stream (e.g. with std::endl)
+ * does not write out partial buffers: the data is only guaranteed to be
+ * in the file after close().
+ */
+class FileBackend : public std::streambuf
+{
+public:
+	/* Create a backend of the given type (posix or uring); if io_uring is
+	 * not available (not compiled in, or not allowed by the kernel),
+	 * a posix backend is returned instead */
+	static FileBackend *create(std::string const& type);
+
+	virtual ~FileBackend() {}
+
+	virtual const char *name() const = 0;
+
+	// open (create or truncate) the given file for writing
+	virtual void open(std::string const& fname) = 0;
+
+	// write out all the data and close the file; throws on errors
+	virtual void close() = 0;
+
+protected:
+	// write out the (full) put area, and set up the next one
+	virtual void flush_put_area() = 0;
+
+	int_type overflow(int_type c);
+
+	// partial buffers are only written out on close()
+	int sync()
+	{ return 0; }
+};
+
+#endif	/* _FILEBACKEND_H */
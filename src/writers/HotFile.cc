@@ -46,7 +46,7 @@ typedef struct {
 	float	reserved[10];
 } encoded_body_t;
 
-HotFile::HotFile(ofstream &fp, const GlobalData *gdata, uint numParts,
+HotFile::HotFile(ostream &fp, const GlobalData *gdata, uint numParts,
 	uint node_offset, double t, const bool testpoints) {
 	_fp.out = &fp;
 	_gdata = gdata;
@@ -134,7 +134,7 @@ unsupported_version(uint version)
 	throw out_of_range(os.str());
 }
 
-void HotFile::writeHeader(ofstream *fp, version_t version) {
+void HotFile::writeHeader(ostream *fp, version_t version) {
 	switch (version) {
 	case VERSION_1:
 		memset(&_header, 0, sizeof(_header));
@@ -170,7 +170,7 @@ void HotFile::readHeader(uint &part_count, uint &numOpenBoundaries) {
 	part_count += _particle_count;
 }
 
-void HotFile::writeBuffer(ofstream *fp, const AbstractBuffer *buffer, version_t version) {
+void HotFile::writeBuffer(ostream *fp, const AbstractBuffer *buffer, version_t version) {
 	switch (version) {
 	case VERSION_1:
 		encoded_buffer_t eb;
@@ -235,7 +235,7 @@ void HotFile::readBuffer(ifstream *fp, AbstractBuffer *buffer, version_t version
 	}
 }
 
-void HotFile::writeBody(ofstream *fp, const MovingBodyData *mbdata, uint numparts, version_t version)
+void HotFile::writeBody(ostream *fp, const MovingBodyData *mbdata, uint numparts, version_t version)
 {
 	switch (version) {
 	case VERSION_1:
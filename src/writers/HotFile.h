@@ -38,7 +38,7 @@ typedef enum {
 class HotFile {
 public:
 	HotFile(std::ifstream &fp, const GlobalData *gdata);
-	HotFile(std::ofstream &fp, const GlobalData *gdata, uint numParts,
+	HotFile(std::ostream &fp, const GlobalData *gdata, uint numParts,
 		uint node_offset, double t, const bool testpoints);
 	~HotFile();
 	ulong get_iterations() { return _header.iterations; }
@@ -50,7 +50,7 @@ public:
 private:
 	union {
 		std::ifstream		*in;
-		std::ofstream		*out;
+		std::ostream		*out;
 	}					_fp;
 	uint				_particle_count;
 	uint				_node_offset;
@@ -59,9 +59,9 @@ private:
 	const GlobalData	*_gdata;
 	header_t			_header;
 
-	void writeBuffer(std::ofstream *fp, const AbstractBuffer *buffer, version_t version);
-	void writeBody(std::ofstream *fp, const MovingBodyData *mbdata, const uint numparts, version_t version);
-	void writeHeader(std::ofstream *fp, version_t version);
+	void writeBuffer(std::ostream *fp, const AbstractBuffer *buffer, version_t version);
+	void writeBody(std::ostream *fp, const MovingBodyData *mbdata, const uint numparts, version_t version);
+	void writeHeader(std::ostream *fp, version_t version);
 	void readBuffer(std::ifstream *fp, AbstractBuffer *buffer, version_t version);
 	void readBody(std::ifstream *fp, version_t version);
 
@@ -15,6 +15,10 @@ HotWriter::HotWriter(const GlobalData *_gdata): Writer(_gdata) {
 
 	m_fname_sfx = ".bin";
 
+	// checkpoints must be on the final storage as soon as they are written,
+	// and old ones are removed from there
+	m_stageable = false;
+
 	_num_files_to_save = DEFAULT_NUM_FILES_TO_SAVE;
 	_particle_count = 0;
 }
@@ -35,8 +39,8 @@ void HotWriter::write(uint numParts, const BufferList &buffers,
 	uint node_offset, double t, const bool testpoints) {
 
 	// generate filename with iterative integer
-	ofstream out;
-	string filename = open_data_file(out, "hot", current_filenum());
+	ostream out(NULL);
+	string filename = open_backend_file(out, "hot", current_filenum());
 
 	// save the filename in order to manage removing unwanted files
 	_current_filenames.push_back(m_dirname + "/" + filename);
@@ -46,7 +50,7 @@ void HotWriter::write(uint numParts, const BufferList &buffers,
 	hf->save();
 	delete hf;
 
-	out.close();
+	close_backend_file();
 
 	// remove unwanted files, we only keep the last _num_files_to_save ones
 	if(_num_files_to_save > 0 && _current_filenames.size() > _num_files_to_save) {
@@ -0,0 +1,253 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdexcept>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#include "IOAggregator.h"
+#include "GlobalData.h"
+#include "NetworkManager.h"
+
+using namespace std;
+
+/* Host buffer holding the particles gathered from the ranks of a group,
+ * with the same element size, array count and name of the buffer it
+ * gathers, but untyped: getData<Key>() only casts the pointer */
+class GatheredBuffer : public AbstractBuffer
+{
+	const char		*m_name;
+	size_t			m_elsize;
+	vector< vector<char> > m_arrays;
+
+public:
+	GatheredBuffer(const AbstractBuffer *model) :
+		m_name(model->get_buffer_name()),
+		m_elsize(model->get_element_size()),
+		m_arrays(model->get_array_count())
+	{}
+
+	size_t get_element_size() const
+	{ return m_elsize; }
+	uint get_array_count() const
+	{ return m_arrays.size(); }
+	const char* get_buffer_name() const
+	{ return m_name; }
+
+	// the arrays are never empty, so that the buffer is seen as present
+	// even when the group has no particles
+	size_t alloc(size_t elems)
+	{
+		for (size_t a = 0; a < m_arrays.size(); ++a)
+			m_arrays[a].resize(max(elems, size_t(1))*m_elsize);
+		return elems*m_elsize*m_arrays.size();
+	}
+
+	void *get_buffer(uint idx=0)
+	{ return m_arrays[idx].empty() ? NULL : &m_arrays[idx][0]; }
+	const void *get_buffer(uint idx=0) const
+	{ return m_arrays[idx].empty() ? NULL : &m_arrays[idx][0]; }
+
+	void *get_offset_buffer(uint idx, size_t offset)
+	{
+		char *buf = (char*)get_buffer(idx);
+		return buf ? buf + offset*m_elsize : NULL;
+	}
+	const void *get_offset_buffer(uint idx, size_t offset) const
+	{
+		const char *buf = (const char*)get_buffer(idx);
+		return buf ? buf + offset*m_elsize : NULL;
+	}
+
+	void swap_elements(uint idx1, uint idx2, uint _buf=0)
+	{ throw runtime_error("gathered buffers cannot be reordered"); }
+};
+
+// BufferList that takes the GatheredBuffers
+class GatheredBufferList : public BufferList
+{
+public:
+	void add(flag_t key, AbstractBuffer *buf)
+	{ addExistingBuffer(key, buf); }
+};
+
+/* The particles sent to the aggregator are serialized as
+ * number of particles, number of devices, (device, count) for each device,
+ * then for each buffer: key, and the arrays of the buffer.
+ * The neighbor list is not sent: its layout depends on the number of
+ * particles of each device (--io-aggregators is refused with the neibs
+ * debug flag, so that all the files have the same arrays). */
+
+static bool
+gathered(BufferList::const_iterator const& buf)
+{
+	return buf->first != BUFFER_NEIBSLIST && buf->second->get_buffer(0);
+}
+
+template<typename T>
+static void
+put(vector<char> &out, T const& val)
+{
+	const char *bytes = (const char*)&val;
+	out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+template<typename T>
+static T
+get(vector<char> const& in, size_t &pos)
+{
+	if (pos + sizeof(T) > in.size())
+		throw runtime_error("truncated particle data from I/O aggregation group");
+	T val;
+	memcpy(&val, &in[pos], sizeof(T));
+	pos += sizeof(T);
+	return val;
+}
+
+IOAggregator::IOAggregator(const GlobalData *gdata, int groups) :
+	m_gdata(gdata),
+	m_rank(gdata->mpi_rank),
+	m_first(0),
+	m_last(0),
+	m_buffers(new GatheredBufferList()),
+	m_numParts(0),
+	m_devices(),
+	m_send(),
+	m_recv()
+{
+	const int nranks = gdata->mpi_nodes;
+	if (groups < 1 || groups > nranks)
+		groups = nranks;
+
+	// group g has ranks [g*nranks/groups, (g+1)*nranks/groups)
+	const int g = ((m_rank + 1)*groups - 1)/nranks;
+	m_first = g*nranks/groups;
+	m_last = (g + 1)*nranks/groups;
+
+	if (is_aggregator())
+		m_recv.resize(m_last - m_first - 1);
+}
+
+IOAggregator::~IOAggregator()
+{
+	// complete the last send
+	if (!is_aggregator())
+		m_gdata->networkManager->waitAsyncBytes();
+	delete m_buffers;
+}
+
+void
+IOAggregator::gather(BufferList const& buffers, uint node_offset, uint numParts)
+{
+	const GlobalData *gdata = m_gdata;
+
+	DeviceCounts devices;
+	for (uint d = 0; d < gdata->devices; ++d)
+		devices.push_back(make_pair(gdata->GLOBAL_DEVICE_ID(m_rank, d), gdata->s_hPartsPerDevice[d]));
+
+	if (!is_aggregator()) {
+		// the previous send must be complete before we reuse the buffer
+		gdata->networkManager->waitAsyncBytes();
+
+		m_send.clear();
+		put(m_send, numParts);
+		put(m_send, uint(devices.size()));
+		for (DeviceCounts::const_iterator dev(devices.begin()); dev != devices.end(); ++dev) {
+			put(m_send, uint(dev->first));
+			put(m_send, dev->second);
+		}
+		for (BufferList::const_iterator buf(buffers.begin()); buf != buffers.end(); ++buf) {
+			if (!gathered(buf))
+				continue;
+			put(m_send, buf->first);
+			const size_t bytes = numParts*buf->second->get_element_size();
+			for (uint a = 0; a < buf->second->get_array_count(); ++a) {
+				const char *data = (const char*)buf->second->get_offset_buffer(a, node_offset);
+				m_send.insert(m_send.end(), data, data + bytes);
+			}
+		}
+		gdata->networkManager->sendBytesAsync(m_send, m_first);
+		return;
+	}
+
+	// receive the particles of the other ranks, and count them
+	m_numParts = numParts;
+	m_devices = devices;
+	vector<size_t> payload(m_recv.size());
+	for (size_t r = 0; r < m_recv.size(); ++r) {
+		gdata->networkManager->receiveBytes(m_recv[r], m_first + 1 + r);
+		size_t pos = 0;
+		m_numParts += get<uint>(m_recv[r], pos);
+		const uint ndevs = get<uint>(m_recv[r], pos);
+		for (uint d = 0; d < ndevs; ++d) {
+			const devcount_t dev = get<uint>(m_recv[r], pos);
+			m_devices.push_back(make_pair(dev, get<uint>(m_recv[r], pos)));
+		}
+		payload[r] = pos;
+	}
+
+	// (re)allocate the gathered buffers, and copy our own particles
+	GatheredBufferList *gbuffers = static_cast<GatheredBufferList*>(m_buffers);
+	for (BufferList::const_iterator buf(buffers.begin()); buf != buffers.end(); ++buf) {
+		if (!gathered(buf))
+			continue;
+		AbstractBuffer *gbuf = (*gbuffers)[buf->first];
+		if (!gbuf) {
+			gbuf = new GatheredBuffer(buf->second);
+			gbuffers->add(buf->first, gbuf);
+		}
+		gbuf->alloc(m_numParts);
+		const size_t bytes = numParts*buf->second->get_element_size();
+		for (uint a = 0; a < buf->second->get_array_count(); ++a)
+			memcpy(gbuf->get_buffer(a), buf->second->get_offset_buffer(a, node_offset), bytes);
+	}
+
+	// append the particles of the other ranks
+	uint offset = numParts;
+	for (size_t r = 0; r < m_recv.size(); ++r) {
+		vector<char> const& in = m_recv[r];
+		size_t pos = 0;
+		const uint parts = get<uint>(in, pos);
+		pos = payload[r];
+		while (pos < in.size()) {
+			const flag_t key = get<flag_t>(in, pos);
+			AbstractBuffer *gbuf = (*gbuffers)[key];
+			if (!gbuf) {
+				ostringstream err;
+				err << "rank " << (m_first + 1 + r) << " sent unknown buffer " << key << " for I/O aggregation";
+				throw runtime_error(err.str());
+			}
+			const size_t bytes = parts*gbuf->get_element_size();
+			for (uint a = 0; a < gbuf->get_array_count(); ++a) {
+				if (pos + bytes > in.size())
+					throw runtime_error("truncated particle data from I/O aggregation group");
+				memcpy(gbuf->get_offset_buffer(a, offset), &in[pos], bytes);
+				pos += bytes;
+			}
+		}
+		offset += parts;
+	}
+}
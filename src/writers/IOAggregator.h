@@ -0,0 +1,95 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _IOAGGREGATOR_H
+#define	_IOAGGREGATOR_H
+
+#include <vector>
+#include <utility>
+
+#include "buffer.h"
+#include "multi_gpu_defines.h"
+
+struct GlobalData;
+
+// global device index and number of particles of a device
+typedef std::vector< std::pair<devcount_t, uint> > DeviceCounts;
+
+/*! I/O aggregation for multi-node output.
+ *
+ * The ranks are split into (contiguous) groups, and the first rank of each
+ * group is its aggregator: at each write, the other ranks of the group send
+ * their particles to it and go back to computing without waiting, and the
+ * aggregator writes the particles of the whole group in a single file for
+ * the writers that support it (see Writer::m_aggregatable). The particles
+ * of the aggregator come first, then those of the other ranks of the group,
+ * in rank order.
+ *
+ * With byslot scheduling (the default of most MPI implementations),
+ * as many groups as hosts give one aggregator per host.
+ */
+class IOAggregator
+{
+	const GlobalData	*m_gdata;
+	int					m_rank;
+
+	// first and last (excluded) rank of our group
+	int					m_first;
+	int					m_last;
+
+	// the particles of the group (aggregators only)
+	BufferList			*m_buffers;
+	uint				m_numParts;
+	DeviceCounts		m_devices;
+
+	// serialized particles sent to the aggregator (other ranks only),
+	// kept until the next gather since the send is asynchronous
+	std::vector<char>	m_send;
+	// serialized particles received from the other ranks (aggregators only)
+	std::vector< std::vector<char> > m_recv;
+
+public:
+	IOAggregator(const GlobalData *gdata, int groups);
+	~IOAggregator();
+
+	bool is_aggregator() const
+	{ return m_rank == m_first; }
+
+	/* Gather the numParts particles starting at node_offset in buffers
+	 * to the aggregator of the group; the other ranks return as soon as
+	 * the send has been started */
+	void gather(BufferList const& buffers, uint node_offset, uint numParts);
+
+	// number of particles of the group, their data and devices
+	// (only valid on the aggregator, after gather)
+	uint get_num_parts() const
+	{ return m_numParts; }
+	BufferList const& get_buffers() const
+	{ return *m_buffers; }
+	DeviceCounts const& get_devices() const
+	{ return m_devices; }
+};
+
+#endif	/* _IOAGGREGATOR_H */
@@ -0,0 +1,583 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <sstream>
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <map>
+#include <cstring>
+
+#include <pthread.h>
+#include <unistd.h>
+
+#include "LODWriter.h"
+#include "GlobalData.h"
+
+using namespace std;
+
+/* Endianness check, as in the VTKWriter */
+static int endian_int=1;
+static const char* endianness[2] = { "BigEndian", "LittleEndian" };
+
+namespace {
+
+// Particles of the same kind (fluid or not) in a cell of some level
+struct lod_cell {
+	uint3	gridPos;	// cell coordinates, at the level of the aggregate
+	uchar	fluid;
+	uint	count;
+	double	mass;
+	double3	mpos;		// mass-weighted sum of the positions
+	double3	mvel;		// mass-weighted sum of the velocities
+	double	rho;		// sum of the densities
+	double	pressure;	// sum of the pressures
+
+	lod_cell(uint3 const& _gridPos, uchar _fluid) :
+		gridPos(_gridPos), fluid(_fluid), count(0), mass(0),
+		mpos(make_double3(0.0)), mvel(make_double3(0.0)),
+		rho(0), pressure(0)
+	{}
+
+	void merge(lod_cell const& other)
+	{
+		count += other.count;
+		mass += other.mass;
+		mpos += other.mpos;
+		mvel += other.mvel;
+		rho += other.rho;
+		pressure += other.pressure;
+	}
+
+	// sort key: z-major cell order, fluid last
+	uint64_t key() const
+	{
+		return (uint64_t(gridPos.z) << 42) | (uint64_t(gridPos.y) << 22) |
+			(uint64_t(gridPos.x) << 2) | fluid;
+	}
+};
+
+bool
+by_key(lod_cell const& a, lod_cell const& b)
+{ return a.key() < b.key(); }
+
+// key of the cell containing gridPos, `shift` levels up
+uint64_t
+cell_key(uint3 const& gridPos, uint shift)
+{
+	return (uint64_t(gridPos.z >> shift) << 42) | (uint64_t(gridPos.y >> shift) << 22) |
+		(uint64_t(gridPos.x >> shift) << 2);
+}
+
+// Work of one thread: a range of particles, made of whole cells
+struct lod_job {
+	const GlobalData	*gdata;
+	const Problem		*problem;
+	const double4		*pos;
+	const float4		*vel;
+	const particleinfo	*info;
+	const hashKey		*hash;
+	uint			begin, end;
+
+	// level 0 aggregates of the range
+	vector<lod_cell>	cells;
+
+	// block of each top level cell
+	const map<uint64_t, uint>	*block_of;
+	uint			levels;
+	// block of each cell of the range, in order
+	vector<uint>	cell_block;
+	// number of particles of the range in each block, then
+	// where to put the next one in the block-sorted order
+	vector<uint>	block_pos;
+	uint			*order;
+};
+
+// level 0 aggregation of the particles in the range
+void *
+aggregate_thread(void *arg)
+{
+	lod_job &job = *static_cast<lod_job*>(arg);
+
+	uint i = job.begin;
+	while (i < job.end) {
+		const uint cellHash = cellHashFromParticleHash(job.hash[i]);
+		const uint3 gridPos = job.gdata->calcGridPosFromCellHash(cellHash);
+		lod_cell cell[2] = { lod_cell(gridPos, 0), lod_cell(gridPos, 1) };
+
+		for (; i < job.end && cellHashFromParticleHash(job.hash[i]) == cellHash; ++i) {
+			const particleinfo &info = job.info[i];
+			if (TESTPOINT(info))
+				continue;
+			const float4 &vel = job.vel[i];
+			const double4 &pos = job.pos[i];
+			lod_cell &c = cell[FLUID(info) ? 1 : 0];
+			++c.count;
+			c.mass += pos.w;
+			c.mpos += pos.w*make_double3(pos);
+			c.mvel += pos.w*make_double3(vel.x, vel.y, vel.z);
+			c.rho += vel.w;
+			c.pressure += job.problem->pressure(vel.w, fluid_num(info));
+		}
+
+		for (int f = 0; f < 2; ++f)
+			if (cell[f].count)
+				job.cells.push_back(cell[f]);
+	}
+	return NULL;
+}
+
+// count the particles of the range in each block
+void *
+count_thread(void *arg)
+{
+	lod_job &job = *static_cast<lod_job*>(arg);
+
+	uint i = job.begin;
+	while (i < job.end) {
+		const uint cellHash = cellHashFromParticleHash(job.hash[i]);
+		const uint3 gridPos = job.gdata->calcGridPosFromCellHash(cellHash);
+		// cells with only testpoints have no block, but nothing to put there either
+		map<uint64_t, uint>::const_iterator found = job.block_of->find(cell_key(gridPos, job.levels));
+		const uint block = (found == job.block_of->end() ? 0 : found->second);
+		job.cell_block.push_back(block);
+		for (; i < job.end && cellHashFromParticleHash(job.hash[i]) == cellHash; ++i)
+			if (!TESTPOINT(job.info[i]))
+				++job.block_pos[block];
+	}
+	return NULL;
+}
+
+// put the (indices of the) particles of the range in block order
+void *
+scatter_thread(void *arg)
+{
+	lod_job &job = *static_cast<lod_job*>(arg);
+
+	uint i = job.begin;
+	vector<uint>::const_iterator block(job.cell_block.begin());
+	while (i < job.end) {
+		const uint cellHash = cellHashFromParticleHash(job.hash[i]);
+		for (; i < job.end && cellHashFromParticleHash(job.hash[i]) == cellHash; ++i)
+			if (!TESTPOINT(job.info[i]))
+				job.order[job.block_pos[*block]++] = i;
+		++block;
+	}
+	return NULL;
+}
+
+void
+run_threads(vector<lod_job> &jobs, void *(*fn)(void*))
+{
+	vector<pthread_t> threads(jobs.size());
+	for (size_t j = 0; j < jobs.size(); ++j) {
+		int err = pthread_create(&threads[j], NULL, fn, &jobs[j]);
+		if (err)
+			throw runtime_error(string("Cannot start LOD thread: ") + strerror(err));
+	}
+	for (size_t j = 0; j < jobs.size(); ++j)
+		pthread_join(threads[j], NULL);
+}
+
+// A data array of a VTU file
+struct vtu_array {
+	string		name;
+	const char	*type;
+	uint		components;
+	vector<char>	data;
+};
+
+template<typename T>
+void
+add_array(vector<vtu_array> &arrays, const char *name, const char *type, uint components,
+	vector<T> const& values)
+{
+	arrays.push_back(vtu_array());
+	vtu_array &arr = arrays.back();
+	arr.name = name;
+	arr.type = type;
+	arr.components = components;
+	arr.data.resize(values.size()*sizeof(T));
+	if (!values.empty())
+		memcpy(&arr.data[0], &values[0], arr.data.size());
+}
+
+// Binary dump a single variable of a given type
+template<typename T>
+inline void
+write_var(ofstream &out, T const& var)
+{
+	out.write(reinterpret_cast<const char *>(&var), sizeof(T));
+}
+
+// write points (vertex cells) with the given point data
+void
+write_vtu(ofstream &fid, vector<double3> const& points, vector<vtu_array> const& arrays)
+{
+	const size_t numParts = points.size();
+
+	fid << "<?xml version='1.0'?>" << endl;
+	fid << "<VTKFile type='UnstructuredGrid'  version='0.1'  byte_order='" <<
+		endianness[*(char*)&endian_int & 1] << "'>" << endl;
+	fid << " <UnstructuredGrid>" << endl;
+	fid << "  <Piece NumberOfPoints='" << numParts << "' NumberOfCells='" << numParts << "'>" << endl;
+	fid << "   <PointData Scalars='Pressure' Vectors='Velocity'>" << endl;
+
+	size_t offset = 0;
+	vector<vtu_array>::const_iterator arr(arrays.begin());
+	for (; arr != arrays.end(); ++arr) {
+		fid << "	<DataArray type='" << arr->type << "' Name='" << arr->name << "'";
+		if (arr->components > 1)
+			fid << " NumberOfComponents='" << arr->components << "'";
+		fid << " format='appended' offset='" << offset << "'/>" << endl;
+		offset += arr->data.size() + sizeof(int);
+	}
+	fid << "   </PointData>" << endl;
+
+	fid << "   <Points>" << endl;
+	fid << "	<DataArray type='Float64' NumberOfComponents='3' format='appended' offset='" << offset << "'/>" << endl;
+	offset += sizeof(double)*3*numParts + sizeof(int);
+	fid << "   </Points>" << endl;
+
+	fid << "   <Cells>" << endl;
+	fid << "	<DataArray type='Int32' Name='connectivity' format='appended' offset='" << offset << "'/>" << endl;
+	offset += sizeof(uint)*numParts + sizeof(int);
+	fid << "	<DataArray type='Int32' Name='offsets' format='appended' offset='" << offset << "'/>" << endl;
+	offset += sizeof(uint)*numParts + sizeof(int);
+	fid << "	<DataArray type='UInt8' Name='types' format='appended' offset='" << offset << "'/>" << endl;
+	fid << "   </Cells>" << endl;
+	fid << "  </Piece>" << endl;
+	fid << " </UnstructuredGrid>" << endl;
+	fid << " <AppendedData encoding='raw'>\n_";
+
+	int numbytes;
+	for (arr = arrays.begin(); arr != arrays.end(); ++arr) {
+		numbytes = arr->data.size();
+		write_var(fid, numbytes);
+		if (numbytes)
+			fid.write(&arr->data[0], numbytes);
+	}
+
+	numbytes = sizeof(double)*3*numParts;
+	write_var(fid, numbytes);
+	if (numbytes)
+		fid.write((const char*)&points[0], numbytes);
+
+	numbytes = sizeof(int)*numParts;
+	write_var(fid, numbytes);
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, i);
+	write_var(fid, numbytes);
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, i + 1);
+
+	// types (all cells type=1, single vertex, the particle)
+	numbytes = sizeof(uchar)*numParts;
+	write_var(fid, numbytes);
+	const uchar celltype = 1;
+	for (uint i = 0; i < numParts; i++)
+		write_var(fid, celltype);
+
+	fid << " </AppendedData>" << endl;
+	fid << "</VTKFile>" << endl;
+}
+
+}
+
+LODWriter::LODWriter(const GlobalData *_gdata)
+  : Writer(_gdata),
+	m_levels(_gdata->clOptions->get("lod-levels", 5U)),
+	m_block_parts(_gdata->clOptions->get("lod-block-parts", 1U << 20)),
+	m_threads(_gdata->clOptions->get("lod-threads", uint(sysconf(_SC_NPROCESSORS_ONLN))))
+{
+	m_fname_sfx = ".vtu";
+
+	if (m_levels < 1)
+		m_levels = 1;
+	// cell coordinates are packed in 20 bits
+	if (m_levels > 20)
+		m_levels = 20;
+	if (m_threads < 1)
+		m_threads = 1;
+
+	open_data_file(m_timefile, "LOD", "", ".pvd");
+	if (m_timefile) {
+		m_timefile << "<?xml version='1.0'?>\n";
+		m_timefile << "<VTKFile type='Collection' version='0.1'>\n";
+		m_timefile << " <Collection>\n";
+	}
+}
+
+LODWriter::~LODWriter()
+{
+	mark_timefile();
+	m_timefile.close();
+}
+
+void
+LODWriter::write_timefile(string const& entries)
+{
+	if (!m_timefile)
+		return;
+	m_timefile << entries;
+	mark_timefile();
+}
+
+void
+LODWriter::mark_timefile()
+{
+	if (!m_timefile)
+		return;
+	ofstream::pos_type mark = m_timefile.tellp();
+	m_timefile << " </Collection>\n";
+	m_timefile << "</VTKFile>" << endl;
+	m_timefile.seekp(mark);
+}
+
+void
+LODWriter::write(uint numParts, BufferList const& buffers, uint node_offset, double t, const bool testpoints)
+{
+	const double4 *pos = buffers.getData<BUFFER_POS_GLOBAL>() + node_offset;
+	const float4 *vel = buffers.getData<BUFFER_VEL>() + node_offset;
+	const particleinfo *info = buffers.getData<BUFFER_INFO>() + node_offset;
+	const hashKey *particleHash = buffers.getData<BUFFER_HASH>() + node_offset;
+
+	// split the particles across threads, at cell boundaries
+	const uint nthreads = max(1U, min(m_threads, numParts/4096));
+	vector<lod_job> jobs(nthreads);
+	uint begin = 0;
+	for (uint j = 0; j < nthreads; ++j) {
+		uint end = (j == nthreads - 1) ? numParts : max(begin, uint(uint64_t(numParts)*(j + 1)/nthreads));
+		while (end > begin && end < numParts &&
+			cellHashFromParticleHash(particleHash[end]) == cellHashFromParticleHash(particleHash[end - 1]))
+			++end;
+
+		lod_job &job = jobs[j];
+		job.gdata = gdata;
+		job.problem = m_problem;
+		job.pos = pos;
+		job.vel = vel;
+		job.info = info;
+		job.hash = particleHash;
+		job.begin = begin;
+		job.end = end;
+		job.levels = m_levels;
+		begin = end;
+	}
+
+	// level 0: one aggregate per (non-empty) simulation cell
+	run_threads(jobs, aggregate_thread);
+
+	// coarser levels, each from the previous one
+	vector< vector<lod_cell> > levels(m_levels + 1);
+	for (uint j = 0; j < nthreads; ++j) {
+		levels[0].insert(levels[0].end(), jobs[j].cells.begin(), jobs[j].cells.end());
+		vector<lod_cell>().swap(jobs[j].cells);
+	}
+	for (uint l = 1; l <= m_levels; ++l) {
+		vector<lod_cell> const& finer = levels[l - 1];
+		vector<lod_cell> &coarser = levels[l];
+		coarser.reserve(finer.size()/4 + 1);
+		for (size_t c = 0; c < finer.size(); ++c) {
+			lod_cell cell = finer[c];
+			cell.gridPos = make_uint3(cell.gridPos.x >> 1, cell.gridPos.y >> 1, cell.gridPos.z >> 1);
+			coarser.push_back(cell);
+		}
+		sort(coarser.begin(), coarser.end(), by_key);
+		// merge the aggregates of the same cell and kind
+		size_t last = 0;
+		for (size_t c = 1; c < coarser.size(); ++c) {
+			if (coarser[c].key() == coarser[last].key())
+				coarser[last].merge(coarser[c]);
+			else
+				coarser[++last] = coarser[c];
+		}
+		if (!coarser.empty())
+			coarser.erase(coarser.begin() + last + 1, coarser.end());
+	}
+
+	// blocks: runs of top level cells with at least m_block_parts particles
+	map<uint64_t, uint> block_of;
+	uint numBlocks = 0;
+	{
+		vector<lod_cell> const& top = levels[m_levels];
+		uint in_block = 0;
+		for (size_t c = 0; c < top.size(); ++c) {
+			const uint64_t key = cell_key(top[c].gridPos, 0);
+			if (block_of.find(key) == block_of.end()) {
+				if (in_block >= m_block_parts) {
+					++numBlocks;
+					in_block = 0;
+				}
+				block_of[key] = numBlocks;
+			}
+			in_block += top[c].count;
+		}
+		if (!top.empty())
+			++numBlocks;
+	}
+
+	// sort the particles by block
+	vector<uint> order;
+	vector<uint> blockStart(numBlocks + 1, 0);
+	if (numBlocks) {
+		for (uint j = 0; j < nthreads; ++j) {
+			jobs[j].block_of = &block_of;
+			jobs[j].block_pos.assign(numBlocks, 0);
+		}
+		run_threads(jobs, count_thread);
+
+		// each thread fills its own slice of each block
+		uint total = 0;
+		for (uint b = 0; b < numBlocks; ++b) {
+			blockStart[b] = total;
+			for (uint j = 0; j < nthreads; ++j) {
+				const uint count = jobs[j].block_pos[b];
+				jobs[j].block_pos[b] = total;
+				total += count;
+			}
+		}
+		blockStart[numBlocks] = total;
+
+		order.resize(total);
+		for (uint j = 0; j < nthreads; ++j)
+			jobs[j].order = order.empty() ? NULL : &order[0];
+		run_threads(jobs, scatter_thread);
+	}
+
+	// full resolution blocks
+	const string num = current_filenum();
+	vector<string> block_fnames(numBlocks);
+	for (uint b = 0; b < numBlocks; ++b) {
+		const uint count = blockStart[b + 1] - blockStart[b];
+		vector<double3> points(count);
+		vector<float3> velocity(count);
+		vector<float> pressure(count), density(count), mass(count);
+		vector<uchar> parttype(count);
+		vector<uint> partid(count);
+		for (uint p = 0; p < count; ++p) {
+			const uint i = order[blockStart[b] + p];
+			points[p] = make_double3(pos[i]);
+			velocity[p] = make_float3(vel[i]);
+			pressure[p] = m_problem->pressure(vel[i].w, fluid_num(info[i]));
+			density[p] = vel[i].w;
+			mass[p] = pos[i].w;
+			parttype[p] = PART_TYPE(info[i]);
+			partid[p] = id(info[i]);
+		}
+
+		vector<vtu_array> arrays;
+		add_array(arrays, "Pressure", "Float32", 1, pressure);
+		add_array(arrays, "Density", "Float32", 1, density);
+		add_array(arrays, "Mass", "Float32", 1, mass);
+		add_array(arrays, "Part type", "UInt8", 1, parttype);
+		add_array(arrays, "Part id", "UInt32", 1, partid);
+		add_array(arrays, "Velocity", "Float32", 3, velocity);
+
+		ostringstream base;
+		base << "LODb" << b;
+		ofstream fid;
+		block_fnames[b] = open_data_file(fid, base.str().c_str(), num);
+		write_vtu(fid, points, arrays);
+		fid.close();
+	}
+
+	// coarse levels
+	{
+		size_t count = 0;
+		for (uint l = 1; l <= m_levels; ++l)
+			count += levels[l].size();
+
+		vector<double3> points;
+		vector<float3> velocity;
+		vector<float> pressure, density, mass, side;
+		vector<uchar> parttype, level;
+		vector<uint> parts, block;
+		points.reserve(count);
+		velocity.reserve(count);
+		pressure.reserve(count);
+		density.reserve(count);
+		mass.reserve(count);
+		side.reserve(count);
+		parttype.reserve(count);
+		level.reserve(count);
+		parts.reserve(count);
+		block.reserve(count);
+
+		const float cellSide = fmaxf(gdata->cellSize.x, fmaxf(gdata->cellSize.y, gdata->cellSize.z));
+		for (uint l = 1; l <= m_levels; ++l) {
+			vector<lod_cell> const& cells = levels[l];
+			for (size_t c = 0; c < cells.size(); ++c) {
+				lod_cell const& cell = cells[c];
+				points.push_back(cell.mpos/cell.mass);
+				velocity.push_back(make_float3(cell.mvel/cell.mass));
+				pressure.push_back(cell.pressure/cell.count);
+				density.push_back(cell.rho/cell.count);
+				mass.push_back(cell.mass);
+				side.push_back(cellSide*(1U << l));
+				parttype.push_back(cell.fluid ? PT_FLUID : PT_BOUNDARY);
+				level.push_back(l);
+				parts.push_back(cell.count);
+				block.push_back(block_of[cell_key(cell.gridPos, m_levels - l)]);
+			}
+		}
+
+		vector<vtu_array> arrays;
+		add_array(arrays, "Pressure", "Float32", 1, pressure);
+		add_array(arrays, "Density", "Float32", 1, density);
+		add_array(arrays, "Mass", "Float32", 1, mass);
+		add_array(arrays, "Part type", "UInt8", 1, parttype);
+		add_array(arrays, "Level", "UInt8", 1, level);
+		add_array(arrays, "Count", "UInt32", 1, parts);
+		add_array(arrays, "Block", "UInt32", 1, block);
+		add_array(arrays, "Size", "Float32", 1, side);
+		add_array(arrays, "Velocity", "Float32", 3, velocity);
+
+		ofstream fid;
+		const string coarse_fname = open_data_file(fid, "LOD", num);
+		write_vtu(fid, points, arrays);
+		fid.close();
+
+		// multiblock index of the frame: coarse levels, and full resolution blocks
+		ofstream vtm;
+		open_data_file(vtm, "LOD", num, ".vtm");
+		vtm << "<?xml version='1.0'?>" << endl;
+		vtm << "<VTKFile type='vtkMultiBlockDataSet' version='1.0' byte_order='" <<
+			endianness[*(char*)&endian_int & 1] << "'>" << endl;
+		vtm << " <vtkMultiBlockDataSet>" << endl;
+		vtm << "  <DataSet index='0' name='Coarse' file='" << coarse_fname << "'/>" << endl;
+		vtm << "  <Block index='1' name='Full'>" << endl;
+		for (uint b = 0; b < numBlocks; ++b)
+			vtm << "   <DataSet index='" << b << "' name='Block " << b << "' file='" << block_fnames[b] << "'/>" << endl;
+		vtm << "  </Block>" << endl;
+		vtm << " </vtkMultiBlockDataSet>" << endl;
+		vtm << "</VTKFile>" << endl;
+		vtm.close();
+
+		ostringstream entry;
+		entry << "  <DataSet timestep='" << t << "' group='0' name='LOD' file='" << coarse_fname << "'/>\n";
+		add_timefile_entry(entry.str());
+	}
+}
@@ -0,0 +1,77 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _LODWRITER_H
+#define	_LODWRITER_H
+
+#include <vector>
+
+#include "Writer.h"
+
+/*! Multi-resolution (level of detail) output, for a quick look at large
+ * simulations.
+ *
+ * For each frame, particles are aggregated over a hierarchy of cells: level L
+ * cells are cubes of 2^L × 2^L × 2^L cells of the simulation grid. Each
+ * aggregate holds the number and total mass of the particles, and the
+ * mass-weighted averages of their position and velocity (as well as average
+ * density and pressure); fluid and boundary particles are aggregated
+ * separately. All the levels go in a small LOD_XXXXX.vtu file (select the
+ * level to show with a threshold on Level), referenced by LOD.pvd.
+ *
+ * The full resolution data is split in blocks, each covering a range of the
+ * coarsest cells, saved in separate LODbN_XXXXX.vtu files. The Block field
+ * of each aggregate tells which block holds its particles, and the
+ * LOD_XXXXX.vtm multiblock file references the coarse levels and all the
+ * blocks, so that single blocks can be enabled on demand.
+ *
+ * Aggregation relies on the host buffers being sorted by cell (as they come
+ * from the devices), and is split across multiple threads.
+ *
+ * Options (--key value on the command line):
+ *   lod-levels: number of coarse levels (default 5)
+ *   lod-block-parts: minimum number of particles per block (default 2^20)
+ *   lod-threads: number of threads (default: number of cores)
+ */
+class LODWriter : public Writer
+{
+	uint	m_levels;
+	uint	m_block_parts;
+	uint	m_threads;
+
+	// close the XML in the timefile, and seek back before the closing tags
+	void mark_timefile();
+
+protected:
+	void write_timefile(std::string const& entries);
+
+public:
+	LODWriter(const GlobalData *_gdata);
+	~LODWriter();
+
+	virtual void write(uint numParts, BufferList const& buffers, uint node_offset, double t, const bool testpoints);
+};
+
+#endif	/* _LODWRITER_H */
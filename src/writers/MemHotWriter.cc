@@ -0,0 +1,190 @@
+#include <sstream>
+#include <fstream>
+#include <iostream>
+#include <stdexcept>
+
+#include <sys/stat.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <limits.h> // PATH_MAX
+#include <stdlib.h> // realpath
+
+#include "MemHotWriter.h"
+#include "GlobalData.h"
+#include "NetworkManager.h"
+
+using namespace std;
+
+// read a whole file into a byte buffer
+static void
+read_image(string const& fname, vector<char> &image)
+{
+	ifstream in(fname.c_str(), ios::binary);
+	if (!in)
+		throw runtime_error("Cannot read in-memory checkpoint " + fname);
+	in.seekg(0, ios::end);
+	image.resize(in.tellg());
+	in.seekg(0);
+	if (!image.empty())
+		in.read(&image[0], image.size());
+}
+
+// (over)write a file from a byte buffer, atomically
+static void
+write_image(string const& fname, vector<char> const& image)
+{
+	const string tmp = fname + ".tmp";
+	ofstream out(tmp.c_str(), ios::binary);
+	out.exceptions(ofstream::failbit | ofstream::badbit);
+	if (!image.empty())
+		out.write(&image[0], image.size());
+	out.close();
+	if (rename(tmp.c_str(), fname.c_str()))
+		throw runtime_error("Cannot save in-memory checkpoint " + fname + ": " + strerror(errno));
+}
+
+MemHotWriter::MemHotWriter(const GlobalData *_gdata) :
+	HotWriter(_gdata),
+	m_memdir(memdir(_gdata)),
+	m_recovered_cleared(false)
+{
+	mkdir(gdata->clOptions->mem_checkpoint_dir.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+	mkdir(m_memdir.c_str(), S_IRWXU);
+}
+
+// the images are only needed if the run is interrupted
+MemHotWriter::~MemHotWriter()
+{
+	const int nranks = gdata->mpi_nodes;
+	const int rank = gdata->mpi_rank;
+	const int buddy_of = (rank + nranks - 1) % nranks;
+
+	unlink(image_name(m_memdir, "hot", rank).c_str());
+	unlink(image_name(m_memdir, "buddy", buddy_of).c_str());
+	for (int i = 0; i < nranks; ++i)
+		unlink(image_name(m_memdir, "recovered", i).c_str());
+	// fails harmlessly while other ranks on the node still have their images there
+	rmdir(m_memdir.c_str());
+}
+
+/* The images are keyed by the (absolute) output directory, so that concurrent
+ * runs on the same node do not overwrite each other, and a resume (with the
+ * same --dir) finds the images of the run it continues */
+string
+MemHotWriter::memdir(const GlobalData *gdata)
+{
+	string outdir = gdata->problem->get_dirname();
+	char resolved[PATH_MAX];
+	if (realpath(outdir.c_str(), resolved))
+		outdir = resolved;
+
+	string key;
+	for (string::const_iterator c = outdir.begin(); c != outdir.end(); ++c)
+		key += (*c == '/' ? '_' : *c);
+
+	return gdata->clOptions->mem_checkpoint_dir + "/gpusph" + key;
+}
+
+string
+MemHotWriter::image_name(string const& dir, const char *kind, int rank)
+{
+	ostringstream fname;
+	fname << dir << "/" << kind << "_n" << rank << ".bin";
+	return fname.str();
+}
+
+void
+MemHotWriter::write(uint numParts, const BufferList &buffers,
+	uint node_offset, double t, const bool testpoints)
+{
+	const int nranks = gdata->mpi_nodes;
+	const int rank = gdata->mpi_rank;
+
+	// serialize our image once: it is both saved and sent to the buddy
+	ostringstream out(ios::binary);
+	HotFile *hf = new HotFile(out, gdata, numParts, node_offset, t, testpoints);
+	hf->save();
+	delete hf;
+	const string serialized = out.str();
+	const vector<char> image(serialized.begin(), serialized.end());
+
+	// save our own image, replacing the previous one only when complete
+	write_image(image_name(m_memdir, "hot", rank), image);
+
+	// images fetched from other ranks on resume are not needed anymore
+	// once we have our own
+	if (!m_recovered_cleared) {
+		for (int i = 0; i < nranks; ++i)
+			unlink(image_name(m_memdir, "recovered", i).c_str());
+		m_recovered_cleared = true;
+	}
+
+	// send it to the next rank, get the one of the previous rank
+	if (nranks > 1) {
+		const int buddy = (rank + 1) % nranks;
+		const int buddy_of = (rank + nranks - 1) % nranks;
+
+		vector<char> buddy_image;
+		gdata->networkManager->exchangeBytes(image, buddy, buddy_image, buddy_of);
+		write_image(image_name(m_memdir, "buddy", buddy_of), buddy_image);
+	}
+}
+
+vector<string>
+MemHotWriter::recover(const GlobalData *gdata)
+{
+	const int nranks = gdata->mpi_nodes;
+	const int rank = gdata->mpi_rank;
+	const string dir = memdir(gdata);
+	const int buddy_of = (rank + nranks - 1) % nranks;
+
+	const string own = image_name(dir, "hot", rank);
+	const string held = image_name(dir, "buddy", buddy_of);
+
+	struct stat statbuf;
+
+	// which images are available, and where
+	vector<int> own_avail(nranks, 0), buddy_avail(nranks, 0);
+	own_avail[rank] = !stat(own.c_str(), &statbuf);
+	if (nranks > 1) {
+		buddy_avail[buddy_of] = !stat(held.c_str(), &statbuf);
+		gdata->networkManager->networkIntReduction(&own_avail[0], nranks, MAX_REDUCTION);
+		gdata->networkManager->networkIntReduction(&buddy_avail[0], nranks, MAX_REDUCTION);
+	}
+
+	vector<string> fnames(nranks);
+
+	for (int i = 0; i < nranks; ++i) {
+		int root;
+		if (own_avail[i])
+			root = i;
+		else if (buddy_avail[i])
+			root = (i + 1) % nranks;
+		else {
+			ostringstream err_msg;
+			err_msg << "No in-memory checkpoint found for rank " << i << " in " << dir;
+			throw runtime_error(err_msg.str());
+		}
+
+		if (root == rank) {
+			fnames[i] = (i == rank ? own : held);
+			if (i != rank)
+				cout << "Rank " << i << " recovered from the copy held by rank " << rank << endl;
+		} else {
+			fnames[i] = image_name(dir, "recovered", i);
+		}
+
+		// all processes need all the images
+		if (nranks > 1) {
+			vector<char> image;
+			if (root == rank)
+				read_image(fnames[i], image);
+			gdata->networkManager->broadcastBytes(image, root);
+			if (root != rank)
+				write_image(fnames[i], image);
+		}
+	}
+
+	return fnames;
+}
@@ -0,0 +1,55 @@
+#ifndef H_MEMHOTWRITER_H
+#define H_MEMHOTWRITER_H
+
+#include <string>
+#include <vector>
+
+#include "HotWriter.h"
+
+/**
+A HotWriter variant that keeps the checkpoint in host memory rather than on
+the (shared) output filesystem, so that it can be taken much more often.
+
+Each process saves its latest HotFile image in a RAM-backed directory
+(/dev/shm by default), and sends a copy to its buddy (the next rank), which
+saves it next to its own. Only the latest image is kept. Regular HotWriter
+checkpoints on disk can still be written, at a lower rate.
+
+To enable it, use
+
+    ./GPUSPH --mem-checkpoint-every 0.01 [--mem-checkpoint-dir /dev/shm]
+
+The images live in a subdirectory named after the output directory, and are
+removed when the simulation ends normally. After an interruption, restart
+with the same number of processes, the same output directory and
+
+    ./GPUSPH --resume-memory --dir <output directory> [--mem-checkpoint-dir /dev/shm]
+
+Each rank uses its own image if still present, or the copy held by its buddy
+otherwise (e.g. if its node was replaced). This can be tested with a local
+mpirun by removing one of the hot_nX.bin images before resuming.
+*/
+class MemHotWriter : public HotWriter {
+public:
+	MemHotWriter(const GlobalData *_gdata);
+	~MemHotWriter();
+
+	void write(uint numParts, const BufferList &buffers,
+		uint node_offset, double t, const bool testpoints);
+
+	/* Collect the latest in-memory checkpoints of all ranks, recovering
+	 * missing ones from the buddies; returns the names of the (local) files
+	 * to resume from, one per rank of the original simulation */
+	static std::vector<std::string> recover(const GlobalData *gdata);
+
+private:
+	// directory holding the in-memory images
+	std::string		m_memdir;
+	// have the images recovered from other ranks been removed?
+	bool			m_recovered_cleared;
+
+	static std::string memdir(const GlobalData *gdata);
+	static std::string image_name(std::string const& dir, const char *kind, int rank);
+};
+
+#endif
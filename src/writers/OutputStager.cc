@@ -0,0 +1,320 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+#include <unistd.h>
+
+#include "OutputStager.h"
+#include "Writer.h"
+
+using namespace std;
+
+// size of the chunks used when copying across filesystems
+static const size_t COPY_CHUNK = 4 << 20;
+
+static double
+elapsed_since(struct timespec const& start)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec)*1.0e-9;
+}
+
+OutputStager::OutputStager(string const& stageroot, string const& finaldir,
+	double bwlimit, double minfree) :
+	m_stagedir(),
+	m_finaldir(finaldir),
+	m_bwlimit(bwlimit*1.0e6),
+	m_minfree(minfree*1.0e6),
+	m_same_fs(false),
+	m_queue(),
+	m_done(false),
+	m_moved_files(0),
+	m_failed_files(0),
+	m_moved_bytes(0)
+{
+	// each process gets its own staging directory, so that multiple
+	// processes on the same node (and subsequent runs) don't clash
+	stringstream ss;
+	ss << stageroot << "/gpusph-" << getpid();
+	m_stagedir = ss.str();
+
+	mkdir(stageroot.c_str(), S_IRWXU | S_IRWXG | S_IRWXO);
+	if (mkdir(m_stagedir.c_str(), S_IRWXU) && errno != EEXIST)
+		throw runtime_error("Cannot create staging directory " + m_stagedir + ": " + strerror(errno));
+
+	struct stat stage_st, final_st;
+	if (!stat(m_stagedir.c_str(), &stage_st) && !stat(m_finaldir.c_str(), &final_st))
+		m_same_fs = (stage_st.st_dev == final_st.st_dev);
+
+	pthread_mutex_init(&m_mutex, NULL);
+	pthread_cond_init(&m_queued, NULL);
+	pthread_cond_init(&m_moved, NULL);
+
+	int err = pthread_create(&m_thread, NULL, mover_thread, (void*)this);
+	if (err)
+		throw runtime_error(string("Cannot start the output mover thread: ") + strerror(err));
+
+	cout << "Output staged in " << m_stagedir << ", moved to " << m_finaldir;
+	if (m_same_fs)
+		cout << " by renaming";
+	else if (m_bwlimit > 0)
+		cout << " at most at " << bwlimit << " MB/s";
+	cout << endl;
+}
+
+OutputStager::~OutputStager()
+{
+	finish();
+
+	pthread_cond_destroy(&m_moved);
+	pthread_cond_destroy(&m_queued);
+	pthread_mutex_destroy(&m_mutex);
+}
+
+void *
+OutputStager::mover_thread(void *arg)
+{
+	static_cast<OutputStager*>(arg)->mover_loop();
+	return NULL;
+}
+
+void
+OutputStager::mover_loop()
+{
+	pthread_mutex_lock(&m_mutex);
+	while (true) {
+		while (m_queue.empty() && !m_done)
+			pthread_cond_wait(&m_queued, &m_mutex);
+		if (m_queue.empty())
+			break;
+
+		// the batch stays in the queue while it's being moved,
+		// so that a writer waiting for space keeps waiting
+		Batch const batch = m_queue.front();
+		pthread_mutex_unlock(&m_mutex);
+
+		bool all_moved = true;
+		vector<string>::const_iterator f(batch.files.begin());
+		for (; f != batch.files.end(); ++f)
+			all_moved &= move_file(*f);
+
+		// only reference the files if they are actually there
+		if (all_moved)
+			batch.owner->staged_files_landed(batch.entries);
+		else if (!batch.entries.empty())
+			cerr << "WARNING: timefile entries dropped for files left in " << m_stagedir << endl;
+
+		pthread_mutex_lock(&m_mutex);
+		m_queue.pop_front();
+		pthread_cond_broadcast(&m_moved);
+	}
+	pthread_mutex_unlock(&m_mutex);
+}
+
+bool
+OutputStager::move_file(string const& fname)
+{
+	const string src = m_stagedir + "/" + fname;
+	const string dst = m_finaldir + "/" + fname;
+
+	struct stat src_st, dst_st;
+	if (stat(src.c_str(), &src_st)) {
+		perror(src.c_str());
+		++m_failed_files;
+		return false;
+	}
+
+	double bytes = 0;
+	bool ok;
+	if (m_same_fs) {
+		ok = !rename(src.c_str(), dst.c_str());
+		if (!ok)
+			perror(dst.c_str());
+		bytes = src_st.st_size;
+	} else {
+		ok = copy_file(src, dst, bytes);
+	}
+
+	// verify that the file landed with the right size
+	if (ok && (stat(dst.c_str(), &dst_st) || dst_st.st_size != src_st.st_size)) {
+		cerr << "Staged file " << dst << " failed verification" << endl;
+		ok = false;
+	}
+
+	if (!ok) {
+		++m_failed_files;
+		return false;
+	}
+
+	if (!m_same_fs && unlink(src.c_str()))
+		perror(src.c_str());
+
+	++m_moved_files;
+	m_moved_bytes += bytes;
+	return true;
+}
+
+bool
+OutputStager::copy_file(string const& src, string const& dst, double &bytes)
+{
+	// copy to a temporary name, so that the final name only ever refers
+	// to a complete file
+	const string part = dst + ".part";
+
+	FILE *in = fopen(src.c_str(), "rb");
+	if (!in) {
+		perror(src.c_str());
+		return false;
+	}
+	FILE *out = fopen(part.c_str(), "wb");
+	if (!out) {
+		perror(part.c_str());
+		fclose(in);
+		return false;
+	}
+
+	vector<char> buf(COPY_CHUNK);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	bool ok = true;
+	bytes = 0;
+	size_t nread;
+	while ((nread = fread(&buf[0], 1, buf.size(), in)) > 0) {
+		if (fwrite(&buf[0], 1, nread, out) != nread) {
+			perror(part.c_str());
+			ok = false;
+			break;
+		}
+		bytes += nread;
+
+		// throttle: sleep until the time it should have taken at the
+		// given bandwidth
+		if (m_bwlimit > 0) {
+			const double ahead = bytes/m_bwlimit - elapsed_since(start);
+			if (ahead > 0) {
+				struct timespec pause;
+				pause.tv_sec = (time_t)ahead;
+				pause.tv_nsec = (long)((ahead - pause.tv_sec)*1.0e9);
+				nanosleep(&pause, NULL);
+			}
+		}
+	}
+	if (ferror(in)) {
+		perror(src.c_str());
+		ok = false;
+	}
+	fclose(in);
+
+	if (fflush(out) || fsync(fileno(out)))
+		ok = false;
+	if (fclose(out))
+		ok = false;
+
+	if (ok && rename(part.c_str(), dst.c_str())) {
+		perror(dst.c_str());
+		ok = false;
+	}
+	if (!ok)
+		unlink(part.c_str());
+
+	return ok;
+}
+
+double
+OutputStager::stage_free_space() const
+{
+	struct statvfs vfs;
+	if (statvfs(m_stagedir.c_str(), &vfs))
+		return 0;
+	return double(vfs.f_bavail)*vfs.f_frsize;
+}
+
+bool
+OutputStager::wait_for_space()
+{
+	if (m_minfree <= 0)
+		return true;
+
+	pthread_mutex_lock(&m_mutex);
+	while (stage_free_space() < m_minfree && !m_queue.empty())
+		pthread_cond_wait(&m_moved, &m_mutex);
+	pthread_mutex_unlock(&m_mutex);
+
+	return stage_free_space() >= m_minfree;
+}
+
+void
+OutputStager::enqueue(Writer *owner, vector<string> const& files, string const& entries)
+{
+	Batch batch;
+	batch.owner = owner;
+	batch.files = files;
+	batch.entries = entries;
+
+	pthread_mutex_lock(&m_mutex);
+	m_queue.push_back(batch);
+	pthread_cond_signal(&m_queued);
+	pthread_mutex_unlock(&m_mutex);
+}
+
+unsigned long
+OutputStager::finish()
+{
+	pthread_mutex_lock(&m_mutex);
+	const bool was_done = m_done;
+	const size_t pending = m_queue.size();
+	m_done = true;
+	pthread_cond_signal(&m_queued);
+	pthread_mutex_unlock(&m_mutex);
+
+	if (was_done)
+		return m_failed_files;
+
+	if (pending)
+		cout << "Flushing " << pending << " staged output batches to " << m_finaldir << " ..." << endl;
+
+	pthread_join(m_thread, NULL);
+
+	cout << "Output staging: " << m_moved_files << " files (" <<
+		m_moved_bytes/(1024*1024) << " MiB) moved to " << m_finaldir << endl;
+	if (m_failed_files)
+		cerr << "WARNING: " << m_failed_files << " files could not be moved and are left in " <<
+			m_stagedir << endl;
+	else
+		rmdir(m_stagedir.c_str());
+
+	return m_failed_files;
+}
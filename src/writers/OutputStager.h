@@ -0,0 +1,116 @@
+/*  Copyright 2011-2013 Alexis Herault, Giuseppe Bilotta, Robert A. Dalrymple, Eugenio Rustico, Ciro Del Negro
+
+    Istituto Nazionale di Geofisica e Vulcanologia
+        Sezione di Catania, Catania, Italy
+
+    Università di Catania, Catania, Italy
+
+    Johns Hopkins University, Baltimore, MD
+
+    This file is part of GPUSPH.
+
+    GPUSPH is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    GPUSPH is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with GPUSPH.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _OUTPUTSTAGER_H
+#define	_OUTPUTSTAGER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <pthread.h>
+
+class Writer;
+
+/*! Two-tier output: writers save their per-timestep files to a fast
+ * (node-local) staging directory, and a background thread moves them
+ * to the final output directory, optionally limiting the bandwidth used.
+ *
+ * Files are handed over in batches (all the files written by a writer
+ * at a given time), and the batch owner is notified (from the mover thread)
+ * once all of them have landed, so that the timefile (.pvd) only ever
+ * references files that exist in the final directory.
+ */
+class OutputStager
+{
+	// a batch of closed files to be moved, with the timefile entries
+	// referencing them
+	struct Batch {
+		Writer *owner;
+		std::vector<std::string> files;
+		std::string entries;
+	};
+
+	std::string m_stagedir;
+	std::string m_finaldir;
+	// bandwidth limit in bytes per second (0: unlimited)
+	double m_bwlimit;
+	// minimum free space (in bytes) to keep in the staging directory
+	double m_minfree;
+	// can files be moved with a rename?
+	bool m_same_fs;
+
+	std::deque<Batch> m_queue;
+	bool m_done;
+
+	pthread_t m_thread;
+	pthread_mutex_t m_mutex;
+	// signaled when a new batch is queued, or when we are done
+	pthread_cond_t m_queued;
+	// signaled when a batch has been moved
+	pthread_cond_t m_moved;
+
+	// statistics
+	unsigned long m_moved_files;
+	unsigned long m_failed_files;
+	double m_moved_bytes;
+
+	static void *mover_thread(void *);
+	void mover_loop();
+
+	// move a single file from the staging to the final directory
+	bool move_file(std::string const& fname);
+	// copy with bandwidth limit, used when a rename is not possible
+	bool copy_file(std::string const& src, std::string const& dst, double &bytes);
+
+	double stage_free_space() const;
+
+public:
+	// stageroot: root of the staging area (e.g. node-local scratch);
+	// finaldir: where the files should end up;
+	// bwlimit: MB/s (0 for unlimited); minfree: MB to keep free in the staging area
+	OutputStager(std::string const& stageroot, std::string const& finaldir,
+		double bwlimit, double minfree);
+	~OutputStager();
+
+	std::string const& get_stagedir() const
+	{ return m_stagedir; }
+
+	// wait until there is enough space in the staging area, draining
+	// the queue if needed. Returns false if the space is insufficient even
+	// with an empty queue, in which case the caller should write to the final
+	// directory directly
+	bool wait_for_space();
+
+	// queue files (names relative to the staging directory) for moving;
+	// owner->staged_files_landed(entries) will be called once they are in place
+	void enqueue(Writer *owner, std::vector<std::string> const& files,
+		std::string const& entries);
+
+	// move all the outstanding files, stop the mover thread and report;
+	// returns the number of files that could not be moved
+	unsigned long finish();
+};
+
+#endif	/* _OUTPUTSTAGER_H */
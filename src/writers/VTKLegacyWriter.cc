@@ -188,12 +188,22 @@ VTKLegacyWriter::write(uint numParts, BufferList const& buffers, uint node_offse
 	// Writing time to VTUinp.pvd file
 	if (m_timefile) {
 		// TODO should node info for multinode be stored in group or part?
-		m_timefile << "<DataSet timestep='" << t << "' group='' part='0' "
-			<< "file='" << filename << "'/>" << endl;
-		mark_timefile();
+		ostringstream entry;
+		entry << "<DataSet timestep='" << t << "' group='' part='0' "
+			<< "file='" << filename << "'/>\n";
+		add_timefile_entry(entry.str());
 	}
 }
 
+void
+VTKLegacyWriter::write_timefile(string const& entries)
+{
+	if (!m_timefile)
+		return;
+	m_timefile << entries;
+	mark_timefile();
+}
+
 void
 VTKLegacyWriter::mark_timefile()
 {
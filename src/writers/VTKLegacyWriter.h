@@ -40,6 +40,10 @@ public:
 	// so that the timefile is always valid, and then seek back to the pre-close
 	// position so that the next entry is properly inserted
 	void mark_timefile();
+
+protected:
+	// write the entries and close the XML
+	void write_timefile(std::string const& entries);
 };
 
 #endif	/* _VTKLEGACYWRITER_H */
@@ -51,6 +51,12 @@ VTKWriter::VTKWriter(const GlobalData *_gdata)
 	m_blockidx(-1)
 {
 	m_fname_sfx = ".vtu";
+	m_aggregatable = true;
+
+	// the members of an I/O aggregation group write no particle files,
+	// so they have no timefile either
+	if (!writes_particle_files())
+		return;
 
 	string time_fname = open_data_file(m_timefile, "VTUinp", "", ".pvd");
 
@@ -72,8 +78,10 @@ VTKWriter::~VTKWriter()
 void VTKWriter::add_block(string const& blockname, string const& fname)
 {
 	++m_blockidx;
-	m_timefile << "  <DataSet timestep='" << m_current_time << "' group='" << m_blockidx <<
-		"' name='" << blockname << "' file='" << fname << "'/>" << endl;
+	ostringstream entry;
+	entry << "  <DataSet timestep='" << m_current_time << "' group='" << m_blockidx <<
+		"' name='" << blockname << "' file='" << fname << "'/>\n";
+	add_timefile_entry(entry.str());
 }
 
 void VTKWriter::start_writing(double t, flag_t write_flags)
@@ -94,7 +102,8 @@ void VTKWriter::start_writing(double t, flag_t write_flags)
 
 	m_blockidx = -1;
 
-	const bool has_planes = gdata->s_hPlanes.size() > 0;
+	// the planes are only listed in the timefile
+	const bool has_planes = gdata->s_hPlanes.size() > 0 && m_timefile.is_open();
 
 	if (has_planes) {
 		if (m_planes_fname.size() == 0) {
@@ -104,11 +113,12 @@ void VTKWriter::start_writing(double t, flag_t write_flags)
 	}
 }
 
-void VTKWriter::mark_written(double t)
+void VTKWriter::write_timefile(string const& entries)
 {
+	if (!m_timefile.is_open())
+		return;
+	m_timefile << entries;
 	mark_timefile();
-
-	Writer::mark_written(t);
 }
 
 /* Endianness check: (char*)&endian_int reads the first byte of the int,
@@ -120,14 +130,14 @@ static float zeroes[4];
 
 /* auxiliary functions to write data array entrypoints */
 inline void
-scalar_array(ofstream &out, const char *type, const char *name, size_t offset)
+scalar_array(ostream &out, const char *type, const char *name, size_t offset)
 {
 	out << "	<DataArray type='" << type << "' Name='" << name
 		<< "' format='appended' offset='" << offset << "'/>" << endl;
 }
 
 inline void
-vector_array(ofstream &out, const char *type, const char *name, uint dim, size_t offset)
+vector_array(ostream &out, const char *type, const char *name, uint dim, size_t offset)
 {
 	out << "	<DataArray type='" << type << "' Name='" << name
 		<< "' NumberOfComponents='" << dim
@@ -135,7 +145,7 @@ vector_array(ofstream &out, const char *type, const char *name, uint dim, size_t
 }
 
 inline void
-vector_array(ofstream &out, const char *type, uint dim, size_t offset)
+vector_array(ostream &out, const char *type, uint dim, size_t offset)
 {
 	out << "	<DataArray type='" << type
 		<< "' NumberOfComponents='" << dim
@@ -145,7 +155,7 @@ vector_array(ofstream &out, const char *type, uint dim, size_t offset)
 // Binary dump a single variable of a given type
 template<typename T>
 inline void
-write_var(ofstream &out, T const& var)
+write_var(ostream &out, T const& var)
 {
 	out.write(reinterpret_cast<const char *>(&var), sizeof(T));
 }
@@ -153,7 +163,7 @@ write_var(ofstream &out, T const& var)
 // Binary dump an array of variables of given type and size
 template<typename T>
 inline void
-write_arr(ofstream &out, T const *var, size_t len)
+write_arr(ostream &out, T const *var, size_t len)
 {
 	out.write(reinterpret_cast<const char *>(var), sizeof(T)*len);
 }
@@ -191,6 +201,7 @@ VTKWriter::write(uint numParts, BufferList const& buffers, uint node_offset, dou
 		const idx_t stride = numParts;
 		const idx_t maxneibsnum = gdata->problem->simparams()->maxneibsnum;
 		const id_t listend = maxneibsnum*stride;
+		const uint cellnum_shift = gdata->problem->simparams()->get_cellnum_shift();
 		for (int i = 0; i < numParts; ++i) {
 			neibsnum[i] = maxneibsnum;
 			neibs << i << "\t" << id(info[i]) << "\t";
@@ -201,9 +212,9 @@ VTKWriter::write(uint numParts, BufferList const& buffers, uint node_offset, dou
 					neibsnum[i] = (index - i)/stride;
 					break;
 				}
-				if (neib >= CELLNUM_ENCODED) {
-					int neib_cellnum = DECODE_CELL(neib);
-					neibdata ndata = neib & NEIBINDEX_MASK;
+				if (neib >= CELLNUM_ENCODED(cellnum_shift)) {
+					int neib_cellnum = DECODE_CELL(neib, cellnum_shift);
+					neibdata ndata = neib & NEIBINDEX_MASK(cellnum_shift);
 					neibs << "(" << neib_cellnum << ": " << ndata << ")\t";
 				}
 			}
@@ -214,8 +225,9 @@ VTKWriter::write(uint numParts, BufferList const& buffers, uint node_offset, dou
 
 	string filename;
 
-	ofstream fid;
-	filename = open_data_file(fid, "PART", current_filenum());
+	// the particle data goes through the file backend
+	ostream fid(NULL);
+	filename = open_backend_file(fid, "PART", current_filenum());
 
 	// Header
 	//====================================================================================
@@ -583,11 +595,11 @@ VTKWriter::write(uint numParts, BufferList const& buffers, uint node_offset, dou
 		// containing cell until next calchash/reorder.
 		// The current policy is: just list the particles according to how the global array is partitioned. In other words, we rely
 		// on the particle index to understad which device downloaded the particle data.
-		for (uint d = 0; d < gdata->devices; d++) {
-			// compute the global device ID for each device
-			dev_idx_t value = gdata->GLOBAL_DEVICE_ID(gdata->mpi_rank, d);
+		const DeviceCounts devices = device_counts();
+		for (DeviceCounts::const_iterator dev(devices.begin()); dev != devices.end(); ++dev) {
+			dev_idx_t value = dev->first;
 			// write one for each particle (no need for the "absolute" particle index)
-			for (uint p = 0; p < gdata->s_hPartsPerDevice[d]; p++)
+			for (uint p = 0; p < dev->second; p++)
 				write_var(fid, value);
 		}
 		// There two alternate policies: 1. use particle hash or 2. compute belonging device.
@@ -754,7 +766,7 @@ VTKWriter::write(uint numParts, BufferList const& buffers, uint node_offset, dou
 	fid << " </AppendedData>" << endl;
 	fid << "</VTKFile>" << endl;
 
-	fid.close();
+	close_backend_file();
 
 	add_block("Particles", filename);
 
@@ -1037,7 +1049,7 @@ VTKWriter::save_planes()
 void
 VTKWriter::mark_timefile()
 {
-	if (!m_timefile)
+	if (!m_timefile.is_open())
 		return;
 	// Mark the current position, close the XML, go back
 	// to the marked position
@@ -58,7 +58,12 @@ public:
 	~VTKWriter();
 
 	void start_writing(double t, flag_t write_flags);
-	void mark_written(double t);
+
+protected:
+	// write the entries and close the XML
+	void write_timefile(std::string const& entries);
+
+public:
 
 	virtual void write(uint numParts, BufferList const& buffers, uint node_offset, double t, const bool testpoints);
 	virtual void write_WaveGage(double t, GageList const& gage);